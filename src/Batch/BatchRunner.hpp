@@ -0,0 +1,278 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BoundedQueue.hpp"
+#include "Manifest.hpp"
+#include "../colortools_batch.hpp"
+#include "../Diff/Region.hpp"
+#include "../ImageFormat/ImageModule.hpp"
+#include "../ImageFormat/LabImage.hpp"
+#include "../Output/OutputModule.hpp"
+
+// Runs many comparisons in a single process.
+//
+// Decoding, Delta E computation and encoding are three stages running at the
+// same time on different pairs, each in its own thread and using OpenMP
+// inside. They are connected by bounded queues and work on a small pool of
+// frames: the buffers of a frame are reused from one pair to the next, and
+// the pool size bounds the memory used. The color map is shared by all the
+// outputs.
+//
+// The largest pairs are processed first, so the run does not end with a
+// single large comparison while the other stages are idle.
+class BatchRunner
+{
+  public:
+    // Frames in flight: one per stage
+    static const size_t n_frames = 3;
+
+    BatchRunner(float exposure, const OutputSettings &settings)
+      : _exposure(exposure)
+      , _settings(settings)
+    {}
+
+
+    // Runs all the jobs. Errors are reported on the standard error and do not
+    // stop the other jobs. Returns the number of failed jobs.
+    size_t run(std::vector<BatchJob> &jobs)
+    {
+        schedule(jobs);
+
+        std::vector<std::unique_ptr<Frame>> frames;
+        BoundedQueue<Frame *>               free_frames(n_frames);
+        BoundedQueue<Frame *>               decoded(n_frames);
+        BoundedQueue<Frame *>               diffed(n_frames);
+
+        for (size_t i = 0; i < n_frames; i++) {
+            frames.emplace_back(new Frame);
+            free_frames.push(frames.back().get());
+        }
+
+        std::thread decode_thread([&]() {
+            for (const BatchJob &job : jobs) {
+                Frame *frame = nullptr;
+                free_frames.pop(frame);
+
+                frame->job = &job;
+                frame->error.clear();
+
+                runStage(frame, [&]() { decode(*frame); });
+                decoded.push(frame);
+            }
+
+            decoded.close();
+        });
+
+        std::thread diff_thread([&]() {
+            Frame *frame = nullptr;
+
+            while (decoded.pop(frame)) {
+                if (frame->error.empty()) {
+                    runStage(frame, [&]() { diff(*frame); });
+                }
+
+                diffed.push(frame);
+            }
+
+            diffed.close();
+        });
+
+        size_t n_failed = 0;
+        Frame *frame = nullptr;
+
+        while (diffed.pop(frame)) {
+            if (frame->error.empty()) {
+                runStage(frame, [&]() { encode(*frame); });
+            }
+
+            if (!frame->error.empty()) {
+                std::cerr << "[error] " << frame->job->filename_1 << ", "
+                          << frame->job->filename_2 << ": " << frame->error
+                          << std::endl;
+                n_failed++;
+            }
+
+            free_frames.push(frame);
+        }
+
+        decode_thread.join();
+        diff_thread.join();
+
+        return n_failed;
+    }
+
+  protected:
+    // Buffers of a pair going through the pipeline
+    struct Frame
+    {
+        Frame()
+          : job(nullptr)
+          , Lab_1(0, 0)
+          , Lab_2(0, 0)
+        {}
+
+        const BatchJob *   job;
+        LabImage           Lab_1;
+        LabImage           Lab_2;
+        std::vector<float> deltaE;
+        std::string        error;
+    };
+
+
+    // Sorts the jobs by decreasing size, read from the headers of the first
+    // files
+    void schedule(std::vector<BatchJob> &jobs) const
+    {
+        #pragma omp parallel for schedule(dynamic)
+        for (size_t i = 0; i < jobs.size(); i++) {
+            try {
+                std::unique_ptr<EXRBandReader> reader(
+                    ImageModule::open(jobs[i].filename_1, _exposure));
+
+                jobs[i].pixels = reader->width() * reader->height();
+            } catch (std::exception &) {
+                // Reported when the job runs
+                jobs[i].pixels = 0;
+            }
+        }
+
+        std::stable_sort(
+            jobs.begin(),
+            jobs.end(),
+            [](const BatchJob &a, const BatchJob &b) {
+                return a.pixels > b.pixels;
+            });
+    }
+
+
+    template<typename F>
+    static void runStage(Frame *frame, F stage)
+    {
+        try {
+            stage();
+        } catch (std::exception &e) {
+            frame->error = e.what();
+        }
+    }
+
+
+    void decode(Frame &frame) const
+    {
+        std::unique_ptr<EXRBandReader> reader_1(
+            ImageModule::open(frame.job->filename_1, _exposure));
+        std::unique_ptr<EXRBandReader> reader_2(
+            ImageModule::open(frame.job->filename_2, _exposure));
+
+        // The files are aligned in their pixel space and only the pixels
+        // stored in both are compared
+        EXRBox2i region;
+
+        if (!intersect(reader_1->dataWindow(), reader_2->dataWindow(), region)) {
+            throw std::runtime_error("The data windows of the images do not overlap");
+        }
+
+        if (memcmp(&reader_1->dataWindow(), &reader_2->dataWindow(), sizeof(EXRBox2i)) != 0) {
+            std::cerr << "[warning] " << frame.job->filename_1 << ", "
+                      << frame.job->filename_2 << ": The data windows of the "
+                      << "images differ, only the pixels stored in both files "
+                      << "are compared." << std::endl;
+        }
+
+        const size_t width  = size_t(region.max_x - region.min_x + 1);
+        const size_t height = size_t(region.max_y - region.min_y + 1);
+
+        frame.Lab_1.resize(width, height);
+        frame.Lab_2.resize(width, height);
+
+        reader_1->readRegion(region, 0, height, frame.Lab_1);
+        reader_2->readRegion(region, 0, height, frame.Lab_2);
+    }
+
+
+    static void diff(Frame &frame)
+    {
+        const LabImage &Lab_1  = frame.Lab_1;
+        const LabImage &Lab_2  = frame.Lab_2;
+        const size_t    stride = Lab_1.stride();
+
+        frame.deltaE.resize(stride * Lab_1.height());
+
+        #pragma omp parallel for
+        for (size_t y = 0; y < Lab_1.height(); y++) {
+            deltaE2000_batch(
+                Lab_1.row(0, y),
+                Lab_1.row(1, y),
+                Lab_1.row(2, y),
+                Lab_2.row(0, y),
+                Lab_2.row(1, y),
+                Lab_2.row(2, y),
+                &frame.deltaE[y * stride],
+                stride);
+        }
+    }
+
+
+    void encode(Frame &frame) const
+    {
+        const size_t width  = frame.Lab_1.width();
+        const size_t height = frame.Lab_1.height();
+        const size_t stride = frame.Lab_1.stride();
+
+        std::unique_ptr<DiffOutput> output(OutputModule::create(
+            frame.job->filename_out,
+            width,
+            height,
+            _settings));
+
+        output->beginBand(0, height);
+
+        #pragma omp parallel for
+        for (size_t y = 0; y < height; y++) {
+            output->writeRow(y, &frame.deltaE[y * stride], nullptr);
+        }
+
+        output->endBand();
+        output->close();
+    }
+
+    float          _exposure;
+    OutputSettings _settings;
+};
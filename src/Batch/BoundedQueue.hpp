@@ -0,0 +1,93 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+// Queue connecting two stages of a pipeline. push() blocks while the queue
+// holds `capacity` items, so a fast stage cannot run ahead of a slow one and
+// the number of items in flight stays bounded.
+template<typename T>
+class BoundedQueue
+{
+  public:
+    BoundedQueue(size_t capacity)
+      : _capacity(capacity)
+      , _closed(false)
+    {}
+
+
+    void push(const T &item)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _not_full.wait(lock, [this]() { return _items.size() < _capacity; });
+
+        _items.push_back(item);
+        _not_empty.notify_one();
+    }
+
+
+    // Waits for an item. Returns false once the queue is closed and empty.
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _not_empty.wait(lock, [this]() { return !_items.empty() || _closed; });
+
+        if (_items.empty()) {
+            return false;
+        }
+
+        item = _items.front();
+        _items.pop_front();
+        _not_full.notify_one();
+
+        return true;
+    }
+
+
+    // No more items will be pushed
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closed = true;
+        _not_empty.notify_all();
+    }
+
+  private:
+    size_t        _capacity;
+    bool          _closed;
+    std::deque<T> _items;
+
+    std::mutex              _mutex;
+    std::condition_variable _not_full;
+    std::condition_variable _not_empty;
+};
@@ -0,0 +1,133 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// One comparison of a batch
+struct BatchJob
+{
+    std::string filename_1;
+    std::string filename_2;
+    std::string filename_out;
+
+    // Number of pixels, from the headers, used to schedule the largest
+    // comparisons first
+    size_t pixels;
+};
+
+
+// List of comparisons to run, one per line:
+//
+//     <file 1> <file 2> <output>
+//
+// Fields are separated by tabs, or by spaces when the line has no tab. Empty
+// lines and lines starting with '#' are ignored.
+class Manifest
+{
+  public:
+    static std::vector<BatchJob> read(const std::string &filename)
+    {
+        std::ifstream file(filename);
+
+        if (!file) {
+            throw std::runtime_error("Cannot open manifest: " + filename);
+        }
+
+        return parse(file, filename);
+    }
+
+
+    static std::vector<BatchJob> parse(std::istream &in, const std::string &name)
+    {
+        std::vector<BatchJob> jobs;
+        std::string           line;
+
+        for (size_t line_number = 1; std::getline(in, line); line_number++) {
+            if (!line.empty() && line[line.size() - 1] == '\r') {
+                line.resize(line.size() - 1);
+            }
+
+            const std::vector<std::string> fields = split(line);
+
+            if (fields.empty() || fields[0][0] == '#') {
+                continue;
+            }
+
+            if (fields.size() != 3) {
+                std::stringstream err_msg;
+                err_msg << name << ":" << line_number
+                        << ": expected <file 1> <file 2> <output>";
+                throw std::runtime_error(err_msg.str());
+            }
+
+            BatchJob job;
+            job.filename_1   = fields[0];
+            job.filename_2   = fields[1];
+            job.filename_out = fields[2];
+            job.pixels       = 0;
+
+            jobs.push_back(job);
+        }
+
+        return jobs;
+    }
+
+  protected:
+    static std::vector<std::string> split(const std::string &line)
+    {
+        const char *separators
+            = (line.find('\t') != std::string::npos) ? "\t" : " ";
+
+        std::vector<std::string> fields;
+        size_t                   begin = 0;
+
+        while (begin < line.size()) {
+            size_t end = line.find_first_of(separators, begin);
+
+            if (end == std::string::npos) {
+                end = line.size();
+            }
+
+            // Consecutive separators do not make empty fields
+            if (end > begin) {
+                fields.push_back(line.substr(begin, end - begin));
+            }
+
+            begin = end + 1;
+        }
+
+        return fields;
+    }
+};
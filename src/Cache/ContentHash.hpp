@@ -0,0 +1,180 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Streaming XXH64 hash: fast enough to hash a whole file for less than the
+// cost of reading it. Input words are read in the machine byte order.
+class ContentHash
+{
+  public:
+    ContentHash(uint64_t seed = 0)
+      : _total(0)
+      , _buffered(0)
+    {
+        _v[0] = seed + P1 + P2;
+        _v[1] = seed + P2;
+        _v[2] = seed;
+        _v[3] = seed - P1;
+        _seed = seed;
+    }
+
+
+    void update(const void *data, size_t size)
+    {
+        const unsigned char *p   = static_cast<const unsigned char *>(data);
+        const unsigned char *end = p + size;
+
+        _total += size;
+
+        // Complete the pending stripe first
+        if (_buffered > 0) {
+            const size_t n = std::min(size, sizeof(_buffer) - _buffered);
+            memcpy(_buffer + _buffered, p, n);
+            _buffered += n;
+            p += n;
+
+            if (_buffered < sizeof(_buffer)) {
+                return;
+            }
+
+            stripe(_buffer);
+            _buffered = 0;
+        }
+
+        for (; p + 32 <= end; p += 32) {
+            stripe(p);
+        }
+
+        memcpy(_buffer, p, size_t(end - p));
+        _buffered = size_t(end - p);
+    }
+
+
+    uint64_t digest() const
+    {
+        uint64_t h;
+
+        if (_total >= 32) {
+            h = rotl(_v[0], 1) + rotl(_v[1], 7) + rotl(_v[2], 12)
+                + rotl(_v[3], 18);
+
+            for (int i = 0; i < 4; i++) {
+                h ^= round(0, _v[i]);
+                h = h * P1 + P4;
+            }
+        } else {
+            h = _seed + P5;
+        }
+
+        h += _total;
+
+        const unsigned char *p   = _buffer;
+        const unsigned char *end = _buffer + _buffered;
+
+        for (; p + 8 <= end; p += 8) {
+            h ^= round(0, read64(p));
+            h = rotl(h, 27) * P1 + P4;
+        }
+
+        if (p + 4 <= end) {
+            h ^= uint64_t(read32(p)) * P1;
+            h = rotl(h, 23) * P2 + P3;
+            p += 4;
+        }
+
+        for (; p < end; p++) {
+            h ^= uint64_t(*p) * P5;
+            h = rotl(h, 11) * P1;
+        }
+
+        h ^= h >> 33;
+        h *= P2;
+        h ^= h >> 29;
+        h *= P3;
+        h ^= h >> 32;
+
+        return h;
+    }
+
+  protected:
+    static const uint64_t P1 = 11400714785074694791ULL;
+    static const uint64_t P2 = 14029467366897019727ULL;
+    static const uint64_t P3 = 1609587929392839161ULL;
+    static const uint64_t P4 = 9650029242287828579ULL;
+    static const uint64_t P5 = 2870177450012600261ULL;
+
+    static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+
+    static uint64_t round(uint64_t acc, uint64_t input)
+    {
+        acc += input * P2;
+        acc = rotl(acc, 31);
+
+        return acc * P1;
+    }
+
+
+    static uint64_t read64(const unsigned char *p)
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+
+        return v;
+    }
+
+
+    static uint32_t read32(const unsigned char *p)
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+
+        return v;
+    }
+
+
+    void stripe(const unsigned char *p)
+    {
+        for (int i = 0; i < 4; i++) {
+            _v[i] = round(_v[i], read64(p + 8 * i));
+        }
+    }
+
+  private:
+    uint64_t      _v[4];
+    uint64_t      _seed;
+    uint64_t      _total;
+    unsigned char _buffer[32];
+    size_t        _buffered;
+};
@@ -0,0 +1,332 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#    include <direct.h>
+#else
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+#include "ContentHash.hpp"
+#include "../ImageFormat/LabImage.hpp"
+
+// Header of a cache entry. The L, a and b planes follow, laid out as in a
+// LabImage: rows padded to the stride, planes one after the other.
+struct LabCacheHeader
+{
+    static const uint32_t version = 1;
+
+    char     magic[8];
+    uint32_t header_version;
+    uint32_t header_size;
+    uint64_t key;
+    uint64_t width;
+    uint64_t height;
+    uint64_t stride;
+    uint64_t reserved[2];
+};
+
+
+// Lab image read from a cache entry mapped in memory: nothing is decoded nor
+// converted. The mapping is private, writing to the image does not change
+// the entry.
+#ifndef _WIN32
+class MappedLabImage: public LabImage
+{
+  public:
+    MappedLabImage(void *mapping, size_t mapping_size, size_t width, size_t height)
+      : LabImage(0, 0)
+      , _mapping(mapping)
+      , _mapping_size(mapping_size)
+    {
+        wrap(width,
+             height,
+             reinterpret_cast<float *>(
+                 static_cast<char *>(mapping) + sizeof(LabCacheHeader)));
+    }
+
+
+    virtual ~MappedLabImage() { munmap(_mapping, _mapping_size); }
+
+  private:
+    void * _mapping;
+    size_t _mapping_size;
+};
+#endif
+
+
+// Writes a cache entry band by band, as the image is decoded.
+//
+// The entry is written to a temporary file first, renamed to its final name
+// once complete: readers and concurrent writers of the same entry only ever
+// see complete entries. Write errors are not fatal, the entry is then simply
+// not created.
+class LabCacheWriter
+{
+  public:
+    LabCacheWriter(const std::string &filename, uint64_t key, size_t width, size_t height)
+      : _filename(filename)
+      , _height(height)
+      , _stride(LabImage::strideFor(width))
+      , _committed(false)
+    {
+        std::random_device random;
+
+        std::stringstream tmp;
+        tmp << filename << ".tmp." << std::hex << random() << random();
+        _tmp_filename = tmp.str();
+
+        _file.open(_tmp_filename, std::ios::binary | std::ios::out);
+
+        LabCacheHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "EXRDLAB", 8);
+        header.header_version = LabCacheHeader::version;
+        header.header_size    = sizeof(LabCacheHeader);
+        header.key            = key;
+        header.width          = width;
+        header.height         = height;
+        header.stride         = _stride;
+
+        write(&header, sizeof(header), 0);
+    }
+
+
+    virtual ~LabCacheWriter()
+    {
+        // Not committed: the entry is incomplete
+        if (!_committed) {
+            _file.close();
+            std::remove(_tmp_filename.c_str());
+        }
+    }
+
+
+    // Stores the rows [y_begin, y_end) of the image, given in the first rows
+    // of `Lab`
+    void writeRows(size_t y_begin, size_t y_end, const PlanarImage &Lab)
+    {
+        for (int c = 0; c < 3; c++) {
+            const size_t offset
+                = sizeof(LabCacheHeader)
+                  + (c * _height + y_begin) * _stride * sizeof(float);
+
+            write(Lab.row(c, 0), (y_end - y_begin) * _stride * sizeof(float), offset);
+        }
+    }
+
+
+    // Makes the entry available once all the rows are written. Returns false
+    // if the entry could not be written.
+    bool commit()
+    {
+        _file.close();
+
+        if (!_file || std::rename(_tmp_filename.c_str(), _filename.c_str()) != 0) {
+            std::remove(_tmp_filename.c_str());
+            _committed = true;
+
+            return false;
+        }
+
+        _committed = true;
+
+        return true;
+    }
+
+  protected:
+    void write(const void *data, size_t size, size_t offset)
+    {
+        _file.seekp(std::streamoff(offset));
+        _file.write(static_cast<const char *>(data), std::streamsize(size));
+    }
+
+  private:
+    std::string   _filename;
+    std::string   _tmp_filename;
+    std::ofstream _file;
+    size_t        _height;
+    size_t        _stride;
+    bool          _committed;
+};
+
+
+// Directory of preprocessed images.
+//
+// An entry holds the Lab planes of an OpenEXR file, ready to be mapped in
+// memory. It is named after a hash of the file content and of the conversion
+// settings, so a modified file never matches an outdated entry. The header
+// of an entry is checked before use: an incomplete or corrupted entry is
+// ignored and written again.
+class LabDiskCache
+{
+  public:
+    LabDiskCache(const std::string &directory)
+      : _directory(directory)
+    {}
+
+
+    // Key of the Lab image of `filename`, converted from RGB with
+    // `rgb_to_xyz`
+    static uint64_t key(const std::string &filename, const float rgb_to_xyz[9])
+    {
+        std::ifstream file(filename, std::ios::binary);
+
+        if (!file) {
+            throw std::runtime_error("Cannot open file: " + filename);
+        }
+
+        ContentHash       hash;
+        std::vector<char> buffer(1 << 20);
+
+        while (file) {
+            file.read(buffer.data(), std::streamsize(buffer.size()));
+            hash.update(buffer.data(), size_t(file.gcount()));
+        }
+
+        // The conversion settings change the Lab values
+        const uint32_t version = LabCacheHeader::version;
+        hash.update(rgb_to_xyz, 9 * sizeof(float));
+        hash.update(&version, sizeof(version));
+
+        return hash.digest();
+    }
+
+
+    // Maps the entry `key`, or returns nullptr if there is no valid entry
+    LabImage *find(uint64_t key, size_t width, size_t height) const
+    {
+        const std::string filename = entryFilename(key);
+
+        LabCacheHeader header;
+        std::ifstream  file(filename, std::ios::binary);
+
+        if (!file.read(reinterpret_cast<char *>(&header), sizeof(header))) {
+            return nullptr;
+        }
+
+        const size_t expected_size
+            = sizeof(LabCacheHeader)
+              + 3 * LabImage::strideFor(width) * height * sizeof(float);
+
+        file.seekg(0, std::ios::end);
+
+        if (   memcmp(header.magic, "EXRDLAB", 8) != 0
+            || header.header_version != LabCacheHeader::version
+            || header.header_size != sizeof(LabCacheHeader)
+            || header.key != key
+            || header.width != width
+            || header.height != height
+            || header.stride != LabImage::strideFor(width)
+            || size_t(file.tellg()) != expected_size) {
+            return nullptr;
+        }
+
+#ifndef _WIN32
+        file.close();
+
+        const int fd = ::open(filename.c_str(), O_RDONLY);
+
+        if (fd < 0) {
+            return nullptr;
+        }
+
+        void *mapping = mmap(
+            nullptr,
+            expected_size,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE,
+            fd,
+            0);
+
+        ::close(fd);
+
+        if (mapping == MAP_FAILED) {
+            return nullptr;
+        }
+
+        return new MappedLabImage(mapping, expected_size, width, height);
+#else
+        // No mapping: the planes are read at once
+        LabImage *image = new LabImage(width, height);
+
+        file.seekg(sizeof(LabCacheHeader));
+        file.read(
+            reinterpret_cast<char *>(image->plane(0)),
+            std::streamsize(expected_size - sizeof(LabCacheHeader)));
+
+        if (!file) {
+            delete image;
+            return nullptr;
+        }
+
+        return image;
+#endif
+    }
+
+
+    // Starts writing the entry `key`
+    LabCacheWriter *create(uint64_t key, size_t width, size_t height) const
+    {
+#ifdef _WIN32
+        _mkdir(_directory.c_str());
+#else
+        mkdir(_directory.c_str(), 0755);
+#endif
+
+        return new LabCacheWriter(entryFilename(key), key, width, height);
+    }
+
+
+    std::string entryFilename(uint64_t key) const
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.lab", (unsigned long long)key);
+
+        return _directory + "/" + name;
+    }
+
+  private:
+    std::string _directory;
+};
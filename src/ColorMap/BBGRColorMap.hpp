@@ -35,45 +35,33 @@
 class BBGRColorMap: public ColorMap
 {
   public:
-    BBGRColorMap() {}
+    BBGRColorMap(size_t lut_size = default_lut_size) { buildLUT(lut_size); }
 
 
     virtual ~BBGRColorMap() {}
 
-
-    virtual void getRGBValue(float v, float RGB[3]) const
+  protected:
+    virtual void evaluate(float v, float RGB[3]) const
     {
+        // Black, blue, cyan, green, yellow, red
+        static const float scale[6][3] = {
+            {0, 0, 0},
+            {0, 0, 1},
+            {0, 1, 1},
+            {0, 1, 0},
+            {1, 1, 0},
+            {1, 0, 0}};
+
+        const size_t n_values = sizeof(scale) / sizeof(scale[0]);
+
         v = clamp(v);
 
-        std::vector<float[3]> scale(6);
-        scale[0][0] = 0;
-        scale[0][1] = 0;
-        scale[0][2] = 0;
-        scale[1][0] = 0;
-        scale[1][1] = 0;
-        scale[1][2] = 1;
-        scale[2][0] = 0;
-        scale[2][1] = 1;
-        scale[2][2] = 1;
-        scale[3][0] = 0;
-        scale[3][1] = 1;
-        scale[3][2] = 0;
-        scale[4][0] = 1;
-        scale[4][1] = 1;
-        scale[4][2] = 0;
-        scale[5][0] = 1;
-        scale[5][1] = 0;
-        scale[5][2] = 0;
-
-        std::vector<float> values(scale.size());
-
-        for (size_t i = 0; i < scale.size(); i++) {
-            values[i] = float(i) / float(scale.size() - 1);
-        }
+        for (size_t i = 1; i < n_values; i++) {
+            const float value = float(i) / float(n_values - 1);
 
-        for (size_t i = 1; i < scale.size(); i++) {
-            if (v <= values[i]) {
-                float interp = place(v, values[i - 1], values[i]);
+            if (v <= value) {
+                float interp
+                    = place(v, float(i - 1) / float(n_values - 1), value);
 
                 for (size_t c = 0; c < 3; c++) {
                     RGB[c] = interp * scale[i][c]
@@ -85,18 +73,11 @@ class BBGRColorMap: public ColorMap
         }
 
         for (size_t c = 0; c < 3; c++) {
-            RGB[c] = scale[scale.size() - 1][c];
+            RGB[c] = scale[n_values - 1][c];
         }
     }
 
 
-    virtual void
-    getRGBValue(float v, float v_min, float v_max, float RGB[3]) const
-    {
-        getRGBValue((v - v_min) / (v_max - v_min), RGB);
-    }
-
-
     inline static float clamp(float v, float v_min = 0, float v_max = 1.f)
     {
         return std::min(std::max(v, v_min), v_max);
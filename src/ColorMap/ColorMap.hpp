@@ -28,18 +28,136 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Base class of the color maps.
+//
+// Each color map is sampled once, at construction, in a lookup table of
+// `lutSize()` entries. A lookup interpolates linearly between two entries:
+// each entry stores its color and the slope to the next one so a lookup only
+// costs a couple of loads and a multiply-add per channel, whatever the color
+// map is, without any allocation.
+//
+// Output images are written a whole row at a time with getRGBA8Row(), from a
+// second table already holding packed 8 bits RGBA colors.
 class ColorMap
 {
   public:
+    static const size_t default_lut_size = 1024;
+
+    // Entries of the 8 bits table: small enough to stay in the L1 cache, fine
+    // enough to be within one level of the interpolated color
+    static const size_t rgba8_lut_size = 4096;
+
     ColorMap() {}
 
     virtual ~ColorMap() {}
 
-    virtual void getRGBValue(float v, float RGB[3]) const = 0;
+    // v in [0..1], values outside are clamped
+    void getRGBValue(float v, float RGB[3]) const
+    {
+        // NaN gives 1
+        v = std::max(0.f, std::min(1.f, v));
+
+        const float  x = v * float(_lut_size - 1);
+        const size_t i = std::min(size_t(x), _lut_size - 2);
+        const float  t = x - float(i);
+
+        const float *entry = &_lut[6 * i];
+
+        for (int c = 0; c < 3; c++) {
+            RGB[c] = entry[c] + t * entry[3 + c];
+        }
+    }
+
+
+    void getRGBValue(float v, float v_min, float v_max, float RGB[3]) const
+    {
+        getRGBValue((v - v_min) / (v_max - v_min), RGB);
+    }
+
+
+    // Color maps the `n` values of `v` to packed 8 bits RGBA colors, fully
+    // opaque, written in `rgba`
+    virtual void getRGBA8Row(
+        const float *  v,
+        size_t         n,
+        float          v_min,
+        float          v_max,
+        unsigned char *rgba) const
+    {
+        const uint32_t *lut   = _lut_rgba8.data();
+        const float     last  = float(_lut_rgba8.size() - 1);
+        const float     scale = last / (v_max - v_min);
+
+        for (size_t i = 0; i < n; i++) {
+            // Nearest entry, NaN gives the last one
+            const float x
+                = std::max(0.f, std::min(last, (v[i] - v_min) * scale + .5f));
+
+            memcpy(&rgba[4 * i], &lut[size_t(x)], 4);
+        }
+    }
+
+
+    size_t lutSize() const { return _lut_size; }
+
+  protected:
+    // Exact color for v in [0..1], only used to build the lookup table
+    virtual void evaluate(float v, float RGB[3]) const = 0;
+
+
+    // Samples evaluate() in `lut_size` entries. Must be called by the
+    // constructor of the derived classes, once they are initialized.
+    void buildLUT(size_t lut_size)
+    {
+        _lut_size = std::max(lut_size, size_t(2));
+        _lut.resize(6 * _lut_size);
+
+        for (size_t i = 0; i < _lut_size; i++) {
+            evaluate(float(i) / float(_lut_size - 1), &_lut[6 * i]);
+        }
+
+        // Slope to the next entry, the last one is never used
+        for (size_t i = 0; i < _lut_size; i++) {
+            for (int c = 0; c < 3; c++) {
+                _lut[6 * i + 3 + c]
+                    = (i + 1 < _lut_size)
+                          ? _lut[6 * (i + 1) + c] - _lut[6 * i + c]
+                          : 0.f;
+            }
+        }
+
+        // Packed in memory order, whatever the endianness
+        _lut_rgba8.resize(rgba8_lut_size);
+
+        for (size_t i = 0; i < rgba8_lut_size; i++) {
+            float         RGB[3];
+            unsigned char pixel[4];
+
+            getRGBValue(float(i) / float(rgba8_lut_size - 1), RGB);
+
+            for (int c = 0; c < 3; c++) {
+                pixel[c] = (unsigned char)(std::max(
+                    0.f,
+                    std::min(255.f, std::round(255.f * RGB[c]))));
+            }
+
+            pixel[3] = 255;
+
+            memcpy(&_lut_rgba8[i], pixel, 4);
+        }
+    }
+
+  private:
+    // Interleaved RGB color and RGB slope of each entry
+    std::vector<float> _lut;
+    size_t             _lut_size;
 
-    virtual void
-    getRGBValue(float v, float v_min, float v_max, float RGB[3]) const = 0;
-    // {
-    //     getRGBValue((v - v_min) / (v_max - v_min), RGB);
-    // }
-};
\ No newline at end of file
+    std::vector<uint32_t> _lut_rgba8;
+};
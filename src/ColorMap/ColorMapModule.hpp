@@ -6,18 +6,19 @@
 class ColorMapModule
 {
   public:
-    static ColorMap *create(const std::string &name)
+    static ColorMap *create(
+        const std::string &name, size_t lut_size = ColorMap::default_lut_size)
     {
         const char *colormap_name = name.c_str();
 
         if (strcmp(colormap_name, "bbgr") == 0) {
-            return new BBGRColorMap();
+            return new BBGRColorMap(lut_size);
         } else if (
             strcmp(colormap_name, "magma") == 0
             || strcmp(colormap_name, "inferno") == 0
             || strcmp(colormap_name, "plasma") == 0
             || strcmp(colormap_name, "viridis") == 0) {
-            return new TabulatedColorMap(colormap_name);
+            return new TabulatedColorMap(colormap_name, lut_size);
         } else {
             std::cout << "[error] Invalid colormap name: " << name << std::endl;
             std::cout << "[error] Valid names are: bbgr, magma, inferno, "
@@ -38,10 +38,10 @@
 class TabulatedColorMap: public ColorMap
 {
   public:
-    TabulatedColorMap(): _array(3), _n_elems(1) {}
+    TabulatedColorMap(): _array(3), _n_elems(1) { buildLUT(default_lut_size); }
 
 
-    TabulatedColorMap(const char *name)
+    TabulatedColorMap(const char *name, size_t lut_size = default_lut_size)
     {
         if (strcmp(name, "magma") == 0) {
             init(magma_data, 256);
@@ -59,35 +59,42 @@ class TabulatedColorMap: public ColorMap
 
             throw -1;
         }
+
+        buildLUT(lut_size);
     }
 
 
     virtual ~TabulatedColorMap() {}
 
-
-    virtual void getRGBValue(float v, float RGB[3]) const
+  protected:
+    // Linear interpolation between the two closest elements
+    virtual void evaluate(float v, float RGB[3]) const
     {
         v = std::max(0.f, std::min(1.f, v));
 
         assert(v >= 0.f);
         assert(v <= 1.f);
 
-        int closet_idx = v * (_n_elems - 1);
+        const float x   = v * (_n_elems - 1);
+        const int   idx = std::min(int(x), std::max(_n_elems - 2, 0));
 
-        assert(closet_idx < _n_elems);
-        assert(closet_idx >= 0);
+        assert(idx < _n_elems);
+        assert(idx >= 0);
 
-        memcpy(RGB, &_array[3 * closet_idx], 3 * sizeof(float));
-    }
+        if (idx + 1 >= _n_elems) {
+            memcpy(RGB, &_array[3 * idx], 3 * sizeof(float));
+            return;
+        }
 
+        const float t = x - float(idx);
 
-    virtual void
-    getRGBValue(float v, float v_min, float v_max, float RGB[3]) const
-    {
-        getRGBValue((v - v_min) / (v_max - v_min), RGB);
+        for (int c = 0; c < 3; c++) {
+            RGB[c] = (1.f - t) * _array[3 * idx + c]
+                     + t * _array[3 * (idx + 1) + c];
+        }
     }
 
-  protected:
+
     void init(float *array, int n_elems)
     {
         _array.resize(3 * n_elems);
@@ -0,0 +1,539 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#ifdef _OPENMP
+#    include <omp.h>
+#endif
+
+#include "../ImageFormat/EXRBandReader.hpp"
+#include "../ImageFormat/LabImage.hpp"
+#include "../ImageFormat/PlanarImage.hpp"
+#include "../Output/DiffOutput.hpp"
+#include "../Cache/LabDiskCache.hpp"
+#include "../Metric/MetricEngine.hpp"
+#include "Region.hpp"
+
+// Flags the pixels of the rows [y_begin, y_end) of `region` inside the mask:
+// the ones stored in the mask file with a luminance above 0. `band` receives
+// the decoded mask.
+inline void read_mask(
+    EXRBandReader &             mask,
+    const EXRBox2i &            region,
+    size_t                      y_begin,
+    size_t                      y_end,
+    LabImage &                  band,
+    std::vector<unsigned char> &inside)
+{
+    const size_t width = size_t(region.max_x - region.min_x + 1);
+
+    inside.assign(width * (y_end - y_begin), 0);
+
+    EXRBox2i rows = region;
+    rows.min_y    = region.min_y + int(y_begin);
+    rows.max_y    = region.min_y + int(y_end) - 1;
+
+    // Pixels out of the mask data window are outside
+    EXRBox2i covered;
+
+    if (!intersect(rows, mask.dataWindow(), covered)) {
+        return;
+    }
+
+    const size_t n_rows = size_t(covered.max_y - covered.min_y + 1);
+    const size_t n      = size_t(covered.max_x - covered.min_x + 1);
+
+    mask.readRegion(covered, 0, n_rows, band);
+
+    for (size_t j = 0; j < n_rows; j++) {
+        const float *   L   = band.row(0, j);
+        unsigned char * row = &inside[(size_t(covered.min_y - rows.min_y) + j) * width
+                                      + size_t(covered.min_x - region.min_x)];
+
+        for (size_t i = 0; i < n; i++) {
+            row[i] = (L[i] > 0.f) ? 1 : 0;
+        }
+    }
+}
+
+
+// Decodes rows [y_begin, y_end) of `region` from both files at the same time,
+// to the rows starting at `lab_row` of the Lab (or XYZ) images, one per
+// layer. Each file also decompresses its chunks with a pool of threads.
+inline void read_rows(
+    EXRBandReader &     reader_1,
+    EXRBandReader &     reader_2,
+    const EXRBox2i &    region,
+    size_t              y_begin,
+    size_t              y_end,
+    PlanarImage *const *Lab_1,
+    PlanarImage *const *Lab_2,
+    size_t              lab_row)
+{
+    std::exception_ptr error_2;
+
+#ifdef _OPENMP
+    // New threads do not inherit the number of threads set by the caller
+    const int n_threads = omp_get_max_threads();
+#endif
+
+    std::thread thread_2([&]() {
+#ifdef _OPENMP
+        omp_set_num_threads(n_threads);
+#endif
+
+        try {
+            reader_2.readRegion(region, y_begin, y_end, Lab_2, lab_row);
+        } catch (...) {
+            error_2 = std::current_exception();
+        }
+    });
+
+    try {
+        reader_1.readRegion(region, y_begin, y_end, Lab_1, lab_row);
+    } catch (...) {
+        thread_2.join();
+        throw;
+    }
+
+    thread_2.join();
+
+    if (error_2) {
+        std::rethrow_exception(error_2);
+    }
+}
+
+
+// Smallest number of rows made of whole chunks in both files. Bands are
+// aligned on it to avoid decoding twice the same chunk.
+inline size_t common_chunk_rows(
+    const EXRBandReader &reader_1, const EXRBandReader &reader_2)
+{
+    size_t a = reader_1.chunkRows(), b = reader_2.chunkRows();
+
+    while (b != 0) {
+        const size_t t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return reader_1.chunkRows() / a * reader_2.chunkRows();
+}
+
+
+// Number of rows of the bands so the memory used stays within `max_memory`
+// bytes, as long as it can hold a single band. Each layer and metric is given
+// to one of `n_outputs` outputs like `output`.
+inline size_t band_rows_for_budget(
+    const EXRBandReader &reader_1,
+    const EXRBandReader &reader_2,
+    const EXRBandReader *mask,
+    const DiffOutput &   output,
+    size_t               n_outputs,
+    size_t               max_memory)
+{
+    const size_t chunk_rows = common_chunk_rows(reader_1, reader_2);
+
+    size_t bytes_per_row = reader_1.bytesPerRow()
+                           + reader_2.bytesPerRow()
+                           + n_outputs * output.bytesPerRow();
+
+    if (mask) {
+        bytes_per_row += mask->bytesPerRow() + output.width();
+    }
+
+    size_t band_rows = max_memory / bytes_per_row / chunk_rows * chunk_rows;
+
+    if (band_rows == 0) {
+        band_rows = chunk_rows;
+
+        std::cerr << "[warning] The memory budget is too small, using "
+                  << (band_rows * bytes_per_row) / (1024 * 1024) + 1
+                  << " MiB bands." << std::endl;
+    }
+
+    return std::min(band_rows, output.height());
+}
+
+
+// Rows [y_begin, y_end) of the compared region, decoded and compared together
+struct Band
+{
+    size_t y_begin, y_end;
+};
+
+
+// Consecutive bands of `band_rows` rows covering the `height` rows of a
+// region
+inline std::vector<Band> split_rows(size_t height, size_t band_rows)
+{
+    std::vector<Band> bands;
+
+    for (size_t y = 0; y < height; y += band_rows) {
+        const Band band = {y, std::min(height, y + band_rows)};
+        bands.push_back(band);
+    }
+
+    return bands;
+}
+
+
+// Stratified sample of about `fraction` of the rows of `region`, at least two
+// bands. The rows are split in units made of whole chunks of both files, at
+// least 16 rows high so each is decoded in parallel, and one unit is drawn
+// from each stratum of consecutive units: the sample spans the whole image.
+// The draw is seeded, the same files always give the same sample.
+inline std::vector<Band> sample_rows(
+    const EXRBandReader &reader_1,
+    const EXRBandReader &reader_2,
+    const EXRBox2i &     region,
+    float                fraction)
+{
+    const size_t chunk_rows = common_chunk_rows(reader_1, reader_2);
+    const size_t unit_rows  = (16 + chunk_rows - 1) / chunk_rows * chunk_rows;
+
+    // Units are aligned on the chunks of the first file
+    const size_t y_0    = size_t(region.min_y - reader_1.dataWindow().min_y);
+    const size_t height = size_t(region.max_y - region.min_y + 1);
+
+    const size_t u_begin = y_0 / unit_rows;
+    const size_t n_units = (y_0 + height - 1) / unit_rows + 1 - u_begin;
+    const size_t n_samples
+        = std::min(n_units, std::max(size_t(2), size_t(fraction * float(n_units) + 0.5f)));
+
+    // mt19937 gives the same numbers on all platforms, unlike the
+    // distributions of the standard library
+    std::mt19937      random;
+    std::vector<Band> bands;
+
+    for (size_t s = 0; s < n_samples; s++) {
+        const size_t first = s * n_units / n_samples;
+        const size_t last  = (s + 1) * n_units / n_samples;
+        const size_t u     = u_begin + first + size_t(random()) % (last - first);
+
+        const Band band = {
+            std::max(u * unit_rows, y_0) - y_0,
+            std::min((u + 1) * unit_rows, y_0 + height) - y_0};
+        bands.push_back(band);
+    }
+
+    return bands;
+}
+
+
+// Compares the pixels of `region` in the two files one of `bands` at a time:
+// each band is decoded, then the metrics of `engine` are computed for each
+// selected layer in a single pass and given to their outputs row by row
+// before the next band is read. The outputs of the layer `l` are
+// outputs[l * engine.size() + m], one per metric `m`. Stops as soon as all
+// the outputs are done. The bands are sorted, and the rows out of them are
+// neither decoded nor given to the outputs.
+//
+// When the second file is already in the disk cache, `cached_2` holds the
+// whole Lab image of its single layer, which `region` must cover, and only
+// the first file is decoded. Otherwise, the bands of the second file are
+// given to `writer_2`, if any, to fill the cache.
+//
+// With `skip_identical`, when both files are stored the same way, chunks
+// made of the same bytes in both files are not decoded: their rows have a
+// difference of 0.
+//
+// With a `mask`, only the pixels inside it are compared, and the rows with
+// no pixel inside are not decoded.
+//
+// Metrics needing the neighborhood of the pixels (see
+// MetricEngine::spatial()) need a single band holding the whole images, all
+// the rows being decoded.
+inline void diff_files(
+    EXRBandReader &                  reader_1,
+    EXRBandReader &                  reader_2,
+    EXRBandReader *                  mask,
+    const EXRBox2i &                 region,
+    const LabImage *                 cached_2,
+    LabCacheWriter *                 writer_2,
+    const std::vector<DiffOutput *> &outputs,
+    const MetricEngine &             engine,
+    const std::vector<Band> &        bands,
+    bool                             skip_identical)
+{
+    const size_t width     = size_t(region.max_x - region.min_x + 1);
+    const size_t height    = size_t(region.max_y - region.min_y + 1);
+    const size_t n_metrics = engine.size();
+    const size_t n_layers  = outputs.size() / n_metrics;
+
+    size_t band_rows = 0;
+
+    for (size_t b = 0; b < bands.size(); b++) {
+        band_rows = std::max(band_rows, bands[b].y_end - bands[b].y_begin);
+    }
+
+    if (engine.spatial() && band_rows < height) {
+        throw std::runtime_error("The whole images are needed by the selected metrics");
+    }
+
+    // Lab, or XYZ when the metrics need it
+    std::vector<std::unique_ptr<PlanarImage>> images;
+    std::vector<PlanarImage *>                Lab_1, Lab_2;
+
+    for (size_t l = 0; l < n_layers; l++) {
+        images.emplace_back(new PlanarImage(width, band_rows));
+        Lab_1.push_back(images.back().get());
+
+        images.emplace_back(new PlanarImage(width, cached_2 ? 0 : band_rows));
+        Lab_2.push_back(images.back().get());
+    }
+
+    LabImage Lab_mask(width, mask ? band_rows : 0);
+
+    // The cache entry needs all the rows of the second file, and the metrics
+    // on whole images all the rows of both files
+    const bool decode_all = writer_2 || engine.spatial();
+    const bool skip
+        = skip_identical && !decode_all && reader_1.sameLayout(reader_2);
+
+    const size_t             chunk_rows = reader_1.chunkRows();
+    const size_t             y_0 = size_t(region.min_y - reader_1.dataWindow().min_y);
+    const std::vector<float> zeros(Lab_1[0]->stride(), 0.f);
+
+    std::vector<unsigned char> inside;
+
+    // All the outputs of a layer need no more rows
+    auto layer_done = [&](size_t l) {
+        for (size_t m = 0; m < n_metrics; m++) {
+            if (!outputs[l * n_metrics + m]->done()) {
+                return false;
+            }
+        }
+
+        return true;
+    };
+
+    auto all_done = [&]() {
+        for (size_t l = 0; l < n_layers; l++) {
+            if (!layer_done(l)) {
+                return false;
+            }
+        }
+
+        return true;
+    };
+
+    size_t b = 0;
+
+    for (; b < bands.size() && !all_done(); b++) {
+        const size_t y_begin = bands[b].y_begin;
+        const size_t y_end   = bands[b].y_end;
+
+        // Rows of the band not to decode: stored in identical chunks, or
+        // outside the mask
+        std::vector<char> same(y_end - y_begin, 0);
+
+        if (skip) {
+            const long c_begin = long((y_0 + y_begin) / chunk_rows);
+            const long c_end   = long((y_0 + y_end + chunk_rows - 1) / chunk_rows);
+
+            #pragma omp parallel for schedule(dynamic)
+            for (long c = c_begin; c < c_end; c++) {
+                if (reader_1.sameChunks(reader_2, size_t(c))) {
+                    const size_t r_begin
+                        = std::max(y_0 + y_begin, size_t(c) * chunk_rows) - y_0;
+                    const size_t r_end
+                        = std::min(y_0 + y_end, size_t(c + 1) * chunk_rows) - y_0;
+
+                    std::fill(
+                        same.begin() + (r_begin - y_begin),
+                        same.begin() + (r_end - y_begin),
+                        1);
+                }
+            }
+        }
+
+        if (mask) {
+            read_mask(*mask, region, y_begin, y_end, Lab_mask, inside);
+
+            for (size_t y = 0; !decode_all && y < y_end - y_begin; y++) {
+                const unsigned char *row = &inside[y * width];
+
+                if (std::find(row, row + width, 1) == row + width) {
+                    same[y] = 1;
+                }
+            }
+        }
+
+        // Only the runs of rows that differ are decoded
+        for (size_t r_begin = y_begin; r_begin < y_end;) {
+            if (same[r_begin - y_begin]) {
+                r_begin++;
+                continue;
+            }
+
+            size_t r_end = r_begin + 1;
+
+            while (r_end < y_end && !same[r_end - y_begin]) {
+                r_end++;
+            }
+
+            if (cached_2) {
+                reader_1.readRegion(
+                    region,
+                    r_begin,
+                    r_end,
+                    Lab_1.data(),
+                    r_begin - y_begin);
+            } else {
+                read_rows(
+                    reader_1,
+                    reader_2,
+                    region,
+                    r_begin,
+                    r_end,
+                    Lab_1.data(),
+                    Lab_2.data(),
+                    r_begin - y_begin);
+            }
+
+            r_begin = r_end;
+        }
+
+        if (writer_2) {
+            writer_2->writeRows(y_begin, y_end, *Lab_2[0]);
+        }
+
+        // Metrics of the whole images, per layer and metric
+        const size_t       plane = Lab_1[0]->stride() * Lab_1[0]->height();
+        std::vector<float> spatial(engine.spatial() ? outputs.size() * plane : 0);
+
+        for (size_t l = 0; l < n_layers && engine.spatial(); l++) {
+            std::vector<float *> maps;
+
+            for (size_t m = 0; m < n_metrics; m++) {
+                maps.push_back(&spatial[(l * n_metrics + m) * plane]);
+            }
+
+            // The single band holds the whole region, like the cached image
+            const PlanarImage &image_2
+                = cached_2 ? *static_cast<const PlanarImage *>(cached_2) : *Lab_2[l];
+
+            engine.computeImages(*Lab_1[l], image_2, maps.data(), Lab_1[0]->stride());
+        }
+
+        for (size_t o = 0; o < outputs.size(); o++) {
+            outputs[o]->beginBand(y_begin, y_end);
+        }
+
+        #pragma omp parallel
+        {
+            // The kernels run on whole padded rows, the padding being zero
+            // filled
+            const size_t stride = Lab_1[0]->stride();
+
+            MetricEngine::Scratch scratch(engine, stride);
+            std::vector<float>    values(n_metrics * stride);
+            std::vector<float *>  rows(n_metrics);
+
+            for (size_t m = 0; m < n_metrics; m++) {
+                rows[m] = &values[m * stride];
+            }
+
+            #pragma omp for schedule(dynamic) collapse(2)
+            for (size_t y = y_begin; y < y_end; y++) {
+                for (size_t l = 0; l < n_layers; l++) {
+                    if (layer_done(l)) {
+                        continue;
+                    }
+
+                    const size_t         y_band = y - y_begin;
+                    const unsigned char *row_mask
+                        = mask ? &inside[y_band * width] : nullptr;
+
+                    if (same[y_band]) {
+                        for (size_t m = 0; m < n_metrics; m++) {
+                            outputs[l * n_metrics + m]->writeRow(y, zeros.data(), row_mask);
+                        }
+
+                        continue;
+                    }
+
+                    // Rows of the second file are either in the band or in
+                    // the whole cached image
+                    const PlanarImage &band_1 = *Lab_1[l];
+                    const PlanarImage &band_2
+                        = cached_2 ? *static_cast<const PlanarImage *>(cached_2) : *Lab_2[l];
+                    const size_t y_band_2 = cached_2 ? y : y_band;
+
+                    const float *const px_1[3] = {
+                        band_1.row(0, y_band),
+                        band_1.row(1, y_band),
+                        band_1.row(2, y_band)};
+                    const float *const px_2[3] = {
+                        band_2.row(0, y_band_2),
+                        band_2.row(1, y_band_2),
+                        band_2.row(2, y_band_2)};
+
+                    engine.computeRow(scratch, px_1, px_2, stride, rows.data());
+
+                    for (size_t m = 0; m < n_metrics; m++) {
+                        DiffOutput & output = *outputs[l * n_metrics + m];
+                        const float *row    = engine.metric(m).kernel
+                                                  ? rows[m]
+                                                  : &spatial[(l * n_metrics + m) * plane + y_band * stride];
+
+                        if (!output.done()) {
+                            output.writeRow(y, row, row_mask);
+                        }
+                    }
+                }
+            }
+        }
+
+        for (size_t o = 0; o < outputs.size(); o++) {
+            outputs[o]->endBand();
+        }
+    }
+
+    for (size_t o = 0; o < outputs.size(); o++) {
+        outputs[o]->close();
+    }
+
+    // An early stop leaves the cache entry incomplete
+    if (writer_2 && b >= bands.size() && !writer_2->commit()) {
+        std::cerr << "[warning] Cannot write the cache entry of the second "
+                  << "file." << std::endl;
+    }
+}
@@ -0,0 +1,195 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../ImageFormat/EXRBandReader.hpp"
+#include "../ImageFormat/ImageModule.hpp"
+
+// A layer found in both files
+struct LayerPair
+{
+    std::string id;    // Name given to its outputs
+    int         part_1, part_2;
+    std::string layer_1, layer_2;
+};
+
+
+// Opens each part of a file, reading their headers only
+inline std::vector<std::unique_ptr<EXRBandReader>> open_parts(
+    const std::string &filename, float exposure)
+{
+    std::vector<std::unique_ptr<EXRBandReader>> parts;
+    parts.emplace_back(ImageModule::open(filename, exposure));
+
+    for (int p = 1; p < parts[0]->numParts(); p++) {
+        parts.emplace_back(ImageModule::open(filename, exposure, p));
+    }
+
+    return parts;
+}
+
+
+// Names of the layers of a file: the part name, for multipart files, then
+// the channel prefix. The default layer of a single part file is "default".
+inline std::vector<std::pair<std::string, std::pair<int, std::string>>> list_layers(
+    const std::vector<std::unique_ptr<EXRBandReader>> &parts)
+{
+    std::vector<std::pair<std::string, std::pair<int, std::string>>> layers;
+
+    for (size_t p = 0; p < parts.size(); p++) {
+        std::string part_name = parts[p]->partName();
+
+        if (parts.size() > 1 && part_name.empty()) {
+            part_name = "part" + std::to_string(p);
+        }
+
+        const std::vector<std::string> names = parts[p]->layerNames();
+
+        for (size_t l = 0; l < names.size(); l++) {
+            std::string id = part_name;
+
+            if (!names[l].empty()) {
+                id += (id.empty() ? "" : ".") + names[l];
+            } else if (id.empty()) {
+                id = "default";
+            }
+
+            layers.push_back(std::make_pair(id, std::make_pair(int(p), names[l])));
+        }
+    }
+
+    return layers;
+}
+
+
+// Layers to compare: the default layer of single part files when `selection`
+// is empty, the layers found in both files for "all", or the ones listed
+inline std::vector<LayerPair> match_layers(
+    const std::vector<std::unique_ptr<EXRBandReader>> &parts_1,
+    const std::vector<std::unique_ptr<EXRBandReader>> &parts_2,
+    const std::string &                                filename_1,
+    const std::string &                                filename_2,
+    const std::string &                                selection)
+{
+    const auto layers_1 = list_layers(parts_1);
+    const auto layers_2 = list_layers(parts_2);
+
+    std::vector<std::string> ids;
+
+    if (selection.empty()) {
+        ids.push_back("default");
+    } else if (selection == "all") {
+        for (size_t i = 0; i < layers_1.size(); i++) {
+            ids.push_back(layers_1[i].first);
+        }
+    } else {
+        std::stringstream in(selection);
+        std::string       id;
+
+        while (std::getline(in, id, ',')) {
+            ids.push_back(id);
+        }
+    }
+
+    std::vector<LayerPair> pairs;
+
+    for (size_t i = 0; i < ids.size(); i++) {
+        LayerPair pair;
+        pair.id     = ids[i];
+        pair.part_1 = pair.part_2 = -1;
+
+        for (size_t j = 0; j < layers_1.size(); j++) {
+            if (layers_1[j].first == ids[i]) {
+                pair.part_1  = layers_1[j].second.first;
+                pair.layer_1 = layers_1[j].second.second;
+            }
+        }
+
+        for (size_t j = 0; j < layers_2.size(); j++) {
+            if (layers_2[j].first == ids[i]) {
+                pair.part_2  = layers_2[j].second.first;
+                pair.layer_2 = layers_2[j].second.second;
+            }
+        }
+
+        if (pair.part_1 >= 0 && pair.part_2 >= 0) {
+            pairs.push_back(pair);
+            continue;
+        }
+
+        const std::string &missing = (pair.part_1 < 0) ? filename_1 : filename_2;
+
+        if (selection.empty()) {
+            throw std::runtime_error(
+                "No default layer (R, G and B or a single channel), use "
+                "--layers: " + missing);
+        } else if (selection == "all") {
+            std::cerr << "[warning] Layer " << ids[i] << " not found in "
+                      << missing << ", not compared." << std::endl;
+        } else {
+            throw std::runtime_error("Missing layer " + ids[i] + ": " + missing);
+        }
+    }
+
+    for (size_t j = 0; selection == "all" && j < layers_2.size(); j++) {
+        if (std::find(ids.begin(), ids.end(), layers_2[j].first) == ids.end()) {
+            std::cerr << "[warning] Layer " << layers_2[j].first << " not found in "
+                      << filename_1 << ", not compared." << std::endl;
+        }
+    }
+
+    if (pairs.empty()) {
+        throw std::runtime_error("No layer found in both files");
+    }
+
+    return pairs;
+}
+
+
+// Output file of a layer: its name is inserted before the extension
+inline std::string layer_filename(const std::string &filename, const std::string &id)
+{
+    const size_t dot   = filename.rfind('.');
+    const size_t slash = filename.find_last_of("/\\");
+
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return filename + "." + id;
+    }
+
+    return filename.substr(0, dot) + "." + id + filename.substr(dot);
+}
@@ -0,0 +1,113 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "../ImageFormat/EXRBandReader.hpp"
+
+// Pixels of both `a` and `b`, returns false if there are none
+inline bool intersect(const EXRBox2i &a, const EXRBox2i &b, EXRBox2i &result)
+{
+    result.min_x = std::max(a.min_x, b.min_x);
+    result.min_y = std::max(a.min_y, b.min_y);
+    result.max_x = std::min(a.max_x, b.max_x);
+    result.max_y = std::min(a.max_y, b.max_y);
+
+    return result.min_x <= result.max_x && result.min_y <= result.max_y;
+}
+
+
+// Parses a region of interest given as "x,y,width,height"
+inline EXRBox2i parse_roi(const std::string &value)
+{
+    std::stringstream in(value);
+    long              v[4];
+    char              sep[3];
+
+    in >> v[0] >> sep[0] >> v[1] >> sep[1] >> v[2] >> sep[2] >> v[3];
+
+    if (   !in || !in.eof()
+        || sep[0] != ',' || sep[1] != ',' || sep[2] != ','
+        || v[2] <= 0 || v[3] <= 0
+        || v[0] < INT_MIN || v[0] + v[2] - 1 > INT_MAX
+        || v[1] < INT_MIN || v[1] + v[3] - 1 > INT_MAX) {
+        throw std::runtime_error(
+            "The region of interest must be given as x,y,width,height");
+    }
+
+    EXRBox2i roi;
+    roi.min_x = int(v[0]);
+    roi.min_y = int(v[1]);
+    roi.max_x = int(v[0] + v[2] - 1);
+    roi.max_y = int(v[1] + v[3] - 1);
+
+    return roi;
+}
+
+
+// Checks, from their headers only, that the two files can be compared, and
+// finds the pixels to compare: the ones of `roi` stored in both files. The
+// files are aligned in their pixel space, following their data window.
+inline bool check_headers(
+    const EXRBandReader &reader_1,
+    const EXRBandReader &reader_2,
+    const EXRBox2i &     roi,
+    EXRBox2i &           region)
+{
+    const EXRBox2i &window_1 = reader_1.dataWindow();
+    const EXRBox2i &window_2 = reader_2.dataWindow();
+
+    if (!intersect(window_1, window_2, region)) {
+        std::cerr << "[error] The data windows of the images do not overlap."
+                  << std::endl;
+
+        return false;
+    }
+
+    if (memcmp(&window_1, &window_2, sizeof(EXRBox2i)) != 0) {
+        std::cerr << "[warning] The data windows of the images differ, only "
+                  << "the pixels stored in both files are compared." << std::endl;
+    }
+
+    if (!intersect(region, roi, region)) {
+        std::cerr << "[error] The region of interest is outside of the "
+                  << "pixels stored in both images." << std::endl;
+
+        return false;
+    }
+
+    return true;
+}
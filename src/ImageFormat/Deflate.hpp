@@ -0,0 +1,800 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+// Raw DEFLATE (RFC 1951) encoder.
+//
+// Each call to compress() produces a byte aligned segment that only
+// references the data given in that call. Unless it is the final one, a
+// segment ends with an empty stored block, the same way zlib does on a
+// Z_SYNC_FLUSH. Segments can then be simply concatenated to form a valid
+// stream: this lets the PNG writer compress an image band by band, and the
+// row groups of a band on different threads.
+class DeflateEncoder
+{
+  public:
+    DeflateEncoder(int level = 6)
+      : _head(kHashSize)
+      , _prev(kWindowSize)
+    {
+        setLevel(level);
+    }
+
+
+    void setLevel(int level)
+    {
+        static const int max_chain[10] = {0, 4, 8, 16, 32, 64, 128, 256, 1024, 4096};
+        static const int nice_len[10]  = {0, 8, 16, 32, 32, 64, 128, 128, 258, 258};
+
+        _level     = std::min(std::max(level, 0), 9);
+        _max_chain = max_chain[_level];
+        _nice_len  = nice_len[_level];
+        _lazy      = _level >= 4;
+    }
+
+
+    int level() const { return _level; }
+
+
+    // Compresses `size` bytes and appends the encoded segment to `out`. When
+    // `final` is set, the last block is marked as such and the stream is
+    // complete.
+    void compress(
+        const unsigned char *       data,
+        size_t                      size,
+        bool                        final,
+        std::vector<unsigned char> &out)
+    {
+        BitWriter bw(out);
+
+        if (_level == 0) {
+            writeStored(bw, data, size, final);
+        } else {
+            compressLZ77(bw, data, size, final);
+        }
+
+        if (!final) {
+            // Sync flush: empty stored block, leaves the stream byte aligned
+            bw.put(0, 3);
+            bw.align();
+            bw.put(0x0000, 16);
+            bw.put(0xFFFF, 16);
+        }
+
+        bw.align();
+    }
+
+
+    static uint32_t
+    adler32(uint32_t adler, const unsigned char *data, size_t size)
+    {
+        uint32_t a = adler & 0xFFFF;
+        uint32_t b = adler >> 16;
+
+        while (size > 0) {
+            // Largest n such that no overflow occurs before the modulo
+            const size_t n = std::min(size, size_t(5552));
+
+            for (size_t i = 0; i < n; i++) {
+                a += data[i];
+                b += a;
+            }
+
+            a %= 65521;
+            b %= 65521;
+            data += n;
+            size -= n;
+        }
+
+        return (b << 16) | a;
+    }
+
+
+    // Adler-32 of the concatenation of two buffers, from their own checksums
+    // and the size of the second one. The same computation as zlib's
+    // adler32_combine().
+    static uint32_t
+    adler32_combine(uint32_t adler_1, uint32_t adler_2, size_t size_2)
+    {
+        const uint32_t base = 65521;
+        const uint32_t rem  = uint32_t(size_2 % base);
+
+        uint32_t sum_1 = adler_1 & 0xFFFF;
+        uint32_t sum_2 = uint32_t((uint64_t(rem) * sum_1) % base);
+
+        sum_1 += (adler_2 & 0xFFFF) + base - 1;
+        sum_2 += ((adler_1 >> 16) & 0xFFFF) + ((adler_2 >> 16) & 0xFFFF) + base - rem;
+
+        if (sum_1 >= base) sum_1 -= base;
+        if (sum_1 >= base) sum_1 -= base;
+        if (sum_2 >= (base << 1)) sum_2 -= (base << 1);
+        if (sum_2 >= base) sum_2 -= base;
+
+        return (sum_2 << 16) | sum_1;
+    }
+
+  private:
+    static const int kWindowSize = 32768;
+    static const int kHashBits   = 15;
+    static const int kHashSize   = 1 << kHashBits;
+    static const int kMinMatch   = 3;
+    static const int kMaxMatch   = 258;
+
+    // Number of LZ77 symbols after which a new Huffman block is started
+    static const size_t kBlockSymbols = 1 << 15;
+
+    struct BitWriter {
+        BitWriter(std::vector<unsigned char> &o): out(o), buf(0), n_bits(0) {}
+
+        void put(uint32_t value, int n)
+        {
+            buf |= uint64_t(value) << n_bits;
+            n_bits += n;
+
+            while (n_bits >= 8) {
+                out.push_back(buf & 0xFF);
+                buf >>= 8;
+                n_bits -= 8;
+            }
+        }
+
+        void align()
+        {
+            if (n_bits > 0) {
+                put(0, 8 - n_bits);
+            }
+        }
+
+        std::vector<unsigned char> &out;
+        uint64_t                    buf;
+        int                         n_bits;
+    };
+
+    // A literal when dist == 0, a back reference otherwise
+    struct Symbol {
+        uint16_t litlen;
+        uint16_t dist;
+    };
+
+    struct HuffmanCode {
+        std::vector<uint8_t>  lengths;
+        std::vector<uint16_t> codes;
+    };
+
+
+    static const uint16_t *lengthBase()
+    {
+        static const uint16_t v[29] = {3,  4,  5,  6,   7,   8,   9,   10,  11, 13,
+                                       15, 17, 19, 23,  27,  31,  35,  43,  51, 59,
+                                       67, 83, 99, 115, 131, 163, 195, 227, 258};
+        return v;
+    }
+
+
+    static const uint8_t *lengthExtra()
+    {
+        static const uint8_t v[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                      2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        return v;
+    }
+
+
+    static const uint16_t *distBase()
+    {
+        static const uint16_t v[30]
+            = {1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+               33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+               1025, 1537, 2049, 3073, 4097, 6145,  8193,  12289, 16385, 24577};
+        return v;
+    }
+
+
+    static const uint8_t *distExtra()
+    {
+        static const uint8_t v[30] = {0, 0, 0, 0, 1, 1, 2,  2,  3,  3,
+                                      4, 4, 5, 5, 6, 6, 7,  7,  8,  8,
+                                      9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+        return v;
+    }
+
+
+    // Index of the length code (0 for code 257)
+    static int lengthCode(int length)
+    {
+        const uint16_t *base = lengthBase();
+        return int(std::upper_bound(base, base + 29, length) - base) - 1;
+    }
+
+
+    static int distCode(int dist)
+    {
+        const uint16_t *base = distBase();
+        return int(std::upper_bound(base, base + 30, dist) - base) - 1;
+    }
+
+
+    static uint16_t reverseBits(uint32_t code, int n)
+    {
+        uint32_t r = 0;
+
+        for (int i = 0; i < n; i++) {
+            r = (r << 1) | (code & 1);
+            code >>= 1;
+        }
+
+        return uint16_t(r);
+    }
+
+
+    // Computes Huffman code lengths limited to `max_bits` from symbol
+    // frequencies.
+    static void buildLengths(
+        const std::vector<uint32_t> &freq,
+        int                          max_bits,
+        std::vector<uint8_t> &       lengths)
+    {
+        lengths.assign(freq.size(), 0);
+
+        std::vector<std::pair<uint32_t, int>> syms;
+
+        for (size_t i = 0; i < freq.size(); i++) {
+            if (freq[i] > 0) {
+                syms.push_back(std::make_pair(freq[i], int(i)));
+            }
+        }
+
+        const int m = int(syms.size());
+
+        if (m == 0) {
+            return;
+        } else if (m == 1) {
+            lengths[syms[0].second] = 1;
+            return;
+        }
+
+        std::sort(syms.begin(), syms.end());
+
+        // Two queues method: leaves are [0, m), internal nodes [m, 2m - 1)
+        std::vector<uint64_t> weight(2 * m - 1);
+        std::vector<int>      parent(2 * m - 1, -1);
+
+        for (int i = 0; i < m; i++) {
+            weight[i] = syms[i].first;
+        }
+
+        int leaf = 0, node = m;
+
+        for (int next = m; next < 2 * m - 1; next++) {
+            int pick[2];
+
+            for (int k = 0; k < 2; k++) {
+                if (leaf < m && (node >= next || weight[leaf] <= weight[node])) {
+                    pick[k] = leaf++;
+                } else {
+                    pick[k] = node++;
+                }
+            }
+
+            weight[next]    = weight[pick[0]] + weight[pick[1]];
+            parent[pick[0]] = next;
+            parent[pick[1]] = next;
+        }
+
+        std::vector<int> depth(2 * m - 1, 0);
+        int              n_codes[33] = {0};
+
+        for (int i = 2 * m - 3; i >= 0; i--) {
+            depth[i] = depth[parent[i]] + 1;
+        }
+
+        for (int i = 0; i < m; i++) {
+            n_codes[std::min(depth[i], 32)]++;
+        }
+
+        // Enforce the maximum code length while keeping a complete code
+        for (int i = max_bits + 1; i <= 32; i++) {
+            n_codes[max_bits] += n_codes[i];
+        }
+
+        uint32_t total = 0;
+
+        for (int i = max_bits; i > 0; i--) {
+            total += uint32_t(n_codes[i]) << (max_bits - i);
+        }
+
+        while (total != (1U << max_bits)) {
+            n_codes[max_bits]--;
+
+            for (int i = max_bits - 1; i > 0; i--) {
+                if (n_codes[i] != 0) {
+                    n_codes[i]--;
+                    n_codes[i + 1] += 2;
+                    break;
+                }
+            }
+
+            total--;
+        }
+
+        // Most frequent symbols get the shortest codes
+        for (int len = 1, j = m; len <= max_bits; len++) {
+            for (int k = n_codes[len]; k > 0; k--) {
+                lengths[syms[--j].second] = uint8_t(len);
+            }
+        }
+    }
+
+
+    static void buildCodes(HuffmanCode &h)
+    {
+        int      bl_count[16] = {0};
+        uint32_t next_code[16];
+
+        for (size_t i = 0; i < h.lengths.size(); i++) {
+            bl_count[h.lengths[i]]++;
+        }
+
+        bl_count[0] = 0;
+        uint32_t code = 0;
+
+        for (int len = 1; len < 16; len++) {
+            code           = (code + bl_count[len - 1]) << 1;
+            next_code[len] = code;
+        }
+
+        h.codes.assign(h.lengths.size(), 0);
+
+        for (size_t i = 0; i < h.lengths.size(); i++) {
+            const int len = h.lengths[i];
+
+            if (len != 0) {
+                h.codes[i] = reverseBits(next_code[len]++, len);
+            }
+        }
+    }
+
+
+    static void fixedCodes(HuffmanCode &litlen, HuffmanCode &dist)
+    {
+        litlen.lengths.resize(288);
+
+        for (int i = 0; i < 288; i++) {
+            litlen.lengths[i] = (i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8;
+        }
+
+        dist.lengths.assign(30, 5);
+
+        buildCodes(litlen);
+        buildCodes(dist);
+    }
+
+
+    static void writeStored(
+        BitWriter &          bw,
+        const unsigned char *data,
+        size_t               size,
+        bool                 final)
+    {
+        size_t pos = 0;
+
+        do {
+            const size_t len  = std::min(size - pos, size_t(65535));
+            const bool   last = final && pos + len == size;
+
+            bw.put(last ? 1 : 0, 1);
+            bw.put(0, 2);
+            bw.align();
+            bw.put(uint32_t(len), 16);
+            bw.put(uint32_t(~len & 0xFFFF), 16);
+
+            bw.out.insert(bw.out.end(), data + pos, data + pos + len);
+            pos += len;
+        } while (pos < size);
+    }
+
+
+    static uint32_t hash3(const unsigned char *p)
+    {
+        return ((uint32_t(p[0]) << 10) ^ (uint32_t(p[1]) << 5) ^ p[2])
+               & (kHashSize - 1);
+    }
+
+
+    void findMatch(
+        const unsigned char *data,
+        std::ptrdiff_t       size,
+        std::ptrdiff_t       pos,
+        int &                best_len,
+        int &                best_dist) const
+    {
+        best_len  = 0;
+        best_dist = 0;
+
+        if (pos + kMinMatch > size) {
+            return;
+        }
+
+        const int max_len = int(std::min(std::ptrdiff_t(kMaxMatch), size - pos));
+
+        std::ptrdiff_t cand  = _head[hash3(data + pos)];
+        int            chain = _max_chain;
+        int            len   = kMinMatch - 1;
+
+        while (cand >= 0 && chain-- > 0) {
+            const std::ptrdiff_t dist = pos - cand;
+
+            if (dist > kWindowSize) {
+                break;
+            }
+
+            if (data[cand + len] == data[pos + len]) {
+                int l = 0;
+
+                while (l < max_len && data[cand + l] == data[pos + l]) {
+                    l++;
+                }
+
+                if (l > len) {
+                    len       = l;
+                    best_len  = l;
+                    best_dist = int(dist);
+
+                    if (l >= _nice_len || l == max_len) {
+                        break;
+                    }
+                }
+            }
+
+            const std::ptrdiff_t next = _prev[cand & (kWindowSize - 1)];
+
+            // The slot may have been reused by a more recent position
+            if (next >= cand) {
+                break;
+            }
+
+            cand = next;
+        }
+    }
+
+
+    void compressLZ77(
+        BitWriter &          bw,
+        const unsigned char *data,
+        size_t               size,
+        bool                 final)
+    {
+        std::fill(_head.begin(), _head.end(), -1);
+
+        const std::ptrdiff_t n        = std::ptrdiff_t(size);
+        std::ptrdiff_t       pos      = 0;
+        std::ptrdiff_t       inserted = 0;
+        std::ptrdiff_t       block_start = 0;
+
+        bool have_next = false;
+        int  next_len = 0, next_dist = 0;
+
+        _symbols.clear();
+
+        if (size == 0) {
+            // Nothing to encode, yet a final stream needs a last block
+            if (final) {
+                writeBlock(bw, data, 0, true);
+            }
+
+            return;
+        }
+
+        while (pos < n) {
+            while (inserted < pos) {
+                if (inserted + kMinMatch <= n) {
+                    const uint32_t h = hash3(data + inserted);
+                    _prev[inserted & (kWindowSize - 1)] = _head[h];
+                    _head[h]                            = inserted;
+                }
+                inserted++;
+            }
+
+            int len, dist;
+
+            if (have_next) {
+                len       = next_len;
+                dist      = next_dist;
+                have_next = false;
+            } else {
+                findMatch(data, n, pos, len, dist);
+            }
+
+            if (_lazy && len >= kMinMatch && len < _nice_len && pos + 1 < n) {
+                // Insert current position before looking one byte ahead
+                if (inserted == pos && pos + kMinMatch <= n) {
+                    const uint32_t h = hash3(data + pos);
+                    _prev[pos & (kWindowSize - 1)] = _head[h];
+                    _head[h]                       = pos;
+                    inserted++;
+                }
+
+                findMatch(data, n, pos + 1, next_len, next_dist);
+
+                if (next_len > len) {
+                    have_next = true;
+                    len       = 0;
+                }
+            }
+
+            Symbol s;
+
+            if (len >= kMinMatch) {
+                s.litlen = uint16_t(len);
+                s.dist   = uint16_t(dist);
+                pos += len;
+            } else {
+                s.litlen = data[pos];
+                s.dist   = 0;
+                pos += 1;
+            }
+
+            _symbols.push_back(s);
+
+            if (_symbols.size() >= kBlockSymbols || pos >= n) {
+                writeBlock(
+                    bw,
+                    data + block_start,
+                    size_t(pos - block_start),
+                    final && pos >= n);
+
+                _symbols.clear();
+                block_start = pos;
+            }
+        }
+    }
+
+
+    // Writes the pending symbols as a single block using whichever of the
+    // stored, fixed or dynamic Huffman encodings is the smallest.
+    void writeBlock(
+        BitWriter &          bw,
+        const unsigned char *raw,
+        size_t               raw_size,
+        bool                 last)
+    {
+        const uint8_t *len_extra  = lengthExtra();
+        const uint8_t *dist_extra = distExtra();
+
+        std::vector<uint32_t> litlen_freq(286, 0);
+        std::vector<uint32_t> dist_freq(30, 0);
+
+        for (size_t i = 0; i < _symbols.size(); i++) {
+            const Symbol &s = _symbols[i];
+
+            if (s.dist == 0) {
+                litlen_freq[s.litlen]++;
+            } else {
+                litlen_freq[257 + lengthCode(s.litlen)]++;
+                dist_freq[distCode(s.dist)]++;
+            }
+        }
+
+        litlen_freq[256] = 1;
+
+        // Keep at least two codes in each alphabet so both are complete
+        if (std::count(litlen_freq.begin(), litlen_freq.end(), 0U) == 285) {
+            litlen_freq[0] = 1;
+        }
+
+        for (int i = 0, used = int(30 - std::count(dist_freq.begin(), dist_freq.end(), 0U));
+             used < 2;
+             i++) {
+            if (dist_freq[i] == 0) {
+                dist_freq[i] = 1;
+                used++;
+            }
+        }
+
+        HuffmanCode litlen_dyn, dist_dyn;
+        buildLengths(litlen_freq, 15, litlen_dyn.lengths);
+        buildLengths(dist_freq, 15, dist_dyn.lengths);
+
+        int hlit = 286, hdist = 30;
+
+        while (hlit > 257 && litlen_dyn.lengths[hlit - 1] == 0) hlit--;
+        while (hdist > 1 && dist_dyn.lengths[hdist - 1] == 0) hdist--;
+
+        // Run length encoding of the code lengths
+        std::vector<uint8_t> all_lengths(
+            litlen_dyn.lengths.begin(),
+            litlen_dyn.lengths.begin() + hlit);
+        all_lengths.insert(
+            all_lengths.end(),
+            dist_dyn.lengths.begin(),
+            dist_dyn.lengths.begin() + hdist);
+
+        std::vector<std::pair<uint8_t, uint8_t>> rle;
+        std::vector<uint32_t>                    cl_freq(19, 0);
+
+        for (size_t i = 0; i < all_lengths.size();) {
+            const uint8_t cur = all_lengths[i];
+            size_t        run = 1;
+
+            while (i + run < all_lengths.size() && all_lengths[i + run] == cur) {
+                run++;
+            }
+
+            i += run;
+
+            if (cur == 0) {
+                while (run >= 11) {
+                    const size_t r = std::min(run, size_t(138));
+                    rle.push_back(std::make_pair(18, uint8_t(r - 11)));
+                    run -= r;
+                }
+
+                if (run >= 3) {
+                    rle.push_back(std::make_pair(17, uint8_t(run - 3)));
+                    run = 0;
+                }
+            } else {
+                rle.push_back(std::make_pair(cur, 0));
+                run--;
+
+                while (run >= 3) {
+                    const size_t r = std::min(run, size_t(6));
+                    rle.push_back(std::make_pair(16, uint8_t(r - 3)));
+                    run -= r;
+                }
+            }
+
+            for (; run > 0; run--) {
+                rle.push_back(std::make_pair(cur, 0));
+            }
+        }
+
+        for (size_t i = 0; i < rle.size(); i++) {
+            cl_freq[rle[i].first]++;
+        }
+
+        HuffmanCode cl;
+        buildLengths(cl_freq, 7, cl.lengths);
+
+        static const int cl_order[19]
+            = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+        int hclen = 19;
+
+        while (hclen > 4 && cl.lengths[cl_order[hclen - 1]] == 0) hclen--;
+
+        // Estimate the size of each encoding
+        HuffmanCode litlen_fix, dist_fix;
+        fixedCodes(litlen_fix, dist_fix);
+
+        uint64_t dyn_bits = 5 + 5 + 4 + 3 * hclen;
+
+        for (size_t i = 0; i < rle.size(); i++) {
+            const int s = rle[i].first;
+            dyn_bits += cl.lengths[s] + (s == 16 ? 2 : s == 17 ? 3 : s == 18 ? 7 : 0);
+        }
+
+        uint64_t fix_bits = 0;
+
+        for (int i = 0; i < 286; i++) {
+            const int extra = (i > 256) ? len_extra[i - 257] : 0;
+            dyn_bits += uint64_t(litlen_freq[i]) * (litlen_dyn.lengths[i] + extra);
+            fix_bits += uint64_t(litlen_freq[i]) * (litlen_fix.lengths[i] + extra);
+        }
+
+        for (int i = 0; i < 30; i++) {
+            dyn_bits += uint64_t(dist_freq[i]) * (dist_dyn.lengths[i] + dist_extra[i]);
+            fix_bits += uint64_t(dist_freq[i]) * (dist_fix.lengths[i] + dist_extra[i]);
+        }
+
+        const uint64_t stored_bits = 8 * (raw_size + 5 * (raw_size / 65535 + 1));
+
+        if (stored_bits < dyn_bits && stored_bits < fix_bits) {
+            writeStored(bw, raw, raw_size, last);
+            return;
+        }
+
+        bw.put(last ? 1 : 0, 1);
+
+        if (fix_bits <= dyn_bits) {
+            bw.put(1, 2);
+            writeSymbols(bw, litlen_fix, dist_fix);
+        } else {
+            buildCodes(litlen_dyn);
+            buildCodes(dist_dyn);
+            buildCodes(cl);
+
+            bw.put(2, 2);
+            bw.put(hlit - 257, 5);
+            bw.put(hdist - 1, 5);
+            bw.put(hclen - 4, 4);
+
+            for (int i = 0; i < hclen; i++) {
+                bw.put(cl.lengths[cl_order[i]], 3);
+            }
+
+            for (size_t i = 0; i < rle.size(); i++) {
+                const int s = rle[i].first;
+                bw.put(cl.codes[s], cl.lengths[s]);
+
+                if (s == 16) bw.put(rle[i].second, 2);
+                else if (s == 17) bw.put(rle[i].second, 3);
+                else if (s == 18) bw.put(rle[i].second, 7);
+            }
+
+            writeSymbols(bw, litlen_dyn, dist_dyn);
+        }
+    }
+
+
+    void writeSymbols(
+        BitWriter &        bw,
+        const HuffmanCode &litlen,
+        const HuffmanCode &dist) const
+    {
+        const uint16_t *len_base   = lengthBase();
+        const uint8_t * len_extra  = lengthExtra();
+        const uint16_t *dist_base  = distBase();
+        const uint8_t * dist_extra = distExtra();
+
+        for (size_t i = 0; i < _symbols.size(); i++) {
+            const Symbol &s = _symbols[i];
+
+            if (s.dist == 0) {
+                bw.put(litlen.codes[s.litlen], litlen.lengths[s.litlen]);
+            } else {
+                const int lc = lengthCode(s.litlen);
+                const int dc = distCode(s.dist);
+
+                bw.put(litlen.codes[257 + lc], litlen.lengths[257 + lc]);
+                bw.put(s.litlen - len_base[lc], len_extra[lc]);
+                bw.put(dist.codes[dc], dist.lengths[dc]);
+                bw.put(s.dist - dist_base[dc], dist_extra[dc]);
+            }
+        }
+
+        bw.put(litlen.codes[256], litlen.lengths[256]);
+    }
+
+
+    int  _level;
+    int  _max_chain;
+    int  _nice_len;
+    bool _lazy;
+
+    std::vector<std::ptrdiff_t> _head;
+    std::vector<std::ptrdiff_t> _prev;
+    std::vector<Symbol>         _symbols;
+};
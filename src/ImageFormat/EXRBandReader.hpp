@@ -0,0 +1,1173 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Chunks are decompressed by a pool of threads, whether OpenMP is enabled or
+// not
+#ifndef TINYEXR_USE_THREAD
+#    define TINYEXR_USE_THREAD 1
+#endif
+
+#define TINYEXR_IMPLEMENTATION
+#include <tinyexr.h>
+#include "../colortools.hpp"
+#include "../colortools_batch.hpp"
+#include "LabImage.hpp"
+#include "MappedFile.hpp"
+#include "PlanarImage.hpp"
+#include "Half.hpp"
+
+// Reads an OpenEXR file band by band instead of decoding the whole image at
+// once.
+//
+// The file is mapped in memory and its header and chunk offset table are
+// parsed when it is opened. Then, for each requested band, only the chunks
+// (scanline blocks or rows of tiles) overlapping it are read. They are packed
+// with the original header in a small in-memory EXR file whose data window
+// covers the band only, which tinyexr then decodes. The memory needed is
+// proportional to the band size, not to the image size.
+//
+// Uncompressed files are not copied nor given to tinyexr: the channels of
+// their rows that are compared are converted to Lab directly from the
+// mapping, the others are never read.
+//
+// A reader decodes a single part of multipart files. The layers of the part
+// (channels sharing a name prefix) to compare are selected, and all of them
+// are converted from the same decoded chunks.
+//
+// Opening the file only reads its header: it can be checked against another
+// file before any pixel is decoded.
+class EXRBandReader
+{
+  public:
+    // Opens the part `part` of the file. Its default layer is selected, if
+    // any: see selectLayers().
+    EXRBandReader(const char *filename, float exposureValue = 0.f, int part = 0)
+      : _file(filename)
+      , _pos(0)
+      , _filename(filename)
+      , _n_parts(1)
+      , _part_prefix(0)
+      , _xyz(false)
+    {
+        InitEXRHeader(&_header);
+
+        try {
+            // Version and header are kept: they are the prefix of each band
+            readBytes(8);
+
+            if (ParseEXRVersionFromMemory(&_version, _buffer.data(), 8)
+                != TINYEXR_SUCCESS) {
+                error("Invalid OpenEXR file");
+            }
+
+            if (_version.non_image) {
+                error("Deep OpenEXR files not supported");
+            }
+
+            // Position of the chunk offset table of the part
+            size_t offsets_begin;
+
+            // Primaries and white point of the part
+            float chromaticities[8];
+            rec709_chromaticities(chromaticities);
+
+            if (_version.multipart) {
+                // The headers of the parts follow each other, the list
+                // ending with an empty header. Only the one of the requested
+                // part is kept, as the header of a single part file.
+                std::string type;
+                uint64_t    chunks_before = 0;
+
+                for (int p = 0;; p++) {
+                    if (_pos >= _file.size()) {
+                        error("Truncated OpenEXR file");
+                    }
+
+                    if (_file.data()[_pos] == 0) {
+                        _pos++;
+                        break;
+                    }
+
+                    const size_t header_begin = _buffer.size();
+                    std::string  name, part_type;
+                    int32_t      chunk_count = 0;
+                    float        part_chromaticities[8];
+
+                    rec709_chromaticities(part_chromaticities);
+                    readHeader(name, part_type, chunk_count, part_chromaticities);
+                    _n_parts = p + 1;
+
+                    if (p == part) {
+                        _part_name = name;
+                        type       = part_type;
+                        std::copy(part_chromaticities, part_chromaticities + 8, chromaticities);
+                    } else {
+                        _buffer.resize(header_begin);
+
+                        if (p < part) {
+                            if (chunk_count < 0) {
+                                error("Invalid OpenEXR header");
+                            }
+
+                            chunks_before += uint64_t(chunk_count);
+                        }
+                    }
+                }
+
+                if (part < 0 || part >= _n_parts) {
+                    error("Missing part in OpenEXR file");
+                }
+
+                if (type.compare(0, 4, "deep") == 0) {
+                    error("Deep OpenEXR files not supported");
+                }
+
+                offsets_begin = _pos + 8 * size_t(chunks_before);
+
+                // Chunks start with the part number
+                _part_prefix = 4;
+
+                // Flags of a single part file: tiled (bit 9), long names (bit
+                // 10) kept, multipart (bit 12) cleared
+                _version.multipart = 0;
+                _version.tiled     = (type == "tiledimage") ? 1 : 0;
+                _buffer[5] = (_buffer[5] & 0x04) | (_version.tiled ? 0x02 : 0x00);
+            } else {
+                if (part != 0) {
+                    error("Missing part in OpenEXR file");
+                }
+
+                std::string name, type;
+                int32_t     chunk_count;
+
+                readHeader(name, type, chunk_count, chromaticities);
+                offsets_begin = _pos;
+            }
+
+            const char *err = nullptr;
+
+            if (ParseEXRHeaderFromMemory(
+                    &_header,
+                    &_version,
+                    _buffer.data(),
+                    _buffer.size(),
+                    &err)
+                != TINYEXR_SUCCESS) {
+                std::string msg = "Invalid OpenEXR header";
+
+                if (err) {
+                    msg += std::string(" (") + err + ")";
+                    FreeEXRErrorMessage(err);
+                }
+
+                error(msg.c_str());
+            }
+
+            // The exposure is folded in the matrix of the file: a single
+            // matrix product per pixel converts to XYZ (D65)
+            if (!lin_rgb_to_xyz_matrix(
+                    chromaticities, std::exp2(exposureValue), _rgb_to_xyz)) {
+                error("Invalid chromaticities in OpenEXR file");
+            }
+
+            _header_size = _buffer.size();
+            _data_window = _header.data_window;
+            _width       = size_t(_data_window.max_x - _data_window.min_x + 1);
+            _height      = size_t(_data_window.max_y - _data_window.min_y + 1);
+
+            // Layout of the chunks
+            if (_header.tiled) {
+                _chunk_rows = size_t(_header.tile_size_y);
+                _chunks_per_row
+                    = (_width + _header.tile_size_x - 1) / _header.tile_size_x;
+            } else {
+                _chunk_rows     = linesPerBlock(_header.compression_type);
+                _chunks_per_row = 1;
+            }
+
+            const size_t n_chunks
+                = _chunks_per_row * ((_height + _chunk_rows - 1) / _chunk_rows);
+
+            // Only the full resolution level is read: for multi-resolution
+            // files, its chunks come first in the offset table.
+            _pos = offsets_begin;
+            readBytes(8 * n_chunks);
+            _offsets.resize(n_chunks);
+
+            for (size_t i = 0; i < n_chunks; i++) {
+                const unsigned char *p = &_buffer[_header_size + 8 * i];
+                _offsets[i] = uint64_t(getUInt32(p)) | (uint64_t(getUInt32(p + 4)) << 32);
+            }
+
+            _buffer.resize(_header_size);
+
+            Layer layer;
+
+            if (findLayer("", layer)) {
+                selectLayers(std::vector<std::string>(1, ""));
+            }
+        } catch (...) {
+            FreeEXRHeader(&_header);
+            throw;
+        }
+    }
+
+
+    virtual ~EXRBandReader() { FreeEXRHeader(&_header); }
+
+
+    size_t width() const { return _width; }
+    size_t height() const { return _height; }
+
+
+    // Number of parts of the file, and name of the part read, empty for
+    // single part files
+    int numParts() const { return _n_parts; }
+    const std::string &partName() const { return _part_name; }
+
+
+    // Layers of the part that can be compared: the channel name prefixes
+    // with R, G and B channels, or a single channel shown as grey. The
+    // default layer, made of the channels without prefix, is named "".
+    std::vector<std::string> layerNames() const
+    {
+        std::vector<std::string> names;
+
+        for (int i = 0; i < _header.num_channels; i++) {
+            const std::string channel = _header.channels[i].name;
+            const size_t      dot     = channel.rfind('.');
+            const std::string name
+                = (dot == std::string::npos) ? "" : channel.substr(0, dot);
+
+            Layer layer;
+
+            if (   std::find(names.begin(), names.end(), name) == names.end()
+                && findLayer(name, layer)) {
+                names.push_back(name);
+            }
+        }
+
+        return names;
+    }
+
+
+    // Selects the layers to decode: readRows() converts each of them to its
+    // own Lab image, all from the same decoded chunks
+    void selectLayers(const std::vector<std::string> &names)
+    {
+        std::vector<Layer> layers(names.size());
+
+        for (size_t l = 0; l < names.size(); l++) {
+            if (!findLayer(names[l], layers[l])) {
+                if (names[l].empty()) {
+                    error("Missing R, G or B channel in OpenEXR file");
+                }
+
+                error(("Missing layer " + names[l] + " in OpenEXR file").c_str());
+            }
+
+            for (int c = 0; c < 3; c++) {
+                if (   _header.pixel_types[layers[l].channels[c]]
+                    == TINYEXR_PIXELTYPE_UINT) {
+                    error("Unsigned integer color channels not supported");
+                }
+            }
+        }
+
+        _layers = layers;
+
+        // Half colors are kept as half until the Lab conversion, which
+        // widens them in registers: the decoded channels take half the
+        // memory. Only mixed precision colors are widened by tinyexr, the
+        // channels of no selected layer are left as stored.
+        for (int i = 0; i < _header.num_channels; i++) {
+            _header.requested_pixel_types[i] = _header.pixel_types[i];
+
+            for (size_t l = 0; l < _layers.size(); l++) {
+                for (int c = 0; c < 3; c++) {
+                    if (   _layers[l].channels[c] == i
+                        && !_layers[l].half
+                        && _header.pixel_types[i] == TINYEXR_PIXELTYPE_HALF) {
+                        _header.requested_pixel_types[i] = TINYEXR_PIXELTYPE_FLOAT;
+                    }
+                }
+            }
+        }
+    }
+
+
+    size_t numLayers() const { return _layers.size(); }
+
+
+    // Pixel area stored in the file
+    const EXRBox2i &dataWindow() const { return _data_window; }
+
+
+    // Whether the chunks of `other` can be compared byte to byte with the
+    // ones of this file: identical chunks then give identical Lab values
+    bool sameLayout(const EXRBandReader &other) const
+    {
+        if (   _header.compression_type != other._header.compression_type
+            || _header.tiled != other._header.tiled
+            || _header.tile_size_x != other._header.tile_size_x
+            || _header.tile_size_y != other._header.tile_size_y
+            || _header.num_channels != other._header.num_channels
+            || _chunk_rows != other._chunk_rows
+            || memcmp(&_data_window, &other._data_window, sizeof(EXRBox2i)) != 0
+            || _layers.size() != other._layers.size()
+            || _xyz != other._xyz
+            || memcmp(_rgb_to_xyz, other._rgb_to_xyz, sizeof(_rgb_to_xyz)) != 0) {
+            return false;
+        }
+
+        for (int i = 0; i < _header.num_channels; i++) {
+            if (   strcmp(_header.channels[i].name, other._header.channels[i].name) != 0
+                || _header.pixel_types[i] != other._header.pixel_types[i]) {
+                return false;
+            }
+        }
+
+        for (size_t l = 0; l < _layers.size(); l++) {
+            if (   _layers[l].half != other._layers[l].half
+                || memcmp(
+                       _layers[l].channels,
+                       other._layers[l].channels,
+                       sizeof(_layers[l].channels))
+                       != 0) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+
+    // Whether the chunks holding the rows [c * chunkRows(), (c + 1) *
+    // chunkRows()) are the same bytes in both files, which must have the same
+    // layout
+    bool sameChunks(const EXRBandReader &other, size_t c) const
+    {
+        for (size_t i = c * _chunks_per_row; i < (c + 1) * _chunks_per_row; i++) {
+            const unsigned char *chunk_1, *chunk_2;
+            size_t               size_1, size_2;
+
+            if (   !chunk(i, chunk_1, size_1)
+                || !other.chunk(i, chunk_2, size_2)
+                || size_1 != size_2
+                || memcmp(chunk_1, chunk_2, size_1) != 0) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+
+    // Conversion from the file RGB to XYZ, exposure included
+    const float *rgbToXYZ() const { return _rgb_to_xyz; }
+
+
+    // Decodes the rows to XYZ instead of Lab, for the metrics that are not
+    // computed in Lab
+    void setXYZ(bool xyz) { _xyz = xyz; }
+
+    bool isXYZ() const { return _xyz; }
+
+
+    // Number of rows stored in one chunk: bands are best aligned on it
+    size_t chunkRows() const { return _chunk_rows; }
+
+
+    // Upper bound of the memory used per row while reading a band
+    size_t bytesPerRow() const
+    {
+        // Compressed chunks (at most the raw pixel size), decoded float
+        // channels and Lab output of each layer
+        return _width
+               * (_header.num_channels * (2 * sizeof(float))
+                  + std::max(_layers.size(), size_t(1)) * 3 * sizeof(float));
+    }
+
+
+    // Decodes the rows [y_begin, y_end) of `region`, an area of the data
+    // window given in the pixel space of the file, to the rows of `Lab`
+    // starting at `lab_row`: one image per selected layer
+    void readRegion(
+        const EXRBox2i &    region,
+        size_t              y_begin,
+        size_t              y_end,
+        PlanarImage *const *Lab,
+        size_t              lab_row = 0)
+    {
+        const size_t x_0 = size_t(region.min_x - _data_window.min_x);
+        const size_t y_0 = size_t(region.min_y - _data_window.min_y);
+
+        readRows(
+            y_0 + y_begin,
+            y_0 + y_end,
+            Lab,
+            lab_row,
+            x_0,
+            x_0 + size_t(region.max_x - region.min_x + 1));
+    }
+
+
+    void readRegion(
+        const EXRBox2i &region,
+        size_t          y_begin,
+        size_t          y_end,
+        PlanarImage &   Lab,
+        size_t          lab_row = 0)
+    {
+        PlanarImage *layers[1] = {&singleLayer(Lab)};
+        readRegion(region, y_begin, y_end, layers, lab_row);
+    }
+
+
+    // Decodes rows [y_begin, y_end) of the image and converts each selected
+    // layer to Lab in the rows of `Lab[layer]` starting at `lab_row`. Only
+    // the columns [x_begin, x_end) are converted, to the first columns of the
+    // Lab images, which must be at least as wide: with tiled files, only the
+    // tiles overlapping them are decoded.
+    void readRows(
+        size_t              y_begin,
+        size_t              y_end,
+        PlanarImage *const *Lab,
+        size_t              lab_row = 0,
+        size_t              x_begin = 0,
+        size_t              x_end   = size_t(-1))
+    {
+        if (_layers.empty()) {
+            error("Missing R, G or B channel in OpenEXR file");
+        }
+
+        x_end = std::min(x_end, _width);
+
+        // No chunk to decode
+        if (y_end <= y_begin || x_end <= x_begin) {
+            return;
+        }
+
+        const size_t c_begin = y_begin / _chunk_rows;
+        const size_t c_end   = (y_end + _chunk_rows - 1) / _chunk_rows;
+
+        // Columns of tiles overlapping [x_begin, x_end)
+        size_t t_begin = 0, t_end = _chunks_per_row;
+
+        if (_header.tiled) {
+            t_begin = x_begin / _header.tile_size_x;
+            t_end   = (x_end + _header.tile_size_x - 1) / _header.tile_size_x;
+        }
+
+        const size_t n_tiles  = t_end - t_begin;
+        const size_t n_chunks = (c_end - c_begin) * n_tiles;
+
+        std::vector<uint64_t> offsets(n_chunks);
+
+        for (size_t c = c_begin; c < c_end; c++) {
+            std::copy(
+                &_offsets[c * _chunks_per_row + t_begin],
+                &_offsets[c * _chunks_per_row + t_end],
+                &offsets[(c - c_begin) * n_tiles]);
+        }
+
+        // Chunks are usually stored in order: prefetch the band at once
+        _file.willNeed(
+            size_t(*std::min_element(offsets.begin(), offsets.end())),
+            size_t(*std::max_element(offsets.begin(), offsets.end())) + chunkBytes());
+
+        if (_header.compression_type == TINYEXR_COMPRESSIONTYPE_NONE) {
+            readInPlace(c_begin, c_end, t_begin, t_end, y_begin, y_end, x_begin, x_end, Lab, lab_row);
+
+            return;
+        }
+
+        _buffer.resize(_header_size + 8 * n_chunks);
+
+        for (size_t i = 0; i < n_chunks; i++) {
+            const size_t chunk_offset = _buffer.size();
+            putUInt64(&_buffer[_header_size + 8 * i], chunk_offset);
+
+            _pos = size_t(offsets[i]) + _part_prefix;
+
+            // Tile coordinates and size, or scanline and size
+            const size_t header_size = _header.tiled ? 20 : 8;
+            readBytes(header_size);
+
+            const int32_t data_size
+                = int32_t(getUInt32(&_buffer[chunk_offset + header_size - 4]));
+
+            if (data_size < 0) {
+                error("Invalid OpenEXR chunk");
+            }
+
+            if (_header.tiled) {
+                // Tiles are renumbered relatively to the band
+                const int32_t tile_x
+                    = int32_t(getUInt32(&_buffer[chunk_offset]));
+                const int32_t tile_y
+                    = int32_t(getUInt32(&_buffer[chunk_offset + 4]));
+                putUInt32(&_buffer[chunk_offset], uint32_t(tile_x - int32_t(t_begin)));
+                putUInt32(&_buffer[chunk_offset + 4], uint32_t(tile_y - int32_t(c_begin)));
+            }
+
+            readBytes(size_t(data_size));
+        }
+
+        // Restrict the header to the band
+        _header.data_window.min_y
+            = _data_window.min_y + int(c_begin * _chunk_rows);
+        _header.data_window.max_y = std::min(
+            _data_window.max_y,
+            _data_window.min_y + int(c_end * _chunk_rows) - 1);
+
+        if (_header.tiled) {
+            _header.data_window.min_x
+                = _data_window.min_x + int(t_begin * _header.tile_size_x);
+            _header.data_window.max_x = std::min(
+                _data_window.max_x,
+                _data_window.min_x + int(t_end * _header.tile_size_x) - 1);
+        }
+
+        _header.chunk_count     = int(n_chunks);
+        const int level_mode    = _header.tile_level_mode;
+        _header.tile_level_mode = TINYEXR_TILE_ONE_LEVEL;
+
+        EXRImage    image;
+        const char *err = nullptr;
+        InitEXRImage(&image);
+
+        const int ret = LoadEXRImageFromMemory(
+            &image,
+            &_header,
+            _buffer.data(),
+            _buffer.size(),
+            &err);
+
+        _header.data_window     = _data_window;
+        _header.tile_level_mode = level_mode;
+
+        if (ret != TINYEXR_SUCCESS) {
+            std::string msg = "Cannot decode OpenEXR file";
+
+            if (err) {
+                msg += std::string(" (") + err + ")";
+                FreeEXRErrorMessage(err);
+            }
+
+            error(msg.c_str());
+        }
+
+        const size_t row_begin = c_begin * _chunk_rows;
+
+        if (_header.tiled) {
+            #pragma omp parallel for
+            for (int t = 0; t < image.num_tiles; t++) {
+                const EXRTile &tile = image.tiles[t];
+
+                const size_t x_0
+                    = (t_begin + size_t(tile.offset_x)) * _header.tile_size_x;
+                const size_t y_0 = row_begin + size_t(tile.offset_y) * _chunk_rows;
+
+                // Columns of the tile to convert
+                const size_t i_begin = std::max(x_0, x_begin);
+                const size_t i_end   = std::min(x_0 + size_t(tile.width), x_end);
+
+                if (i_begin >= i_end) {
+                    continue;
+                }
+
+                for (size_t j = 0; j < size_t(tile.height); j++) {
+                    const size_t y = y_0 + j;
+
+                    if (y < y_begin || y >= y_end) {
+                        continue;
+                    }
+
+                    for (size_t l = 0; l < _layers.size(); l++) {
+                        convert(
+                            _layers[l],
+                            tile.images,
+                            j * _header.tile_size_x + i_begin - x_0,
+                            i_end - i_begin,
+                            *Lab[l],
+                            i_begin - x_begin,
+                            lab_row + y - y_begin);
+                    }
+                }
+            }
+        } else {
+            const size_t first = (y_begin - row_begin) * _width;
+
+            #pragma omp parallel for
+            for (size_t y = 0; y < y_end - y_begin; y++) {
+                for (size_t l = 0; l < _layers.size(); l++) {
+                    convert(
+                        _layers[l],
+                        image.images,
+                        first + y * _width + x_begin,
+                        x_end - x_begin,
+                        *Lab[l],
+                        0,
+                        lab_row + y);
+                }
+            }
+        }
+
+        FreeEXRImage(&image);
+        _buffer.resize(_header_size);
+    }
+
+
+    void readRows(
+        size_t       y_begin,
+        size_t       y_end,
+        PlanarImage &Lab,
+        size_t       lab_row = 0,
+        size_t       x_begin = 0,
+        size_t       x_end   = size_t(-1))
+    {
+        PlanarImage *layers[1] = {&singleLayer(Lab)};
+        readRows(y_begin, y_end, layers, lab_row, x_begin, x_end);
+    }
+
+  protected:
+    // Channels converted to Lab for a layer
+    struct Layer
+    {
+        int  channels[3];    // R, G and B, or the same channel three times
+        bool half;           // Decoded as half floats
+    };
+
+
+    // Finds the channels of the layer `name`, returns false if it cannot be
+    // compared
+    bool findLayer(const std::string &name, Layer &layer) const
+    {
+        const std::string prefix = name.empty() ? "" : name + ".";
+
+        if (name.empty() && _header.num_channels == 1) {
+            layer.channels[0] = layer.channels[1] = layer.channels[2] = 0;
+        } else {
+            const char *names[3] = {"R", "G", "B"};
+
+            int n_found = 0;
+
+            for (int c = 0; c < 3; c++) {
+                layer.channels[c] = -1;
+
+                for (int i = 0; i < _header.num_channels; i++) {
+                    if (prefix + names[c] == _header.channels[i].name) {
+                        layer.channels[c] = i;
+                        n_found++;
+                    }
+                }
+            }
+
+            if (n_found > 0 && n_found < 3) {
+                return false;
+            }
+
+            // Otherwise, a single channel is shown as grey
+            if (n_found == 0) {
+                for (int i = 0; i < _header.num_channels; i++) {
+                    const std::string channel = _header.channels[i].name;
+
+                    if (   channel.compare(0, prefix.size(), prefix) == 0
+                        && channel.find('.', prefix.size()) == std::string::npos) {
+                        if (n_found++ > 0) {
+                            return false;
+                        }
+
+                        layer.channels[0] = layer.channels[1] = layer.channels[2] = i;
+                    }
+                }
+
+                if (n_found == 0) {
+                    return false;
+                }
+            }
+        }
+
+        layer.half = true;
+
+        for (int c = 0; c < 3; c++) {
+            layer.half = layer.half
+                         && _header.pixel_types[layer.channels[c]]
+                                == TINYEXR_PIXELTYPE_HALF;
+        }
+
+        return true;
+    }
+
+
+    // Checks a single layer is selected before giving its Lab image
+    PlanarImage &singleLayer(PlanarImage &Lab) const
+    {
+        if (_layers.size() > 1) {
+            throw std::runtime_error("A single layer must be selected");
+        }
+
+        return Lab;
+    }
+
+
+    // Converts `n` pixels of the decoded channels of `layer`, indexed like
+    // the channels of the file, to the row `y` of `Lab`
+    void convert(
+        const Layer &        layer,
+        unsigned char *const *images,
+        size_t               i,
+        size_t               n,
+        PlanarImage &        Lab,
+        size_t               x,
+        size_t               y) const
+    {
+        const unsigned char *rgb[3];
+
+        for (int c = 0; c < 3; c++) {
+            rgb[c] = images[layer.channels[c]];
+        }
+
+        convert(rgb, layer.half, i, n, Lab, x, y);
+    }
+
+
+    // Converts `n` pixels of the decoded channels starting at `i` to the row
+    // `y` of `Lab` (XYZ with setXYZ()), starting at column `x`. The channels
+    // hold half floats when `half` is set, floats otherwise.
+    void convert(
+        const unsigned char *rgb[3],
+        bool                 half,
+        size_t               i,
+        size_t               n,
+        PlanarImage &        Lab,
+        size_t               x,
+        size_t               y) const
+    {
+        if (_xyz && half) {
+            lin_rgb_to_xyz_batch(
+                _rgb_to_xyz,
+                reinterpret_cast<const uint16_t *>(rgb[0]) + i,
+                reinterpret_cast<const uint16_t *>(rgb[1]) + i,
+                reinterpret_cast<const uint16_t *>(rgb[2]) + i,
+                &Lab.row(0, y)[x],
+                &Lab.row(1, y)[x],
+                &Lab.row(2, y)[x],
+                n);
+        } else if (_xyz) {
+            lin_rgb_to_xyz_batch(
+                _rgb_to_xyz,
+                reinterpret_cast<const float *>(rgb[0]) + i,
+                reinterpret_cast<const float *>(rgb[1]) + i,
+                reinterpret_cast<const float *>(rgb[2]) + i,
+                &Lab.row(0, y)[x],
+                &Lab.row(1, y)[x],
+                &Lab.row(2, y)[x],
+                n);
+        } else if (half) {
+            lin_rgb_to_Lab_batch(
+                _rgb_to_xyz,
+                reinterpret_cast<const uint16_t *>(rgb[0]) + i,
+                reinterpret_cast<const uint16_t *>(rgb[1]) + i,
+                reinterpret_cast<const uint16_t *>(rgb[2]) + i,
+                &Lab.row(0, y)[x],
+                &Lab.row(1, y)[x],
+                &Lab.row(2, y)[x],
+                n);
+        } else {
+            lin_rgb_to_Lab_batch(
+                _rgb_to_xyz,
+                reinterpret_cast<const float *>(rgb[0]) + i,
+                reinterpret_cast<const float *>(rgb[1]) + i,
+                reinterpret_cast<const float *>(rgb[2]) + i,
+                &Lab.row(0, y)[x],
+                &Lab.row(1, y)[x],
+                &Lab.row(2, y)[x],
+                n);
+        }
+    }
+
+
+    // Bytes of the chunk `i`, header included. Returns false if the chunk is
+    // not within the file.
+    bool chunk(size_t i, const unsigned char *&data, size_t &size) const
+    {
+        const size_t offset      = size_t(_offsets[i]) + _part_prefix;
+        const size_t header_size = _header.tiled ? 20 : 8;
+
+        if (offset > _file.size() || _file.size() - offset < header_size) {
+            return false;
+        }
+
+        data = _file.data() + offset;
+        size = header_size + getUInt32(data + header_size - 4);
+
+        return size <= _file.size() - offset;
+    }
+
+
+    // Size of the pixel data of a chunk, when not compressed
+    size_t chunkBytes() const
+    {
+        const size_t chunk_width
+            = _header.tiled ? size_t(_header.tile_size_x) : _width;
+
+        size_t bytes = 0;
+
+        for (int i = 0; i < _header.num_channels; i++) {
+            bytes += chunk_width * pixelSize(_header.pixel_types[i]);
+        }
+
+        // Part number, tile coordinates and size, or scanline and size
+        return bytes * _chunk_rows + _part_prefix + (_header.tiled ? 20 : 8);
+    }
+
+
+    // Converts the columns [x_begin, x_end) of the rows [y_begin, y_end) of
+    // an uncompressed file straight from the mapping, from the chunks of the
+    // rows [c_begin, c_end) and columns [t_begin, t_end) of chunks. Only the
+    // channels of the selected layers are read.
+    void readInPlace(
+        size_t              c_begin,
+        size_t              c_end,
+        size_t              t_begin,
+        size_t              t_end,
+        size_t              y_begin,
+        size_t              y_end,
+        size_t              x_begin,
+        size_t              x_end,
+        PlanarImage *const *Lab,
+        size_t              lab_row)
+    {
+        // Position of each channel in a row of a chunk, in bytes per pixel:
+        // channels are stored one after the other
+        std::vector<size_t> pixel_offset(_header.num_channels + 1, 0);
+
+        for (int i = 0; i < _header.num_channels; i++) {
+            pixel_offset[i + 1]
+                = pixel_offset[i] + pixelSize(_header.pixel_types[i]);
+        }
+
+        const size_t pixel_bytes = pixel_offset[_header.num_channels];
+        const size_t header_size = _header.tiled ? 20 : 8;
+        const size_t chunk_width
+            = _header.tiled ? size_t(_header.tile_size_x) : _width;
+
+        std::vector<size_t> chunks;
+
+        for (size_t c = c_begin; c < c_end; c++) {
+            for (size_t t = t_begin; t < t_end; t++) {
+                chunks.push_back(c * _chunks_per_row + t);
+            }
+        }
+
+        // Checked first: no exception can leave the parallel loop
+        for (size_t k = 0; k < chunks.size(); k++) {
+            const size_t c      = chunks[k] / _chunks_per_row;
+            const size_t t      = chunks[k] % _chunks_per_row;
+            const size_t w      = std::min(chunk_width, _width - t * chunk_width);
+            const size_t h      = std::min(_chunk_rows, _height - c * _chunk_rows);
+            const size_t bytes  = w * h * pixel_bytes;
+            const size_t offset = size_t(_offsets[chunks[k]]) + _part_prefix;
+
+            if (offset > _file.size() || _file.size() - offset < header_size + bytes) {
+                error("Truncated OpenEXR file");
+            }
+
+            if (getUInt32(_file.data() + offset + header_size - 4) != bytes) {
+                error("Invalid OpenEXR chunk");
+            }
+        }
+
+        #pragma omp parallel
+        {
+            // Aligned copies of the color channels of a row, half colors
+            // stay half
+            PlanarImage rgb(x_end - x_begin, 1);
+
+            #pragma omp for schedule(dynamic)
+            for (long k = 0; k < long(chunks.size()); k++) {
+                const size_t c   = chunks[k] / _chunks_per_row;
+                const size_t t   = chunks[k] % _chunks_per_row;
+                const size_t x_0 = t * chunk_width;
+                const size_t y_0 = c * _chunk_rows;
+                const size_t w   = std::min(chunk_width, _width - x_0);
+                const size_t h   = std::min(_chunk_rows, _height - y_0);
+
+                // Columns of the chunk to convert
+                const size_t i_begin = std::max(x_0, x_begin);
+                const size_t i_end   = std::min(x_0 + w, x_end);
+
+                if (i_begin >= i_end) {
+                    continue;
+                }
+
+                const unsigned char *data = _file.data() + _offsets[chunks[k]]
+                                            + _part_prefix + header_size;
+
+                for (size_t j = 0; j < h; j++) {
+                    const size_t y = y_0 + j;
+
+                    if (y < y_begin || y >= y_end) {
+                        continue;
+                    }
+
+                    convertStored(
+                        data + j * w * pixel_bytes,
+                        w,
+                        pixel_offset.data(),
+                        i_begin - x_0,
+                        i_end - i_begin,
+                        rgb,
+                        Lab,
+                        i_begin - x_begin,
+                        lab_row + y - y_begin);
+                }
+            }
+        }
+    }
+
+
+    // Converts `n` pixels from the column `first` of a stored row, `width`
+    // pixels wide, to the row `y` of the Lab image of each layer, starting at
+    // column `x`. The channels of the layers are copied to `rgb` first.
+    void convertStored(
+        const unsigned char *row,
+        size_t               width,
+        const size_t *       pixel_offset,
+        size_t               first,
+        size_t               n,
+        PlanarImage &        rgb,
+        PlanarImage *const * Lab,
+        size_t               x,
+        size_t               y) const
+    {
+        const unsigned char *rgb_rows[3];
+
+        for (int c = 0; c < 3; c++) {
+            rgb_rows[c] = reinterpret_cast<const unsigned char *>(rgb.plane(c));
+        }
+
+        for (size_t l = 0; l < _layers.size(); l++) {
+            const Layer &layer = _layers[l];
+
+            for (int c = 0; c < 3; c++) {
+                const int            i       = layer.channels[c];
+                const size_t         size    = pixelSize(_header.pixel_types[i]);
+                const unsigned char *channel = row + width * pixel_offset[i] + first * size;
+
+                if (layer.half) {
+                    // Little endian, as tinyexr assumes
+                    memcpy(rgb.plane(c), channel, 2 * n);
+                } else if (_header.pixel_types[i] == TINYEXR_PIXELTYPE_HALF) {
+                    half_to_float_row(channel, rgb.plane(c), n);
+                } else {
+                    float_row(channel, rgb.plane(c), n);
+                }
+            }
+
+            convert(rgb_rows, layer.half, 0, n, *Lab[l], x, y);
+        }
+    }
+
+
+    static size_t pixelSize(int pixel_type)
+    {
+        return (pixel_type == TINYEXR_PIXELTYPE_HALF) ? 2 : 4;
+    }
+
+
+    static size_t linesPerBlock(int compression_type)
+    {
+        switch (compression_type) {
+            case TINYEXR_COMPRESSIONTYPE_NONE:
+            case TINYEXR_COMPRESSIONTYPE_RLE:
+            case TINYEXR_COMPRESSIONTYPE_ZIPS:
+                return 1;
+            case TINYEXR_COMPRESSIONTYPE_ZIP:
+            case TINYEXR_COMPRESSIONTYPE_ZFP:
+                return 16;
+            case TINYEXR_COMPRESSIONTYPE_PIZ:
+                return 32;
+            default:
+                throw std::runtime_error("Unsupported OpenEXR compression");
+        }
+    }
+
+
+    static uint32_t getUInt32(const unsigned char *p)
+    {
+        return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16)
+               | (uint32_t(p[3]) << 24);
+    }
+
+
+    static void putUInt32(unsigned char *p, uint32_t v)
+    {
+        for (int i = 0; i < 4; i++) {
+            p[i] = (v >> (8 * i)) & 0xFF;
+        }
+    }
+
+
+    static void putUInt64(unsigned char *p, uint64_t v)
+    {
+        putUInt32(p, uint32_t(v & 0xFFFFFFFF));
+        putUInt32(p + 4, uint32_t(v >> 32));
+    }
+
+
+    // Appends `size` bytes read from the file to the buffer
+    void readBytes(size_t size)
+    {
+        if (_pos > _file.size() || size > _file.size() - _pos) {
+            error("Truncated OpenEXR file");
+        }
+
+        _buffer.insert(_buffer.end(), _file.data() + _pos, _file.data() + _pos + size);
+        _pos += size;
+    }
+
+
+    // Appends a header read from the file to the buffer, up to the empty
+    // attribute name ending it. The name, type and chunkCount attributes of
+    // multipart files, and the chromaticities, are returned when present.
+    void readHeader(
+        std::string &name,
+        std::string &type,
+        int32_t &    chunk_count,
+        float        chromaticities[8])
+    {
+        for (;;) {
+            const size_t name_offset = _buffer.size();
+
+            if (readString() == 0) {
+                return;
+            }
+
+            const std::string attr_name(
+                reinterpret_cast<const char *>(&_buffer[name_offset]));
+
+            readString();
+            const size_t size_offset = _buffer.size();
+            readBytes(4);
+
+            const int32_t attr_size = int32_t(getUInt32(&_buffer[size_offset]));
+
+            if (attr_size < 0) {
+                error("Invalid OpenEXR header");
+            }
+
+            readBytes(size_t(attr_size));
+
+            const char *value
+                = reinterpret_cast<const char *>(&_buffer[size_offset + 4]);
+
+            if (attr_name == "name") {
+                name.assign(value, size_t(attr_size));
+            } else if (attr_name == "type") {
+                type.assign(value, size_t(attr_size));
+            } else if (attr_name == "chunkCount" && attr_size == 4) {
+                chunk_count = int32_t(getUInt32(&_buffer[size_offset + 4]));
+            } else if (attr_name == "chromaticities" && attr_size == 32) {
+                for (int i = 0; i < 8; i++) {
+                    const uint32_t bits = getUInt32(&_buffer[size_offset + 4 + 4 * i]);
+                    std::memcpy(&chromaticities[i], &bits, 4);
+                }
+            }
+        }
+    }
+
+
+    // Appends a null terminated string read from the file to the buffer and
+    // returns its length
+    size_t readString()
+    {
+        size_t length = 0;
+
+        for (;;) {
+            readBytes(1);
+
+            if (_buffer.back() == 0) {
+                return length;
+            }
+
+            if (++length > 255) {
+                error("Invalid OpenEXR header");
+            }
+        }
+    }
+
+
+    void error(const char *message) const
+    {
+        std::stringstream err_msg;
+        err_msg << message << ": " << _filename;
+        throw std::runtime_error(err_msg.str());
+    }
+
+  private:
+    EXRBandReader(const EXRBandReader &) = delete;
+    EXRBandReader &operator=(const EXRBandReader &) = delete;
+
+    MappedFile    _file;
+    size_t        _pos;    // Next byte read by readBytes()
+    std::string   _filename;
+    float         _rgb_to_xyz[9];
+    int           _n_parts;
+    std::string   _part_name;
+    size_t        _part_prefix;    // Bytes of the part number before each chunk
+    bool          _xyz;            // Rows decoded to XYZ instead of Lab
+
+    EXRVersion _version;
+    EXRHeader  _header;
+    EXRBox2i   _data_window;
+
+    size_t _header_size;
+    size_t _width, _height;
+    size_t _chunk_rows;
+    size_t _chunks_per_row;
+
+    std::vector<Layer> _layers;    // Selected layers
+
+    std::vector<uint64_t>      _offsets;
+    std::vector<unsigned char> _buffer;
+};
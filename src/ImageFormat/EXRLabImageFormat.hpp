@@ -0,0 +1,60 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include "LabImage.hpp"
+#include "EXRBandReader.hpp"
+
+// OpenEXR file loaded directly in the Lab colorspace: only the color channels
+// are decoded, and converted to Lab, exposure included, in a single pass
+// without going through a full XYZ image.
+class EXRLabImageFormat: public LabImage
+{
+  public:
+    EXRLabImageFormat(const char *filename, float exposureValue = 0.f)
+      : LabImage(0, 0)
+    {
+        // The whole image is read as a single band
+        EXRBandReader reader(filename, exposureValue);
+
+        resize(reader.width(), reader.height());
+        reader.readRows(0, _height, *this);
+
+        _data_window = reader.dataWindow();
+    }
+
+    virtual ~EXRLabImageFormat() {}
+
+
+    // Pixels of the file held by the image
+    const EXRBox2i &dataWindow() const { return _data_window; }
+
+  protected:
+    EXRBox2i _data_window;
+};
@@ -0,0 +1,89 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Converts a half float, as stored in OpenEXR files, to a float
+inline float half_to_float(uint16_t h)
+{
+    const uint32_t sign     = uint32_t(h & 0x8000) << 16;
+    const uint32_t exponent = (h >> 10) & 0x1F;
+    uint32_t       mantissa = h & 0x3FF;
+    uint32_t       bits;
+
+    if (exponent == 0x1F) {
+        // Infinity or NaN
+        bits = sign | 0x7F800000 | (mantissa << 13);
+    } else if (exponent != 0) {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    } else if (mantissa != 0) {
+        // Denormal: normalized in the float range
+        uint32_t e = 113;
+
+        while ((mantissa & 0x400) == 0) {
+            mantissa <<= 1;
+            e--;
+        }
+
+        bits = sign | (e << 23) | ((mantissa & 0x3FF) << 13);
+    } else {
+        bits = sign;
+    }
+
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+
+    return f;
+}
+
+
+// Converts `n` little endian half floats starting at `src`, which may be
+// unaligned
+inline void half_to_float_row(const unsigned char *src, float *dst, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = half_to_float(uint16_t(src[2 * i] | (src[2 * i + 1] << 8)));
+    }
+}
+
+
+// Reads `n` little endian floats starting at `src`, which may be unaligned
+inline void float_row(const unsigned char *src, float *dst, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        const uint32_t bits = uint32_t(src[4 * i]) | (uint32_t(src[4 * i + 1]) << 8)
+                              | (uint32_t(src[4 * i + 2]) << 16)
+                              | (uint32_t(src[4 * i + 3]) << 24);
+
+        memcpy(&dst[i], &bits, sizeof(float));
+    }
+}
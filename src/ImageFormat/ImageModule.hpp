@@ -28,16 +28,39 @@
 
 #pragma once
 
+#include <cstring>
 #include <sstream>
 #include <stdexcept>
+#include <string>
 
-#include "XYZImage.hpp"
-#include "EXRImageFormat.hpp"
+#include "LabImage.hpp"
+#include "EXRLabImageFormat.hpp"
+#include "EXRBandReader.hpp"
 
 class ImageModule
 {
   public:
-    static XYZImage *load(const std::string &filename, float exposure = 0.f)
+    // Loads the file directly in the Lab colorspace
+    static EXRLabImageFormat *loadLab(const std::string &filename, float exposure = 0.f)
+    {
+        checkFormat(filename);
+
+        return new EXRLabImageFormat(filename.c_str(), exposure);
+    }
+
+    // Opens a part of the file and reads its header only, the pixels are
+    // decoded on demand by the returned reader
+    static EXRBandReader *open(
+        const std::string &filename, float exposure = 0.f, int part = 0)
+    {
+        checkFormat(filename);
+
+        return new EXRBandReader(filename.c_str(), exposure, part);
+    }
+
+  protected:
+    // Throws if the file extension is not one of a supported format
+    static void checkFormat(const std::string &filename)
     {
         // Check if the filename size is long enough
         if (filename.size() < 5) {
@@ -48,10 +71,8 @@ class ImageModule
 
         const char *filename_ext = &filename.c_str()[filename.size() - 4];
 
-        if (   strcmp(filename_ext, ".exr") == 0
-            || strcmp(filename_ext, ".EXR") == 0) {
-            return new EXRImageFormat(filename.c_str(), exposure);
-        } else {
+        if (   strcmp(filename_ext, ".exr") != 0
+            && strcmp(filename_ext, ".EXR") != 0) {
             std::stringstream err_msg;
             err_msg << "Cannot open file: " << filename << "(unknown file format: " << filename_ext << ")";
             throw std::runtime_error(err_msg.str());
@@ -29,36 +29,26 @@
 #pragma once
 
 #include <cstddef>
-#include <vector>
 
-class XYZImage
+#include "PlanarImage.hpp"
+
+// Image in the CIE 1976 L*a*b* colorspace (D65), stored as L, a and b planes
+class LabImage: public PlanarImage
 {
   public:
-    XYZImage(size_t width, size_t height)
-      : _width(width)
-      , _height(height)
-      , _pXyzBuffer(3 * width * height)
+    LabImage(size_t width, size_t height)
+      : PlanarImage(width, height)
     {}
 
 
-    virtual ~XYZImage() {}
-
-
-    size_t width() const { return _width; }
-    size_t height() const { return _height; }
-
-
-    void resize(size_t width, size_t height)
-    {
-        _width  = width;
-        _height = height;
-        _pXyzBuffer.resize(3 * width * height);
-    }
+    virtual ~LabImage() {}
 
 
-    float *data_xyz() { return _pXyzBuffer.data(); }
+    float *data_L() { return plane(0); }
+    float *data_a() { return plane(1); }
+    float *data_b() { return plane(2); }
 
-  protected:
-    size_t             _width, _height;
-    std::vector<float> _pXyzBuffer;
-};
\ No newline at end of file
+    const float *data_L() const { return plane(0); }
+    const float *data_a() const { return plane(1); }
+    const float *data_b() const { return plane(2); }
+};
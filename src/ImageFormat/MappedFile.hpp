@@ -0,0 +1,163 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+// Read only view of a whole file.
+//
+// The file is mapped in memory, so it is read once, directly from the page
+// cache, whatever the number of times it is parsed. On platforms without
+// mmap, it is read in a buffer instead.
+class MappedFile
+{
+  public:
+    MappedFile(const char *filename)
+      : _data(nullptr)
+      , _size(0)
+      , _mapping(nullptr)
+    {
+#ifndef _WIN32
+        const int fd = ::open(filename, O_RDONLY);
+
+        if (fd < 0) {
+            error("Cannot open file", filename);
+        }
+
+        struct stat info;
+
+        if (fstat(fd, &info) != 0) {
+            ::close(fd);
+            error("Cannot open file", filename);
+        }
+
+        _size = size_t(info.st_size);
+
+        if (_size > 0) {
+            _mapping = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+
+        ::close(fd);
+
+        if (_mapping == MAP_FAILED) {
+            _mapping = nullptr;
+            error("Cannot map file", filename);
+        }
+
+        _data = static_cast<const unsigned char *>(_mapping);
+
+        // Files are mostly read from the start to the end
+        if (_mapping) {
+            madvise(_mapping, _size, MADV_SEQUENTIAL);
+        }
+#else
+        std::ifstream file(filename, std::ios::binary | std::ios::ate);
+
+        if (!file) {
+            error("Cannot open file", filename);
+        }
+
+        _buffer.resize(size_t(file.tellg()));
+        file.seekg(0);
+        file.read(reinterpret_cast<char *>(_buffer.data()), std::streamsize(_buffer.size()));
+
+        if (!file) {
+            error("Cannot read file", filename);
+        }
+
+        _data = _buffer.data();
+        _size = _buffer.size();
+#endif
+    }
+
+
+    virtual ~MappedFile()
+    {
+#ifndef _WIN32
+        if (_mapping) {
+            munmap(_mapping, _size);
+        }
+#endif
+    }
+
+
+    const unsigned char *data() const { return _data; }
+    size_t size() const { return _size; }
+
+
+    // Hints that the bytes [begin, end) are going to be read soon
+    void willNeed(size_t begin, size_t end) const
+    {
+#ifndef _WIN32
+        if (!_mapping || begin >= end) {
+            return;
+        }
+
+        const size_t page  = size_t(sysconf(_SC_PAGESIZE));
+        const size_t first = begin / page * page;
+
+        madvise(
+            static_cast<char *>(_mapping) + first,
+            std::min(end, _size) - first,
+            MADV_WILLNEED);
+#else
+        (void)begin;
+        (void)end;
+#endif
+    }
+
+  protected:
+    static void error(const char *message, const char *filename)
+    {
+        throw std::runtime_error(std::string(message) + ": " + filename);
+    }
+
+  private:
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const unsigned char *_data;
+    size_t               _size;
+    void *               _mapping;
+
+    std::vector<unsigned char> _buffer;
+};
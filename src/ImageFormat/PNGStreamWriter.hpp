@@ -0,0 +1,451 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Deflate.hpp"
+
+// Row filters, see the PNG specification. Adaptive picks the best one for
+// each row.
+enum class PNGFilter
+{
+    None = 0,
+    Sub,
+    Up,
+    Average,
+    Paeth,
+    Adaptive
+};
+
+
+// Writes an 8-bit RGBA PNG file incrementally: rows are filtered, compressed
+// and written to the disk as soon as they are given, so only the rows of the
+// current band need to be held in memory.
+//
+// The rows given at once are split in groups of about `group_size` bytes that
+// are filtered and compressed in parallel, each group as an independent
+// deflate segment. As the segments are sync flushed, they are concatenated in
+// a single zlib stream, the same way pigz does.
+class PNGStreamWriter
+{
+  public:
+    static const size_t group_size = 256 * 1024;
+
+    PNGStreamWriter(
+        const std::string &filename,
+        size_t             width,
+        size_t             height,
+        int                level  = 6,
+        PNGFilter          filter = PNGFilter::Adaptive)
+      : _file(filename.c_str(), std::ios::binary)
+      , _filename(filename)
+      , _width(width)
+      , _height(height)
+      , _rows_written(0)
+      , _adler(1)
+      , _level(level)
+      , _filter(filter)
+      , _prev_row(4 * width, 0)
+      , _closed(false)
+    {
+        if (!_file) {
+            std::stringstream err_msg;
+            err_msg << "Cannot write PNG file: " << filename;
+            throw std::runtime_error(err_msg.str());
+        }
+
+        static const unsigned char signature[8]
+            = {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+
+        write(signature, 8);
+
+        unsigned char ihdr[13];
+        putUInt32(ihdr + 0, uint32_t(width));
+        putUInt32(ihdr + 4, uint32_t(height));
+        ihdr[8]  = 8;   // Bit depth
+        ihdr[9]  = 6;   // Color type: RGBA
+        ihdr[10] = 0;   // Compression method: deflate
+        ihdr[11] = 0;   // Filter method: adaptive
+        ihdr[12] = 0;   // Interlace method: none
+
+        writeChunk("IHDR", ihdr, 13);
+
+        // zlib stream header with the compression level hint
+        const int           flevel = (level <= 1) ? 0 : (level <= 5) ? 1 : (level == 6) ? 2 : 3;
+        const unsigned char cmf    = 0x78;
+        unsigned char       flg    = flevel << 6;
+        flg += 31 - (cmf * 256 + flg) % 31;
+
+        _compressed.push_back(cmf);
+        _compressed.push_back(flg);
+    }
+
+
+    virtual ~PNGStreamWriter() {}
+
+
+    size_t width() const { return _width; }
+    size_t height() const { return _height; }
+
+
+    // Filter from its name: none, sub, up, average, paeth or adaptive
+    static PNGFilter filterFromName(const std::string &name)
+    {
+        const char *names[6]
+            = {"none", "sub", "up", "average", "paeth", "adaptive"};
+
+        for (int i = 0; i < 6; i++) {
+            if (name == names[i]) {
+                return PNGFilter(i);
+            }
+        }
+
+        throw std::runtime_error(
+            "Invalid PNG filter: " + name
+            + " (valid filters are none, sub, up, average, paeth and "
+              "adaptive)");
+    }
+
+
+    // Appends `n_rows` rows of `width` RGBA pixels to the image
+    void writeRows(const unsigned char *rgba, size_t n_rows)
+    {
+        if (_rows_written + n_rows > _height) {
+            throw std::runtime_error("Too many rows written to the PNG file");
+        }
+
+        const size_t row_size   = 4 * _width;
+        const size_t group_rows = std::max(size_t(1), group_size / (row_size + 1));
+        const int    n_groups   = int((n_rows + group_rows - 1) / group_rows);
+
+        _rows_written += n_rows;
+
+        const bool final = _rows_written == _height;
+
+        _filtered.resize(n_rows * (row_size + 1));
+        _groups.resize(n_groups);
+
+        #pragma omp parallel
+        {
+            DeflateEncoder             deflate(_level);
+            std::vector<unsigned char> candidate(row_size);
+
+            #pragma omp for schedule(dynamic)
+            for (int g = 0; g < n_groups; g++) {
+                const size_t y_begin = size_t(g) * group_rows;
+                const size_t y_end   = std::min(n_rows, y_begin + group_rows);
+
+                unsigned char *filtered = &_filtered[y_begin * (row_size + 1)];
+                const size_t   size     = (y_end - y_begin) * (row_size + 1);
+
+                for (size_t y = y_begin; y < y_end; y++) {
+                    const unsigned char *row = &rgba[y * row_size];
+                    const unsigned char *prev
+                        = (y == 0) ? _prev_row.data() : &rgba[(y - 1) * row_size];
+
+                    filterRow(
+                        row,
+                        prev,
+                        row_size,
+                        candidate.data(),
+                        &_filtered[y * (row_size + 1)]);
+                }
+
+                _groups[g].adler = DeflateEncoder::adler32(1, filtered, size);
+                _groups[g].size  = size;
+                _groups[g].compressed.clear();
+
+                deflate.compress(
+                    filtered,
+                    size,
+                    final && g == n_groups - 1,
+                    _groups[g].compressed);
+            }
+        }
+
+        if (n_rows > 0) {
+            std::copy(
+                &rgba[(n_rows - 1) * row_size],
+                &rgba[n_rows * row_size],
+                _prev_row.begin());
+        }
+
+        for (int g = 0; g < n_groups; g++) {
+            _adler = DeflateEncoder::adler32_combine(
+                _adler,
+                _groups[g].adler,
+                _groups[g].size);
+
+            _compressed.insert(
+                _compressed.end(),
+                _groups[g].compressed.begin(),
+                _groups[g].compressed.end());
+        }
+
+        if (final) {
+            unsigned char adler[4];
+            putUInt32(adler, _adler);
+            _compressed.insert(_compressed.end(), adler, adler + 4);
+        }
+
+        flushIDAT();
+    }
+
+
+    // Terminates the file. All rows must have been written.
+    void close()
+    {
+        if (_closed) {
+            return;
+        }
+
+        if (_rows_written != _height) {
+            std::stringstream err_msg;
+            err_msg << "Incomplete PNG file: " << _filename << " ("
+                    << _rows_written << " rows written out of " << _height
+                    << ")";
+            throw std::runtime_error(err_msg.str());
+        }
+
+        writeChunk("IEND", nullptr, 0);
+        _file.close();
+        _closed = true;
+
+        if (!_file) {
+            std::stringstream err_msg;
+            err_msg << "Cannot write PNG file: " << _filename;
+            throw std::runtime_error(err_msg.str());
+        }
+    }
+
+  protected:
+    static void putUInt32(unsigned char *dst, uint32_t v)
+    {
+        dst[0] = (v >> 24) & 0xFF;
+        dst[1] = (v >> 16) & 0xFF;
+        dst[2] = (v >> 8) & 0xFF;
+        dst[3] = v & 0xFF;
+    }
+
+
+    // CRC table of the PNG polynomial
+    struct CRCTable
+    {
+        uint32_t values[256];
+    };
+
+
+    static CRCTable crcTable()
+    {
+        CRCTable table;
+
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+            }
+
+            table.values[n] = c;
+        }
+
+        return table;
+    }
+
+
+    static uint32_t crc32(uint32_t crc, const unsigned char *data, size_t size)
+    {
+        // Built once, even when chunks are written from several threads
+        static const CRCTable table = crcTable();
+
+        crc = ~crc;
+
+        for (size_t i = 0; i < size; i++) {
+            crc = table.values[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+
+        return ~crc;
+    }
+
+
+    static unsigned char paeth(int a, int b, int c)
+    {
+        const int p  = a + b - c;
+        const int pa = std::abs(p - a);
+        const int pb = std::abs(p - b);
+        const int pc = std::abs(p - c);
+
+        if (pa <= pb && pa <= pc) return a;
+        if (pb <= pc) return b;
+        return c;
+    }
+
+
+    // Applies the PNG filter `type` to a row of 4 bytes per pixel
+    static void applyFilter(
+        int                  type,
+        const unsigned char *row,
+        const unsigned char *prev,
+        size_t               size,
+        unsigned char *      out)
+    {
+        for (size_t i = 0; i < size; i++) {
+            const int a = (i >= 4) ? row[i - 4] : 0;
+            const int b = prev[i];
+            const int c = (i >= 4) ? prev[i - 4] : 0;
+
+            switch (type) {
+                case 0: out[i] = row[i]; break;
+                case 1: out[i] = row[i] - a; break;
+                case 2: out[i] = row[i] - b; break;
+                case 3: out[i] = row[i] - ((a + b) >> 1); break;
+                default: out[i] = row[i] - paeth(a, b, c); break;
+            }
+        }
+    }
+
+
+    // Filters a row with the writer's filter. For the adaptive filter, picks
+    // the one giving the smallest sum of absolute signed differences, the
+    // heuristic recommended by the PNG specification. `candidate` is a
+    // scratch buffer of `size` bytes.
+    void filterRow(
+        const unsigned char *row,
+        const unsigned char *prev,
+        size_t               size,
+        unsigned char *      candidate,
+        unsigned char *      out) const
+    {
+        if (_filter != PNGFilter::Adaptive) {
+            out[0] = (unsigned char)_filter;
+            applyFilter(int(_filter), row, prev, size, out + 1);
+            return;
+        }
+
+        unsigned long best_sum = 0;
+
+        for (int type = 0; type < 5; type++) {
+            applyFilter(type, row, prev, size, candidate);
+
+            unsigned long sum = 0;
+
+            for (size_t i = 0; i < size; i++) {
+                const unsigned char s = candidate[i];
+                sum += (s < 128) ? s : 256 - s;
+            }
+
+            if (type == 0 || sum < best_sum) {
+                best_sum = sum;
+                out[0]   = (unsigned char)type;
+                std::copy(candidate, candidate + size, out + 1);
+            }
+        }
+    }
+
+
+    void writeChunk(const char *type, const unsigned char *data, size_t size)
+    {
+        unsigned char header[8];
+        putUInt32(header, uint32_t(size));
+        std::copy(type, type + 4, header + 4);
+
+        uint32_t crc = crc32(0, header + 4, 4);
+        crc          = crc32(crc, data, size);
+
+        unsigned char footer[4];
+        putUInt32(footer, crc);
+
+        write(header, 8);
+        write(data, size);
+        write(footer, 4);
+    }
+
+
+    void flushIDAT()
+    {
+        const size_t max_chunk = size_t(1) << 30;
+
+        for (size_t pos = 0; pos < _compressed.size(); pos += max_chunk) {
+            writeChunk(
+                "IDAT",
+                &_compressed[pos],
+                std::min(max_chunk, _compressed.size() - pos));
+        }
+
+        _compressed.clear();
+    }
+
+
+    void write(const unsigned char *data, size_t size)
+    {
+        if (size > 0) {
+            _file.write(reinterpret_cast<const char *>(data), size);
+        }
+
+        if (!_file) {
+            std::stringstream err_msg;
+            err_msg << "Cannot write PNG file: " << _filename;
+            throw std::runtime_error(err_msg.str());
+        }
+    }
+
+  private:
+    std::ofstream _file;
+    std::string   _filename;
+    size_t        _width, _height;
+    size_t        _rows_written;
+    uint32_t      _adler;
+
+    int       _level;
+    PNGFilter _filter;
+
+    // Row group compressed independently
+    struct Group
+    {
+        uint32_t                   adler;
+        size_t                     size;
+        std::vector<unsigned char> compressed;
+    };
+
+    std::vector<unsigned char> _prev_row;
+    std::vector<unsigned char> _filtered;
+    std::vector<Group>         _groups;
+    std::vector<unsigned char> _compressed;
+
+    bool _closed;
+};
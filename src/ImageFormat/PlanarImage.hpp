@@ -0,0 +1,153 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// Image made of three float planes, one per channel.
+//
+// Each plane starts on a 64 bytes boundary and rows are padded to a multiple
+// of 16 floats, so that every row is aligned for SIMD loads, AVX-512
+// included. The padding is zero filled: kernels can process full rows up to
+// the stride without handling a remainder.
+class PlanarImage
+{
+  public:
+    static const size_t alignment = 64;
+
+    PlanarImage(size_t width, size_t height)
+      : _width(0)
+      , _height(0)
+      , _stride(0)
+      , _capacity(0)
+      , _pAllocation(nullptr)
+      , _pPlanes(nullptr)
+    {
+        resize(width, height);
+    }
+
+
+    virtual ~PlanarImage() { std::free(_pAllocation); }
+
+
+    size_t width() const { return _width; }
+    size_t height() const { return _height; }
+
+
+    // Number of floats between the start of two consecutive rows
+    size_t stride() const { return _stride; }
+
+
+    // Stride of the rows of an image `width` pixels wide
+    static size_t strideFor(size_t width)
+    {
+        const size_t floats = alignment / sizeof(float);
+
+        return (width + floats - 1) / floats * floats;
+    }
+
+
+    // The allocation is kept when it is large enough, so an image can be
+    // reused for a sequence of images of different sizes
+    void resize(size_t width, size_t height)
+    {
+        const size_t stride = strideFor(width);
+
+        if (stride * height > _capacity) {
+            std::free(_pAllocation);
+            _pAllocation = nullptr;
+            _pPlanes     = nullptr;
+            _capacity    = 0;
+
+            _pAllocation
+                = std::malloc(3 * stride * height * sizeof(float) + alignment);
+
+            if (!_pAllocation) {
+                throw std::bad_alloc();
+            }
+
+            const uintptr_t p = reinterpret_cast<uintptr_t>(_pAllocation);
+            _pPlanes          = reinterpret_cast<float *>(
+                (p + alignment - 1) / alignment * alignment);
+            _capacity         = stride * height;
+        }
+
+        _width  = width;
+        _height = height;
+        _stride = stride;
+
+        if (_pPlanes) {
+            memset(_pPlanes, 0, 3 * _stride * _height * sizeof(float));
+        }
+    }
+
+
+    float *plane(int c) { return _pPlanes + c * _stride * _height; }
+
+    const float *plane(int c) const
+    {
+        return _pPlanes + c * _stride * _height;
+    }
+
+
+    float *row(int c, size_t y) { return plane(c) + y * _stride; }
+
+    const float *row(int c, size_t y) const { return plane(c) + y * _stride; }
+
+  protected:
+    // Uses `planes`, laid out as the planes of a `width` x `height` image
+    // (padded rows included), instead of an own allocation. The memory must
+    // outlive the image or the next resize().
+    void wrap(size_t width, size_t height, float *planes)
+    {
+        std::free(_pAllocation);
+        _pAllocation = nullptr;
+        _capacity    = 0;
+
+        _width   = width;
+        _height  = height;
+        _stride  = strideFor(width);
+        _pPlanes = planes;
+    }
+
+    size_t _width, _height;
+    size_t _stride;
+
+  private:
+    PlanarImage(const PlanarImage &) = delete;
+    PlanarImage &operator=(const PlanarImage &) = delete;
+
+    size_t _capacity;    // Floats available per plane
+    void * _pAllocation;
+    float *_pPlanes;
+};
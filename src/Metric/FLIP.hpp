@@ -0,0 +1,670 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+#include "../colortools.hpp"
+#include "../colortools_batch.hpp"
+#include "../ImageFormat/PlanarImage.hpp"
+
+// HDR-FLIP perceptual error (Andersson et al., "Visualizing Errors in
+// Rendered High Dynamic Range Images", Eurographics 2021), in [0, 1].
+//
+// Both images are tone mapped at several exposures spanning the luminances of
+// the reference, then compared by LDR-FLIP at each exposure: the error of a
+// pixel is the largest one. LDR-FLIP filters the images in YCxCz with models
+// of the contrast sensitivity of the eye, compares their colors in a Hunt
+// adjusted Lab space, and amplifies the differences of edges and points.
+//
+// All the filters are sums of separable Gaussians or Gaussian derivatives:
+// each one runs as a horizontal pass then a vertical pass, with the rows
+// split among the threads. The vertical passes go through tiles of columns
+// whose accumulators stay in registers, the rows they read staying in cache
+// from one row to the next.
+class FLIP
+{
+  public:
+    // `pixels_per_degree` is the number of pixels per degree of visual
+    // angle: 67 for a 0.7 m wide 4K monitor seen from 0.7 m
+    explicit FLIP(float pixels_per_degree)
+    {
+        // Contrast sensitivity of the achromatic, red-green and blue-yellow
+        // channels, as sums of two Gaussians: a1, b1, a2, b2
+        const float csf[3][4] = {
+            {1.f, 0.0047f, 0.f, 1e-5f},
+            {1.f, 0.0053f, 0.f, 1e-5f},
+            {34.1f, 0.04f, 13.5f, 0.025f}};
+
+        const float pi = 3.14159265358979f;
+
+        for (int c = 0; c < 3; c++) {
+            float sum_weights = 0.f;
+
+            for (int t = 0; t < 2; t++) {
+                const float a = csf[c][2 * t];
+                const float b = csf[c][2 * t + 1];
+
+                if (a == 0.f) {
+                    continue;
+                }
+
+                const float sigma = pixels_per_degree * std::sqrt(b / (2.f * pi * pi));
+                const int   r     = int(std::ceil(3.f * sigma));
+
+                Term term;
+                float sum = 0.f;
+
+                for (int x = -r; x <= r; x++) {
+                    const float d = float(x) / pixels_per_degree;
+                    term.kernel.push_back(std::exp(-pi * pi * d * d / b));
+                    sum += term.kernel.back();
+                }
+
+                for (size_t i = 0; i < term.kernel.size(); i++) {
+                    term.kernel[i] /= sum;
+                }
+
+                // Sum of the 2D filter, before normalization
+                term.weight = a * std::sqrt(pi / b) * sum * sum;
+                sum_weights += term.weight;
+
+                _csf[c].push_back(term);
+            }
+
+            for (size_t t = 0; t < _csf[c].size(); t++) {
+                _csf[c][t].weight /= sum_weights;
+            }
+        }
+
+        // Edge and point detectors: first and second derivatives of a
+        // Gaussian, their positive and negative weights summing to 1 and -1
+        const float sigma = 0.5f * 0.082f * pixels_per_degree;
+        const int   r     = int(std::ceil(3.f * sigma));
+
+        float sum_g = 0.f, sum_d = 0.f, sum_h_pos = 0.f, sum_h_neg = 0.f;
+
+        for (int x = -r; x <= r; x++) {
+            const float g = std::exp(-float(x * x) / (2.f * sigma * sigma));
+            const float d = -float(x) * g;
+            const float h = (float(x * x) / (sigma * sigma) - 1.f) * g;
+
+            _gauss.push_back(g);
+            _edge.push_back(d);
+            _point.push_back(h);
+
+            sum_g += g;
+            sum_d += std::max(0.f, d);
+            (h > 0.f ? sum_h_pos : sum_h_neg) += h;
+        }
+
+        for (size_t i = 0; i < _gauss.size(); i++) {
+            _gauss[i] /= sum_g;
+            _edge[i] /= sum_d;
+            _point[i] /= (_point[i] > 0.f) ? sum_h_pos : -sum_h_neg;
+        }
+
+        // Input of the tone mapper mapped to 0.85, the brightest exposure
+        // maps the brightest pixel of the reference there
+        const float *k = tonemapCoefs();
+        const float  t = 0.85f;
+        const float  a = k[0] - t * k[3];
+        const float  b = k[1] - t * k[4];
+        const float  c = k[2] - t * k[5];
+
+        _x_max = (-b + std::sqrt(b * b - 4.f * a * c)) / (2.f * a);
+
+        // Largest color difference: between green and blue
+        const float green[3] = {0.f, 1.f, 0.f}, blue[3] = {0.f, 0.f, 1.f};
+        float       Lab_green[3], Lab_blue[3];
+
+        huntLab(green, Lab_green);
+        huntLab(blue, Lab_blue);
+
+        _c_max = std::pow(hyAB(Lab_green, Lab_blue), colorExponent());
+    }
+
+
+    // HDR-FLIP of `test` against `reference`, linear sRGB images of the same
+    // size, to the rows of `out`, `stride` floats apart. Pixels with a NaN in
+    // either image get a NaN error.
+    void compute(
+        const PlanarImage &test,
+        const PlanarImage &reference,
+        float *            out,
+        size_t             stride) const
+    {
+        const size_t width  = test.width();
+        const size_t height = test.height();
+
+        if (width == 0 || height == 0) {
+            return;
+        }
+
+        // Exposures from the one mapping the brightest pixel of the
+        // reference to 0.85 to the one mapping its median luminance there
+        std::vector<float> luminance;
+        luminance.reserve(width * height);
+
+        for (size_t y = 0; y < height; y++) {
+            for (size_t x = 0; x < width; x++) {
+                const float rgb[3] = {
+                    reference.row(0, y)[x],
+                    reference.row(1, y)[x],
+                    reference.row(2, y)[x]};
+                float XYZ[3];
+
+                lin_rgb_to_xyz(rgb, XYZ);
+
+                if (XYZ[1] > 0.f && std::isfinite(XYZ[1])) {
+                    luminance.push_back(XYZ[1]);
+                }
+            }
+        }
+
+        float start = 0.f, stop = 0.f;
+
+        if (!luminance.empty()) {
+            const float Y_max = *std::max_element(luminance.begin(), luminance.end());
+
+            std::nth_element(
+                luminance.begin(),
+                luminance.begin() + luminance.size() / 2,
+                luminance.end());
+
+            const float Y_median = luminance[luminance.size() / 2];
+
+            start = std::log2(_x_max / Y_max);
+            stop  = std::log2(_x_max / Y_median);
+        }
+
+        const int   n_exposures = std::max(2, int(std::ceil(stop - start)));
+        const float step        = (stop - start) / float(n_exposures - 1);
+
+        // YCxCz, then filtered YCxCz, and edge and point features of both
+        // images
+        PlanarImage ycxcz_test(width, height), ycxcz_reference(width, height);
+        PlanarImage horizontal(width, height);
+
+        const size_t       plane = horizontal.stride() * height;
+        std::vector<float> features_test(2 * plane), features_reference(2 * plane);
+
+        for (int e = 0; e < n_exposures; e++) {
+            const float scale = std::exp2(start + float(e) * step);
+
+            filter(test, scale, ycxcz_test, horizontal, features_test.data());
+            filter(reference, scale, ycxcz_reference, horizontal, features_reference.data());
+
+            #pragma omp parallel
+            {
+                std::vector<float> Lab(6 * horizontal.stride());
+
+                #pragma omp for schedule(static)
+                for (long y = 0; y < long(height); y++) {
+                    const size_t i = size_t(y) * horizontal.stride();
+
+                    errorRow(
+                        ycxcz_test,
+                        ycxcz_reference,
+                        size_t(y),
+                        &features_test[i],
+                        &features_reference[i],
+                        plane,
+                        Lab.data(),
+                        out + size_t(y) * stride,
+                        e > 0);
+                }
+            }
+        }
+
+        #pragma omp parallel for schedule(static)
+        for (long y = 0; y < long(height); y++) {
+            for (size_t x = 0; x < width; x++) {
+                float sum = 0.f;
+
+                for (int c = 0; c < 3; c++) {
+                    sum += test.row(c, size_t(y))[x] + reference.row(c, size_t(y))[x];
+                }
+
+                // Infinite values give NaN too, when of opposite signs
+                if (std::isnan(sum)) {
+                    out[size_t(y) * stride + x] = std::numeric_limits<float>::quiet_NaN();
+                }
+            }
+        }
+    }
+
+  protected:
+    // Exponent of the color error
+    static float colorExponent() { return 0.7f; }
+
+
+    // ACES filmic tone mapper, the 0.6 pre-exposure of the fit cancelled
+    static const float *tonemapCoefs()
+    {
+        static const float coefs[6] = {
+            0.6f * 0.6f * 2.51f, 0.6f * 0.03f, 0.f,
+            0.6f * 0.6f * 2.43f, 0.6f * 0.59f, 0.14f};
+
+        return coefs;
+    }
+
+
+    // Same white as xyz_to_Lab()
+    static const float *white()
+    {
+        static const float XYZ[3] = {0.950489f, 1.f, 1.08840f};
+        return XYZ;
+    }
+
+
+    // Normalized Gaussian, with its weight in the 2D filter
+    struct Term
+    {
+        float              weight;
+        std::vector<float> kernel;
+    };
+
+
+    static float tonemap(float x)
+    {
+        // Also maps NaN to 0
+        if (!(x > 0.f)) {
+            return 0.f;
+        }
+
+        // Keeps x * x finite
+        x = std::min(x, 1e18f);
+
+        const float *k = tonemapCoefs();
+        const float  v = (k[0] * x * x + k[1] * x + k[2]) / (k[3] * x * x + k[4] * x + k[5]);
+
+        return std::min(v, 1.f);
+    }
+
+
+    // Linear sRGB in [0, 1] to Lab, the chroma scaled by the lightness
+    static void huntLab(const float rgb[3], float Lab[3])
+    {
+        float XYZ[3];
+
+        lin_rgb_to_xyz(rgb, XYZ);
+        xyz_to_Lab(XYZ, Lab);
+
+        Lab[1] *= 0.01f * Lab[0];
+        Lab[2] *= 0.01f * Lab[0];
+    }
+
+
+    static float hyAB(const float Lab_1[3], const float Lab_2[3])
+    {
+        const float da = Lab_1[1] - Lab_2[1];
+        const float db = Lab_1[2] - Lab_2[2];
+
+        return std::abs(Lab_1[0] - Lab_2[0]) + std::sqrt(da * da + db * db);
+    }
+
+
+    // Tone maps `rgb` exposed by `scale` to YCxCz in `ycxcz`, computes its
+    // edge and point features, two planes of `features`, then filters
+    // `ycxcz` in place. `horizontal` holds the horizontal passes.
+    void filter(
+        const PlanarImage &rgb,
+        float              scale,
+        PlanarImage &      ycxcz,
+        PlanarImage &      horizontal,
+        float *            features) const
+    {
+        const size_t width  = rgb.width();
+        const size_t height = rgb.height();
+        const size_t stride = ycxcz.stride();
+
+        #pragma omp parallel for schedule(static)
+        for (long y = 0; y < long(height); y++) {
+            for (size_t x = 0; x < width; x++) {
+                float tm[3], XYZ[3];
+
+                for (int c = 0; c < 3; c++) {
+                    tm[c] = tonemap(scale * rgb.row(c, size_t(y))[x]);
+                }
+
+                lin_rgb_to_xyz(tm, XYZ);
+
+                const float Y = XYZ[1] / white()[1];
+
+                ycxcz.row(0, size_t(y))[x] = 116.f * Y - 16.f;
+                ycxcz.row(1, size_t(y))[x] = 500.f * (XYZ[0] / white()[0] - Y);
+                ycxcz.row(2, size_t(y))[x] = 200.f * (Y - XYZ[2] / white()[2]);
+            }
+        }
+
+        // Features of the normalized luminance (Y' + 16) / 116: the filters
+        // sum to 0 but the Gaussian, so the offset vanishes and the scale is
+        // folded in the horizontal passes
+        std::vector<float> gauss(_gauss), edge(_edge), point(_point);
+
+        for (size_t i = 0; i < gauss.size(); i++) {
+            gauss[i] /= 116.f;
+            edge[i] /= 116.f;
+            point[i] /= 116.f;
+        }
+
+        convolveRows(ycxcz.plane(0), horizontal.plane(0), width, height, stride, gauss);
+        convolveRows(ycxcz.plane(0), horizontal.plane(1), width, height, stride, edge);
+        convolveRows(ycxcz.plane(0), horizontal.plane(2), width, height, stride, point);
+
+        detectFeatures(horizontal, features);
+
+        // Contrast sensitivity filters: all the horizontal passes of a
+        // channel are done before it is overwritten
+        for (int c = 0; c < 3; c++) {
+            for (size_t t = 0; t < _csf[c].size(); t++) {
+                convolveRows(
+                    ycxcz.plane(c),
+                    horizontal.plane(int(t)),
+                    width,
+                    height,
+                    stride,
+                    _csf[c][t].kernel);
+            }
+
+            for (size_t t = 0; t < _csf[c].size(); t++) {
+                convolveColumns(
+                    horizontal.plane(int(t)),
+                    ycxcz.plane(c),
+                    width,
+                    height,
+                    stride,
+                    _csf[c][t].kernel,
+                    _csf[c][t].weight,
+                    t > 0);
+            }
+        }
+    }
+
+
+    // Convolves each row of `in` with `kernel`, centered, the borders being
+    // extended
+    static void convolveRows(
+        const float *             in,
+        float *                   out,
+        size_t                    width,
+        size_t                    height,
+        size_t                    stride,
+        const std::vector<float> &kernel)
+    {
+        const size_t r = kernel.size() / 2;
+
+        #pragma omp parallel
+        {
+            std::vector<float> padded(width + 2 * r);
+
+            #pragma omp for schedule(static)
+            for (long y = 0; y < long(height); y++) {
+                const float *src = in + size_t(y) * stride;
+                float *      dst = out + size_t(y) * stride;
+
+                std::fill(padded.begin(), padded.begin() + r, src[0]);
+                std::copy(src, src + width, padded.begin() + r);
+                std::fill(padded.begin() + r + width, padded.end(), src[width - 1]);
+
+                std::fill(dst, dst + width, 0.f);
+
+                for (size_t k = 0; k < kernel.size(); k++) {
+                    const float  w = kernel[k];
+                    const float *p = &padded[k];
+
+                    for (size_t x = 0; x < width; x++) {
+                        dst[x] += w * p[x];
+                    }
+                }
+            }
+        }
+    }
+
+
+    // Columns processed at once by the vertical passes: their accumulators
+    // stay in registers
+    static const size_t column_tile = 16;
+
+
+    // Rows read by the vertical pass of a kernel of radius `r` for the row
+    // `y`, the borders being extended
+    static void rowsAround(
+        const float *        in,
+        long                 y,
+        long                 r,
+        size_t               height,
+        size_t               stride,
+        const float **       rows)
+    {
+        for (long k = -r; k <= r; k++) {
+            const long y_k = std::min(std::max(y + k, 0L), long(height) - 1);
+            rows[k + r]    = in + size_t(y_k) * stride;
+        }
+    }
+
+
+    // Convolves each column of `in` with `kernel`, centered, the borders
+    // being extended, and writes the result times `weight` to `out`, or adds
+    // it with `accumulate`. Rows are padded, so whole tiles are processed.
+    static void convolveColumns(
+        const float *             in,
+        float *                   out,
+        size_t                    width,
+        size_t                    height,
+        size_t                    stride,
+        const std::vector<float> &kernel,
+        float                     weight,
+        bool                      accumulate)
+    {
+        const long r = long(kernel.size() / 2);
+
+        #pragma omp parallel
+        {
+            std::vector<const float *> rows(kernel.size());
+
+            #pragma omp for schedule(static)
+            for (long y = 0; y < long(height); y++) {
+                rowsAround(in, y, r, height, stride, rows.data());
+
+                float *dst = out + size_t(y) * stride;
+
+                for (size_t x_0 = 0; x_0 < width; x_0 += column_tile) {
+                    float acc[column_tile] = {};
+
+                    for (size_t k = 0; k < kernel.size(); k++) {
+                        const float  w = kernel[k];
+                        const float *p = rows[k] + x_0;
+
+                        for (size_t x = 0; x < column_tile; x++) {
+                            acc[x] += w * p[x];
+                        }
+                    }
+
+                    for (size_t x = 0; x < column_tile; x++) {
+                        dst[x_0 + x] = (accumulate ? dst[x_0 + x] : 0.f) + weight * acc[x];
+                    }
+                }
+            }
+        }
+    }
+
+
+    // Vertical passes of the feature detectors, from the horizontal passes
+    // of the Gaussian, edge and point filters in the planes of `horizontal`.
+    // Writes the edge magnitudes to the first plane of `features`, the point
+    // magnitudes to the second one.
+    void detectFeatures(const PlanarImage &horizontal, float *features) const
+    {
+        const size_t width  = horizontal.width();
+        const size_t height = horizontal.height();
+        const size_t stride = horizontal.stride();
+        const long   r      = long(_gauss.size() / 2);
+
+        #pragma omp parallel
+        {
+            std::vector<const float *> rows(3 * _gauss.size());
+
+            const float **h_gauss = &rows[0];
+            const float **h_edge  = &rows[_gauss.size()];
+            const float **h_point = &rows[2 * _gauss.size()];
+
+            #pragma omp for schedule(static)
+            for (long y = 0; y < long(height); y++) {
+                rowsAround(horizontal.plane(0), y, r, height, stride, h_gauss);
+                rowsAround(horizontal.plane(1), y, r, height, stride, h_edge);
+                rowsAround(horizontal.plane(2), y, r, height, stride, h_point);
+
+                float *edges  = features + size_t(y) * stride;
+                float *points = edges + stride * height;
+
+                for (size_t x_0 = 0; x_0 < width; x_0 += column_tile) {
+                    float edge_x[column_tile] = {}, edge_y[column_tile] = {};
+                    float point_x[column_tile] = {}, point_y[column_tile] = {};
+
+                    for (size_t k = 0; k < _gauss.size(); k++) {
+                        const float g = _gauss[k];
+                        const float d = _edge[k];
+                        const float h = _point[k];
+
+                        for (size_t x = 0; x < column_tile; x++) {
+                            edge_x[x] += g * h_edge[k][x_0 + x];
+                            edge_y[x] += d * h_gauss[k][x_0 + x];
+                            point_x[x] += g * h_point[k][x_0 + x];
+                            point_y[x] += h * h_gauss[k][x_0 + x];
+                        }
+                    }
+
+                    for (size_t x = 0; x < column_tile; x++) {
+                        edges[x_0 + x]  = std::sqrt(edge_x[x] * edge_x[x] + edge_y[x] * edge_y[x]);
+                        points[x_0 + x] = std::sqrt(point_x[x] * point_x[x] + point_y[x] * point_y[x]);
+                    }
+                }
+            }
+        }
+    }
+
+
+    // LDR-FLIP of the row `y` from the filtered images and their features,
+    // the point features being `plane` floats after the edge features. The
+    // errors are written to `out`, or kept where larger with `accumulate`.
+    // `Lab` holds 6 rows.
+    void errorRow(
+        const PlanarImage &test,
+        const PlanarImage &reference,
+        size_t             y,
+        const float *      features_test,
+        const float *      features_reference,
+        size_t             plane,
+        float *            Lab,
+        float *            out,
+        bool               accumulate) const
+    {
+        const size_t width  = test.width();
+        const size_t stride = test.stride();
+
+        for (int i = 0; i < 2; i++) {
+            const PlanarImage &image = i ? reference : test;
+            float *            L     = Lab + 3 * i * stride;
+            float *            a     = L + stride;
+            float *            b     = a + stride;
+
+            // Filtered YCxCz back to linear sRGB, which the filters may have
+            // moved out of [0, 1], then to XYZ
+            for (size_t x = 0; x < width; x++) {
+                const float Y = (image.row(0, y)[x] + 16.f) / 116.f;
+
+                const float XYZ[3] = {
+                    (image.row(1, y)[x] / 500.f + Y) * white()[0],
+                    Y * white()[1],
+                    (Y - image.row(2, y)[x] / 200.f) * white()[2]};
+
+                float rgb[3], XYZ_clamped[3];
+                xyz_to_lin_rgb(XYZ, rgb);
+
+                for (int c = 0; c < 3; c++) {
+                    rgb[c] = std::min(std::max(rgb[c], 0.f), 1.f);
+                }
+
+                lin_rgb_to_xyz(rgb, XYZ_clamped);
+
+                L[x] = XYZ_clamped[0];
+                a[x] = XYZ_clamped[1];
+                b[x] = XYZ_clamped[2];
+            }
+
+            xyz_to_Lab_batch(L, a, b, L, a, b, width);
+        }
+
+        // Color error, mapped so 0.4 times the largest one gives 0.95
+        const float p_c = 0.4f;
+        const float p_t = 0.95f;
+
+        for (size_t x = 0; x < width; x++) {
+            float Lab_hunt[2][3];
+
+            for (int i = 0; i < 2; i++) {
+                const float L = Lab[3 * i * stride + x];
+
+                Lab_hunt[i][0] = L;
+                Lab_hunt[i][1] = 0.01f * L * Lab[(3 * i + 1) * stride + x];
+                Lab_hunt[i][2] = 0.01f * L * Lab[(3 * i + 2) * stride + x];
+            }
+
+            float delta_c = std::pow(hyAB(Lab_hunt[0], Lab_hunt[1]), colorExponent());
+
+            if (delta_c < p_c * _c_max) {
+                delta_c *= p_t / (p_c * _c_max);
+            } else {
+                delta_c = p_t + (delta_c - p_c * _c_max) / (_c_max - p_c * _c_max) * (1.f - p_t);
+            }
+
+            // Feature error, with an exponent of 0.5
+            const float delta_edge  = std::abs(features_test[x] - features_reference[x]);
+            const float delta_point = std::abs(features_test[plane + x] - features_reference[plane + x]);
+            const float delta_f
+                = std::sqrt(std::max(delta_edge, delta_point) / std::sqrt(2.f));
+
+            const float v = std::pow(delta_c, 1.f - delta_f);
+
+            out[x] = accumulate ? std::max(out[x], v) : v;
+        }
+    }
+
+
+    std::vector<Term>  _csf[3];    // Per YCxCz channel
+    std::vector<float> _gauss, _edge, _point;
+    float              _x_max;
+    float              _c_max;
+};
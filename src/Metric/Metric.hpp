@@ -0,0 +1,297 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+#include "../colortools.hpp"
+#include "../colortools_batch.hpp"
+#include "../ImageFormat/PlanarImage.hpp"
+#include "FLIP.hpp"
+#include "SSIM.hpp"
+
+// Color spaces the metrics are computed in. The files are decoded to Lab
+// when only Lab is needed, to XYZ otherwise.
+enum MetricSpace
+{
+    METRIC_LAB   = 1,
+    METRIC_RGB   = 2,    // Linear sRGB, exposure included
+    METRIC_ICTCP = 4
+};
+
+
+// Rows of the pixels of both files, in each color space needed. The second
+// file is the reference.
+struct MetricRows
+{
+    const float *Lab_1[3], *Lab_2[3];
+    const float *RGB_1[3], *RGB_2[3];
+    const float *ICtCp_1[3], *ICtCp_2[3];
+};
+
+
+// Whole images of both files, in each color space needed by the metrics
+// computed on images
+struct MetricImages
+{
+    const PlanarImage *Lab_1, *Lab_2;
+    const PlanarImage *RGB_1, *RGB_2;
+};
+
+
+// Viewing conditions and windows of the metrics
+struct MetricParameters
+{
+    float  white_luminance;      // Of a pixel of luminance 1, in cd/m2
+    float  pixels_per_degree;    // Of visual angle
+    size_t ssim_window;          // Width of the SSIM windows, odd
+};
+
+
+// Computes the metric of `n` pixels
+typedef void (*MetricKernel)(const MetricRows &rows, float *out, size_t n);
+
+
+// Computes a metric depending on the neighborhood of the pixels from the
+// whole images, to the rows of `out`, `stride` floats apart
+typedef void (*MetricImageKernel)(
+    const MetricImages &    images,
+    const MetricParameters &parameters,
+    float *                 out,
+    size_t                  stride);
+
+
+// A metric selectable from the command line, with either a row kernel or an
+// image kernel
+struct Metric
+{
+    const char *      name;
+    const char *      description;
+    int               spaces;    // MetricSpace flags
+    MetricKernel      kernel;
+    MetricImageKernel image_kernel;
+    bool              mse;     // Squared error, summarized as a PSNR
+    bool              unit;    // Values in [0, 1]
+};
+
+
+// Per pixel metrics: the row kernel is specialized for each of them, so the
+// pixel function is inlined in the loop
+namespace metrics
+{
+struct DeltaE76
+{
+    static float pixel(const MetricRows &r, size_t i)
+    {
+        const float Lab_1[3] = {r.Lab_1[0][i], r.Lab_1[1][i], r.Lab_1[2][i]};
+        const float Lab_2[3] = {r.Lab_2[0][i], r.Lab_2[1][i], r.Lab_2[2][i]};
+
+        return deltaE76(Lab_1, Lab_2);
+    }
+};
+
+
+struct DeltaE94
+{
+    static float pixel(const MetricRows &r, size_t i)
+    {
+        const float Lab_1[3] = {r.Lab_1[0][i], r.Lab_1[1][i], r.Lab_1[2][i]};
+        const float Lab_2[3] = {r.Lab_2[0][i], r.Lab_2[1][i], r.Lab_2[2][i]};
+
+        return deltaE94(Lab_1, Lab_2);
+    }
+};
+
+
+struct DeltaITP
+{
+    static float pixel(const MetricRows &r, size_t i)
+    {
+        const float ICtCp_1[3] = {r.ICtCp_1[0][i], r.ICtCp_1[1][i], r.ICtCp_1[2][i]};
+        const float ICtCp_2[3] = {r.ICtCp_2[0][i], r.ICtCp_2[1][i], r.ICtCp_2[2][i]};
+
+        return deltaITP(ICtCp_1, ICtCp_2);
+    }
+};
+
+
+// Mean of the absolute differences of the channels
+struct AbsError
+{
+    static float pixel(const MetricRows &r, size_t i)
+    {
+        float sum = 0.f;
+
+        for (int c = 0; c < 3; c++) {
+            sum += std::abs(r.RGB_1[c][i] - r.RGB_2[c][i]);
+        }
+
+        return sum / 3.f;
+    }
+};
+
+
+// Mean of the absolute differences of the channels relative to the
+// reference, offset so black pixels do not give infinite errors
+struct RelError
+{
+    static float pixel(const MetricRows &r, size_t i)
+    {
+        float sum = 0.f;
+
+        for (int c = 0; c < 3; c++) {
+            sum += std::abs(r.RGB_1[c][i] - r.RGB_2[c][i])
+                   / (std::abs(r.RGB_2[c][i]) + 0.01f);
+        }
+
+        return sum / 3.f;
+    }
+};
+
+
+// Mean of the squared differences of the channels
+struct SquaredError
+{
+    static float pixel(const MetricRows &r, size_t i)
+    {
+        float sum = 0.f;
+
+        for (int c = 0; c < 3; c++) {
+            const float d = r.RGB_1[c][i] - r.RGB_2[c][i];
+            sum += d * d;
+        }
+
+        return sum / 3.f;
+    }
+};
+
+
+struct RootSquaredError
+{
+    static float pixel(const MetricRows &r, size_t i)
+    {
+        return std::sqrt(SquaredError::pixel(r, i));
+    }
+};
+
+
+template<class Pixel>
+void row(const MetricRows &rows, float *out, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        out[i] = Pixel::pixel(rows, i);
+    }
+}
+
+
+// HDR-FLIP, the second image being the reference
+inline void flip_image(
+    const MetricImages &    images,
+    const MetricParameters &parameters,
+    float *                 out,
+    size_t                  stride)
+{
+    FLIP(parameters.pixels_per_degree).compute(*images.RGB_1, *images.RGB_2, out, stride);
+}
+
+
+// SSIM of the lightness L*, from 0 to 100
+inline void ssim_image(
+    const MetricImages &    images,
+    const MetricParameters &parameters,
+    float *                 out,
+    size_t                  stride)
+{
+    const PlanarImage &Lab_1 = *images.Lab_1;
+
+    SSIM(parameters.ssim_window, 100.f)
+        .compute(
+            Lab_1.plane(0),
+            images.Lab_2->plane(0),
+            Lab_1.width(),
+            Lab_1.height(),
+            Lab_1.stride(),
+            out,
+            stride);
+}
+
+
+inline void ms_ssim_image(
+    const MetricImages &    images,
+    const MetricParameters &parameters,
+    float *                 out,
+    size_t                  stride)
+{
+    const PlanarImage &Lab_1 = *images.Lab_1;
+
+    SSIM(parameters.ssim_window, 100.f)
+        .computeMultiScale(
+            Lab_1.plane(0),
+            images.Lab_2->plane(0),
+            Lab_1.width(),
+            Lab_1.height(),
+            Lab_1.stride(),
+            out,
+            stride);
+}
+
+
+// Delta E 2000 has its own vectorized kernel
+inline void deltaE2000_row(const MetricRows &r, float *out, size_t n)
+{
+    deltaE2000_batch(
+        r.Lab_1[0], r.Lab_1[1], r.Lab_1[2],
+        r.Lab_2[0], r.Lab_2[1], r.Lab_2[2],
+        out,
+        n);
+}
+}    // namespace metrics
+
+
+// All the metrics, the first one being the default
+inline const Metric *metric_list(size_t &count)
+{
+    static const Metric list[] = {
+        {"de2000", "CIE Delta E 2000", METRIC_LAB, metrics::deltaE2000_row, nullptr, false, false},
+        {"de76", "CIE Delta E 1976", METRIC_LAB, metrics::row<metrics::DeltaE76>, nullptr, false, false},
+        {"de94", "CIE Delta E 1994", METRIC_LAB, metrics::row<metrics::DeltaE94>, nullptr, false, false},
+        {"itp", "Delta ITP (ITU-R BT.2124)", METRIC_ICTCP, metrics::row<metrics::DeltaITP>, nullptr, false, false},
+        {"abs", "Absolute error of linear RGB", METRIC_RGB, metrics::row<metrics::AbsError>, nullptr, false, false},
+        {"rel", "Relative error of linear RGB", METRIC_RGB, metrics::row<metrics::RelError>, nullptr, false, false},
+        {"rmse", "Root mean squared error of linear RGB", METRIC_RGB, metrics::row<metrics::RootSquaredError>, nullptr, false, false},
+        {"psnr", "Squared error of linear RGB, summarized as a PSNR", METRIC_RGB, metrics::row<metrics::SquaredError>, nullptr, true, false},
+        {"flip", "HDR-FLIP perceptual error", METRIC_RGB, nullptr, metrics::flip_image, false, true},
+        {"ssim", "1 - SSIM of L*", METRIC_LAB, nullptr, metrics::ssim_image, false, true},
+        {"msssim", "1 - MS-SSIM of L*", METRIC_LAB, nullptr, metrics::ms_ssim_image, false, true}};
+
+    count = sizeof(list) / sizeof(list[0]);
+
+    return list;
+}
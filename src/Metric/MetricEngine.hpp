@@ -0,0 +1,334 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../colortools.hpp"
+#include "../colortools_batch.hpp"
+#include "Metric.hpp"
+
+// Computes the selected metrics from the decoded rows of both files in a
+// single pass: each color space needed is converted once per row, then each
+// metric writes its own row of values.
+//
+// The files are decoded to Lab when all the metrics are computed in Lab, to
+// XYZ otherwise: see needsXYZ().
+//
+// Metrics depending on the neighborhood of the pixels, like FLIP, are
+// computed on the whole images instead: see computeImages().
+class MetricEngine
+{
+  public:
+    // `names` are metric names, see metric_list()
+    MetricEngine(const std::vector<std::string> &names, const MetricParameters &parameters)
+      : _parameters(parameters)
+      , _spaces(0)
+      , _spatial(false)
+    {
+        size_t        count;
+        const Metric *list = metric_list(count);
+
+        for (size_t i = 0; i < names.size(); i++) {
+            const Metric *metric = nullptr;
+
+            for (size_t m = 0; m < count; m++) {
+                if (names[i] == list[m].name) {
+                    metric = &list[m];
+                }
+            }
+
+            if (!metric) {
+                throw std::runtime_error("Unknown metric: " + names[i]);
+            }
+
+            _metrics.push_back(metric);
+            _spaces |= metric->spaces;
+            _spatial = _spatial || metric->image_kernel;
+        }
+
+        if (_metrics.empty()) {
+            throw std::runtime_error("No metric selected");
+        }
+    }
+
+
+    // Metric names separated by commas
+    static std::vector<std::string> parse(const std::string &list)
+    {
+        std::vector<std::string> names;
+        std::stringstream        in(list);
+        std::string              name;
+
+        while (std::getline(in, name, ',')) {
+            names.push_back(name);
+        }
+
+        return names;
+    }
+
+
+    size_t size() const { return _metrics.size(); }
+
+    const Metric &metric(size_t i) const { return *_metrics[i]; }
+
+
+    // Whether the files must be decoded to XYZ instead of Lab
+    bool needsXYZ() const { return (_spaces & ~METRIC_LAB) != 0; }
+
+
+    // Whether some metrics need the whole images, see computeImages()
+    bool spatial() const { return _spatial; }
+
+
+    // Rows converted from XYZ, one set per thread
+    class Scratch
+    {
+      public:
+        Scratch(const MetricEngine &engine, size_t width)
+          : _width(width)
+        {
+            const int spaces = engine.needsXYZ() ? engine._spaces : 0;
+            size_t    n_rows = 0;
+
+            for (int s = METRIC_LAB; s <= METRIC_ICTCP; s <<= 1) {
+                n_rows += (spaces & s) ? 6 : 0;
+            }
+
+            _data.resize(n_rows * width);
+        }
+
+      private:
+        // The 3 rows of each file starting at the row `r` of the scratch
+        void rows(size_t r, float *rows_1[3], float *rows_2[3])
+        {
+            for (int c = 0; c < 3; c++) {
+                rows_1[c] = &_data[(r + c) * _width];
+                rows_2[c] = &_data[(r + 3 + c) * _width];
+            }
+        }
+
+
+        std::vector<float> _data;
+        size_t             _width;
+
+        friend class MetricEngine;
+    };
+
+
+    // Computes the metrics of `n` pixels whose channels are `px_1` and
+    // `px_2` (Lab, or XYZ if needsXYZ()) to `out`, one row per metric
+    void computeRow(
+        Scratch &          scratch,
+        const float *const px_1[3],
+        const float *const px_2[3],
+        size_t             n,
+        float *const *     out) const
+    {
+        MetricRows rows;
+
+        for (int c = 0; c < 3; c++) {
+            rows.Lab_1[c] = px_1[c];
+            rows.Lab_2[c] = px_2[c];
+        }
+
+        if (needsXYZ()) {
+            const float luminance = _parameters.white_luminance;
+            size_t      r         = 0;
+
+            if (_spaces & METRIC_LAB) {
+                float *Lab_1[3], *Lab_2[3];
+                scratch.rows(r, Lab_1, Lab_2);
+                r += 6;
+
+                xyz_to_Lab_batch(px_1[0], px_1[1], px_1[2], Lab_1[0], Lab_1[1], Lab_1[2], n);
+                xyz_to_Lab_batch(px_2[0], px_2[1], px_2[2], Lab_2[0], Lab_2[1], Lab_2[2], n);
+
+                setRows(rows.Lab_1, rows.Lab_2, Lab_1, Lab_2);
+            }
+
+            if (_spaces & METRIC_RGB) {
+                float *RGB_1[3], *RGB_2[3];
+                scratch.rows(r, RGB_1, RGB_2);
+                r += 6;
+
+                auto to_rgb = [](const float XYZ[3], float RGB[3]) {
+                    xyz_to_lin_rgb(XYZ, RGB);
+                };
+
+                convert(px_1, RGB_1, n, to_rgb);
+                convert(px_2, RGB_2, n, to_rgb);
+
+                setRows(rows.RGB_1, rows.RGB_2, RGB_1, RGB_2);
+            }
+
+            if (_spaces & METRIC_ICTCP) {
+                float *ICtCp_1[3], *ICtCp_2[3];
+                scratch.rows(r, ICtCp_1, ICtCp_2);
+
+                auto to_ICtCp = [luminance](const float XYZ[3], float ICtCp[3]) {
+                    xyz_to_ICtCp(XYZ, luminance, ICtCp);
+                };
+
+                convert(px_1, ICtCp_1, n, to_ICtCp);
+                convert(px_2, ICtCp_2, n, to_ICtCp);
+
+                setRows(rows.ICtCp_1, rows.ICtCp_2, ICtCp_1, ICtCp_2);
+            }
+        }
+
+        for (size_t m = 0; m < _metrics.size(); m++) {
+            if (_metrics[m]->kernel) {
+                _metrics[m]->kernel(rows, out[m], n);
+            }
+        }
+    }
+
+
+    // Computes the metrics needing the whole images from `px_1` and `px_2`
+    // (Lab, or XYZ if needsXYZ()) to the rows of out[m], `stride` floats
+    // apart, for each of them. The rows of the other metrics are computed by
+    // computeRow().
+    void computeImages(
+        const PlanarImage &px_1,
+        const PlanarImage &px_2,
+        float *const *     out,
+        size_t             stride) const
+    {
+        // Color spaces needed by the metrics on images
+        int spaces = 0;
+
+        for (size_t m = 0; m < _metrics.size(); m++) {
+            if (_metrics[m]->image_kernel) {
+                spaces |= _metrics[m]->spaces;
+            }
+        }
+
+        const size_t width  = px_1.width();
+        const size_t height = px_1.height();
+
+        // Lab then RGB images of both files, converted from XYZ when needed
+        std::unique_ptr<PlanarImage> converted[4];
+        MetricImages                 images = {&px_1, &px_2, nullptr, nullptr};
+
+        if ((spaces & METRIC_LAB) && needsXYZ()) {
+            converted[0].reset(new PlanarImage(width, height));
+            converted[1].reset(new PlanarImage(width, height));
+            images.Lab_1 = converted[0].get();
+            images.Lab_2 = converted[1].get();
+        }
+
+        if (spaces & METRIC_RGB) {
+            converted[2].reset(new PlanarImage(width, height));
+            converted[3].reset(new PlanarImage(width, height));
+            images.RGB_1 = converted[2].get();
+            images.RGB_2 = converted[3].get();
+        }
+
+        auto to_rgb = [](const float XYZ[3], float RGB[3]) {
+            xyz_to_lin_rgb(XYZ, RGB);
+        };
+
+        #pragma omp parallel for schedule(static)
+        for (long y = 0; y < long(height); y++) {
+            for (int i = 0; i < 2; i++) {
+                const PlanarImage &XYZ = i ? px_2 : px_1;
+
+                const float *const src[3] = {
+                    XYZ.row(0, size_t(y)), XYZ.row(1, size_t(y)), XYZ.row(2, size_t(y))};
+
+                if (converted[i]) {
+                    PlanarImage &Lab = *converted[i];
+
+                    xyz_to_Lab_batch(
+                        src[0], src[1], src[2],
+                        Lab.row(0, size_t(y)), Lab.row(1, size_t(y)), Lab.row(2, size_t(y)),
+                        width);
+                }
+
+                if (converted[2 + i]) {
+                    PlanarImage &RGB = *converted[2 + i];
+
+                    float *const dst[3] = {
+                        RGB.row(0, size_t(y)), RGB.row(1, size_t(y)), RGB.row(2, size_t(y))};
+
+                    convert(src, dst, width, to_rgb);
+                }
+            }
+        }
+
+        for (size_t m = 0; m < _metrics.size(); m++) {
+            if (_metrics[m]->image_kernel) {
+                _metrics[m]->image_kernel(images, _parameters, out[m], stride);
+            }
+        }
+    }
+
+  private:
+    static void setRows(
+        const float *rows_1[3],
+        const float *rows_2[3],
+        float *const values_1[3],
+        float *const values_2[3])
+    {
+        for (int c = 0; c < 3; c++) {
+            rows_1[c] = values_1[c];
+            rows_2[c] = values_2[c];
+        }
+    }
+
+
+    // Converts `n` pixels from XYZ with `fn(XYZ, out)`
+    template<class Fn>
+    static void convert(
+        const float *const XYZ[3], float *const out[3], size_t n, Fn fn)
+    {
+        for (size_t i = 0; i < n; i++) {
+            const float px[3] = {XYZ[0][i], XYZ[1][i], XYZ[2][i]};
+            float       v[3];
+
+            fn(px, v);
+
+            out[0][i] = v[0];
+            out[1][i] = v[1];
+            out[2][i] = v[2];
+        }
+    }
+
+
+    std::vector<const Metric *> _metrics;
+    MetricParameters            _parameters;
+    int                         _spaces;
+    bool                        _spatial;    // Some metrics need whole images
+};
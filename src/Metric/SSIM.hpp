@@ -0,0 +1,333 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#ifdef _OPENMP
+#    include <omp.h>
+#endif
+
+// Structural similarity (Wang et al., "Image Quality Assessment: From Error
+// Visibility to Structural Similarity", 2004) and its multi-scale version
+// (Wang et al., "Multi-Scale Structural Similarity for Image Quality
+// Assessment", 2003) of single channel images, L* in this tool.
+//
+// Means, variances and covariances come from square windows, truncated at
+// the borders, summed by running sums: a horizontal pass on each row, then a
+// vertical pass on bands of rows, one per thread. The cost per pixel does not
+// depend on the window size.
+//
+// The maps hold 1 - SSIM, so they read as differences: 0 for identical
+// images.
+class SSIM
+{
+  public:
+    // `window` is the width of the windows, odd. `range` is the dynamic range
+    // of the values, 100 for L*.
+    SSIM(size_t window, float range)
+      : _radius(window / 2)
+      , _C1((0.01f * range) * (0.01f * range))
+      , _C2((0.03f * range) * (0.03f * range))
+    {}
+
+
+    // 1 - SSIM of `a` against `b`, `width` x `height` images with rows
+    // `stride` floats apart, to the rows of `out`, `out_stride` floats apart
+    void compute(
+        const float *a,
+        const float *b,
+        size_t       width,
+        size_t       height,
+        size_t       stride,
+        float *      out,
+        size_t       out_stride) const
+    {
+        std::vector<float> l(width * height), cs(width * height);
+
+        terms(a, b, width, height, stride, l.data(), cs.data());
+
+        #pragma omp parallel for schedule(static)
+        for (long y = 0; y < long(height); y++) {
+            for (size_t x = 0; x < width; x++) {
+                const size_t i = size_t(y) * width + x;
+
+                out[size_t(y) * out_stride + x] = 1.f - l[i] * cs[i];
+            }
+        }
+    }
+
+
+    // 1 - MS-SSIM, over up to 5 scales, each half the size of the previous
+    // one. The map combines, for each pixel, the contrast and structure
+    // terms of the pixels covering it at each scale and the luminance term
+    // at the coarsest scale. Scales smaller than a window are skipped, the
+    // weights of the others being normalized.
+    void computeMultiScale(
+        const float *a,
+        const float *b,
+        size_t       width,
+        size_t       height,
+        size_t       stride,
+        float *      out,
+        size_t       out_stride) const
+    {
+        const float weights[5] = {0.0448f, 0.2856f, 0.3001f, 0.2363f, 0.1333f};
+
+        // Sizes of the scales
+        std::vector<size_t> widths(1, width), heights(1, height);
+
+        while (   widths.size() < 5
+               && std::min(widths.back(), heights.back()) / 2 >= 2 * _radius + 1) {
+            widths.push_back(widths.back() / 2);
+            heights.push_back(heights.back() / 2);
+        }
+
+        const size_t n_scales = widths.size();
+        float        sum_weights = 0.f;
+
+        for (size_t s = 0; s < n_scales; s++) {
+            sum_weights += weights[s];
+        }
+
+        // Images of the current scale, then their terms
+        std::vector<float>              scale_a(a, a + stride * height);
+        std::vector<float>              scale_b(b, b + stride * height);
+        size_t                          scale_stride = stride;
+        std::vector<std::vector<float>> cs(n_scales);
+        std::vector<float>              l;
+
+        for (size_t s = 0; s < n_scales; s++) {
+            const size_t w = widths[s], h = heights[s];
+
+            if (s > 0) {
+                downsample(scale_a, w, h, scale_stride);
+                downsample(scale_b, w, h, scale_stride);
+                scale_stride = w;
+            }
+
+            cs[s].resize(w * h);
+
+            if (s + 1 == n_scales) {
+                l.resize(w * h);
+            }
+
+            terms(
+                scale_a.data(),
+                scale_b.data(),
+                w,
+                h,
+                scale_stride,
+                (s + 1 == n_scales) ? l.data() : nullptr,
+                cs[s].data());
+        }
+
+        #pragma omp parallel for schedule(static)
+        for (long y = 0; y < long(height); y++) {
+            for (size_t x = 0; x < width; x++) {
+                float ms_ssim = 1.f;
+
+                for (size_t s = 0; s < n_scales; s++) {
+                    // Pixel covering (x, y) at this scale
+                    const size_t x_s = std::min(x >> s, widths[s] - 1);
+                    const size_t y_s = std::min(size_t(y) >> s, heights[s] - 1);
+                    const size_t i   = y_s * widths[s] + x_s;
+
+                    float v = std::max(0.f, cs[s][i]);
+
+                    if (s + 1 == n_scales) {
+                        v *= std::max(0.f, l[i]);
+                    }
+
+                    ms_ssim *= std::pow(v, weights[s] / sum_weights);
+                }
+
+                out[size_t(y) * out_stride + x] = 1.f - ms_ssim;
+            }
+        }
+    }
+
+  protected:
+    // Luminance term `l`, if not null, and contrast and structure term `cs`
+    // of each pixel, `width` floats per row
+    void terms(
+        const float *a,
+        const float *b,
+        size_t       width,
+        size_t       height,
+        size_t       stride,
+        float *      l,
+        float *      cs) const
+    {
+        // Horizontal sums of a, b, a^2, b^2 and ab over the windows
+        std::vector<float> sums(5 * width * height);
+        const size_t       plane = width * height;
+
+        #pragma omp parallel for schedule(static)
+        for (long y = 0; y < long(height); y++) {
+            const float *row_a = a + size_t(y) * stride;
+            const float *row_b = b + size_t(y) * stride;
+            double       acc[5] = {0., 0., 0., 0., 0.};
+
+            // Window of the pixel x is [x - r, x + r]: pixels enter at x + r
+            // and leave at x - r - 1
+            for (size_t x = 0; x < width + _radius; x++) {
+                if (x < width) {
+                    add(acc, row_a[x], row_b[x], 1.);
+                }
+
+                if (x >= 2 * _radius + 1) {
+                    add(acc, row_a[x - 2 * _radius - 1], row_b[x - 2 * _radius - 1], -1.);
+                }
+
+                if (x >= _radius) {
+                    float *dst = &sums[size_t(y) * width + x - _radius];
+
+                    for (int q = 0; q < 5; q++) {
+                        dst[q * plane] = float(acc[q]);
+                    }
+                }
+            }
+        }
+
+        // Vertical sums, each thread sliding its window down its band
+        #pragma omp parallel
+        {
+#ifdef _OPENMP
+            const size_t n_bands = size_t(omp_get_num_threads());
+            const size_t band    = size_t(omp_get_thread_num());
+#else
+            const size_t n_bands = 1;
+            const size_t band    = 0;
+#endif
+            const size_t y_begin = height * band / n_bands;
+            const size_t y_end   = height * (band + 1) / n_bands;
+
+            std::vector<double> acc(5 * width, 0.);
+
+            // Window of the first row of the band, but its last row
+            for (size_t y = (y_begin > _radius ? y_begin - _radius : 0);
+                 y < std::min(height, y_begin + _radius);
+                 y++) {
+                addRow(acc, sums, y, width, plane, 1.);
+            }
+
+            for (size_t y = y_begin; y < y_end; y++) {
+                if (y + _radius < height) {
+                    addRow(acc, sums, y + _radius, width, plane, 1.);
+                }
+
+                if (y > y_begin && y > _radius) {
+                    addRow(acc, sums, y - _radius - 1, width, plane, -1.);
+                }
+
+                const size_t n_y
+                    = std::min(height, y + _radius + 1) - (y > _radius ? y - _radius : 0);
+
+                for (size_t x = 0; x < width; x++) {
+                    const size_t n_x
+                        = std::min(width, x + _radius + 1) - (x > _radius ? x - _radius : 0);
+                    const double n = double(n_x * n_y);
+
+                    const double mu_a  = acc[x] / n;
+                    const double mu_b  = acc[width + x] / n;
+                    const double var_a = std::max(0., acc[2 * width + x] / n - mu_a * mu_a);
+                    const double var_b = std::max(0., acc[3 * width + x] / n - mu_b * mu_b);
+                    const double cov   = acc[4 * width + x] / n - mu_a * mu_b;
+
+                    const size_t i = y * width + x;
+
+                    if (l) {
+                        l[i] = float((2. * mu_a * mu_b + _C1) / (mu_a * mu_a + mu_b * mu_b + _C1));
+                    }
+
+                    cs[i] = float((2. * cov + _C2) / (var_a + var_b + _C2));
+                }
+            }
+        }
+    }
+
+
+    static void add(double acc[5], float a, float b, double sign)
+    {
+        acc[0] += sign * a;
+        acc[1] += sign * b;
+        acc[2] += sign * double(a) * a;
+        acc[3] += sign * double(b) * b;
+        acc[4] += sign * double(a) * b;
+    }
+
+
+    // Adds the row `y` of each of the 5 planes of horizontal sums
+    static void addRow(
+        std::vector<double> &      acc,
+        const std::vector<float> & sums,
+        size_t                     y,
+        size_t                     width,
+        size_t                     plane,
+        double                     sign)
+    {
+        for (int q = 0; q < 5; q++) {
+            const float *src = &sums[q * plane + y * width];
+            double *     dst = &acc[q * width];
+
+            for (size_t x = 0; x < width; x++) {
+                dst[x] += sign * src[x];
+            }
+        }
+    }
+
+
+    // Averages the 2 x 2 blocks of `image`, rows `stride` floats apart, to a
+    // `width` x `height` image stored without padding
+    static void downsample(std::vector<float> &image, size_t width, size_t height, size_t stride)
+    {
+        std::vector<float> half(width * height);
+
+        #pragma omp parallel for schedule(static)
+        for (long y = 0; y < long(height); y++) {
+            const float *row_0 = &image[2 * size_t(y) * stride];
+            const float *row_1 = row_0 + stride;
+
+            for (size_t x = 0; x < width; x++) {
+                half[size_t(y) * width + x]
+                    = 0.25f * (row_0[2 * x] + row_0[2 * x + 1] + row_1[2 * x] + row_1[2 * x + 1]);
+            }
+        }
+
+        image.swap(half);
+    }
+
+
+    size_t _radius;
+    float  _C1, _C2;
+};
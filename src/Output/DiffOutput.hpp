@@ -0,0 +1,87 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <cstddef>
+
+// Destination of the Delta E map.
+//
+// The map is given band by band: for each band, beginBand() is called, then
+// writeRow() for each of its rows, then endBand(). writeRow() is called from
+// several threads at once, each time for a different row of the current band,
+// so it must only touch data specific to that row.
+class DiffOutput
+{
+  public:
+    DiffOutput(size_t width, size_t height)
+      : _width(width)
+      , _height(height)
+    {}
+
+
+    virtual ~DiffOutput() {}
+
+
+    size_t width() const { return _width; }
+    size_t height() const { return _height; }
+
+
+    // The rows [y_begin, y_end) are going to be written
+    virtual void beginBand(size_t y_begin, size_t y_end)
+    {
+        (void)y_begin;
+        (void)y_end;
+    }
+
+
+    // Receives the `width()` Delta E values of the row `y`. When `mask` is
+    // not null, only the pixels with a non zero mask value were compared: the
+    // others are left out of the output.
+    virtual void writeRow(size_t y, const float *deltaE, const unsigned char *mask) = 0;
+
+
+    // All rows of the current band have been written
+    virtual void endBand() {}
+
+
+    // The output needs no more rows: the remaining ones may be skipped. Can
+    // be called from several threads.
+    virtual bool done() const { return false; }
+
+
+    // All the bands have been written, or the output is done
+    virtual void close() {}
+
+
+    // Memory used for each row of a band, in bytes
+    virtual size_t bytesPerRow() const { return 0; }
+
+  protected:
+    size_t _width, _height;
+};
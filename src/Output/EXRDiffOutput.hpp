@@ -0,0 +1,134 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <tinyexr.h>
+#include "DiffOutput.hpp"
+
+// Raw Delta E, written as a single channel OpenEXR file.
+//
+// tinyexr writes whole images only: the full Delta E map is kept in memory
+// until close(). The chunks are then compressed in parallel by tinyexr.
+class EXRDiffOutput: public DiffOutput
+{
+  public:
+    EXRDiffOutput(
+        const std::string &filename,
+        size_t             width,
+        size_t             height,
+        bool               half = false)
+      : DiffOutput(width, height)
+      , _filename(filename)
+      , _half(half)
+      , _deltaE(width * height)
+    {}
+
+
+    virtual ~EXRDiffOutput() {}
+
+
+    virtual void writeRow(size_t y, const float *deltaE, const unsigned char *mask)
+    {
+        float *row = &_deltaE[y * _width];
+        memcpy(row, deltaE, _width * sizeof(float));
+
+        // Pixels left out are stored as NaN
+        if (mask) {
+            for (size_t x = 0; x < _width; x++) {
+                if (!mask[x]) {
+                    row[x] = std::numeric_limits<float>::quiet_NaN();
+                }
+            }
+        }
+    }
+
+
+    virtual void close()
+    {
+        EXRHeader header;
+        EXRImage  image;
+
+        InitEXRHeader(&header);
+        InitEXRImage(&image);
+
+        unsigned char *images[1] = {
+            reinterpret_cast<unsigned char *>(_deltaE.data())};
+
+        image.images       = images;
+        image.num_channels = 1;
+        image.width        = int(_width);
+        image.height       = int(_height);
+
+        // Single luminance channel, displayed as grey by viewers
+        EXRChannelInfo channel;
+        memset(&channel, 0, sizeof(EXRChannelInfo));
+        strcpy(channel.name, "Y");
+
+        int pixel_type           = TINYEXR_PIXELTYPE_FLOAT;
+        int requested_pixel_type = _half ? TINYEXR_PIXELTYPE_HALF
+                                         : TINYEXR_PIXELTYPE_FLOAT;
+
+        header.num_channels          = 1;
+        header.channels              = &channel;
+        header.pixel_types           = &pixel_type;
+        header.requested_pixel_types = &requested_pixel_type;
+        header.compression_type      = TINYEXR_COMPRESSIONTYPE_ZIP;
+
+        const char *err = nullptr;
+
+        // The header members point to local variables: it must not be freed
+        // with FreeEXRHeader()
+        const int ret = SaveEXRImageToFile(&image, &header, _filename.c_str(), &err);
+
+        if (ret != TINYEXR_SUCCESS) {
+            std::stringstream err_msg;
+            err_msg << "Cannot write OpenEXR file: " << _filename;
+
+            if (err) {
+                err_msg << " (" << err << ")";
+                FreeEXRErrorMessage(err);
+            }
+
+            throw std::runtime_error(err_msg.str());
+        }
+    }
+
+  protected:
+    std::string        _filename;
+    bool               _half;
+    std::vector<float> _deltaE;
+};
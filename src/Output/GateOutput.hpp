@@ -0,0 +1,115 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "DiffOutput.hpp"
+
+// Exit status when the gate fails, errors give EXIT_FAILURE
+#define EXIT_GATE_FAILED 2
+
+// Checks that at most `max_count` pixels have a Delta E above `threshold`.
+// NaN values count as above. As soon as the count is exceeded the output is
+// done: the remaining rows are not needed to know the result.
+class GateOutput: public DiffOutput
+{
+  public:
+    GateOutput(size_t width, size_t height, float threshold, uint64_t max_count)
+      : DiffOutput(width, height)
+      , _threshold(threshold)
+      , _max_count(max_count)
+      , _count(0)
+    {}
+
+
+    virtual ~GateOutput() {}
+
+
+    virtual void writeRow(size_t y, const float *deltaE, const unsigned char *mask)
+    {
+        (void)y;
+
+        uint64_t count = 0;
+
+        for (size_t x = 0; x < _width; x++) {
+            if ((!mask || mask[x]) && !(deltaE[x] <= _threshold)) {
+                count++;
+            }
+        }
+
+        if (count > 0) {
+            _count.fetch_add(count, std::memory_order_relaxed);
+        }
+    }
+
+
+    virtual bool done() const
+    {
+        return _count.load(std::memory_order_relaxed) > _max_count;
+    }
+
+
+    bool passed() const { return !done(); }
+
+
+    // Number of pixels above the threshold, only a lower bound once done
+    uint64_t count() const { return _count.load(); }
+
+
+    // Writes the result of the gate as a message for the user, prefixed with
+    // the name of the layer compared, if any
+    void report(std::ostream &out, const std::string &layer = "") const
+    {
+        out << "[gate] " << (layer.empty() ? "" : layer + ": ");
+
+        if (passed()) {
+            out << "Passed: " << count()
+                << " pixels with a Delta E above " << _threshold << "."
+                << std::endl;
+        } else {
+            out << "Failed: more than " << _max_count
+                << " pixels with a Delta E above " << _threshold << "."
+                << std::endl;
+        }
+    }
+
+
+    float threshold() const { return _threshold; }
+    uint64_t maxCount() const { return _max_count; }
+
+  protected:
+    float                 _threshold;
+    uint64_t              _max_count;
+    std::atomic<uint64_t> _count;
+};
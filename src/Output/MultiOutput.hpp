@@ -0,0 +1,115 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "DiffOutput.hpp"
+
+// Gives the Delta E map to several outputs
+class MultiOutput: public DiffOutput
+{
+  public:
+    MultiOutput(size_t width, size_t height)
+      : DiffOutput(width, height)
+    {}
+
+
+    virtual ~MultiOutput() {}
+
+
+    // Takes the ownership of `output`
+    void add(DiffOutput *output)
+    {
+        _outputs.push_back(std::unique_ptr<DiffOutput>(output));
+    }
+
+
+    virtual void beginBand(size_t y_begin, size_t y_end)
+    {
+        for (size_t i = 0; i < _outputs.size(); i++) {
+            _outputs[i]->beginBand(y_begin, y_end);
+        }
+    }
+
+
+    virtual void writeRow(size_t y, const float *deltaE, const unsigned char *mask)
+    {
+        for (size_t i = 0; i < _outputs.size(); i++) {
+            _outputs[i]->writeRow(y, deltaE, mask);
+        }
+    }
+
+
+    virtual void endBand()
+    {
+        for (size_t i = 0; i < _outputs.size(); i++) {
+            _outputs[i]->endBand();
+        }
+    }
+
+
+    // Done only when all the outputs are, right away without any: nothing
+    // needs the rows then
+    virtual bool done() const
+    {
+        for (size_t i = 0; i < _outputs.size(); i++) {
+            if (!_outputs[i]->done()) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+
+    virtual void close()
+    {
+        for (size_t i = 0; i < _outputs.size(); i++) {
+            _outputs[i]->close();
+        }
+    }
+
+
+    virtual size_t bytesPerRow() const
+    {
+        size_t bytes = 0;
+
+        for (size_t i = 0; i < _outputs.size(); i++) {
+            bytes += _outputs[i]->bytesPerRow();
+        }
+
+        return bytes;
+    }
+
+  protected:
+    std::vector<std::unique_ptr<DiffOutput>> _outputs;
+};
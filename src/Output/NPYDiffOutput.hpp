@@ -0,0 +1,155 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "DiffOutput.hpp"
+
+// Raw Delta E, written as a NumPy .npy file: a (height, width) array of 32
+// bits floats in row major order. The rows are written sequentially as the
+// bands come, and the array data starts at a 64 bytes aligned offset, so the
+// file can be memory mapped directly, e.g. with numpy.load(mmap_mode='r').
+class NPYDiffOutput: public DiffOutput
+{
+  public:
+    NPYDiffOutput(const std::string &filename, size_t width, size_t height)
+      : DiffOutput(width, height)
+      , _file(filename.c_str(), std::ios::binary)
+      , _filename(filename)
+      , _y_begin(0)
+      , _y_end(0)
+    {
+        if (!_file) {
+            error("Cannot write NPY file");
+        }
+
+        // Data stored in the machine byte order
+        const uint16_t one        = 1;
+        const bool     big_endian = *reinterpret_cast<const unsigned char *>(&one) == 0;
+
+        std::stringstream dict;
+        dict << "{'descr': '" << (big_endian ? '>' : '<') << "f4', "
+             << "'fortran_order': False, "
+             << "'shape': (" << height << ", " << width << "), }";
+
+        // Magic string, version 1.0 and header length come first. The header
+        // is padded with spaces and ends with a newline.
+        std::string header = dict.str();
+        const size_t total = 10 + header.size() + 1;
+        header.append((64 - total % 64) % 64, ' ');
+        header.push_back('\n');
+
+        if (header.size() > 0xFFFF) {
+            error("NPY header too long");
+        }
+
+        const unsigned char preamble[10] = {
+            0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0,
+            (unsigned char)(header.size() & 0xFF),
+            (unsigned char)(header.size() >> 8)};
+
+        write(preamble, 10);
+        write(header.data(), header.size());
+    }
+
+
+    virtual ~NPYDiffOutput() {}
+
+
+    virtual void beginBand(size_t y_begin, size_t y_end)
+    {
+        _y_begin = y_begin;
+        _y_end   = y_end;
+        _band.resize(_width * (y_end - y_begin));
+    }
+
+
+    virtual void writeRow(size_t y, const float *deltaE, const unsigned char *mask)
+    {
+        float *row = &_band[(y - _y_begin) * _width];
+        memcpy(row, deltaE, _width * sizeof(float));
+
+        // Pixels left out are stored as NaN
+        if (mask) {
+            for (size_t x = 0; x < _width; x++) {
+                if (!mask[x]) {
+                    row[x] = std::numeric_limits<float>::quiet_NaN();
+                }
+            }
+        }
+    }
+
+
+    virtual void endBand() { write(_band.data(), _band.size() * sizeof(float)); }
+
+
+    virtual void close()
+    {
+        _file.close();
+
+        if (!_file) {
+            error("Cannot write NPY file");
+        }
+    }
+
+
+    virtual size_t bytesPerRow() const { return _width * sizeof(float); }
+
+  protected:
+    void write(const void *data, size_t size)
+    {
+        _file.write(reinterpret_cast<const char *>(data), size);
+
+        if (!_file) {
+            error("Cannot write NPY file");
+        }
+    }
+
+
+    void error(const char *message) const
+    {
+        std::stringstream err_msg;
+        err_msg << message << ": " << _filename;
+        throw std::runtime_error(err_msg.str());
+    }
+
+    std::ofstream      _file;
+    std::string        _filename;
+    size_t             _y_begin, _y_end;
+    std::vector<float> _band;
+};
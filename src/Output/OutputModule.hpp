@@ -0,0 +1,107 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <cctype>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "DiffOutput.hpp"
+#include "PNGDiffOutput.hpp"
+#include "EXRDiffOutput.hpp"
+#include "NPYDiffOutput.hpp"
+
+// Settings of the outputs, each output only uses the ones it needs
+struct OutputSettings
+{
+    const ColorMap *cmap;
+    float           max_deltaE;
+    bool            displayScale;
+    int             png_level;
+    PNGFilter       png_filter;
+    bool            exr_half;
+};
+
+
+class OutputModule
+{
+  public:
+    // Creates the output matching the file extension: .png for the color
+    // mapped Delta E, .exr or .npy for the raw values
+    static DiffOutput *create(
+        const std::string &   filename,
+        size_t                width,
+        size_t                height,
+        const OutputSettings &settings)
+    {
+        if (hasExtension(filename, ".png")) {
+            return new PNGDiffOutput(
+                filename,
+                width,
+                height,
+                *settings.cmap,
+                settings.max_deltaE,
+                settings.displayScale,
+                settings.png_level,
+                settings.png_filter);
+        } else if (hasExtension(filename, ".exr")) {
+            return new EXRDiffOutput(filename, width, height, settings.exr_half);
+        } else if (hasExtension(filename, ".npy")) {
+            return new NPYDiffOutput(filename, width, height);
+        }
+
+        std::stringstream err_msg;
+        err_msg << "Wrong file extension for output: " << filename
+                << " (supported extensions: .png, .exr, .npy)";
+        throw std::runtime_error(err_msg.str());
+    }
+
+
+    // Case insensitive extension check
+    static bool hasExtension(const std::string &filename, const char *ext)
+    {
+        const size_t ext_size = strlen(ext);
+
+        if (filename.size() <= ext_size) {
+            return false;
+        }
+
+        for (size_t i = 0; i < ext_size; i++) {
+            const char c = filename[filename.size() - ext_size + i];
+
+            if (tolower((unsigned char)c) != ext[i]) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+};
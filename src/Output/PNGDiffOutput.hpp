@@ -0,0 +1,136 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "DiffOutput.hpp"
+#include "../ColorMap/ColorMap.hpp"
+#include "../ImageFormat/PNGStreamWriter.hpp"
+
+// Color mapped Delta E, written as a PNG file, optionally with the color
+// scale on the right
+class PNGDiffOutput: public DiffOutput
+{
+  public:
+    PNGDiffOutput(
+        const std::string &filename,
+        size_t             width,
+        size_t             height,
+        const ColorMap &   cmap,
+        float              max_deltaE,
+        bool               displayScale,
+        int                level  = 6,
+        PNGFilter          filter = PNGFilter::Adaptive)
+      : DiffOutput(width, height)
+      , _cmap(cmap)
+      , _max_deltaE(max_deltaE)
+      , _width_out(displayScale ? width + scaleWidth(width) : width)
+      , _writer(filename, _width_out, height, level, filter)
+      , _y_begin(0)
+      , _y_end(0)
+    {}
+
+
+    virtual ~PNGDiffOutput() {}
+
+
+    // Width of the color scale for an image `width` pixels wide
+    static size_t scaleWidth(size_t width)
+    {
+        const float scale_percent = 0.05f;
+        return std::max(30, int(scale_percent * float(width)));
+    }
+
+
+    virtual void beginBand(size_t y_begin, size_t y_end)
+    {
+        _y_begin = y_begin;
+        _y_end   = y_end;
+        _rgba_band.resize(4 * _width_out * (y_end - y_begin));
+    }
+
+
+    virtual void writeRow(size_t y, const float *deltaE, const unsigned char *mask)
+    {
+        unsigned char *row = &_rgba_band[4 * (y - _y_begin) * _width_out];
+
+        // Color map the Delta E values straight to the output row
+        _cmap.getRGBA8Row(deltaE, _width, 0.f, _max_deltaE, row);
+
+        // Pixels left out are transparent
+        if (mask) {
+            for (size_t x = 0; x < _width; x++) {
+                if (!mask[x]) {
+                    memset(&row[4 * x], 0, 4);
+                }
+            }
+        }
+
+        // Color scale on the right
+        if (_width_out > _width) {
+            float v = float(_height - 1 - y) / float(_height - 1);
+
+            _cmap.getRGBA8Row(&v, 1, 0.f, 1.f, &row[4 * _width]);
+
+            for (size_t x = _width + 1; x < _width_out; x++) {
+                memcpy(&row[4 * x], &row[4 * _width], 4);
+            }
+        }
+    }
+
+
+    virtual void endBand()
+    {
+        _writer.writeRows(_rgba_band.data(), _y_end - _y_begin);
+    }
+
+
+    virtual void close() { _writer.close(); }
+
+
+    virtual size_t bytesPerRow() const
+    {
+        // Color mapped rows and filtered rows
+        return 2 * (4 * _width_out + 1);
+    }
+
+  protected:
+    const ColorMap &_cmap;
+    float           _max_deltaE;
+    size_t          _width_out;
+
+    PNGStreamWriter            _writer;
+    size_t                     _y_begin, _y_end;
+    std::vector<unsigned char> _rgba_band;
+};
@@ -0,0 +1,279 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#ifdef _OPENMP
+#    include <omp.h>
+#endif
+
+#include "StatsOutput.hpp"
+
+// Summary of a Delta E map of which only a sample of bands is compared (see
+// --approx). The fields of StatsOutput are estimated from the compared
+// pixels, and a "sampling" field gives 95% confidence intervals of the mean,
+// the percentiles and the fractions of pixels above the thresholds. The
+// maximum is the one of the sample, a lower bound of the true maximum.
+//
+// Pixels of nearby rows are correlated: each band is a sampling unit, and
+// the variances are estimated from the spread between the bands (ratio
+// estimators of a cluster sample), with the finite population correction of
+// the fraction of rows compared. Percentile intervals are Woodruff intervals:
+// the interval of the fraction of pixels below the estimated percentile,
+// mapped back through the distribution of the sample.
+class SampledStatsOutput: public StatsOutput
+{
+  public:
+    SampledStatsOutput(size_t width, size_t height, float max_deltaE, std::ostream &out)
+      : StatsOutput(width, height, max_deltaE, out)
+      , _sampled_rows(0)
+      , _band_accumulators(_accumulators.size())
+    {}
+
+
+    virtual ~SampledStatsOutput() {}
+
+
+    virtual void beginBand(size_t y_begin, size_t y_end)
+    {
+        StatsOutput::beginBand(y_begin, y_end);
+        _sampled_rows += y_end - y_begin;
+
+        for (size_t t = 0; t < _band_accumulators.size(); t++) {
+            _band_accumulators[t] = Accumulator();
+        }
+    }
+
+
+    virtual void writeRow(size_t y, const float *deltaE, const unsigned char *mask)
+    {
+        StatsOutput::writeRow(y, deltaE, mask);
+
+#ifdef _OPENMP
+        Accumulator &acc = _band_accumulators[omp_get_thread_num()];
+#else
+        Accumulator &acc = _band_accumulators[0];
+#endif
+        acc.init(_max_deltaE);
+
+        for (size_t x = 0; x < _width; x++) {
+            if ((!mask || mask[x]) && std::isfinite(deltaE[x])) {
+                acc.add(deltaE[x]);
+            }
+        }
+    }
+
+
+    virtual void endBand()
+    {
+        Unit unit;
+        unit.sum = 0.;
+
+        for (size_t i = 0; i < _row_sum.size(); i++) {
+            unit.sum += _row_sum[i];
+        }
+
+        StatsOutput::endBand();
+
+        Accumulator band;
+        band.init(_max_deltaE);
+
+        for (size_t t = 0; t < _band_accumulators.size(); t++) {
+            band.merge(_band_accumulators[t]);
+        }
+
+        unit.n     = band.n;
+        unit.above = band.above;
+
+        // Most bins are empty: only the others are kept
+        for (size_t i = 0; i < band.fine.size(); i++) {
+            if (band.fine[i] > 0) {
+                unit.fine.push_back(std::make_pair(i, band.fine[i]));
+            }
+        }
+
+        _units.push_back(unit);
+    }
+
+  protected:
+    // Normal quantile of the two-sided 95% confidence level
+    static constexpr double z_95 = 1.959964;
+
+    // Values of the pixels of a band
+    struct Unit
+    {
+        uint64_t                                  n;
+        double                                    sum;
+        std::vector<uint64_t>                     above;
+        std::vector<std::pair<size_t, uint64_t>>  fine;    // Non empty bins
+    };
+
+
+    virtual void writeExtraFields(const Accumulator &total)
+    {
+        const double n = double(total.n);
+
+        std::vector<double> values(_units.size());
+
+        _out << "  \"sampling\": {" << std::endl;
+        _out << "    \"rows\": " << _sampled_rows << "," << std::endl;
+        _out << "    \"total_rows\": " << _height << "," << std::endl;
+        _out << "    \"confidence\": 0.95," << std::endl;
+
+        const double mean = total.n > 0 ? _sum / n : 0.;
+
+        for (size_t i = 0; i < _units.size(); i++) {
+            values[i] = _units[i].sum;
+        }
+
+        _out << "    \"mean\": ";
+        writeInterval(mean, standardError(values, mean), -HUGE_VAL, HUGE_VAL);
+        _out << "," << std::endl;
+
+        // Fraction of the pixels below each estimated percentile
+        _out << "    \"percentiles\": {";
+
+        for (int p = 0; p < n_percentiles; p++) {
+            const float value = total.percentile(percentiles()[p]);
+            double      below = 0.;
+
+            for (size_t i = 0; i < _units.size(); i++) {
+                values[i] = countBelow(_units[i], value);
+                below += values[i];
+            }
+
+            const double fraction = total.n > 0 ? below / n : 0.;
+            const double error    = z_95 * standardError(values, fraction);
+
+            _out << (p > 0 ? ", " : "") << "\"" << percentiles()[p] << "\": ";
+
+            if (std::isnan(error)) {
+                _out << "null";
+            } else {
+                _out << "["
+                     << total.percentile(float(100. * std::max(0., fraction - error)))
+                     << ", "
+                     << total.percentile(float(100. * std::min(1., fraction + error)))
+                     << "]";
+            }
+        }
+
+        _out << "}," << std::endl;
+
+        _out << "    \"above\": {";
+
+        for (int t = 0; t < n_thresholds; t++) {
+            const double fraction = total.n > 0 ? double(total.above[t]) / n : 0.;
+
+            for (size_t i = 0; i < _units.size(); i++) {
+                values[i] = double(_units[i].above[t]);
+            }
+
+            _out << (t > 0 ? ", " : "") << "\"" << thresholds()[t] << "\": ";
+            writeInterval(fraction, standardError(values, fraction), 0., 1.);
+        }
+
+        _out << "}" << std::endl;
+        _out << "  }," << std::endl;
+    }
+
+
+    // Standard error of the ratio estimate `ratio` of sum(values) over the
+    // number of pixels of the units, or NaN when it cannot be estimated
+    double standardError(const std::vector<double> &values, double ratio) const
+    {
+        const size_t k = _units.size();
+
+        uint64_t n = 0;
+        double   residuals = 0.;
+
+        for (size_t i = 0; i < k; i++) {
+            const double e = values[i] - ratio * double(_units[i].n);
+
+            n += _units[i].n;
+            residuals += e * e;
+        }
+
+        if (k < 2 || n == 0) {
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+
+        const double f = std::min(1., double(_sampled_rows) / double(_height));
+
+        return std::sqrt(
+            (1. - f) * double(k) / double(k - 1) * residuals / (double(n) * double(n)));
+    }
+
+
+    // Pixels of the unit below `value`, interpolated within the bin of the
+    // fine histogram as Accumulator::percentile() does
+    static double countBelow(const Unit &unit, float value)
+    {
+        const double bin   = double(std::max(0.f, value)) * double(fine_bins_per_unit);
+        double       count = 0.;
+
+        for (size_t i = 0; i < unit.fine.size(); i++) {
+            const double first = double(unit.fine[i].first);
+
+            if (first + 1. <= bin) {
+                count += double(unit.fine[i].second);
+            } else if (first < bin) {
+                count += (bin - first) * double(unit.fine[i].second);
+            }
+        }
+
+        return count;
+    }
+
+
+    // Writes the `z_95` interval around `value` bounded to [lo, hi], or null
+    void writeInterval(double value, double error, double lo, double hi)
+    {
+        if (std::isnan(error)) {
+            _out << "null";
+            return;
+        }
+
+        _out << "[" << std::max(lo, value - z_95 * error) << ", "
+             << std::min(hi, value + z_95 * error) << "]";
+    }
+
+
+    size_t                   _sampled_rows;
+    std::vector<Accumulator> _band_accumulators;    // Per thread, current band
+    std::vector<Unit>        _units;
+};
@@ -0,0 +1,347 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <ios>
+#include <ostream>
+#include <vector>
+
+#ifdef _OPENMP
+#    include <omp.h>
+#endif
+
+#include "DiffOutput.hpp"
+
+// Summary of the Delta E map, written as JSON on close(): mean, RMS, maximum,
+// percentiles, number of pixels above the usual just noticeable difference
+// thresholds and a histogram. NaN and infinite values are only counted, in
+// their own fields: JSON has no number for them.
+//
+// The results do not depend on the number of threads: counts and maxima are
+// accumulated per thread, which gives the same totals in any order, while the
+// sums are accumulated per row and then merged in row order.
+class StatsOutput: public DiffOutput
+{
+  public:
+    // Percentiles are computed from a histogram of this resolution
+    static const int fine_bins_per_unit = 64;
+    static const int fine_max           = 256;
+    static const int histogram_bins     = 20;
+
+    StatsOutput(size_t width, size_t height, float max_deltaE, std::ostream &out)
+      : DiffOutput(width, height)
+      , _max_deltaE(max_deltaE)
+      , _out(out)
+      , _y_begin(0)
+      , _sum(0.)
+      , _sum_sq(0.)
+      , _psnr_peak(0.f)
+    {
+#ifdef _OPENMP
+        _accumulators.resize(omp_get_max_threads());
+#else
+        _accumulators.resize(1);
+#endif
+    }
+
+
+    virtual ~StatsOutput() {}
+
+
+    // The values are squared errors: their mean is also given as a PSNR for
+    // signals of this peak value
+    void reportPSNR(float peak) { _psnr_peak = peak; }
+
+
+    virtual void beginBand(size_t y_begin, size_t y_end)
+    {
+        _y_begin = y_begin;
+        _row_sum.assign(y_end - y_begin, 0.);
+        _row_sum_sq.assign(y_end - y_begin, 0.);
+    }
+
+
+    virtual void writeRow(size_t y, const float *deltaE, const unsigned char *mask)
+    {
+#ifdef _OPENMP
+        Accumulator &acc = _accumulators[omp_get_thread_num()];
+#else
+        Accumulator &acc = _accumulators[0];
+#endif
+        acc.init(_max_deltaE);
+
+        double sum = 0., sum_sq = 0.;
+
+        for (size_t x = 0; x < _width; x++) {
+            if (mask && !mask[x]) {
+                continue;
+            }
+
+            const float v = deltaE[x];
+
+            if (std::isnan(v)) {
+                acc.n_nan++;
+                continue;
+            }
+
+            if (std::isinf(v)) {
+                acc.n_inf++;
+                continue;
+            }
+
+            sum += v;
+            sum_sq += double(v) * double(v);
+            acc.add(v);
+        }
+
+        _row_sum[y - _y_begin]    = sum;
+        _row_sum_sq[y - _y_begin] = sum_sq;
+    }
+
+
+    virtual void endBand()
+    {
+        for (size_t i = 0; i < _row_sum.size(); i++) {
+            _sum += _row_sum[i];
+            _sum_sq += _row_sum_sq[i];
+        }
+    }
+
+
+    virtual void close()
+    {
+        Accumulator total;
+        total.init(_max_deltaE);
+
+        for (size_t t = 0; t < _accumulators.size(); t++) {
+            total.merge(_accumulators[t]);
+        }
+
+        const uint64_t n = total.n;
+
+        // The stream may be the one of the caller
+        const std::streamsize precision = _out.precision(7);
+
+        _out << "{" << std::endl;
+        _out << "  \"width\": " << _width << "," << std::endl;
+        _out << "  \"height\": " << _height << "," << std::endl;
+        _out << "  \"pixels\": " << n << "," << std::endl;
+        _out << "  \"nan_pixels\": " << total.n_nan << "," << std::endl;
+        _out << "  \"inf_pixels\": " << total.n_inf << "," << std::endl;
+        _out << "  \"mean\": " << (n > 0 ? _sum / double(n) : 0.) << "," << std::endl;
+        _out << "  \"rms\": " << (n > 0 ? std::sqrt(_sum_sq / double(n)) : 0.) << "," << std::endl;
+        _out << "  \"max\": " << total.max << "," << std::endl;
+
+        if (_psnr_peak > 0.f) {
+            const double mse = n > 0 ? _sum / double(n) : 0.;
+
+            _out << "  \"psnr\": ";
+
+            // Identical images have no finite PSNR
+            if (mse > 0.) {
+                _out << 10. * std::log10(double(_psnr_peak) * double(_psnr_peak) / mse);
+            } else {
+                _out << "null";
+            }
+
+            _out << "," << std::endl;
+        }
+
+        writeExtraFields(total);
+
+        _out << "  \"percentiles\": {";
+
+        for (int i = 0; i < n_percentiles; i++) {
+            _out << (i > 0 ? ", " : "") << "\"" << percentiles()[i]
+                 << "\": " << total.percentile(percentiles()[i]);
+        }
+
+        _out << "}," << std::endl;
+
+        _out << "  \"above\": {";
+
+        for (int i = 0; i < n_thresholds; i++) {
+            _out << (i > 0 ? ", " : "") << "\"" << thresholds()[i]
+                 << "\": " << total.above[i];
+        }
+
+        _out << "}," << std::endl;
+
+        _out << "  \"histogram\": {\"min\": 0, \"max\": " << _max_deltaE
+             << ", \"counts\": [";
+
+        for (int i = 0; i < histogram_bins; i++) {
+            _out << (i > 0 ? ", " : "") << total.histogram[i];
+        }
+
+        _out << "], \"overflow\": " << total.histogram[histogram_bins] << "}"
+             << std::endl;
+        _out << "}" << std::endl;
+
+        _out.precision(precision);
+    }
+
+  protected:
+    // Just noticeable difference thresholds
+    static const int n_thresholds = 3;
+
+    static const float *thresholds()
+    {
+        static const float values[n_thresholds] = {1.f, 2.3f, 5.f};
+        return values;
+    }
+
+
+    static const int n_percentiles = 5;
+
+    static const float *percentiles()
+    {
+        static const float values[n_percentiles] = {50.f, 90.f, 95.f, 99.f, 99.9f};
+        return values;
+    }
+
+
+    struct Accumulator;
+
+    // Lets derived summaries add their fields, each line ending with a comma,
+    // before the percentiles. `total` merges the values of all the threads.
+    virtual void writeExtraFields(const Accumulator &total) { (void)total; }
+
+
+    struct Accumulator
+    {
+        Accumulator()
+          : n(0)
+          , n_nan(0)
+          , n_inf(0)
+          , max(0.f)
+          , max_deltaE(0.f)
+        {}
+
+
+        void init(float max_value)
+        {
+            if (fine.empty()) {
+                max_deltaE = max_value;
+                fine.assign(fine_bins_per_unit * fine_max + 1, 0);
+                histogram.assign(histogram_bins + 1, 0);
+                above.assign(n_thresholds, 0);
+            }
+        }
+
+
+        void add(float v)
+        {
+            n++;
+            max = std::max(max, v);
+
+            const float f = std::max(0.f, v) * float(fine_bins_per_unit);
+            fine[size_t(std::min(f, float(fine.size() - 1)))]++;
+
+            const float h = std::max(0.f, v) / max_deltaE * float(histogram_bins);
+            histogram[size_t(std::min(h, float(histogram_bins)))]++;
+
+            for (int i = 0; i < n_thresholds; i++) {
+                if (v > thresholds()[i]) {
+                    above[i]++;
+                }
+            }
+        }
+
+
+        void merge(const Accumulator &other)
+        {
+            if (other.fine.empty()) {
+                return;
+            }
+
+            n += other.n;
+            n_nan += other.n_nan;
+            n_inf += other.n_inf;
+            max = std::max(max, other.max);
+
+            for (size_t i = 0; i < fine.size(); i++) fine[i] += other.fine[i];
+            for (size_t i = 0; i < histogram.size(); i++) histogram[i] += other.histogram[i];
+            for (size_t i = 0; i < above.size(); i++) above[i] += other.above[i];
+        }
+
+
+        // Interpolated within the bin of the fine histogram, and bounded by
+        // the maximum. Values beyond the fine histogram give the maximum.
+        float percentile(float p) const
+        {
+            if (n == 0) {
+                return 0.f;
+            }
+
+            const double rank  = double(p) / 100. * double(n);
+            uint64_t     count = 0;
+
+            for (size_t i = 0; i < fine.size(); i++) {
+                if (fine[i] > 0 && double(count + fine[i]) >= rank) {
+                    if (i + 1 == fine.size()) {
+                        return max;
+                    }
+
+                    const float t = float((rank - double(count)) / double(fine[i]));
+                    const float v = (float(i) + t) / float(fine_bins_per_unit);
+
+                    return std::min(v, max);
+                }
+
+                count += fine[i];
+            }
+
+            return max;
+        }
+
+
+        uint64_t              n, n_nan, n_inf;
+        float                 max;
+        float                 max_deltaE;
+        std::vector<uint64_t> fine;
+        std::vector<uint64_t> histogram;
+        std::vector<uint64_t> above;
+    };
+
+
+    float         _max_deltaE;
+    std::ostream &_out;
+
+    size_t              _y_begin;
+    std::vector<double> _row_sum, _row_sum_sq;
+    double              _sum, _sum_sq;
+    float               _psnr_peak;    // 0 when no PSNR is reported
+
+    std::vector<Accumulator> _accumulators;
+};
@@ -0,0 +1,81 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <climits>
+#include <iostream>
+#include <string>
+
+#include <unistd.h>
+
+#include "DiffProtocol.hpp"
+#include "SocketStream.hpp"
+
+// Sends comparisons to a server started with --serve
+class DiffClient
+{
+  public:
+    // Runs `request` on the server listening on `path` and writes its results
+    // on the standard outputs. Returns the exit status of the comparison.
+    static int run(const std::string &path, DiffRequest request)
+    {
+        request.filename_1   = absolutePath(request.filename_1);
+        request.filename_2   = absolutePath(request.filename_2);
+        request.filename_out = absolutePath(request.filename_out);
+
+        SocketStream stream(SocketStream::connect(path));
+
+        request.write(stream);
+
+        DiffResponse response;
+        response.read(stream);
+
+        std::cout << response.out << std::flush;
+        std::cerr << response.err << std::flush;
+
+        return response.status;
+    }
+
+
+    // The server does not run in the client's working directory
+    static std::string absolutePath(const std::string &filename)
+    {
+        if (filename.empty() || filename[0] == '/') {
+            return filename;
+        }
+
+        char cwd[PATH_MAX];
+
+        if (!getcwd(cwd, sizeof(cwd))) {
+            return filename;
+        }
+
+        return std::string(cwd) + "/" + filename;
+    }
+};
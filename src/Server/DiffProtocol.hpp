@@ -0,0 +1,224 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "SocketStream.hpp"
+
+// Messages exchanged between the client and the server.
+//
+// A request is a list of "<key> <value>" lines ended by an empty line. The
+// response starts with a "status <exit status>" line, followed by the text
+// the client writes on its standard output and on its standard error, each
+// given as a "<stream> <size>" line then the bytes themselves.
+
+// Comparison requested by a client, with the same meaning as the command line
+// options. Paths are absolute: the server does not share the client's working
+// directory.
+struct DiffRequest
+{
+    DiffRequest()
+      : exposure(0.f)
+      , max_deltaE(10.f)
+      , displayScale(false)
+      , colormap("bbgr")
+      , png_level(6)
+      , png_filter("adaptive")
+      , exr_half(false)
+      , stats(false)
+      , gate(false)
+      , fail_above(2.3f)
+      , max_count(0)
+    {}
+
+
+    void write(SocketStream &stream) const
+    {
+        std::stringstream msg;
+        msg << std::setprecision(9)
+            << "file1 " << filename_1 << "\n"
+            << "file2 " << filename_2 << "\n"
+            << "output " << filename_out << "\n"
+            << "exposure " << exposure << "\n"
+            << "max " << max_deltaE << "\n"
+            << "scale " << displayScale << "\n"
+            << "colormap " << colormap << "\n"
+            << "png-level " << png_level << "\n"
+            << "png-filter " << png_filter << "\n"
+            << "half " << exr_half << "\n"
+            << "stats " << stats << "\n"
+            << "gate " << gate << "\n"
+            << "fail-above " << fail_above << "\n"
+            << "max-count " << max_count << "\n"
+            << "\n";
+
+        stream.write(msg.str());
+    }
+
+
+    // Returns false if the client closed the connection without a request,
+    // throws if it closed it in the middle of one
+    bool read(SocketStream &stream)
+    {
+        std::string line;
+
+        if (!stream.readLine(line)) {
+            return false;
+        }
+
+        for (; !line.empty(); readLine(stream, line)) {
+            const size_t      space = line.find(' ');
+            const std::string key   = line.substr(0, space);
+            const std::string value
+                = (space == std::string::npos) ? "" : line.substr(space + 1);
+
+            if (key == "file1") {
+                filename_1 = value;
+            } else if (key == "file2") {
+                filename_2 = value;
+            } else if (key == "output") {
+                filename_out = value;
+            } else if (key == "exposure") {
+                exposure = std::strtof(value.c_str(), nullptr);
+            } else if (key == "max") {
+                max_deltaE = std::strtof(value.c_str(), nullptr);
+            } else if (key == "scale") {
+                displayScale = (value == "1");
+            } else if (key == "colormap") {
+                colormap = value;
+            } else if (key == "png-level") {
+                png_level = std::atoi(value.c_str());
+            } else if (key == "png-filter") {
+                png_filter = value;
+            } else if (key == "half") {
+                exr_half = (value == "1");
+            } else if (key == "stats") {
+                stats = (value == "1");
+            } else if (key == "gate") {
+                gate = (value == "1");
+            } else if (key == "fail-above") {
+                fail_above = std::strtof(value.c_str(), nullptr);
+            } else if (key == "max-count") {
+                max_count = std::strtoull(value.c_str(), nullptr, 10);
+            } else {
+                throw std::runtime_error("Unknown request field: " + key);
+            }
+        }
+
+        return true;
+    }
+
+
+    std::string filename_1;
+    std::string filename_2;
+    std::string filename_out;
+
+    float       exposure;
+    float       max_deltaE;
+    bool        displayScale;
+    std::string colormap;
+    int         png_level;
+    std::string png_filter;
+    bool        exr_half;
+    bool        stats;
+    bool        gate;
+    float       fail_above;
+    uint64_t    max_count;
+
+  protected:
+    // Reads the next line of a request, which ends with an empty line
+    static void readLine(SocketStream &stream, std::string &line)
+    {
+        if (!stream.readLine(line)) {
+            throw std::runtime_error("Truncated request");
+        }
+    }
+};
+
+
+// Result of a comparison, as the client reports it
+struct DiffResponse
+{
+    DiffResponse()
+      : status(EXIT_SUCCESS)
+    {}
+
+
+    void write(SocketStream &stream) const
+    {
+        std::stringstream msg;
+        msg << "status " << status << "\n"
+            << "stdout " << out.size() << "\n" << out
+            << "stderr " << err.size() << "\n" << err;
+
+        stream.write(msg.str());
+    }
+
+
+    void read(SocketStream &stream)
+    {
+        std::string line;
+
+        if (   !stream.readLine(line)
+            || line.compare(0, 7, "status ") != 0) {
+            throw std::runtime_error("Invalid response from the server");
+        }
+
+        status = std::atoi(line.c_str() + 7);
+
+        readText(stream, "stdout ", out);
+        readText(stream, "stderr ", err);
+    }
+
+
+    int         status;
+    std::string out;
+    std::string err;
+
+  protected:
+    static void readText(SocketStream &stream, const char *name, std::string &text)
+    {
+        std::string line;
+        const size_t name_size = strlen(name);
+
+        if (   !stream.readLine(line)
+            || line.compare(0, name_size, name) != 0) {
+            throw std::runtime_error("Invalid response from the server");
+        }
+
+        stream.readBytes(text, size_t(std::strtoull(line.c_str() + name_size, nullptr, 10)));
+    }
+};
@@ -0,0 +1,269 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "DiffProtocol.hpp"
+#include "LabCache.hpp"
+#include "SocketStream.hpp"
+#include "../colortools_batch.hpp"
+#include "../Diff/Region.hpp"
+#include "../ColorMap/ColorMapModule.hpp"
+#include "../Output/OutputModule.hpp"
+#include "../Output/MultiOutput.hpp"
+#include "../Output/StatsOutput.hpp"
+#include "../Output/GateOutput.hpp"
+
+// Resident process answering comparison requests on a local UNIX socket.
+//
+// The input images are kept in Lab in a cache shared by all the requests,
+// so reference images compared again and again are decoded once. Color maps
+// are built once per name. Requests are processed one at a time, each using
+// all the cores, on a thread pool that stays warm between requests. A client
+// that stops sending its request or reading the response is dropped after
+// `io_timeout_ms`, so it only delays the others up to then.
+class DiffServer
+{
+  public:
+    static const int io_timeout_ms = 10000;
+
+    DiffServer(const std::string &path, size_t cache_bytes, size_t colormap_size)
+      : _path(path)
+      , _cache(cache_bytes)
+      , _colormap_size(colormap_size)
+    {}
+
+
+    // Serves requests until the process is stopped
+    void run()
+    {
+        // A client leaving early must not stop the server
+        signal(SIGPIPE, SIG_IGN);
+
+        const int listen_fd = SocketStream::listen(_path);
+
+        std::cerr << "[serve] Listening on " << _path << std::endl;
+
+        for (;;) {
+            const int fd = ::accept(listen_fd, nullptr, nullptr);
+
+            if (fd < 0) {
+                continue;
+            }
+
+            SocketStream stream(fd);
+
+            try {
+                stream.setTimeout(io_timeout_ms);
+
+                DiffRequest request;
+
+                if (request.read(stream)) {
+                    handle(request).write(stream);
+                }
+            } catch (std::exception &e) {
+                std::cerr << "[serve] " << e.what() << std::endl;
+            }
+        }
+    }
+
+
+    // Runs a comparison, reporting the results the same way the command line
+    // tool does
+    DiffResponse handle(const DiffRequest &request)
+    {
+        DiffResponse      response;
+        std::stringstream out, err;
+
+        try {
+            if (!(request.max_deltaE > 0.f)) {
+                throw std::runtime_error("The maximum Delta E must be positive");
+            }
+
+            std::shared_ptr<const EXRLabImageFormat> Lab_1
+                = _cache.get(request.filename_1, request.exposure);
+            std::shared_ptr<const EXRLabImageFormat> Lab_2
+                = _cache.get(request.filename_2, request.exposure);
+
+            // The images are aligned in their pixel space, like on the
+            // command line
+            const EXRBox2i &window_1 = Lab_1->dataWindow();
+            const EXRBox2i &window_2 = Lab_2->dataWindow();
+            EXRBox2i        region;
+
+            if (!intersect(window_1, window_2, region)) {
+                throw std::runtime_error("The data windows of the images do not overlap.");
+            }
+
+            if (memcmp(&window_1, &window_2, sizeof(EXRBox2i)) != 0) {
+                err << "[warning] The data windows of the images differ, only "
+                    << "the pixels stored in both files are compared." << std::endl;
+            }
+
+            const size_t width  = size_t(region.max_x - region.min_x + 1);
+            const size_t height = size_t(region.max_y - region.min_y + 1);
+
+            OutputSettings settings;
+            settings.cmap         = &colormap(request.colormap);
+            settings.max_deltaE   = request.max_deltaE;
+            settings.displayScale = request.displayScale;
+            settings.png_level    = request.png_level;
+            settings.png_filter   = PNGStreamWriter::filterFromName(request.png_filter);
+            settings.exr_half     = request.exr_half;
+
+            MultiOutput output(width, height);
+            GateOutput *gate_output = nullptr;
+
+            if (!request.filename_out.empty()) {
+                output.add(OutputModule::create(
+                    request.filename_out,
+                    width,
+                    height,
+                    settings));
+            }
+
+            if (request.stats) {
+                output.add(new StatsOutput(width, height, request.max_deltaE, out));
+            }
+
+            if (request.gate) {
+                gate_output = new GateOutput(
+                    width,
+                    height,
+                    request.fail_above,
+                    request.max_count);
+                output.add(gate_output);
+            }
+
+            diff(*Lab_1, *Lab_2, region, output);
+
+            if (gate_output) {
+                gate_output->report(err);
+
+                if (!gate_output->passed()) {
+                    response.status = EXIT_GATE_FAILED;
+                }
+            }
+        } catch (std::exception &e) {
+            err << "[error] " << e.what() << std::endl;
+            response.status = EXIT_FAILURE;
+        }
+
+        response.out = out.str();
+        response.err = err.str();
+
+        return response;
+    }
+
+
+    const LabCache &cache() const { return _cache; }
+
+  protected:
+    const ColorMap &colormap(const std::string &name)
+    {
+        std::unique_ptr<ColorMap> &cmap = _colormaps[name];
+
+        if (!cmap) {
+            try {
+                cmap.reset(ColorMapModule::create(name, _colormap_size));
+            } catch (int) {
+                _colormaps.erase(name);
+                throw std::runtime_error("Cannot create the colormap.");
+            }
+        }
+
+        return *cmap;
+    }
+
+
+    // Compares the pixels of `region`, in the pixel space of both images
+    static void diff(
+        const EXRLabImageFormat &Lab_1,
+        const EXRLabImageFormat &Lab_2,
+        const EXRBox2i &         region,
+        DiffOutput &             output)
+    {
+        const size_t width  = size_t(region.max_x - region.min_x + 1);
+        const size_t height = size_t(region.max_y - region.min_y + 1);
+        const size_t x_1    = size_t(region.min_x - Lab_1.dataWindow().min_x);
+        const size_t y_1    = size_t(region.min_y - Lab_1.dataWindow().min_y);
+        const size_t x_2    = size_t(region.min_x - Lab_2.dataWindow().min_x);
+        const size_t y_2    = size_t(region.min_y - Lab_2.dataWindow().min_y);
+
+        output.beginBand(0, height);
+
+        #pragma omp parallel
+        {
+            std::vector<float> deltaE(width);
+
+            #pragma omp for schedule(dynamic)
+            for (size_t y = 0; y < height; y++) {
+                if (output.done()) {
+                    continue;
+                }
+
+                deltaE2000_batch(
+                    Lab_1.row(0, y_1 + y) + x_1,
+                    Lab_1.row(1, y_1 + y) + x_1,
+                    Lab_1.row(2, y_1 + y) + x_1,
+                    Lab_2.row(0, y_2 + y) + x_2,
+                    Lab_2.row(1, y_2 + y) + x_2,
+                    Lab_2.row(2, y_2 + y) + x_2,
+                    deltaE.data(),
+                    width);
+
+                output.writeRow(y, deltaE.data(), nullptr);
+            }
+        }
+
+        output.endBand();
+        output.close();
+    }
+
+  private:
+    std::string _path;
+    LabCache    _cache;
+    size_t      _colormap_size;
+
+    std::map<std::string, std::unique_ptr<ColorMap>> _colormaps;
+};
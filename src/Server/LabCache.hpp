@@ -0,0 +1,181 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+#include <sys/stat.h>
+
+#include "../ImageFormat/ImageModule.hpp"
+#include "../ImageFormat/EXRLabImageFormat.hpp"
+
+// Images already converted to Lab, kept for the next comparisons.
+//
+// Entries are keyed by path and exposure. An entry is only used while the
+// file keeps the same size, modification time and inode: a file rewritten in
+// place is loaded again. The least recently used entries are dropped when
+// the images take more than `max_bytes`. Not thread safe.
+class LabCache
+{
+  public:
+    LabCache(size_t max_bytes)
+      : _max_bytes(max_bytes)
+      , _bytes(0)
+      , _hits(0)
+      , _misses(0)
+    {}
+
+
+    // Returns the image of `filename`, loading it if it is not cached. The
+    // image stays valid after it is dropped from the cache.
+    std::shared_ptr<const EXRLabImageFormat> get(const std::string &filename, float exposure)
+    {
+        std::stringstream key;
+        key << exposure << ' ' << filename;
+
+        const Stamp stamp = stampOf(filename);
+
+        auto it = _index.find(key.str());
+
+        if (it != _index.end()) {
+            if (it->second->stamp == stamp) {
+                _hits++;
+
+                // Most recently used first
+                _entries.splice(_entries.begin(), _entries, it->second);
+
+                return it->second->image;
+            }
+
+            erase(it);
+        }
+
+        _misses++;
+
+        std::shared_ptr<const EXRLabImageFormat> image(
+            ImageModule::loadLab(filename, exposure));
+
+        const size_t bytes = bytesOf(*image);
+
+        if (bytes <= _max_bytes) {
+            Entry entry = {key.str(), stamp, image, bytes};
+            _entries.push_front(entry);
+            _index[entry.key] = _entries.begin();
+            _bytes += bytes;
+
+            while (_bytes > _max_bytes) {
+                erase(_index.find(_entries.back().key));
+            }
+        }
+
+        return image;
+    }
+
+
+    size_t bytes() const { return _bytes; }
+    size_t size() const { return _entries.size(); }
+    uint64_t hits() const { return _hits; }
+    uint64_t misses() const { return _misses; }
+
+  protected:
+    // Identifies a version of a file
+    struct Stamp
+    {
+        uint64_t size;
+        int64_t  mtime;    // Nanoseconds
+        uint64_t inode;
+
+        bool operator==(const Stamp &other) const
+        {
+            return size == other.size && mtime == other.mtime
+                   && inode == other.inode;
+        }
+    };
+
+
+    struct Entry
+    {
+        std::string                              key;
+        Stamp                                    stamp;
+        std::shared_ptr<const EXRLabImageFormat> image;
+        size_t                                   bytes;
+    };
+
+
+    static Stamp stampOf(const std::string &filename)
+    {
+        struct stat info;
+
+        if (stat(filename.c_str(), &info) != 0) {
+            throw std::runtime_error("Cannot open file: " + filename);
+        }
+
+        Stamp stamp;
+        stamp.size  = uint64_t(info.st_size);
+#if defined(__APPLE__)
+        stamp.mtime = int64_t(info.st_mtimespec.tv_sec) * 1000000000
+                      + info.st_mtimespec.tv_nsec;
+#else
+        stamp.mtime = int64_t(info.st_mtim.tv_sec) * 1000000000
+                      + info.st_mtim.tv_nsec;
+#endif
+        stamp.inode = uint64_t(info.st_ino);
+
+        return stamp;
+    }
+
+
+    static size_t bytesOf(const LabImage &image)
+    {
+        return 3 * image.stride() * image.height() * sizeof(float);
+    }
+
+
+    void erase(std::unordered_map<std::string, std::list<Entry>::iterator>::iterator it)
+    {
+        _bytes -= it->second->bytes;
+        _entries.erase(it->second);
+        _index.erase(it);
+    }
+
+  private:
+    size_t   _max_bytes;
+    size_t   _bytes;
+    uint64_t _hits, _misses;
+
+    std::list<Entry>                                         _entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> _index;
+};
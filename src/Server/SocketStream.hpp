@@ -0,0 +1,242 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Connection over a local UNIX socket, with line and byte oriented reads
+class SocketStream
+{
+  public:
+    explicit SocketStream(int fd)
+      : _fd(fd)
+      , _pos(0)
+    {}
+
+
+    virtual ~SocketStream()
+    {
+        if (_fd >= 0) {
+            ::close(_fd);
+        }
+    }
+
+
+    // Creates the socket `path` and listens on it, a stale socket file at
+    // the same path is replaced. Returns the listening descriptor.
+    static int listen(const std::string &path)
+    {
+        sockaddr_un address = makeAddress(path);
+
+        const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+
+        if (fd < 0) {
+            error("Cannot create socket", path);
+        }
+
+        ::unlink(path.c_str());
+
+        if (   ::bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0
+            || ::listen(fd, 16) != 0) {
+            ::close(fd);
+            error("Cannot listen on socket", path);
+        }
+
+        return fd;
+    }
+
+
+    // Connects to the server listening on `path`. Returns the descriptor.
+    static int connect(const std::string &path)
+    {
+        sockaddr_un address = makeAddress(path);
+
+        const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+
+        if (fd < 0) {
+            error("Cannot create socket", path);
+        }
+
+        if (::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+            ::close(fd);
+            error("Cannot connect to socket", path);
+        }
+
+        return fd;
+    }
+
+
+    // Reads up to the next '\n', which is not kept. Returns false at the end
+    // of the stream.
+    bool readLine(std::string &line)
+    {
+        line.clear();
+
+        for (;;) {
+            const size_t end = _buffer.find('\n', _pos);
+
+            if (end != std::string::npos) {
+                line.assign(_buffer, _pos, end - _pos);
+                _pos = end + 1;
+
+                return true;
+            }
+
+            if (!fill()) {
+                return false;
+            }
+        }
+    }
+
+
+    // Reads exactly `n` bytes
+    void readBytes(std::string &bytes, size_t n)
+    {
+        while (_buffer.size() - _pos < n) {
+            if (!fill()) {
+                throw std::runtime_error("Connection closed");
+            }
+        }
+
+        bytes.assign(_buffer, _pos, n);
+        _pos += n;
+    }
+
+
+    // Makes the reads and writes waiting for more than `milliseconds` throw,
+    // so a stalled peer cannot block the other end forever
+    void setTimeout(int milliseconds)
+    {
+        timeval timeout;
+        timeout.tv_sec  = milliseconds / 1000;
+        timeout.tv_usec = (milliseconds % 1000) * 1000;
+
+        if (   ::setsockopt(_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0
+            || ::setsockopt(_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) != 0) {
+            throw std::runtime_error("Cannot set the socket timeout");
+        }
+    }
+
+
+    void write(const std::string &bytes)
+    {
+        size_t written = 0;
+
+        while (written < bytes.size()) {
+            const ssize_t n
+                = ::write(_fd, bytes.data() + written, bytes.size() - written);
+
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    throw std::runtime_error("Connection timed out");
+                }
+
+                throw std::runtime_error("Connection closed");
+            }
+
+            written += size_t(n);
+        }
+    }
+
+  protected:
+    // Appends the next received bytes to the buffer. Returns false at the end
+    // of the stream, throws after the timeout, if any.
+    bool fill()
+    {
+        // Drop the bytes already read
+        _buffer.erase(0, _pos);
+        _pos = 0;
+
+        char buffer[4096];
+
+        for (;;) {
+            const ssize_t n = ::read(_fd, buffer, sizeof(buffer));
+
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                throw std::runtime_error("Connection timed out");
+            }
+
+            if (n <= 0) {
+                return false;
+            }
+
+            _buffer.append(buffer, size_t(n));
+
+            return true;
+        }
+    }
+
+
+    static sockaddr_un makeAddress(const std::string &path)
+    {
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+
+        if (path.size() >= sizeof(address.sun_path)) {
+            error("Socket path too long", path);
+        }
+
+        memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+        return address;
+    }
+
+
+    static void error(const char *msg, const std::string &path)
+    {
+        throw std::runtime_error(
+            std::string(msg) + ": " + path + " (" + strerror(errno) + ")");
+    }
+
+  private:
+    SocketStream(const SocketStream &) = delete;
+    SocketStream &operator=(const SocketStream &) = delete;
+
+    int         _fd;
+    std::string _buffer;
+    size_t      _pos;
+};
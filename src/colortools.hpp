@@ -27,6 +27,7 @@
 //
 
 #pragma once
+#include <algorithm>
 #include <cmath>
 
 
@@ -52,6 +53,199 @@ void lin_rgb_to_xyz(const Float RGB[3], Float XYZ[3])
 }
 
 
+// Matrix of lin_rgb_to_xyz(), row major, with all coefficients multiplied by
+// `scale` so an exposure compensation can be folded in
+template<class Float>
+void lin_rgb_to_xyz_matrix(Float scale, Float matrix[9])
+{
+    const Float m[9] = {
+        0.4124564, 0.3575761, 0.1804375,
+        0.2126729, 0.7151522, 0.0721750,
+        0.0193339, 0.1191920, 0.9503041};
+
+    for (int i = 0; i < 9; i++) {
+        matrix[i] = scale * m[i];
+    }
+}
+
+
+// Inverse of a row major 3x3 matrix. Returns false if it is singular.
+template<class Float>
+bool invert_matrix(const Float m[9], Float inverse[9])
+{
+    const Float c[9] = {
+        m[4] * m[8] - m[5] * m[7], m[2] * m[7] - m[1] * m[8], m[1] * m[5] - m[2] * m[4],
+        m[5] * m[6] - m[3] * m[8], m[0] * m[8] - m[2] * m[6], m[2] * m[3] - m[0] * m[5],
+        m[3] * m[7] - m[4] * m[6], m[1] * m[6] - m[0] * m[7], m[0] * m[4] - m[1] * m[3]};
+
+    const Float det = m[0] * c[0] + m[1] * c[3] + m[2] * c[6];
+
+    if (!(std::abs(det) > Float(1e-12))) {
+        return false;
+    }
+
+    for (int i = 0; i < 9; i++) {
+        inverse[i] = c[i] / det;
+    }
+
+    return true;
+}
+
+
+// Rec. 709 primaries and D65 white point, the chromaticities assumed by
+// OpenEXR when a file has no chromaticities attribute
+template<class Float>
+void rec709_chromaticities(Float chromaticities[8])
+{
+    const Float c[8] = {0.64, 0.33, 0.30, 0.60, 0.15, 0.06, 0.3127, 0.3290};
+
+    std::copy(c, c + 8, chromaticities);
+}
+
+
+// Matrix from linear RGB with the given primaries to XYZ, row major, with
+// all coefficients multiplied by `scale`. `chromaticities` are the CIE xy
+// coordinates of the red, green and blue primaries then of the white point,
+// as in the OpenEXR attribute. Colors are adapted to D65 with the Bradford
+// transform: files with different white points share the white of Lab.
+//
+// Rec. 709, Rec. 2020, ACES AP0 and AP1 primaries use tabulated matrices,
+// Rec. 709 the one of lin_rgb_to_xyz(). Others are derived, and false is
+// returned if they do not define a color space.
+template<class Float>
+bool lin_rgb_to_xyz_matrix(const Float chromaticities[8], Float scale, Float matrix[9])
+{
+    static const double known[4][17] = {
+        // Rec. 709 / sRGB
+        {0.64, 0.33, 0.30, 0.60, 0.15, 0.06, 0.3127, 0.3290,
+         0.4124564, 0.3575761, 0.1804375,
+         0.2126729, 0.7151522, 0.0721750,
+         0.0193339, 0.1191920, 0.9503041},
+        // Rec. 2020
+        {0.708, 0.292, 0.170, 0.797, 0.131, 0.046, 0.3127, 0.3290,
+         0.6369580, 0.1446169, 0.1688810,
+         0.2627002, 0.6779981, 0.0593017,
+         0.0000000, 0.0280727, 1.0609851},
+        // ACES AP0 (ACES2065-1), D60 white
+        {0.7347, 0.2653, 0.0, 1.0, 0.0001, -0.0770, 0.32168, 0.33767,
+         0.9382798, -0.0044514, 0.0166275,
+         0.3373689, 0.7295216, -0.0668905,
+         0.0011740, -0.0037107, 1.0915945},
+        // ACES AP1 (ACEScg, ACEScct), D60 white
+        {0.713, 0.293, 0.165, 0.830, 0.128, 0.044, 0.32168, 0.33767,
+         0.6522375, 0.1282361, 0.1699822,
+         0.2676722, 0.6743400, 0.0579878,
+         -0.0053818, 0.0013691, 1.0930705}};
+
+    for (int s = 0; s < 4; s++) {
+        bool match = true;
+
+        for (int i = 0; i < 8; i++) {
+            match = match && std::abs(double(chromaticities[i]) - known[s][i]) < 5e-4;
+        }
+
+        if (match) {
+            for (int i = 0; i < 9; i++) {
+                matrix[i] = scale * Float(known[s][8 + i]);
+            }
+
+            return true;
+        }
+    }
+
+    // XYZ of the primaries (columns) and of the white point, for Y = 1
+    double primaries[9], white[3];
+
+    for (int i = 0; i < 4; i++) {
+        const double x = chromaticities[2 * i];
+        const double y = chromaticities[2 * i + 1];
+
+        if (!(std::abs(y) > 1e-6)) {
+            return false;
+        }
+
+        const double XYZ[3] = {x / y, 1., (1. - x - y) / y};
+
+        for (int c = 0; c < 3; c++) {
+            if (i < 3) {
+                primaries[3 * c + i] = XYZ[c];
+            } else {
+                white[c] = XYZ[c];
+            }
+        }
+    }
+
+    // Primaries scaled so that RGB = (1, 1, 1) is the white point
+    double inverse[9];
+
+    if (!invert_matrix(primaries, inverse)) {
+        return false;
+    }
+
+    double rgb_to_xyz[9];
+
+    for (int i = 0; i < 3; i++) {
+        const double s = inverse[3 * i] * white[0] + inverse[3 * i + 1] * white[1]
+                         + inverse[3 * i + 2] * white[2];
+
+        for (int c = 0; c < 3; c++) {
+            rgb_to_xyz[3 * c + i] = primaries[3 * c + i] * s;
+        }
+    }
+
+    // Bradford adaptation from the white point to D65
+    static const double bradford[9] = {
+         0.8951, 0.2664, -0.1614,
+        -0.7502, 1.7135,  0.0367,
+         0.0389, -0.0685, 1.0296};
+
+    const double d65[3] = {0.3127 / 0.3290, 1., (1. - 0.3127 - 0.3290) / 0.3290};
+
+    double bradford_inv[9];
+    invert_matrix(bradford, bradford_inv);
+
+    double adapt[9];
+
+    for (int i = 0; i < 3; i++) {
+        double cone_src = 0., cone_dst = 0.;
+
+        for (int c = 0; c < 3; c++) {
+            cone_src += bradford[3 * i + c] * white[c];
+            cone_dst += bradford[3 * i + c] * d65[c];
+        }
+
+        if (!(std::abs(cone_src) > 1e-12)) {
+            return false;
+        }
+
+        // Rows of the cone response scaled by the ratio of the whites
+        for (int c = 0; c < 3; c++) {
+            adapt[3 * i + c] = bradford[3 * i + c] * cone_dst / cone_src;
+        }
+    }
+
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            double v = 0.;
+
+            for (int k = 0; k < 3; k++) {
+                double a = 0.;
+
+                for (int l = 0; l < 3; l++) {
+                    a += bradford_inv[3 * i + l] * adapt[3 * l + k];
+                }
+
+                v += a * rgb_to_xyz[3 * k + j];
+            }
+
+            matrix[3 * i + j] = scale * Float(v);
+        }
+    }
+
+    return true;
+}
+
+
 // XYZ with each component in [0..1]
 template<class Float>
 void xyz_to_Lab(const Float XYZ[3], Float Lab[3])
@@ -202,3 +396,98 @@ Float deltaE2000(const Float Lab_1[3], const Float Lab_2[3])
         + delta_H_r * delta_H_r
         + R_T * delta_C_r * delta_H_r);
 }
+
+
+// CIE 1976 Delta E: Euclidean distance in Lab
+template<class Float>
+Float deltaE76(const Float Lab_1[3], const Float Lab_2[3])
+{
+    const Float dL = Lab_1[0] - Lab_2[0];
+    const Float da = Lab_1[1] - Lab_2[1];
+    const Float db = Lab_1[2] - Lab_2[2];
+
+    return std::sqrt(dL * dL + da * da + db * db);
+}
+
+
+// CIE 1994 Delta E, graphic arts weights. `Lab_2` is the reference.
+template<class Float>
+Float deltaE94(const Float Lab_1[3], const Float Lab_2[3])
+{
+    const Float C_1 = std::sqrt(Lab_1[1] * Lab_1[1] + Lab_1[2] * Lab_1[2]);
+    const Float C_2 = std::sqrt(Lab_2[1] * Lab_2[1] + Lab_2[2] * Lab_2[2]);
+
+    const Float dL = Lab_1[0] - Lab_2[0];
+    const Float da = Lab_1[1] - Lab_2[1];
+    const Float db = Lab_1[2] - Lab_2[2];
+    const Float dC = C_1 - C_2;
+
+    // Rounding may make the hue difference slightly negative
+    const Float dH_2 = std::max(Float(0), da * da + db * db - dC * dC);
+
+    const Float S_C = 1. + 0.045 * C_2;
+    const Float S_H = 1. + 0.015 * C_2;
+
+    return std::sqrt(dL * dL + (dC * dC) / (S_C * S_C) + dH_2 / (S_H * S_H));
+}
+
+
+// XYZ (D65) to linear sRGB
+template<class Float>
+void xyz_to_lin_rgb(const Float XYZ[3], Float RGB[3])
+{
+    RGB[0] =  3.2404542 * XYZ[0] - 1.5371385 * XYZ[1] - 0.4985314 * XYZ[2];
+    RGB[1] = -0.9692660 * XYZ[0] + 1.8760108 * XYZ[1] + 0.0415560 * XYZ[2];
+    RGB[2] =  0.0556434 * XYZ[0] - 0.2040259 * XYZ[1] + 1.0572252 * XYZ[2];
+}
+
+
+// SMPTE ST 2084 (PQ) encoding of a luminance relative to 10000 cd/m2
+template<class Float>
+Float pq_encode(Float Y)
+{
+    const Float m1 = 0.1593017578125;
+    const Float m2 = 78.84375;
+    const Float c1 = 0.8359375;
+    const Float c2 = 18.8515625;
+    const Float c3 = 18.6875;
+
+    const Float Y_m1 = std::pow(std::max(Float(0), Y), m1);
+
+    return std::pow((c1 + c2 * Y_m1) / (1. + c3 * Y_m1), m2);
+}
+
+
+// XYZ (D65) to ICtCp (ITU-R BT.2100, PQ). `luminance` is the luminance of
+// Y = 1, in cd/m2.
+template<class Float>
+void xyz_to_ICtCp(const Float XYZ[3], Float luminance, Float ICtCp[3])
+{
+    // LMS with crosstalk, from XYZ
+    const Float LMS[3] = {
+        Float( 0.3592 * XYZ[0] + 0.6976 * XYZ[1] - 0.0358 * XYZ[2]),
+        Float(-0.1922 * XYZ[0] + 1.1004 * XYZ[1] + 0.0755 * XYZ[2]),
+        Float( 0.0070 * XYZ[0] + 0.0749 * XYZ[1] + 0.8434 * XYZ[2])};
+
+    Float LMS_p[3];
+
+    for (int i = 0; i < 3; i++) {
+        LMS_p[i] = pq_encode(LMS[i] * luminance / Float(10000.));
+    }
+
+    ICtCp[0] = 0.5 * LMS_p[0] + 0.5 * LMS_p[1];
+    ICtCp[1] = ( 6610. * LMS_p[0] - 13613. * LMS_p[1] + 7003. * LMS_p[2]) / 4096.;
+    ICtCp[2] = (17933. * LMS_p[0] - 17390. * LMS_p[1] -  543. * LMS_p[2]) / 4096.;
+}
+
+
+// Delta ITP (ITU-R BT.2124) between two ICtCp colors
+template<class Float>
+Float deltaITP(const Float ICtCp_1[3], const Float ICtCp_2[3])
+{
+    const Float dI = ICtCp_1[0] - ICtCp_2[0];
+    const Float dT = 0.5 * (ICtCp_1[1] - ICtCp_2[1]);
+    const Float dP = ICtCp_1[2] - ICtCp_2[2];
+
+    return 720. * std::sqrt(dI * dI + dT * dT + dP * dP);
+}
@@ -0,0 +1,659 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "colortools.hpp"
+#include "ImageFormat/Half.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) \
+    || defined(_M_IX86)
+#    define COLORTOOLS_X86
+#    include <immintrin.h>
+#    if defined(_MSC_VER)
+#        include <intrin.h>
+#    endif
+#endif
+
+// Instruction sets the batched kernels are compiled for. The best one
+// supported by the running CPU is picked at runtime.
+enum class SimdLevel
+{
+    Scalar = 0,
+    SSE42,
+    AVX2,
+    AVX512
+};
+
+
+namespace colortools_scalar
+{
+    static void deltaE2000_batch(
+        const float *L1,
+        const float *a1,
+        const float *b1,
+        const float *L2,
+        const float *a2,
+        const float *b2,
+        float *      out,
+        size_t       n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            const float Lab_1[3] = {L1[i], a1[i], b1[i]};
+            const float Lab_2[3] = {L2[i], a2[i], b2[i]};
+
+            out[i] = deltaE2000(Lab_1, Lab_2);
+        }
+    }
+
+
+    static void xyz_to_Lab_batch(
+        const float *X,
+        const float *Y,
+        const float *Z,
+        float *      L,
+        float *      a,
+        float *      b,
+        size_t       n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            const float xyz[3] = {X[i], Y[i], Z[i]};
+            float       Lab[3];
+
+            xyz_to_Lab(xyz, Lab);
+
+            L[i] = Lab[0];
+            a[i] = Lab[1];
+            b[i] = Lab[2];
+        }
+    }
+
+
+    static void lin_rgb_to_Lab_batch(
+        const float  rgb_to_xyz[9],
+        const float *R,
+        const float *G,
+        const float *B,
+        float *      L,
+        float *      a,
+        float *      b,
+        size_t       n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            float xyz[3], Lab[3];
+
+            for (int c = 0; c < 3; c++) {
+                xyz[c] = rgb_to_xyz[3 * c + 0] * R[i]
+                         + rgb_to_xyz[3 * c + 1] * G[i]
+                         + rgb_to_xyz[3 * c + 2] * B[i];
+            }
+
+            xyz_to_Lab(xyz, Lab);
+
+            L[i] = Lab[0];
+            a[i] = Lab[1];
+            b[i] = Lab[2];
+        }
+    }
+
+
+    static void lin_rgb_to_Lab_batch(
+        const float     rgb_to_xyz[9],
+        const uint16_t *R,
+        const uint16_t *G,
+        const uint16_t *B,
+        float *         L,
+        float *         a,
+        float *         b,
+        size_t          n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            const float r = half_to_float(R[i]);
+            const float g = half_to_float(G[i]);
+            const float v = half_to_float(B[i]);
+
+            lin_rgb_to_Lab_batch(rgb_to_xyz, &r, &g, &v, &L[i], &a[i], &b[i], 1);
+        }
+    }
+}   // namespace colortools_scalar
+
+
+#ifdef COLORTOOLS_X86
+
+// Each variant is compiled for its own instruction set, regardless of the
+// flags used for the rest of the program.
+#    if defined(__clang__)
+#        pragma clang attribute push(__attribute__((target("sse4.2"))), apply_to = function)
+#    elif defined(__GNUC__)
+#        pragma GCC push_options
+#        pragma GCC target("sse4.2")
+#    endif
+
+namespace colortools_sse42
+{
+    struct Simd {
+        typedef __m128 vf;
+        typedef __m128 vm;
+
+        static const int N = 4;
+
+        static inline vf set1(float v) { return _mm_set1_ps(v); }
+        static inline vf load(const float *p) { return _mm_loadu_ps(p); }
+
+        // F16C is not part of this level: halves are widened one by one
+        static inline vf load_half(const uint16_t *p)
+        {
+            return _mm_setr_ps(
+                half_to_float(p[0]),
+                half_to_float(p[1]),
+                half_to_float(p[2]),
+                half_to_float(p[3]));
+        }
+
+        static inline void store(float *p, vf v) { _mm_storeu_ps(p, v); }
+
+        static inline vf add(vf a, vf b) { return _mm_add_ps(a, b); }
+        static inline vf sub(vf a, vf b) { return _mm_sub_ps(a, b); }
+        static inline vf mul(vf a, vf b) { return _mm_mul_ps(a, b); }
+        static inline vf div(vf a, vf b) { return _mm_div_ps(a, b); }
+        static inline vf fmadd(vf a, vf b, vf c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+        static inline vf sqrt(vf a) { return _mm_sqrt_ps(a); }
+        static inline vf min(vf a, vf b) { return _mm_min_ps(a, b); }
+        static inline vf max(vf a, vf b) { return _mm_max_ps(a, b); }
+        static inline vf neg(vf a) { return _mm_xor_ps(a, _mm_set1_ps(-0.f)); }
+        static inline vf abs(vf a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a); }
+        static inline vf floor(vf a) { return _mm_floor_ps(a); }
+        static inline vf round(vf a) { return _mm_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+
+        static inline vm lt(vf a, vf b) { return _mm_cmplt_ps(a, b); }
+        static inline vm gt(vf a, vf b) { return _mm_cmpgt_ps(a, b); }
+        static inline vm eq(vf a, vf b) { return _mm_cmpeq_ps(a, b); }
+        static inline vm neq(vf a, vf b) { return _mm_cmpneq_ps(a, b); }
+        static inline vm mask_and(vm a, vm b) { return _mm_and_ps(a, b); }
+        static inline vm mask_andnot(vm a, vm b) { return _mm_andnot_ps(a, b); }
+        static inline vf select(vm m, vf a, vf b) { return _mm_blendv_ps(b, a, m); }
+
+        // 2^n for integral n in [-126, 127]
+        static inline vf pow2n(vf n)
+        {
+            return _mm_castsi128_ps(_mm_slli_epi32(
+                _mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)),
+                23));
+        }
+
+
+        // Rough cube root of x > 0, from its bits divided by 3
+        static inline vf cbrt_seed(vf x)
+        {
+            return _mm_castsi128_ps(_mm_add_epi32(
+                _mm_cvttps_epi32(_mm_mul_ps(
+                    _mm_cvtepi32_ps(_mm_castps_si128(x)), _mm_set1_ps(1.f / 3.f))),
+                _mm_set1_epi32(709958130)));
+        }
+    };
+
+#    include "colortools_batch_kernel.inl"
+}   // namespace colortools_sse42
+
+#    if defined(__clang__)
+#        pragma clang attribute pop
+#        pragma clang attribute push(__attribute__((target("avx2,fma,f16c"))), apply_to = function)
+#    elif defined(__GNUC__)
+#        pragma GCC pop_options
+#        pragma GCC push_options
+#        pragma GCC target("avx2,fma,f16c")
+#    endif
+
+namespace colortools_avx2
+{
+    struct Simd {
+        typedef __m256 vf;
+        typedef __m256 vm;
+
+        static const int N = 8;
+
+        static inline vf set1(float v) { return _mm256_set1_ps(v); }
+        static inline vf load(const float *p) { return _mm256_loadu_ps(p); }
+
+        static inline vf load_half(const uint16_t *p)
+        {
+            return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+        }
+
+        static inline void store(float *p, vf v) { _mm256_storeu_ps(p, v); }
+
+        static inline vf add(vf a, vf b) { return _mm256_add_ps(a, b); }
+        static inline vf sub(vf a, vf b) { return _mm256_sub_ps(a, b); }
+        static inline vf mul(vf a, vf b) { return _mm256_mul_ps(a, b); }
+        static inline vf div(vf a, vf b) { return _mm256_div_ps(a, b); }
+        static inline vf fmadd(vf a, vf b, vf c) { return _mm256_fmadd_ps(a, b, c); }
+        static inline vf sqrt(vf a) { return _mm256_sqrt_ps(a); }
+        static inline vf min(vf a, vf b) { return _mm256_min_ps(a, b); }
+        static inline vf max(vf a, vf b) { return _mm256_max_ps(a, b); }
+        static inline vf neg(vf a) { return _mm256_xor_ps(a, _mm256_set1_ps(-0.f)); }
+        static inline vf abs(vf a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a); }
+        static inline vf floor(vf a) { return _mm256_floor_ps(a); }
+        static inline vf round(vf a) { return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+
+        static inline vm lt(vf a, vf b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+        static inline vm gt(vf a, vf b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+        static inline vm eq(vf a, vf b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+        static inline vm neq(vf a, vf b) { return _mm256_cmp_ps(a, b, _CMP_NEQ_UQ); }
+        static inline vm mask_and(vm a, vm b) { return _mm256_and_ps(a, b); }
+        static inline vm mask_andnot(vm a, vm b) { return _mm256_andnot_ps(a, b); }
+        static inline vf select(vm m, vf a, vf b) { return _mm256_blendv_ps(b, a, m); }
+
+        static inline vf pow2n(vf n)
+        {
+            return _mm256_castsi256_ps(_mm256_slli_epi32(
+                _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)),
+                23));
+        }
+
+
+        // Rough cube root of x > 0, from its bits divided by 3
+        static inline vf cbrt_seed(vf x)
+        {
+            return _mm256_castsi256_ps(_mm256_add_epi32(
+                _mm256_cvttps_epi32(_mm256_mul_ps(
+                    _mm256_cvtepi32_ps(_mm256_castps_si256(x)), _mm256_set1_ps(1.f / 3.f))),
+                _mm256_set1_epi32(709958130)));
+        }
+    };
+
+#    include "colortools_batch_kernel.inl"
+}   // namespace colortools_avx2
+
+#    if defined(__clang__)
+#        pragma clang attribute pop
+#        pragma clang attribute push(__attribute__((target("avx512f"))), apply_to = function)
+#    elif defined(__GNUC__)
+#        pragma GCC pop_options
+#        pragma GCC push_options
+#        pragma GCC target("avx512f")
+// GCC 12 headers trigger false positives on _mm512_undefined_ps()
+#        pragma GCC diagnostic push
+#        pragma GCC diagnostic ignored "-Wuninitialized"
+#        pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#    endif
+
+namespace colortools_avx512
+{
+    struct Simd {
+        typedef __m512    vf;
+        typedef __mmask16 vm;
+
+        static const int N = 16;
+
+        static inline vf set1(float v) { return _mm512_set1_ps(v); }
+        static inline vf load(const float *p) { return _mm512_loadu_ps(p); }
+
+        static inline vf load_half(const uint16_t *p)
+        {
+            return _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)));
+        }
+
+        static inline void store(float *p, vf v) { _mm512_storeu_ps(p, v); }
+
+        static inline vf add(vf a, vf b) { return _mm512_add_ps(a, b); }
+        static inline vf sub(vf a, vf b) { return _mm512_sub_ps(a, b); }
+        static inline vf mul(vf a, vf b) { return _mm512_mul_ps(a, b); }
+        static inline vf div(vf a, vf b) { return _mm512_div_ps(a, b); }
+        static inline vf fmadd(vf a, vf b, vf c) { return _mm512_fmadd_ps(a, b, c); }
+        static inline vf sqrt(vf a) { return _mm512_sqrt_ps(a); }
+        static inline vf min(vf a, vf b) { return _mm512_min_ps(a, b); }
+        static inline vf max(vf a, vf b) { return _mm512_max_ps(a, b); }
+        static inline vf neg(vf a) { return _mm512_sub_ps(_mm512_setzero_ps(), a); }
+        static inline vf abs(vf a) { return _mm512_abs_ps(a); }
+        static inline vf floor(vf a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+        static inline vf round(vf a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+
+        static inline vm lt(vf a, vf b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+        static inline vm gt(vf a, vf b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+        static inline vm eq(vf a, vf b) { return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ); }
+        static inline vm neq(vf a, vf b) { return _mm512_cmp_ps_mask(a, b, _CMP_NEQ_UQ); }
+        static inline vm mask_and(vm a, vm b) { return vm(a & b); }
+        static inline vm mask_andnot(vm a, vm b) { return vm(~a & b); }
+        static inline vf select(vm m, vf a, vf b) { return _mm512_mask_blend_ps(m, b, a); }
+
+        static inline vf pow2n(vf n)
+        {
+            return _mm512_castsi512_ps(_mm512_slli_epi32(
+                _mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127)),
+                23));
+        }
+
+
+        // Rough cube root of x > 0, from its bits divided by 3
+        static inline vf cbrt_seed(vf x)
+        {
+            return _mm512_castsi512_ps(_mm512_add_epi32(
+                _mm512_cvttps_epi32(_mm512_mul_ps(
+                    _mm512_cvtepi32_ps(_mm512_castps_si512(x)), _mm512_set1_ps(1.f / 3.f))),
+                _mm512_set1_epi32(709958130)));
+        }
+    };
+
+#    include "colortools_batch_kernel.inl"
+}   // namespace colortools_avx512
+
+#    if defined(__clang__)
+#        pragma clang attribute pop
+#    elif defined(__GNUC__)
+#        pragma GCC diagnostic pop
+#        pragma GCC pop_options
+#    endif
+
+#endif   // COLORTOOLS_X86
+
+
+// Best instruction set supported by the CPU and the operating system
+inline SimdLevel simd_level_supported()
+{
+#if defined(COLORTOOLS_X86) && defined(_MSC_VER)
+    int info[4];
+
+    __cpuid(info, 1);
+
+    const bool sse42   = (info[2] & (1 << 20)) != 0;
+    const bool fma     = (info[2] & (1 << 12)) != 0;
+    const bool f16c    = (info[2] & (1 << 29)) != 0;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+
+    const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+
+    __cpuidex(info, 7, 0);
+
+    const bool avx2    = (info[1] & (1 << 5)) != 0;
+    const bool avx512f = (info[1] & (1 << 16)) != 0;
+
+    if (avx512f && (xcr0 & 0xE6) == 0xE6) return SimdLevel::AVX512;
+    if (avx2 && fma && f16c && (xcr0 & 0x06) == 0x06) return SimdLevel::AVX2;
+    if (sse42) return SimdLevel::SSE42;
+#elif defined(COLORTOOLS_X86) && defined(__GNUC__)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f")) return SimdLevel::AVX512;
+    if (   __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")
+        && __builtin_cpu_supports("f16c"))
+        return SimdLevel::AVX2;
+    if (__builtin_cpu_supports("sse4.2")) return SimdLevel::SSE42;
+#endif
+
+    return SimdLevel::Scalar;
+}
+
+
+// Computes the Delta E 2000 of n pairs of Lab colors given as separate L, a
+// and b arrays, using the instruction set `level`.
+inline void deltaE2000_batch(
+    SimdLevel    level,
+    const float *L1,
+    const float *a1,
+    const float *b1,
+    const float *L2,
+    const float *a2,
+    const float *b2,
+    float *      out,
+    size_t       n)
+{
+    switch (level) {
+#ifdef COLORTOOLS_X86
+        case SimdLevel::AVX512:
+            colortools_avx512::deltaE2000_batch(L1, a1, b1, L2, a2, b2, out, n);
+            break;
+        case SimdLevel::AVX2:
+            colortools_avx2::deltaE2000_batch(L1, a1, b1, L2, a2, b2, out, n);
+            break;
+        case SimdLevel::SSE42:
+            colortools_sse42::deltaE2000_batch(L1, a1, b1, L2, a2, b2, out, n);
+            break;
+#endif
+        default:
+            colortools_scalar::deltaE2000_batch(L1, a1, b1, L2, a2, b2, out, n);
+            break;
+    }
+}
+
+
+// Same as above with the best instruction set available
+inline void deltaE2000_batch(
+    const float *L1,
+    const float *a1,
+    const float *b1,
+    const float *L2,
+    const float *a2,
+    const float *b2,
+    float *      out,
+    size_t       n)
+{
+    static const SimdLevel level = simd_level_supported();
+
+    deltaE2000_batch(level, L1, a1, b1, L2, a2, b2, out, n);
+}
+
+
+// Converts n XYZ colors given as separate X, Y and Z arrays to Lab, using the
+// instruction set `level`. The output arrays may alias the input ones.
+inline void xyz_to_Lab_batch(
+    SimdLevel    level,
+    const float *X,
+    const float *Y,
+    const float *Z,
+    float *      L,
+    float *      a,
+    float *      b,
+    size_t       n)
+{
+    switch (level) {
+#ifdef COLORTOOLS_X86
+        case SimdLevel::AVX512:
+            colortools_avx512::xyz_to_Lab_batch(X, Y, Z, L, a, b, n);
+            break;
+        case SimdLevel::AVX2:
+            colortools_avx2::xyz_to_Lab_batch(X, Y, Z, L, a, b, n);
+            break;
+        case SimdLevel::SSE42:
+            colortools_sse42::xyz_to_Lab_batch(X, Y, Z, L, a, b, n);
+            break;
+#endif
+        default:
+            colortools_scalar::xyz_to_Lab_batch(X, Y, Z, L, a, b, n);
+            break;
+    }
+}
+
+
+// Same as above with the best instruction set available
+inline void xyz_to_Lab_batch(
+    const float *X,
+    const float *Y,
+    const float *Z,
+    float *      L,
+    float *      a,
+    float *      b,
+    size_t       n)
+{
+    static const SimdLevel level = simd_level_supported();
+
+    xyz_to_Lab_batch(level, X, Y, Z, L, a, b, n);
+}
+
+
+// Converts n linear RGB colors given as separate R, G and B arrays to XYZ.
+// `rgb_to_xyz` is a row major matrix, see lin_rgb_to_xyz_matrix(). The loop
+// is simple enough to be vectorized by the compiler.
+inline void lin_rgb_to_xyz_batch(
+    const float  rgb_to_xyz[9],
+    const float *R,
+    const float *G,
+    const float *B,
+    float *      X,
+    float *      Y,
+    float *      Z,
+    size_t       n)
+{
+    const float *m = rgb_to_xyz;
+
+    for (size_t i = 0; i < n; i++) {
+        const float r = R[i], g = G[i], b = B[i];
+
+        X[i] = m[0] * r + m[1] * g + m[2] * b;
+        Y[i] = m[3] * r + m[4] * g + m[5] * b;
+        Z[i] = m[6] * r + m[7] * g + m[8] * b;
+    }
+}
+
+
+// Same as above with half float colors
+inline void lin_rgb_to_xyz_batch(
+    const float     rgb_to_xyz[9],
+    const uint16_t *R,
+    const uint16_t *G,
+    const uint16_t *B,
+    float *         X,
+    float *         Y,
+    float *         Z,
+    size_t          n)
+{
+    const float *m = rgb_to_xyz;
+
+    for (size_t i = 0; i < n; i++) {
+        const float r = half_to_float(R[i]);
+        const float g = half_to_float(G[i]);
+        const float b = half_to_float(B[i]);
+
+        X[i] = m[0] * r + m[1] * g + m[2] * b;
+        Y[i] = m[3] * r + m[4] * g + m[5] * b;
+        Z[i] = m[6] * r + m[7] * g + m[8] * b;
+    }
+}
+
+
+// Converts n linear RGB colors given as separate R, G and B arrays to Lab in a
+// single pass, using the instruction set `level`. `rgb_to_xyz` is a row major
+// matrix, see lin_rgb_to_xyz_matrix(). The output arrays may alias the input
+// ones.
+inline void lin_rgb_to_Lab_batch(
+    SimdLevel    level,
+    const float  rgb_to_xyz[9],
+    const float *R,
+    const float *G,
+    const float *B,
+    float *      L,
+    float *      a,
+    float *      b,
+    size_t       n)
+{
+    switch (level) {
+#ifdef COLORTOOLS_X86
+        case SimdLevel::AVX512:
+            colortools_avx512::lin_rgb_to_Lab_batch(rgb_to_xyz, R, G, B, L, a, b, n);
+            break;
+        case SimdLevel::AVX2:
+            colortools_avx2::lin_rgb_to_Lab_batch(rgb_to_xyz, R, G, B, L, a, b, n);
+            break;
+        case SimdLevel::SSE42:
+            colortools_sse42::lin_rgb_to_Lab_batch(rgb_to_xyz, R, G, B, L, a, b, n);
+            break;
+#endif
+        default:
+            colortools_scalar::lin_rgb_to_Lab_batch(rgb_to_xyz, R, G, B, L, a, b, n);
+            break;
+    }
+}
+
+
+// Same as above with the best instruction set available
+inline void lin_rgb_to_Lab_batch(
+    const float  rgb_to_xyz[9],
+    const float *R,
+    const float *G,
+    const float *B,
+    float *      L,
+    float *      a,
+    float *      b,
+    size_t       n)
+{
+    static const SimdLevel level = simd_level_supported();
+
+    lin_rgb_to_Lab_batch(level, rgb_to_xyz, R, G, B, L, a, b, n);
+}
+
+
+// Same as lin_rgb_to_Lab_batch() with R, G and B given as half floats, as
+// stored in OpenEXR files. They are widened to floats in registers only, the
+// results are the same as with the values converted to floats first.
+inline void lin_rgb_to_Lab_batch(
+    SimdLevel       level,
+    const float     rgb_to_xyz[9],
+    const uint16_t *R,
+    const uint16_t *G,
+    const uint16_t *B,
+    float *         L,
+    float *         a,
+    float *         b,
+    size_t          n)
+{
+    switch (level) {
+#ifdef COLORTOOLS_X86
+        case SimdLevel::AVX512:
+            colortools_avx512::lin_rgb_to_Lab_batch(rgb_to_xyz, R, G, B, L, a, b, n);
+            break;
+        case SimdLevel::AVX2:
+            colortools_avx2::lin_rgb_to_Lab_batch(rgb_to_xyz, R, G, B, L, a, b, n);
+            break;
+        case SimdLevel::SSE42:
+            colortools_sse42::lin_rgb_to_Lab_batch(rgb_to_xyz, R, G, B, L, a, b, n);
+            break;
+#endif
+        default:
+            colortools_scalar::lin_rgb_to_Lab_batch(rgb_to_xyz, R, G, B, L, a, b, n);
+            break;
+    }
+}
+
+
+// Same as above with the best instruction set available
+inline void lin_rgb_to_Lab_batch(
+    const float     rgb_to_xyz[9],
+    const uint16_t *R,
+    const uint16_t *G,
+    const uint16_t *B,
+    float *         L,
+    float *         a,
+    float *         b,
+    size_t          n)
+{
+    static const SimdLevel level = simd_level_supported();
+
+    lin_rgb_to_Lab_batch(level, rgb_to_xyz, R, G, B, L, a, b, n);
+}
@@ -0,0 +1,585 @@
+//
+// Copyright (c) 2021 Alban Fichet <alban.fichet at gmx.fr>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+// list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation and/or
+// other materials provided with the distribution.
+//  * Neither the name of %ORGANIZATION% nor the names of its contributors may be
+// used to endorse or promote products derived from this software without specific
+// prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+// ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+
+// Kernels shared by all the SIMD variants of deltaE2000_batch(),
+// xyz_to_Lab_batch() and lin_rgb_to_Lab_batch().
+//
+// This file is included once per instruction set, inside a namespace
+// defining a `Simd` structure wrapping the intrinsics of that instruction set.
+// The hue cases are handled with masks and the transcendental functions are
+// replaced by polynomial approximations accurate to a few float ULPs.
+
+typedef Simd::vf vf;
+typedef Simd::vm vm;
+
+
+// Computes sin(x) and cos(x). x is reduced to r in [-pi/4, pi/4] with
+// x = r + k pi/2, the quadrant k mod 4 then selects the result.
+static inline void sincos_ps(vf x, vf &s, vf &c)
+{
+    const vf k = Simd::round(Simd::mul(x, Simd::set1(0.636619772f)));
+
+    // pi/2 split in three parts for an accurate reduction
+    vf r = Simd::fmadd(k, Simd::set1(-1.5703125f), x);
+    r    = Simd::fmadd(k, Simd::set1(-4.837512969970703125e-4f), r);
+    r    = Simd::fmadd(k, Simd::set1(-7.54978995489188216e-8f), r);
+
+    const vf r2 = Simd::mul(r, r);
+
+    vf ps = Simd::fmadd(
+        Simd::set1(-1.9515295891e-4f),
+        r2,
+        Simd::set1(8.3321608736e-3f));
+    ps = Simd::fmadd(ps, r2, Simd::set1(-1.6666654611e-1f));
+    ps = Simd::fmadd(Simd::mul(ps, r2), r, r);
+
+    vf pc = Simd::fmadd(
+        Simd::set1(2.443315711809948e-5f),
+        r2,
+        Simd::set1(-1.388731625493765e-3f));
+    pc = Simd::fmadd(pc, r2, Simd::set1(4.166664568298827e-2f));
+    pc = Simd::fmadd(
+        Simd::mul(pc, r2),
+        r2,
+        Simd::fmadd(r2, Simd::set1(-0.5f), Simd::set1(1.f)));
+
+    const vf q = Simd::sub(
+        k,
+        Simd::mul(Simd::set1(4.f), Simd::floor(Simd::mul(k, Simd::set1(0.25f)))));
+    const vf q_half = Simd::mul(q, Simd::set1(0.5f));
+    const vm odd    = Simd::gt(q_half, Simd::floor(q_half));
+
+    s = Simd::select(odd, pc, ps);
+    c = Simd::select(odd, ps, pc);
+
+    // sin(x) < 0 in quadrants 2 and 3, cos(x) < 0 in quadrants 1 and 2
+    s = Simd::select(Simd::gt(q, Simd::set1(1.5f)), Simd::neg(s), s);
+    c = Simd::select(
+        Simd::mask_and(
+            Simd::gt(q, Simd::set1(0.5f)),
+            Simd::lt(q, Simd::set1(2.5f))),
+        Simd::neg(c),
+        c);
+}
+
+
+// atan2(y, x) mapped to [0, 2 pi), 0 when both x and y are 0
+static inline vf atan2_pos_ps(vf y, vf x)
+{
+    const vf zero = Simd::set1(0.f);
+    const vf one  = Simd::set1(1.f);
+    const vf ax   = Simd::abs(x);
+    const vf ay   = Simd::abs(y);
+    const vf mx   = Simd::max(ax, ay);
+    const vf mn   = Simd::min(ax, ay);
+
+    vf t = Simd::select(Simd::gt(mx, zero), Simd::div(mn, mx), zero);
+
+    // atan(t) = pi/4 + atan((t - 1) / (t + 1)) for t > tan(pi/8)
+    const vm large  = Simd::gt(t, Simd::set1(0.414213562f));
+    const vf offset = Simd::select(large, Simd::set1(0.785398163f), zero);
+    t = Simd::select(large, Simd::div(Simd::sub(t, one), Simd::add(t, one)), t);
+
+    const vf z = Simd::mul(t, t);
+
+    vf p = Simd::fmadd(
+        Simd::set1(8.05374449538e-2f),
+        z,
+        Simd::set1(-1.38776856032e-1f));
+    p = Simd::fmadd(p, z, Simd::set1(1.99777106478e-1f));
+    p = Simd::fmadd(p, z, Simd::set1(-3.33329491539e-1f));
+
+    vf a = Simd::add(offset, Simd::fmadd(Simd::mul(p, z), t, t));
+
+    a = Simd::select(Simd::gt(ay, ax), Simd::sub(Simd::set1(1.570796327f), a), a);
+    a = Simd::select(Simd::lt(x, zero), Simd::sub(Simd::set1(3.141592654f), a), a);
+    a = Simd::select(Simd::lt(y, zero), Simd::sub(Simd::set1(6.283185307f), a), a);
+
+    return a;
+}
+
+
+static inline vf exp_ps(vf x)
+{
+    x = Simd::min(Simd::max(x, Simd::set1(-87.3f)), Simd::set1(88.3f));
+
+    // exp(x) = 2^n exp(r) with r = x - n ln(2)
+    const vf n = Simd::round(Simd::mul(x, Simd::set1(1.44269504089f)));
+
+    vf r = Simd::fmadd(n, Simd::set1(-0.693359375f), x);
+    r    = Simd::fmadd(n, Simd::set1(2.12194440e-4f), r);
+
+    const vf r2 = Simd::mul(r, r);
+
+    vf p = Simd::fmadd(
+        Simd::set1(1.9875691500e-4f),
+        r,
+        Simd::set1(1.3981999507e-3f));
+    p = Simd::fmadd(p, r, Simd::set1(8.3334519073e-3f));
+    p = Simd::fmadd(p, r, Simd::set1(4.1665795894e-2f));
+    p = Simd::fmadd(p, r, Simd::set1(1.6666665459e-1f));
+    p = Simd::fmadd(p, r, Simd::set1(5.0000001201e-1f));
+    p = Simd::fmadd(p, r2, Simd::add(r, Simd::set1(1.f)));
+
+    return Simd::mul(p, Simd::pow2n(n));
+}
+
+
+// Cube root of x > 0: the bit level estimate is refined by two Halley
+// iterations, each one tripling the number of correct bits.
+static inline vf cbrt_ps(vf x)
+{
+    vf y = Simd::cbrt_seed(x);
+
+    for (int i = 0; i < 2; i++) {
+        const vf y3 = Simd::mul(Simd::mul(y, y), y);
+
+        y = Simd::mul(
+            y,
+            Simd::div(
+                Simd::add(y3, Simd::add(x, x)),
+                Simd::add(Simd::add(y3, y3), x)));
+    }
+
+    return y;
+}
+
+
+// Same computation as xyz_to_Lab() in colortools.hpp, on Simd::N colors
+static inline void xyz_to_Lab_ps(vf X, vf Y, vf Z, vf &L, vf &a, vf &b)
+{
+    const vf epsilon = Simd::set1(0.008856f);
+    const vf kappa   = Simd::set1(903.3f / 116.f);
+    const vf offset  = Simd::set1(16.f / 116.f);
+
+    // D65
+    const float coefs[3] = {0.950489f, 1.f, 1.08840f};
+    const vf    xyz[3]   = {X, Y, Z};
+    vf          f[3];
+
+    for (int i = 0; i < 3; i++) {
+        const vf t = Simd::div(xyz[i], Simd::set1(coefs[i]));
+
+        f[i] = Simd::select(
+            Simd::gt(t, epsilon),
+            cbrt_ps(Simd::max(t, epsilon)),
+            Simd::fmadd(kappa, t, offset));
+    }
+
+    L = Simd::sub(Simd::mul(Simd::set1(116.f), f[1]), Simd::set1(16.f));
+    a = Simd::mul(Simd::set1(500.f), Simd::sub(f[0], f[1]));
+    b = Simd::mul(Simd::set1(200.f), Simd::sub(f[1], f[2]));
+}
+
+
+// Linear RGB to Lab, `m` being the RGB to XYZ matrix, row major
+static inline void lin_rgb_to_Lab_ps(
+    const vf m[9], vf R, vf G, vf B, vf &L, vf &a, vf &b)
+{
+    vf xyz[3];
+
+    for (int c = 0; c < 3; c++) {
+        xyz[c] = Simd::fmadd(
+            m[3 * c + 0],
+            R,
+            Simd::fmadd(m[3 * c + 1], G, Simd::mul(m[3 * c + 2], B)));
+    }
+
+    xyz_to_Lab_ps(xyz[0], xyz[1], xyz[2], L, a, b);
+}
+
+
+// Same computation as deltaE2000() in colortools.hpp, on Simd::N pairs
+static inline vf deltaE2000_ps(vf L1, vf a1, vf b1, vf L2, vf a2, vf b2)
+{
+    const vf zero   = Simd::set1(0.f);
+    const vf one    = Simd::set1(1.f);
+    const vf half   = Simd::set1(0.5f);
+    const vf pi     = Simd::set1(3.141592654f);
+    const vf two_pi = Simd::set1(6.283185307f);
+    const vf p25_7  = Simd::set1(6103515625.f);
+
+    const vf C_star_1   = Simd::sqrt(Simd::fmadd(a1, a1, Simd::mul(b1, b1)));
+    const vf C_star_2   = Simd::sqrt(Simd::fmadd(a2, a2, Simd::mul(b2, b2)));
+    const vf bar_C_star = Simd::mul(Simd::add(C_star_1, C_star_2), half);
+
+    vf bar_C_star_p7 = Simd::mul(bar_C_star, bar_C_star);
+    bar_C_star_p7    = Simd::mul(
+        Simd::mul(Simd::mul(bar_C_star_p7, bar_C_star_p7), bar_C_star_p7),
+        bar_C_star);
+
+    const vf G = Simd::mul(
+        half,
+        Simd::sub(
+            one,
+            Simd::sqrt(
+                Simd::div(bar_C_star_p7, Simd::add(bar_C_star_p7, p25_7)))));
+
+    const vf a_prime_1 = Simd::mul(Simd::add(one, G), a1);
+    const vf a_prime_2 = Simd::mul(Simd::add(one, G), a2);
+    const vf C_prime_1
+        = Simd::sqrt(Simd::fmadd(a_prime_1, a_prime_1, Simd::mul(b1, b1)));
+    const vf C_prime_2
+        = Simd::sqrt(Simd::fmadd(a_prime_2, a_prime_2, Simd::mul(b2, b2)));
+
+    const vf h_prime_1 = atan2_pos_ps(b1, a_prime_1);
+    const vf h_prime_2 = atan2_pos_ps(b2, a_prime_2);
+
+    const vf p_C_prime_12 = Simd::add(C_prime_1, C_prime_2);
+    const vm has_chroma   = Simd::neq(p_C_prime_12, zero);
+
+    // Exactly opposite hues differ by pi, whichever way the hue angles were
+    // rounded: they must not be taken for a difference larger than pi.
+    // The two products of the cross product are compared rather than
+    // subtracted so the compiler cannot contract them into an FMA.
+    const vf dot = Simd::fmadd(a_prime_1, a_prime_2, Simd::mul(b1, b2));
+    const vm opposite = Simd::mask_and(
+        Simd::eq(Simd::mul(a_prime_1, b2), Simd::mul(b1, a_prime_2)),
+        Simd::lt(dot, zero));
+
+    // Hue difference brought back to [-pi, pi]
+    const vf h_diff  = Simd::sub(h_prime_2, h_prime_1);
+    const vm wrapped = Simd::mask_andnot(opposite, Simd::gt(Simd::abs(h_diff), pi));
+
+    vf Delta_h_prime = Simd::select(
+        wrapped,
+        Simd::select(
+            Simd::gt(h_diff, zero),
+            Simd::sub(h_diff, two_pi),
+            Simd::add(h_diff, two_pi)),
+        h_diff);
+    Delta_h_prime = Simd::select(has_chroma, Delta_h_prime, zero);
+
+    vf sin_half_dh, cos_half_dh;
+    sincos_ps(Simd::mul(Delta_h_prime, half), sin_half_dh, cos_half_dh);
+
+    const vf Delta_L_prime = Simd::sub(L2, L1);
+    const vf Delta_C_prime = Simd::sub(C_prime_2, C_prime_1);
+    const vf Delta_H_prime = Simd::mul(
+        Simd::mul(Simd::set1(2.f), Simd::sqrt(Simd::mul(C_prime_1, C_prime_2))),
+        sin_half_dh);
+
+    const vf bar_L_prime = Simd::mul(Simd::add(L1, L2), half);
+    const vf bar_C_prime = Simd::mul(p_C_prime_12, half);
+
+    // Mean hue
+    const vf h_sum       = Simd::add(h_prime_1, h_prime_2);
+    const vf h_shift     = Simd::select(
+        wrapped,
+        Simd::select(Simd::lt(h_sum, two_pi), pi, Simd::neg(pi)),
+        zero);
+    const vf bar_h_prime = Simd::select(
+        has_chroma,
+        Simd::fmadd(h_sum, half, h_shift),
+        h_sum);
+
+    // The four cosines of T are expanded from a single sin / cos pair
+    vf s1, c1;
+    sincos_ps(bar_h_prime, s1, c1);
+
+    const vf c1_2 = Simd::mul(c1, c1);
+    const vf s1_2 = Simd::mul(s1, s1);
+    const vf c2   = Simd::fmadd(Simd::set1(2.f), c1_2, Simd::neg(one));
+    const vf s2   = Simd::mul(Simd::set1(2.f), Simd::mul(s1, c1));
+    const vf c3   = Simd::mul(c1, Simd::fmadd(Simd::set1(4.f), c1_2, Simd::set1(-3.f)));
+    const vf s3   = Simd::mul(s1, Simd::fmadd(Simd::set1(-4.f), s1_2, Simd::set1(3.f)));
+    const vf c4   = Simd::fmadd(Simd::set1(2.f), Simd::mul(c2, c2), Simd::neg(one));
+    const vf s4   = Simd::mul(Simd::set1(2.f), Simd::mul(s2, c2));
+
+    // 1 - 0.17 cos(h - pi/6) + 0.24 cos(2h) + 0.32 cos(3h + pi/30)
+    //   - 0.20 cos(4h - 7pi/20)
+    vf T = Simd::fmadd(c1, Simd::set1(-0.17f * 0.866025404f), one);
+    T    = Simd::fmadd(s1, Simd::set1(-0.17f * 0.5f), T);
+    T    = Simd::fmadd(c2, Simd::set1(0.24f), T);
+    T    = Simd::fmadd(c3, Simd::set1(0.32f * 0.994521895f), T);
+    T    = Simd::fmadd(s3, Simd::set1(-0.32f * 0.104528463f), T);
+    T    = Simd::fmadd(c4, Simd::set1(-0.20f * 0.453990500f), T);
+    T    = Simd::fmadd(s4, Simd::set1(-0.20f * 0.891006524f), T);
+
+    // (h * 180 / pi - 275) / 25
+    const vf exp_v = Simd::fmadd(
+        bar_h_prime,
+        Simd::set1(2.291831181f),
+        Simd::set1(-11.f));
+    const vf Delta_theta = Simd::mul(
+        Simd::set1(0.523598776f),
+        exp_ps(Simd::neg(Simd::mul(exp_v, exp_v))));
+
+    vf bar_C_prime_p7 = Simd::mul(bar_C_prime, bar_C_prime);
+    bar_C_prime_p7    = Simd::mul(
+        Simd::mul(Simd::mul(bar_C_prime_p7, bar_C_prime_p7), bar_C_prime_p7),
+        bar_C_prime);
+
+    const vf bar_L_prime_m50   = Simd::sub(bar_L_prime, Simd::set1(50.f));
+    const vf bar_L_prime_m50_2 = Simd::mul(bar_L_prime_m50, bar_L_prime_m50);
+
+    const vf R_C = Simd::mul(
+        Simd::set1(2.f),
+        Simd::sqrt(
+            Simd::div(bar_C_prime_p7, Simd::add(bar_C_prime_p7, p25_7))));
+    const vf S_L = Simd::add(
+        one,
+        Simd::div(
+            Simd::mul(Simd::set1(0.015f), bar_L_prime_m50_2),
+            Simd::sqrt(Simd::add(Simd::set1(20.f), bar_L_prime_m50_2))));
+    const vf S_C = Simd::fmadd(Simd::set1(0.045f), bar_C_prime, one);
+    const vf S_H
+        = Simd::fmadd(Simd::mul(Simd::set1(0.015f), bar_C_prime), T, one);
+
+    vf sin_2dt, cos_2dt;
+    sincos_ps(Simd::mul(Simd::set1(2.f), Delta_theta), sin_2dt, cos_2dt);
+
+    const vf R_T = Simd::neg(Simd::mul(sin_2dt, R_C));
+
+    const vf delta_L_r = Simd::div(Delta_L_prime, S_L);
+    const vf delta_C_r = Simd::div(Delta_C_prime, S_C);
+    const vf delta_H_r = Simd::div(Delta_H_prime, S_H);
+
+    vf sum = Simd::mul(delta_L_r, delta_L_r);
+    sum    = Simd::fmadd(delta_C_r, delta_C_r, sum);
+    sum    = Simd::fmadd(delta_H_r, delta_H_r, sum);
+    sum    = Simd::fmadd(Simd::mul(R_T, delta_C_r), delta_H_r, sum);
+
+    return Simd::sqrt(sum);
+}
+
+
+static void deltaE2000_batch(
+    const float *L1,
+    const float *a1,
+    const float *b1,
+    const float *L2,
+    const float *a2,
+    const float *b2,
+    float *      out,
+    size_t       n)
+{
+    size_t i = 0;
+
+    for (; i + Simd::N <= n; i += Simd::N) {
+        Simd::store(
+            &out[i],
+            deltaE2000_ps(
+                Simd::load(&L1[i]),
+                Simd::load(&a1[i]),
+                Simd::load(&b1[i]),
+                Simd::load(&L2[i]),
+                Simd::load(&a2[i]),
+                Simd::load(&b2[i])));
+    }
+
+    // Remaining elements go through a zero padded vector
+    if (i < n) {
+        float in[6][Simd::N] = {};
+        float res[Simd::N];
+
+        for (size_t j = 0; i + j < n; j++) {
+            in[0][j] = L1[i + j];
+            in[1][j] = a1[i + j];
+            in[2][j] = b1[i + j];
+            in[3][j] = L2[i + j];
+            in[4][j] = a2[i + j];
+            in[5][j] = b2[i + j];
+        }
+
+        Simd::store(
+            res,
+            deltaE2000_ps(
+                Simd::load(in[0]),
+                Simd::load(in[1]),
+                Simd::load(in[2]),
+                Simd::load(in[3]),
+                Simd::load(in[4]),
+                Simd::load(in[5])));
+
+        for (size_t j = 0; i + j < n; j++) {
+            out[i + j] = res[j];
+        }
+    }
+}
+
+
+static void xyz_to_Lab_batch(
+    const float *X,
+    const float *Y,
+    const float *Z,
+    float *      L,
+    float *      a,
+    float *      b,
+    size_t       n)
+{
+    size_t i = 0;
+    vf     Lab[3];
+
+    for (; i + Simd::N <= n; i += Simd::N) {
+        xyz_to_Lab_ps(
+            Simd::load(&X[i]),
+            Simd::load(&Y[i]),
+            Simd::load(&Z[i]),
+            Lab[0],
+            Lab[1],
+            Lab[2]);
+
+        Simd::store(&L[i], Lab[0]);
+        Simd::store(&a[i], Lab[1]);
+        Simd::store(&b[i], Lab[2]);
+    }
+
+    // Remaining elements go through a zero padded vector
+    if (i < n) {
+        float in[3][Simd::N] = {};
+        float res[3][Simd::N];
+
+        for (size_t j = 0; i + j < n; j++) {
+            in[0][j] = X[i + j];
+            in[1][j] = Y[i + j];
+            in[2][j] = Z[i + j];
+        }
+
+        xyz_to_Lab_ps(
+            Simd::load(in[0]),
+            Simd::load(in[1]),
+            Simd::load(in[2]),
+            Lab[0],
+            Lab[1],
+            Lab[2]);
+
+        for (int c = 0; c < 3; c++) {
+            Simd::store(res[c], Lab[c]);
+        }
+
+        for (size_t j = 0; i + j < n; j++) {
+            L[i + j] = res[0][j];
+            a[i + j] = res[1][j];
+            b[i + j] = res[2][j];
+        }
+    }
+}
+
+
+// Loads Simd::N linear RGB values, stored as floats or half floats
+static inline vf load_rgb(const float *p) { return Simd::load(p); }
+static inline vf load_rgb(const uint16_t *p) { return Simd::load_half(p); }
+
+
+template<typename T>
+static void lin_rgb_to_Lab_batch_impl(
+    const float  rgb_to_xyz[9],
+    const T *    R,
+    const T *    G,
+    const T *    B,
+    float *      L,
+    float *      a,
+    float *      b,
+    size_t       n)
+{
+    vf m[9];
+
+    for (int j = 0; j < 9; j++) {
+        m[j] = Simd::set1(rgb_to_xyz[j]);
+    }
+
+    size_t i = 0;
+    vf     Lab[3];
+
+    for (; i + Simd::N <= n; i += Simd::N) {
+        lin_rgb_to_Lab_ps(
+            m,
+            load_rgb(&R[i]),
+            load_rgb(&G[i]),
+            load_rgb(&B[i]),
+            Lab[0],
+            Lab[1],
+            Lab[2]);
+
+        Simd::store(&L[i], Lab[0]);
+        Simd::store(&a[i], Lab[1]);
+        Simd::store(&b[i], Lab[2]);
+    }
+
+    // Remaining elements go through a zero padded vector
+    if (i < n) {
+        T     in[3][Simd::N] = {};
+        float res[3][Simd::N];
+
+        for (size_t j = 0; i + j < n; j++) {
+            in[0][j] = R[i + j];
+            in[1][j] = G[i + j];
+            in[2][j] = B[i + j];
+        }
+
+        lin_rgb_to_Lab_ps(
+            m,
+            load_rgb(in[0]),
+            load_rgb(in[1]),
+            load_rgb(in[2]),
+            Lab[0],
+            Lab[1],
+            Lab[2]);
+
+        for (int c = 0; c < 3; c++) {
+            Simd::store(res[c], Lab[c]);
+        }
+
+        for (size_t j = 0; i + j < n; j++) {
+            L[i + j] = res[0][j];
+            a[i + j] = res[1][j];
+            b[i + j] = res[2][j];
+        }
+    }
+}
+
+
+static void lin_rgb_to_Lab_batch(
+    const float  rgb_to_xyz[9],
+    const float *R,
+    const float *G,
+    const float *B,
+    float *      L,
+    float *      a,
+    float *      b,
+    size_t       n)
+{
+    lin_rgb_to_Lab_batch_impl(rgb_to_xyz, R, G, B, L, a, b, n);
+}
+
+
+// Half float input, widened in registers only
+static void lin_rgb_to_Lab_batch(
+    const float     rgb_to_xyz[9],
+    const uint16_t *R,
+    const uint16_t *G,
+    const uint16_t *B,
+    float *         L,
+    float *         a,
+    float *         b,
+    size_t          n)
+{
+    lin_rgb_to_Lab_batch_impl(rgb_to_xyz, R, G, B, L, a, b, n);
+}
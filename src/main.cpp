@@ -26,20 +26,79 @@
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 //
 
+#include <algorithm>
+#include <climits>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
 #include <iostream>
 #include <memory>
 #include <sstream>
 #include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
+#ifdef _OPENMP
+#    include <omp.h>
+#endif
+
 #include "colortools.hpp"
+#include "colortools_batch.hpp"
 
-#include <lodepng.h>
 #include <tclap/CmdLine.h>
 
 #include "ImageFormat/ImageModule.hpp"
+#include "ImageFormat/EXRBandReader.hpp"
+#include "ImageFormat/PNGStreamWriter.hpp"
 #include "ColorMap/ColorMapModule.hpp"
+#include "Output/OutputModule.hpp"
+#include "Output/StatsOutput.hpp"
+#include "Output/SampledStatsOutput.hpp"
+#include "Output/MultiOutput.hpp"
+#include "Output/GateOutput.hpp"
+#include "Batch/BatchRunner.hpp"
+#include "Cache/LabDiskCache.hpp"
+#include "Metric/MetricEngine.hpp"
+#include "Diff/Region.hpp"
+#include "Diff/DiffFiles.hpp"
+#include "Diff/Layers.hpp"
+
+#ifndef _WIN32
+#include "Server/DiffServer.hpp"
+#include "Server/DiffClient.hpp"
+#endif
+
+
+// Layers of a part of each file, compared together
+struct PartDiff
+{
+    PartDiff(int part_1, int part_2)
+      : part_1(part_1)
+      , part_2(part_2)
+      , reader_1(nullptr)
+      , reader_2(nullptr)
+      , band_rows(0)
+    {}
+
+    int            part_1, part_2;
+    EXRBandReader *reader_1;
+    EXRBandReader *reader_2;
+
+    std::unique_ptr<EXRBandReader> mask;
+
+    EXRBox2i                 region;
+    std::vector<std::string> layers_1, layers_2, ids;
+    std::vector<std::string> output_ids;    // Layer and metric of each output
+
+    std::vector<std::unique_ptr<DiffOutput>> outputs;    // Per layer and metric
+    std::vector<GateOutput *>                gates;      // Per layer, first metric
+    size_t                                   band_rows;
+    std::vector<Band>                        bands;      // Rows compared
+};
+
 
 int main(int argc, char *argv[])
 {
@@ -48,29 +107,61 @@ int main(int argc, char *argv[])
     std::string filename_out;
 
     std::string colormap_name;
-
-    float max_deltaE;
-    float exposure;
-    bool  displayScale;
-
-    std::unique_ptr<XYZImage> image_1;
-    std::unique_ptr<XYZImage> image_2;
+    size_t      colormap_size;
+
+    float  max_deltaE;
+    float  exposure;
+    bool   displayScale;
+    size_t max_memory;
+    int    png_level;
+    bool   exr_half;
+    bool   stats;
+    bool   gate;
+    float  fail_above;
+
+    uint64_t max_count;
+
+    std::string manifest;
+    std::string serve_path;
+    std::string client_path;
+    size_t      cache_size;
+    std::string cache_dir;
+    bool        decode_all;
+    std::string png_filter_name;
+    std::string filename_mask;
+    std::string layers;
+    std::string metrics;
+    float       approx;
+
+    MetricParameters metric_parameters;
+    bool             default_max;
+
+    // Pixels to compare, all by default
+    EXRBox2i roi;
+    roi.min_x = roi.min_y = INT_MIN;
+    roi.max_x = roi.max_y = INT_MAX;
+
+    PNGFilter png_filter;
 
     std::unique_ptr<ColorMap> cmap;
 
-    std::vector<unsigned char> rgb_out;
-
     // Parse command line
     try {
         TCLAP::CmdLine cmd("Difference tool for OpenEXR files", ' ', "0.1");
 
-        TCLAP::UnlabeledValueArg<std::string>
-            file_1Arg("file1", "File 1", true, "input_1.exr", "input file 1");
-        TCLAP::UnlabeledValueArg<std::string>
-            file_2Arg("file2", "File 2", true, "input_2.exr", "input file 2");
+        // The two input files, not given in batch mode
+        TCLAP::UnlabeledMultiArg<std::string>
+            filesArg("files", "Files to compare", false, "file1 file2");
 
         TCLAP::ValueArg<std::string>
-            fileoutArg("o", "output", "Output file", true, "out.png", "string");
+            fileoutArg(
+                "o",
+                "output",
+                "Output file: .png for the color mapped Delta E, .exr or .npy "
+                "for the raw Delta E values",
+                false,
+                "",
+                "string");
         TCLAP::SwitchArg scaleSwitch(
             "s",
             "scale",
@@ -98,135 +189,765 @@ int main(int argc, char *argv[])
             false,
             "bbgr",
             "bbgr, magma, inferno, plasma, viridis");
+        TCLAP::ValueArg<size_t> colormapSizeArg(
+            "",
+            "colormap-size",
+            "Number of entries of the lookup table the color map is sampled "
+            "in",
+            false,
+            ColorMap::default_lut_size,
+            "Integer");
+        TCLAP::ValueArg<int> pngLevelArg(
+            "",
+            "png-level",
+            "Compression level of the output PNG file, from 0 (fastest) to 9 "
+            "(smallest)",
+            false,
+            6,
+            "Integer");
+        TCLAP::ValueArg<std::string> pngFilterArg(
+            "",
+            "png-filter",
+            "Row filter of the output PNG file",
+            false,
+            "adaptive",
+            "none, sub, up, average, paeth, adaptive");
+        TCLAP::SwitchArg statsSwitch(
+            "",
+            "stats",
+            "Print a summary of the Delta E as JSON on the standard output. "
+            "No output file is needed.",
+            cmd,
+            false);
+        TCLAP::ValueArg<float> failAboveArg(
+            "",
+            "fail-above",
+            "Fail when more than --max-count pixels have a Delta E above "
+            "this value. The exit status is then 2. The processing stops "
+            "as soon as the result is known when there is no other output.",
+            false,
+            2.3f,
+            "Float");
+        TCLAP::ValueArg<uint64_t> maxCountArg(
+            "",
+            "max-count",
+            "Number of pixels allowed above the --fail-above value",
+            false,
+            0,
+            "Integer");
+        TCLAP::SwitchArg halfSwitch(
+            "",
+            "half",
+            "Write the Delta E values as half floats (EXR output).",
+            cmd,
+            false);
+        TCLAP::ValueArg<std::string> batchArg(
+            "",
+            "batch",
+            "Run all the comparisons listed in a manifest, one \"<file 1> "
+            "<file 2> <output>\" line each, in a single process",
+            false,
+            "",
+            "manifest");
+        TCLAP::ValueArg<std::string> serveArg(
+            "",
+            "serve",
+            "Stay resident and answer the comparisons requested with "
+            "--client on this UNIX socket, keeping the decoded images in "
+            "a cache",
+            false,
+            "",
+            "socket");
+        TCLAP::ValueArg<std::string> clientArg(
+            "",
+            "client",
+            "Run the comparison on the server listening on this UNIX socket",
+            false,
+            "",
+            "socket");
+        TCLAP::ValueArg<size_t> cacheSizeArg(
+            "",
+            "cache-size",
+            "Memory used by the server to keep decoded images (in MiB)",
+            false,
+            2048,
+            "MiB");
+        TCLAP::SwitchArg decodeAllSwitch(
+            "",
+            "decode-all",
+            "Decode all the pixels, even the ones stored in chunks identical "
+            "in both files, which otherwise get a Delta E of 0 without being "
+            "decoded, NaN and infinite values included.",
+            cmd,
+            false);
+        TCLAP::ValueArg<std::string> cacheDirArg(
+            "",
+            "cache-dir",
+            "Keep the second file, the reference, converted to Lab in this "
+            "directory for the next comparisons",
+            false,
+            "",
+            "directory");
+        TCLAP::ValueArg<std::string> roiArg(
+            "",
+            "roi",
+            "Only compare the pixels of this region, given in the pixel "
+            "space of the files",
+            false,
+            "",
+            "x,y,width,height");
+        TCLAP::ValueArg<std::string> maskArg(
+            "",
+            "mask",
+            "Only compare the pixels with a luminance above 0 in this "
+            "OpenEXR file. The other pixels are transparent in PNG outputs, "
+            "NaN in raw outputs and ignored by --stats and --fail-above.",
+            false,
+            "",
+            "mask.exr");
+        TCLAP::ValueArg<std::string> layersArg(
+            "",
+            "layers",
+            "Compare these layers, matched by name in both files, or all the "
+            "layers found in both files. Layers are named after their part "
+            "in multipart files, then after the prefix of their channels. "
+            "Each layer gets its own output file, named after it, and "
+            "summary.",
+            false,
+            "",
+            "all or name,name,...");
+        TCLAP::ValueArg<std::string> metricsArg(
+            "",
+            "metrics",
+            "Compute these metrics, all in a single pass: de2000, de76 and "
+            "de94 (CIE Delta E), itp (Delta ITP), abs and rel (absolute and "
+            "relative error of linear RGB), rmse (root mean squared error), "
+            "psnr (squared error, summarized as a PSNR with --stats), flip "
+            "(HDR-FLIP), ssim and msssim (1 - SSIM and 1 - MS-SSIM of L*). "
+            "flip, ssim and msssim are computed on the whole images. With "
+            "several metrics, each gets its own output file, named after it, "
+            "and summary, and --fail-above applies to the first one.",
+            false,
+            "de2000",
+            "name,name,...");
+        TCLAP::ValueArg<float> whiteLuminanceArg(
+            "",
+            "white-luminance",
+            "Luminance of a pixel of luminance 1 (in cd/m2) for the metrics "
+            "on absolute luminances, like itp",
+            false,
+            100.f,
+            "Float");
+        TCLAP::ValueArg<float> pixelsPerDegreeArg(
+            "",
+            "pixels-per-degree",
+            "Pixels per degree of visual angle for the metrics depending on "
+            "the viewing conditions, like flip. 67 is a 0.7 m wide 4K monitor "
+            "seen from 0.7 m.",
+            false,
+            67.02f,
+            "Float");
+        TCLAP::ValueArg<size_t> ssimWindowArg(
+            "",
+            "ssim-window",
+            "Width of the windows of the ssim and msssim metrics, in pixels",
+            false,
+            7,
+            "Odd integer");
+        TCLAP::ValueArg<float> approxArg(
+            "",
+            "approx",
+            "Estimate the --stats summary from this fraction of the rows, "
+            "drawn across the image, and give 95% confidence intervals. The "
+            "maximum is then the one of the rows compared.",
+            false,
+            0.05f,
+            "Float");
+        TCLAP::ValueArg<size_t> maxMemoryArg(
+            "",
+            "max-memory",
+            "Process the images by bands so the memory used stays under this "
+            "budget (in MiB). The whole images are loaded when not set.",
+            false,
+            0,
+            "MiB");
 
-        cmd.add(file_1Arg);
-        cmd.add(file_2Arg);
+        cmd.add(filesArg);
 
         cmd.add(fileoutArg);
         cmd.add(maxArg);
         cmd.add(exposureArg);
         cmd.add(colormapArg);
+        cmd.add(colormapSizeArg);
+        cmd.add(pngLevelArg);
+        cmd.add(pngFilterArg);
+        cmd.add(maxMemoryArg);
+        cmd.add(failAboveArg);
+        cmd.add(maxCountArg);
+        cmd.add(batchArg);
+        cmd.add(serveArg);
+        cmd.add(clientArg);
+        cmd.add(cacheSizeArg);
+        cmd.add(cacheDirArg);
+        cmd.add(roiArg);
+        cmd.add(maskArg);
+        cmd.add(layersArg);
+        cmd.add(metricsArg);
+        cmd.add(whiteLuminanceArg);
+        cmd.add(pixelsPerDegreeArg);
+        cmd.add(ssimWindowArg);
+        cmd.add(approxArg);
 
         cmd.parse(argc, argv);
 
-        filename_1    = file_1Arg.getValue();
-        filename_2    = file_2Arg.getValue();
         filename_out  = fileoutArg.getValue();
         colormap_name = colormapArg.getValue();
+        colormap_size = colormapSizeArg.getValue();
 
         max_deltaE   = maxArg.getValue();
         exposure     = exposureArg.getValue();
         displayScale = scaleSwitch.getValue();
+        max_memory   = maxMemoryArg.getValue() * 1024 * 1024;
+        png_level    = pngLevelArg.getValue();
+        exr_half     = halfSwitch.getValue();
+        stats        = statsSwitch.getValue();
+        gate         = failAboveArg.isSet();
+        fail_above   = failAboveArg.getValue();
+        max_count    = maxCountArg.getValue();
+        manifest     = batchArg.getValue();
+        serve_path   = serveArg.getValue();
+        client_path  = clientArg.getValue();
+        cache_size   = cacheSizeArg.getValue() * 1024 * 1024;
+        cache_dir    = cacheDirArg.getValue();
+        decode_all   = decodeAllSwitch.getValue();
+
+        filename_mask = maskArg.getValue();
+        layers        = layersArg.getValue();
+
+        metrics = metricsArg.getValue();
+        approx  = approxArg.isSet() ? approxArg.getValue() : 0.f;
+
+        metric_parameters.white_luminance   = whiteLuminanceArg.getValue();
+        metric_parameters.pixels_per_degree = pixelsPerDegreeArg.getValue();
+        metric_parameters.ssim_window       = ssimWindowArg.getValue();
+
+        default_max = !maxArg.isSet();
+
+        if (!roiArg.getValue().empty()) {
+            roi = parse_roi(roiArg.getValue());
+        }
+
+        const std::vector<std::string> &files = filesArg.getValue();
+
+        if (  int(!manifest.empty()) + int(!serve_path.empty())
+            + int(!client_path.empty()) > 1) {
+            throw std::runtime_error(
+                "Only one of --batch, --serve and --client can be used");
+        }
+
+        if (!client_path.empty() && max_memory > 0) {
+            throw std::runtime_error(
+                "--max-memory is not available with --client");
+        }
+
+        if (   !cache_dir.empty()
+            && (!manifest.empty() || !serve_path.empty() || !client_path.empty())) {
+            throw std::runtime_error(
+                "--cache-dir is only available for a single comparison");
+        }
+
+        if (!cache_dir.empty() && !layers.empty()) {
+            throw std::runtime_error("--cache-dir is not available with --layers");
+        }
+
+        if (   (roiArg.isSet() || !filename_mask.empty() || !layers.empty())
+            && (!manifest.empty() || !serve_path.empty() || !client_path.empty())) {
+            throw std::runtime_error(
+                "--roi, --mask and --layers are only available for a single "
+                "comparison");
+        }
+
+        if (   (   metricsArg.isSet() || whiteLuminanceArg.isSet()
+                || pixelsPerDegreeArg.isSet() || ssimWindowArg.isSet())
+            && (!manifest.empty() || !serve_path.empty() || !client_path.empty())) {
+            throw std::runtime_error(
+                "--metrics, --white-luminance, --pixels-per-degree and "
+                "--ssim-window are only available for a single comparison");
+        }
+
+        if (approxArg.isSet()) {
+            if (!(approx > 0.f && approx <= 1.f)) {
+                throw std::runtime_error("The --approx fraction must be in ]0..1]");
+            }
+
+            if (!manifest.empty() || !serve_path.empty() || !client_path.empty()) {
+                throw std::runtime_error(
+                    "--approx is only available for a single comparison");
+            }
+
+            if (!stats || !filename_out.empty() || gate || !cache_dir.empty()) {
+                throw std::runtime_error(
+                    "--approx only estimates the --stats summary, it is not "
+                    "available with an output file, --fail-above or "
+                    "--cache-dir");
+            }
+        }
+
+        if (metric_parameters.pixels_per_degree <= 0.f) {
+            throw std::runtime_error("The pixels per degree must be positive");
+        }
+
+        if (metric_parameters.ssim_window % 2 == 0) {
+            throw std::runtime_error("The SSIM window width must be odd");
+        }
+
+        if (!serve_path.empty()) {
+            if (!files.empty() || !filename_out.empty() || stats || gate) {
+                throw std::runtime_error(
+                    "Files and outputs are given by the clients in server "
+                    "mode");
+            }
+        } else if (!manifest.empty()) {
+            if (!files.empty() || !filename_out.empty()) {
+                throw std::runtime_error(
+                    "Input and output files are given by the manifest in "
+                    "batch mode");
+            }
+
+            if (stats || gate || max_memory > 0) {
+                throw std::runtime_error(
+                    "--stats, --fail-above and --max-memory are not "
+                    "available in batch mode");
+            }
+        } else if (files.size() != 2) {
+            throw std::runtime_error("Two input files are required");
+        } else {
+            filename_1 = files[0];
+            filename_2 = files[1];
+        }
+
+        if (   manifest.empty() && serve_path.empty()
+            && filename_out.empty() && !stats && !gate) {
+            throw std::runtime_error(
+                "An output file, --stats or --fail-above is required");
+        }
+
+        png_filter_name = pngFilterArg.getValue();
+        png_filter      = PNGStreamWriter::filterFromName(png_filter_name);
+
+        if (png_level < 0 || png_level > 9) {
+            throw std::runtime_error("The PNG compression level must be in [0..9]");
+        }
+
+        if (!(max_deltaE > 0.f)) {
+            throw std::runtime_error("The maximum Delta E must be positive");
+        }
     } catch (TCLAP::ArgException &e) {
         std::cerr << "[error] " << e.error() << " for arg " << e.argId()
                   << std::endl;
 
+        return EXIT_FAILURE;
+    } catch (std::exception &e) {
+        std::cerr << "[error] " << e.what() << std::endl;
+
         return EXIT_FAILURE;
     }
 
-    // Ensure the output file is in a PNG format
-    if (filename_out.size() < 5) {
-        std::cerr << "[error] Wrong output filename: does not contain .png extension" << std::endl;
+#ifndef _WIN32
+    if (!serve_path.empty()) {
+        try {
+            DiffServer server(serve_path, cache_size, colormap_size);
+            server.run();
+        } catch (std::exception &e) {
+            std::cerr << "[error] " << e.what() << std::endl;
+        }
 
         return EXIT_FAILURE;
     }
 
-    const char *filename_out_ext = &filename_out.c_str()[filename_out.size() - 4];
+    if (!client_path.empty()) {
+        DiffRequest request;
+        request.filename_1   = filename_1;
+        request.filename_2   = filename_2;
+        request.filename_out = filename_out;
+        request.exposure     = exposure;
+        request.max_deltaE   = max_deltaE;
+        request.displayScale = displayScale;
+        request.colormap     = colormap_name;
+        request.png_level    = png_level;
+        request.png_filter   = png_filter_name;
+        request.exr_half     = exr_half;
+        request.stats        = stats;
+        request.gate         = gate;
+        request.fail_above   = fail_above;
+        request.max_count    = max_count;
+
+        try {
+            return DiffClient::run(client_path, request);
+        } catch (std::exception &e) {
+            std::cerr << "[error] " << e.what() << std::endl;
+
+            return EXIT_FAILURE;
+        }
+    }
+#else
+    if (!serve_path.empty() || !client_path.empty()) {
+        std::cerr << "[error] --serve and --client are not available on this "
+                  << "platform." << std::endl;
 
-    if (   strcmp(filename_out_ext, ".png") != 0
-        && strcmp(filename_out_ext, ".PNG") != 0) {
-        std::cerr << "[error] Wrong file extension for output." << std::endl;
-        std::cerr << "[error] Supported extensions: .png, .PNG" << std::endl;
+        return EXIT_FAILURE;
+    }
+#endif
+
+    // Create the colormap
+    try {
+        cmap = std::unique_ptr<ColorMap>(ColorMapModule::create(colormap_name, colormap_size));
+    } catch (int e) {
+        std::cerr << "[error] Cannot create the colormap." << std::endl;
 
         return EXIT_FAILURE;
     }
 
-    // Load the two EXR files to compare
+    OutputSettings settings;
+    settings.cmap         = cmap.get();
+    settings.max_deltaE   = max_deltaE;
+    settings.displayScale = displayScale;
+    settings.png_level    = png_level;
+    settings.png_filter   = png_filter;
+    settings.exr_half     = exr_half;
+
+    if (!manifest.empty()) {
+        try {
+            std::vector<BatchJob> jobs = Manifest::read(manifest);
+
+            BatchRunner  runner(exposure, settings);
+            const size_t n_failed = runner.run(jobs);
+
+            std::cerr << "[batch] " << jobs.size() - n_failed << " of "
+                      << jobs.size() << " comparisons done." << std::endl;
+
+            return (n_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+        } catch (std::exception &e) {
+            std::cerr << "[error] " << e.what() << std::endl;
+
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Read the headers only, so incompatible files are reported before the
+    // pixels are decoded
+    std::vector<std::unique_ptr<EXRBandReader>> parts_1, parts_2, extra_parts;
+    std::vector<LayerPair>                      pairs;
+    std::unique_ptr<MetricEngine>               engine;
+
     try {
-        image_1 = std::unique_ptr<XYZImage>(ImageModule::load(filename_1.c_str(), exposure));
-        image_2 = std::unique_ptr<XYZImage>(ImageModule::load(filename_2.c_str(), exposure));
+        engine.reset(new MetricEngine(MetricEngine::parse(metrics), metric_parameters));
+
+        if (approx > 0.f && engine->spatial()) {
+            throw std::runtime_error(
+                "--approx is not available with the metrics computed on the "
+                "whole images");
+        }
+
+        // Values in [0, 1] are shown in full
+        if (default_max && engine->metric(0).unit) {
+            max_deltaE          = 1.f;
+            settings.max_deltaE = max_deltaE;
+        }
+
+        parts_1 = open_parts(filename_1, exposure);
+        parts_2 = open_parts(filename_2, exposure);
+        pairs   = match_layers(parts_1, parts_2, filename_1, filename_2, layers);
     } catch (std::exception& e) {
         std::cerr << "[error] " << e.what() << std::endl;
 
         return EXIT_FAILURE;
     }
 
-    // Ensure they have the same dimensions
-    if (   image_1->width()  != image_2->width()
-        || image_2->height() != image_2->height()) {
-        std::cerr << "[error] Image dimensions mismatch." << std::endl;
+    // Outputs are named after the layers when they are selected, and after
+    // the metrics when there are several
+    const bool named = !layers.empty() || engine->size() > 1;
 
-        return EXIT_FAILURE;
-    }
+    std::vector<std::unique_ptr<PartDiff>> diffs;
 
-    // Create the colormap
     try {
-        cmap = std::unique_ptr<ColorMap>(ColorMapModule::create(colormap_name));
-    } catch (int e) {
-        std::cerr << "[error] Cannot create the colormap." << std::endl;
+        // Layers stored in the same parts are compared together: their
+        // chunks are decoded once
+        for (size_t i = 0; i < pairs.size(); i++) {
+            PartDiff *diff = nullptr;
+
+            for (size_t d = 0; d < diffs.size(); d++) {
+                if (   diffs[d]->part_1 == pairs[i].part_1
+                    && diffs[d]->part_2 == pairs[i].part_2) {
+                    diff = diffs[d].get();
+                }
+            }
+
+            if (!diff) {
+                diffs.emplace_back(new PartDiff(pairs[i].part_1, pairs[i].part_2));
+                diff = diffs.back().get();
+            }
+
+            diff->layers_1.push_back(pairs[i].layer_1);
+            diff->layers_2.push_back(pairs[i].layer_2);
+            diff->ids.push_back(pairs[i].id);
+        }
+
+        std::vector<char> used_1(parts_1.size(), 0), used_2(parts_2.size(), 0);
+
+        for (size_t d = 0; d < diffs.size(); d++) {
+            PartDiff &diff = *diffs[d];
+
+            // A part compared with several parts of the other file gets a
+            // reader for each comparison
+            diff.reader_1 = parts_1[diff.part_1].get();
+            diff.reader_2 = parts_2[diff.part_2].get();
+
+            if (used_1[diff.part_1]++) {
+                extra_parts.emplace_back(ImageModule::open(filename_1, exposure, diff.part_1));
+                diff.reader_1 = extra_parts.back().get();
+            }
+
+            if (used_2[diff.part_2]++) {
+                extra_parts.emplace_back(ImageModule::open(filename_2, exposure, diff.part_2));
+                diff.reader_2 = extra_parts.back().get();
+            }
+
+            diff.reader_1->selectLayers(diff.layers_1);
+            diff.reader_2->selectLayers(diff.layers_2);
+            diff.reader_1->setXYZ(engine->needsXYZ());
+            diff.reader_2->setXYZ(engine->needsXYZ());
+
+            if (!filename_mask.empty()) {
+                diff.mask.reset(ImageModule::open(filename_mask));
+            }
+        }
+    } catch (std::exception &e) {
+        std::cerr << "[error] " << e.what() << std::endl;
 
         return EXIT_FAILURE;
     }
 
-    {
-        const size_t width  = image_1->width();
-        const size_t height = image_1->height();
+    // Per layer summaries, printed together when there are several layers
+    std::vector<std::unique_ptr<std::stringstream>> stats_out;
+
+    // The second file is read from the disk cache, or added to it
+    std::unique_ptr<LabImage>       cached_2;
+    std::unique_ptr<LabCacheWriter> writer_2;
+
+    try {
+        for (size_t d = 0; d < diffs.size(); d++) {
+            PartDiff &diff = *diffs[d];
+
+            if (!check_headers(*diff.reader_1, *diff.reader_2, roi, diff.region)) {
+                return EXIT_FAILURE;
+            }
+
+            // The outputs cover the compared pixels only
+            const size_t width  = size_t(diff.region.max_x - diff.region.min_x + 1);
+            const size_t height = size_t(diff.region.max_y - diff.region.min_y + 1);
+
+            for (size_t l = 0; l < diff.ids.size(); l++) {
+                for (size_t m = 0; m < engine->size(); m++) {
+                    std::unique_ptr<MultiOutput> outputs(new MultiOutput(width, height));
+
+                    std::string id = layers.empty() ? "" : diff.ids[l];
 
-        // We need to determine the width of the output image depending on the
-        // display of the color scale on the right or not
-        const float  scale_percent = 0.05f;
-        const size_t width_scale
-            = std::max(30, int(scale_percent * float(width)));
-        const size_t width_out = (displayScale) ? width + width_scale : width;
+                    if (engine->size() > 1) {
+                        id += (id.empty() ? "" : ".") + std::string(engine->metric(m).name);
+                    }
+
+                    diff.output_ids.push_back(id);
+
+                    if (!filename_out.empty()) {
+                        outputs->add(OutputModule::create(
+                            named ? layer_filename(filename_out, id) : filename_out,
+                            width,
+                            height,
+                            settings));
+                    }
+
+                    // With --stats alone, no image is allocated, color mapped
+                    // or encoded
+                    if (stats) {
+                        std::ostream *out = &std::cout;
+
+                        if (named) {
+                            stats_out.emplace_back(new std::stringstream);
+                            out = stats_out.back().get();
+                        }
 
-        rgb_out.resize(width_out * height * 4);
+                        StatsOutput *summary
+                            = (approx > 0.f)
+                                  ? new SampledStatsOutput(width, height, max_deltaE, *out)
+                                  : new StatsOutput(width, height, max_deltaE, *out);
 
-        #pragma omp parallel for
-        for (size_t i = 0; i < width * height; i++) {
-            const size_t x          = i % width;
-            const size_t y          = i / width;
-            const size_t offset_out = y * width_out + x;
+                        // Linear RGB values are relative to a white of 1
+                        if (engine->metric(m).mse) {
+                            summary->reportPSNR(1.f);
+                        }
 
-            // Convert colors to Lab space
-            float Lab_1[3], Lab_2[3];
-            xyz_to_Lab(&image_1->data_xyz()[3 * i], Lab_1);
-            xyz_to_Lab(&image_2->data_xyz()[3 * i], Lab_2);
+                        outputs->add(summary);
+                    }
 
-            // Compute the Delta E 2000 difference
-            const float deltaE = deltaE2000(Lab_1, Lab_2);
+                    if (gate && m == 0) {
+                        diff.gates.push_back(
+                            new GateOutput(width, height, fail_above, max_count));
+                        outputs->add(diff.gates.back());
+                    }
 
-            // Find a color maping for the Delta E value
-            float scale_rgb[3];
-            cmap->getRGBValue(deltaE, 0.f, max_deltaE, scale_rgb);
+                    diff.outputs.emplace_back(outputs.release());
+                }
+            }
 
-            // Set the output file pixel values
-            for (int c = 0; c < 3; c++) {
-                rgb_out[4 * offset_out + c] = 255 * scale_rgb[c];
+            // The whole images are processed at once when there is no
+            // budget, which is shared by the parts
+            diff.band_rows = height;
+
+            if (max_memory > 0 && engine->spatial()) {
+                std::cerr << "[warning] The selected metrics need the whole "
+                          << "images, --max-memory is ignored." << std::endl;
+            } else if (max_memory > 0) {
+                diff.band_rows = band_rows_for_budget(
+                    *diff.reader_1,
+                    *diff.reader_2,
+                    diff.mask.get(),
+                    *diff.outputs[0],
+                    diff.outputs.size(),
+                    max_memory / diffs.size());
             }
 
-            rgb_out[4 * offset_out + 3] = 255;
+            // Smaller bands let the gate stop before the whole images are
+            // decoded
+            if (gate && !engine->spatial()) {
+                const size_t chunk_rows = common_chunk_rows(*diff.reader_1, *diff.reader_2);
+                const size_t gate_rows  = (height / 16 + chunk_rows - 1)
+                                         / chunk_rows * chunk_rows;
+
+                diff.band_rows = std::max(chunk_rows, std::min(diff.band_rows, gate_rows));
+                diff.band_rows = std::min(diff.band_rows, height);
+            }
+
+            // With --approx, each sampled unit is a band of its own
+            diff.bands = (approx > 0.f)
+                             ? sample_rows(*diff.reader_1, *diff.reader_2, diff.region, approx)
+                             : split_rows(height, diff.band_rows);
+
+            if (cache_dir.empty()) {
+                continue;
+            }
+
+            const EXRBox2i &window_2 = diff.reader_2->dataWindow();
+
+            // The cache holds Lab images only
+            if (engine->needsXYZ()) {
+                std::cerr << "[warning] The cache is only used by the metrics "
+                          << "computed in Lab." << std::endl;
+            } else if (memcmp(&diff.region, &window_2, sizeof(EXRBox2i)) != 0) {
+                std::cerr << "[warning] The cache is only used when all the "
+                          << "pixels of the second file are compared." << std::endl;
+            } else {
+                LabDiskCache   cache(cache_dir);
+                const uint64_t key = LabDiskCache::key(
+                    filename_2,
+                    diff.reader_2->rgbToXYZ());
+
+                cached_2.reset(cache.find(key, width, height));
+
+                if (!cached_2) {
+                    writer_2.reset(cache.create(key, width, height));
+                }
+            }
         }
 
-        // If we use a color scale on the right, add it to the output image
-        if (displayScale) {
-            #pragma omp parallel for
-            for (size_t y = 0; y < height; y++) {
-                float v = float(height - 1 - y) / float(height - 1);
-                float scale_rgb[3];
-                cmap->getRGBValue(v, scale_rgb);
+        // Each part is compared by its own worker, sharing the threads
+        std::vector<std::exception_ptr> errors(diffs.size());
+        std::vector<std::thread>        workers;
 
-                for (size_t x = width; x < width_out; x++) {
-                    for (int c = 0; c < 3; c++) {
-                        rgb_out[4 * (y * width_out + x) + c]
-                            = 255 * scale_rgb[c];
-                    }
-                    rgb_out[4 * (y * width_out + x) + 3] = 255;
+#ifdef _OPENMP
+        const int n_threads
+            = std::max(1, omp_get_max_threads() / int(diffs.size()));
+#endif
+
+        for (size_t d = 0; d < diffs.size(); d++) {
+            workers.emplace_back([&, d]() {
+                PartDiff &diff = *diffs[d];
+
+#ifdef _OPENMP
+                omp_set_num_threads(n_threads);
+#endif
+
+                std::vector<DiffOutput *> outputs;
+
+                for (size_t l = 0; l < diff.outputs.size(); l++) {
+                    outputs.push_back(diff.outputs[l].get());
                 }
+
+                try {
+                    diff_files(
+                        *diff.reader_1,
+                        *diff.reader_2,
+                        diff.mask.get(),
+                        diff.region,
+                        cached_2.get(),
+                        writer_2.get(),
+                        outputs,
+                        *engine,
+                        diff.bands,
+                        !decode_all);
+                } catch (...) {
+                    errors[d] = std::current_exception();
+                }
+            });
+        }
+
+        for (size_t d = 0; d < workers.size(); d++) {
+            workers[d].join();
+        }
+
+        for (size_t d = 0; d < errors.size(); d++) {
+            if (errors[d]) {
+                std::rethrow_exception(errors[d]);
+            }
+        }
+    } catch (std::exception &e) {
+        std::cerr << "[error] " << e.what() << std::endl;
+
+        return EXIT_FAILURE;
+    }
+
+    // A single JSON object, with a summary per layer and metric
+    if (named && stats) {
+        std::cout << "{" << std::endl;
+
+        for (size_t d = 0, i = 0; d < diffs.size(); d++) {
+            for (size_t l = 0; l < diffs[d]->output_ids.size(); l++, i++) {
+                std::string summary = stats_out[i]->str();
+
+                // Indented and without its last new line
+                summary.pop_back();
+
+                for (size_t pos = summary.find('\n'); pos != std::string::npos;
+                     pos = summary.find('\n', pos + 1)) {
+                    summary.insert(pos + 1, "  ");
+                }
+
+                std::cout << "  \"" << diffs[d]->output_ids[l] << "\": " << summary
+                          << (i + 1 < stats_out.size() ? "," : "") << std::endl;
             }
         }
 
-        lodepng::encode(filename_out, rgb_out.data(), width_out, height);
+        std::cout << "}" << std::endl;
+    }
+
+    bool passed = true;
+
+    for (size_t d = 0; d < diffs.size(); d++) {
+        for (size_t l = 0; l < diffs[d]->gates.size(); l++) {
+            diffs[d]->gates[l]->report(std::cerr, layers.empty() ? "" : diffs[d]->ids[l]);
+            passed = passed && diffs[d]->gates[l]->passed();
+        }
     }
 
-    return EXIT_SUCCESS;
+    return passed ? EXIT_SUCCESS : EXIT_GATE_FAILED;
 }
@@ -1,4 +1,19 @@
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <zlib.h>
 
 
 // Test data from:
@@ -47,6 +62,31 @@ const float test_DeltaE_2000_data[] = {
 
 
 #include <colortools.hpp>
+#include <colortools_batch.hpp>
+#include <ColorMap/BBGRColorMap.hpp>
+#include <Output/StatsOutput.hpp>
+#include <Output/SampledStatsOutput.hpp>
+#include <Output/GateOutput.hpp>
+#include <Output/MultiOutput.hpp>
+#include <Output/EXRDiffOutput.hpp>
+#include <Output/NPYDiffOutput.hpp>
+#include <Batch/BatchRunner.hpp>
+#include <Batch/BoundedQueue.hpp>
+#include <Batch/Manifest.hpp>
+#include <Cache/ContentHash.hpp>
+#include <Cache/LabDiskCache.hpp>
+#include <Diff/DiffFiles.hpp>
+#include <Diff/Layers.hpp>
+#include <Diff/Region.hpp>
+#include <ImageFormat/EXRBandReader.hpp>
+#include <ImageFormat/Half.hpp>
+#include <ImageFormat/PNGStreamWriter.hpp>
+#include <Metric/MetricEngine.hpp>
+
+#ifndef _WIN32
+#include <Server/DiffProtocol.hpp>
+#include <Server/DiffServer.hpp>
+#endif
 
 
 TEST(Diff, DeltaE_2000)
@@ -64,3 +104,2467 @@ TEST(Diff, DeltaE_2000)
         EXPECT_NEAR(deltaE_ref, deltaE_cmp, 1E-4);
     }
 }
+
+
+TEST(Diff, DeltaE_2000_batch)
+{
+    const int n_data = sizeof(test_DeltaE_2000_data) / (sizeof(float) * 7);
+
+    // Planar copy of the test data
+    std::vector<float> Lab[6];
+
+    for (int c = 0; c < 6; c++) {
+        for (int i = 0; i < n_data; i++) {
+            Lab[c].push_back(test_DeltaE_2000_data[7 * i + c]);
+        }
+    }
+
+    for (int level = 0; level <= int(simd_level_supported()); level++) {
+        std::vector<float> deltaE_cmp(n_data);
+
+        deltaE2000_batch(
+            SimdLevel(level),
+            Lab[0].data(),
+            Lab[1].data(),
+            Lab[2].data(),
+            Lab[3].data(),
+            Lab[4].data(),
+            Lab[5].data(),
+            deltaE_cmp.data(),
+            n_data);
+
+        for (int i = 0; i < n_data; i++) {
+            const float deltaE_ref = test_DeltaE_2000_data[7 * i + 6];
+
+            EXPECT_NEAR(deltaE_ref, deltaE_cmp[i], 1E-4)
+                << "SIMD level " << level << ", pair " << i;
+        }
+    }
+}
+
+
+TEST(Diff, XYZ_to_Lab_batch)
+{
+    // Covers the linear segment, negative values and HDR values
+    std::vector<float> XYZ[3];
+
+    for (int i = 0; i < 1001; i++) {
+        const float v = -0.05f + 0.0002f * float(i * i);
+
+        XYZ[0].push_back(v);
+        XYZ[1].push_back(0.5f * v + 0.01f);
+        XYZ[2].push_back(1.2f * v);
+    }
+
+    const size_t n = XYZ[0].size();
+
+    for (int level = 0; level <= int(simd_level_supported()); level++) {
+        std::vector<float> Lab_cmp[3];
+
+        for (int c = 0; c < 3; c++) {
+            Lab_cmp[c].resize(n);
+        }
+
+        xyz_to_Lab_batch(
+            SimdLevel(level),
+            XYZ[0].data(),
+            XYZ[1].data(),
+            XYZ[2].data(),
+            Lab_cmp[0].data(),
+            Lab_cmp[1].data(),
+            Lab_cmp[2].data(),
+            n);
+
+        for (size_t i = 0; i < n; i++) {
+            const float xyz[3] = {XYZ[0][i], XYZ[1][i], XYZ[2][i]};
+            float       Lab_ref[3];
+
+            xyz_to_Lab(xyz, Lab_ref);
+
+            for (int c = 0; c < 3; c++) {
+                EXPECT_NEAR(
+                    Lab_ref[c],
+                    Lab_cmp[c][i],
+                    1E-4 * std::max(1.f, std::abs(Lab_ref[c])))
+                    << "SIMD level " << level << ", color " << i;
+            }
+        }
+    }
+}
+
+
+TEST(Diff, RGB_to_Lab_batch)
+{
+    const float exposure_mul = 2.f;
+
+    std::vector<float> RGB[3];
+
+    for (int i = 0; i < 1001; i++) {
+        const float v = -0.02f + 0.0001f * float(i * i);
+
+        RGB[0].push_back(v);
+        RGB[1].push_back(0.3f * v + 0.005f);
+        RGB[2].push_back(float(i % 7) * 0.1f * v);
+    }
+
+    const size_t n = RGB[0].size();
+
+    float rgb_to_xyz[9];
+    lin_rgb_to_xyz_matrix(exposure_mul, rgb_to_xyz);
+
+    for (int level = 0; level <= int(simd_level_supported()); level++) {
+        std::vector<float> Lab_cmp[3];
+
+        for (int c = 0; c < 3; c++) {
+            Lab_cmp[c].resize(n);
+        }
+
+        lin_rgb_to_Lab_batch(
+            SimdLevel(level),
+            rgb_to_xyz,
+            RGB[0].data(),
+            RGB[1].data(),
+            RGB[2].data(),
+            Lab_cmp[0].data(),
+            Lab_cmp[1].data(),
+            Lab_cmp[2].data(),
+            n);
+
+        for (size_t i = 0; i < n; i++) {
+            const float rgb[3] = {
+                exposure_mul * RGB[0][i],
+                exposure_mul * RGB[1][i],
+                exposure_mul * RGB[2][i]};
+
+            float Lab_ref[3];
+
+            lin_rgb_to_Lab(rgb, Lab_ref);
+
+            for (int c = 0; c < 3; c++) {
+                EXPECT_NEAR(
+                    Lab_ref[c],
+                    Lab_cmp[c][i],
+                    1E-4 * std::max(1.f, std::abs(Lab_ref[c])))
+                    << "SIMD level " << level << ", color " << i;
+            }
+        }
+    }
+}
+
+
+TEST(Diff, Chromaticities)
+{
+    float matrix[9], matrix_ref[9];
+
+    // Rec. 709 keeps the matrix of lin_rgb_to_xyz(), exposure folded in
+    float rec709[8];
+    rec709_chromaticities(rec709);
+
+    ASSERT_TRUE(lin_rgb_to_xyz_matrix(rec709, 2.f, matrix));
+    lin_rgb_to_xyz_matrix(2.f, matrix_ref);
+
+    for (int i = 0; i < 9; i++) {
+        EXPECT_EQ(matrix_ref[i], matrix[i]);
+    }
+
+    // White maps to D65 whatever the white point of the primaries
+    const float spaces[][8] = {
+        {0.708f, 0.292f, 0.170f, 0.797f, 0.131f, 0.046f, 0.3127f, 0.3290f},
+        {0.7347f, 0.2653f, 0.f, 1.f, 0.0001f, -0.0770f, 0.32168f, 0.33767f},
+        {0.713f, 0.293f, 0.165f, 0.830f, 0.128f, 0.044f, 0.32168f, 0.33767f},
+        // Display P3, derived
+        {0.680f, 0.320f, 0.265f, 0.690f, 0.150f, 0.060f, 0.3127f, 0.3290f},
+        // AP1 with a white point off the tabulated one, derived
+        {0.713f, 0.293f, 0.165f, 0.830f, 0.128f, 0.044f, 0.3227f, 0.3387f}};
+
+    const float d65[3] = {0.95046f, 1.f, 1.08906f};
+
+    for (size_t s = 0; s < sizeof(spaces) / sizeof(spaces[0]); s++) {
+        ASSERT_TRUE(lin_rgb_to_xyz_matrix(spaces[s], 1.f, matrix));
+
+        for (int c = 0; c < 3; c++) {
+            EXPECT_NEAR(d65[c], matrix[3 * c] + matrix[3 * c + 1] + matrix[3 * c + 2], 1E-4)
+                << "Space " << s;
+        }
+    }
+
+    // Derived matrix of Display P3
+    const float p3[9] = {
+        0.4865709f, 0.2656677f, 0.1982173f,
+        0.2289746f, 0.6917385f, 0.0792869f,
+        0.0000000f, 0.0451134f, 1.0439444f};
+
+    lin_rgb_to_xyz_matrix(spaces[3], 1.f, matrix);
+
+    for (int i = 0; i < 9; i++) {
+        EXPECT_NEAR(p3[i], matrix[i], 1E-5);
+    }
+
+    // Derivation and table agree for ACEScg
+    float derived[9];
+    lin_rgb_to_xyz_matrix(spaces[2], 1.f, matrix);
+    lin_rgb_to_xyz_matrix(spaces[4], 1.f, derived);
+
+    for (int i = 0; i < 9; i++) {
+        EXPECT_NEAR(matrix[i], derived[i], 5E-3);
+    }
+
+    // Degenerate primaries
+    const float invalid[8] = {0.64f, 0.f, 0.30f, 0.60f, 0.15f, 0.06f, 0.3127f, 0.3290f};
+    EXPECT_FALSE(lin_rgb_to_xyz_matrix(invalid, 1.f, matrix));
+}
+
+
+TEST(ColorMap, BBGR_LUT)
+{
+    const float keys[6][3] = {
+        {0, 0, 0},
+        {0, 0, 1},
+        {0, 1, 1},
+        {0, 1, 0},
+        {1, 1, 0},
+        {1, 0, 0}};
+
+    for (size_t lut_size: {2, 16, 1024}) {
+        BBGRColorMap cmap(lut_size);
+
+        float RGB[3];
+
+        // The end points are exact whatever the resolution
+        cmap.getRGBValue(-1.f, RGB);
+
+        for (int c = 0; c < 3; c++) {
+            EXPECT_FLOAT_EQ(keys[0][c], RGB[c]);
+        }
+
+        cmap.getRGBValue(2.f, RGB);
+
+        for (int c = 0; c < 3; c++) {
+            EXPECT_FLOAT_EQ(keys[5][c], RGB[c]);
+        }
+    }
+
+    BBGRColorMap cmap;
+
+    for (int i = 0; i < 6; i++) {
+        float RGB[3];
+        cmap.getRGBValue(float(i), 0.f, 5.f, RGB);
+
+        for (int c = 0; c < 3; c++) {
+            EXPECT_NEAR(keys[i][c], RGB[c], 1E-2) << "key " << i;
+        }
+    }
+}
+
+
+TEST(ColorMap, RGBA8_row)
+{
+    BBGRColorMap cmap;
+
+    std::vector<float> values;
+
+    for (int i = -10; i <= 1010; i++) {
+        values.push_back(0.01f * float(i));
+    }
+
+    values.push_back(std::nanf(""));
+
+    std::vector<unsigned char> rgba(4 * values.size());
+    cmap.getRGBA8Row(values.data(), values.size(), 0.f, 10.f, rgba.data());
+
+    for (size_t i = 0; i < values.size(); i++) {
+        float RGB[3];
+        cmap.getRGBValue(
+            std::isnan(values[i]) ? 10.f : values[i], 0.f, 10.f, RGB);
+
+        for (int c = 0; c < 3; c++) {
+            EXPECT_NEAR(255.f * RGB[c], float(rgba[4 * i + c]), 1.f)
+                << "value " << values[i];
+        }
+
+        EXPECT_EQ(255, rgba[4 * i + 3]);
+    }
+}
+
+
+TEST(Stats, Deterministic)
+{
+    const size_t width = 97, height = 41;
+
+    std::vector<float> deltaE(width * height);
+
+    for (size_t i = 0; i < deltaE.size(); i++) {
+        deltaE[i] = 0.001f * float((i * 7919) % 12007);
+    }
+
+    deltaE[5] = std::nanf("");
+    deltaE[6] = std::numeric_limits<float>::infinity();
+
+    // Different band sizes, rows given in reverse order within the bands
+    std::string json[2];
+    const size_t band_rows[2] = {1, 16};
+
+    for (int k = 0; k < 2; k++) {
+        std::stringstream out;
+        StatsOutput       stats(width, height, 10.f, out);
+
+        out.precision(3);
+
+        for (size_t y_begin = 0; y_begin < height; y_begin += band_rows[k]) {
+            const size_t y_end = std::min(height, y_begin + band_rows[k]);
+
+            stats.beginBand(y_begin, y_end);
+
+            for (size_t y = y_end; y-- > y_begin;) {
+                stats.writeRow(y, &deltaE[y * width], nullptr);
+            }
+
+            stats.endBand();
+        }
+
+        stats.close();
+        json[k] = out.str();
+
+        // The precision of the stream is left as it was
+        EXPECT_EQ(3, out.precision());
+    }
+
+    EXPECT_EQ(json[0], json[1]);
+    EXPECT_NE(std::string::npos, json[0].find("\"nan_pixels\": 1,"));
+    EXPECT_NE(std::string::npos, json[0].find("\"inf_pixels\": 1,"));
+    EXPECT_NE(std::string::npos, json[0].find("\"max\": 12.006,"));
+    EXPECT_EQ(std::string::npos, json[0].find("inf,"));
+}
+
+
+TEST(Gate, Count)
+{
+    const size_t width = 4, height = 2;
+
+    const float row_0[width] = {0.f, 2.3f, 2.4f, 1.f};
+    const float row_1[width] = {std::nanf(""), 0.f, 0.f, 0.f};
+
+    GateOutput gate(width, height, 2.3f, 1);
+
+    gate.writeRow(0, row_0, nullptr);
+    EXPECT_TRUE(gate.passed());
+    EXPECT_EQ(1u, gate.count());
+
+    // NaN counts as above the threshold
+    gate.writeRow(1, row_1, nullptr);
+    EXPECT_FALSE(gate.passed());
+    EXPECT_TRUE(gate.done());
+    EXPECT_EQ(2u, gate.count());
+}
+
+
+TEST(Gate, Mask)
+{
+    const size_t width = 4, height = 1;
+
+    const float         row[width]  = {5.f, std::nanf(""), 5.f, 0.f};
+    const unsigned char mask[width] = {1, 0, 0, 1};
+
+    GateOutput gate(width, height, 2.3f, 0);
+
+    // Pixels left out by the mask are not counted
+    gate.writeRow(0, row, mask);
+    EXPECT_EQ(1u, gate.count());
+}
+
+
+// Gives a test Delta E map to an output, in two bands. The pixels with a
+// multiple of 4 as x + y are out of the mask.
+static void write_test_map(DiffOutput &output)
+{
+    const size_t width = output.width(), height = output.height();
+    const size_t bands[3] = {0, 3, height};
+
+    std::vector<float>         row(width);
+    std::vector<unsigned char> mask(width);
+
+    for (int b = 0; b < 2; b++) {
+        output.beginBand(bands[b], bands[b + 1]);
+
+        for (size_t y = bands[b]; y < bands[b + 1]; y++) {
+            for (size_t x = 0; x < width; x++) {
+                row[x]  = float(y) * 10.f + float(x) * 0.37f;
+                mask[x] = (x + y) % 4 != 0;
+            }
+
+            output.writeRow(y, row.data(), mask.data());
+        }
+
+        output.endBand();
+    }
+
+    output.close();
+}
+
+
+// Checks a value read back from an output of write_test_map()
+static void expect_test_map_value(float value, size_t x, size_t y, float tolerance)
+{
+    if ((x + y) % 4 == 0) {
+        EXPECT_TRUE(std::isnan(value)) << "pixel (" << x << ", " << y << ")";
+    } else {
+        EXPECT_NEAR(float(y) * 10.f + float(x) * 0.37f, value, tolerance)
+            << "pixel (" << x << ", " << y << ")";
+    }
+}
+
+
+TEST(Output, NPY)
+{
+    const std::string filename = ::testing::TempDir() + "output_test.npy";
+    const size_t      width = 13, height = 7;
+
+    {
+        NPYDiffOutput output(filename, width, height);
+        write_test_map(output);
+    }
+
+    std::vector<unsigned char> file;
+
+    {
+        std::ifstream in(filename.c_str(), std::ios::binary);
+        file.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    ASSERT_GE(file.size(), size_t(10));
+
+    // Magic string and version 1.0
+    const unsigned char magic[8] = {0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0};
+    EXPECT_EQ(0, memcmp(file.data(), magic, 8));
+
+    // The data starts at a 64 bytes aligned offset
+    const size_t header_size = size_t(file[8]) | (size_t(file[9]) << 8);
+    EXPECT_EQ(size_t(0), (10 + header_size) % 64);
+    ASSERT_EQ(10 + header_size + width * height * sizeof(float), file.size());
+
+    const std::string header(reinterpret_cast<const char *>(&file[10]), header_size);
+    EXPECT_EQ('\n', header.back());
+    EXPECT_NE(std::string::npos, header.find("'descr': '<f4'"));
+    EXPECT_NE(std::string::npos, header.find("'fortran_order': False"));
+    EXPECT_NE(std::string::npos, header.find("'shape': (7, 13)"));
+
+    // Little endian floats in row major order
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            float value;
+            memcpy(&value, &file[10 + header_size + 4 * (y * width + x)], 4);
+
+            expect_test_map_value(value, x, y, 0.f);
+        }
+    }
+
+    std::remove(filename.c_str());
+}
+
+
+TEST(Output, EXR)
+{
+    const std::string filename = ::testing::TempDir() + "output_test.exr";
+    const size_t      width = 13, height = 7;
+
+    for (bool half: {false, true}) {
+        {
+            EXRDiffOutput output(filename, width, height, half);
+            write_test_map(output);
+        }
+
+        // Stored as requested
+        std::vector<unsigned char> file;
+
+        {
+            std::ifstream in(filename.c_str(), std::ios::binary);
+            file.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+
+        EXRVersion  version;
+        EXRHeader   header;
+        const char *err = nullptr;
+
+        InitEXRHeader(&header);
+        ASSERT_EQ(TINYEXR_SUCCESS, ParseEXRVersionFromMemory(&version, file.data(), file.size()));
+        ASSERT_EQ(
+            TINYEXR_SUCCESS,
+            ParseEXRHeaderFromMemory(&header, &version, file.data(), file.size(), &err));
+
+        ASSERT_EQ(1, header.num_channels);
+        EXPECT_STREQ("Y", header.channels[0].name);
+        EXPECT_EQ(half ? TINYEXR_PIXELTYPE_HALF : TINYEXR_PIXELTYPE_FLOAT, header.pixel_types[0]);
+        FreeEXRHeader(&header);
+
+        // A single channel is loaded as grey
+        float *rgba = nullptr;
+        int    read_width, read_height;
+
+        ASSERT_EQ(TINYEXR_SUCCESS, LoadEXR(&rgba, &read_width, &read_height, filename.c_str(), &err));
+        EXPECT_EQ(int(width), read_width);
+        EXPECT_EQ(int(height), read_height);
+
+        for (size_t y = 0; y < height; y++) {
+            for (size_t x = 0; x < width; x++) {
+                const float value = rgba[4 * (y * width + x)];
+
+                // Half floats keep 11 significant bits
+                expect_test_map_value(value, x, y, half ? 1E-3f * std::abs(value) : 0.f);
+            }
+        }
+
+        free(rgba);
+    }
+
+    std::remove(filename.c_str());
+}
+
+
+TEST(Batch, Manifest)
+{
+    std::stringstream in(
+        "# file 1, file 2, output\n"
+        "a.exr b.exr out.png\n"
+        "\n"
+        "dir with spaces/a.exr\tb.exr\tout.exr\r\n");
+
+    const std::vector<BatchJob> jobs = Manifest::parse(in, "manifest");
+
+    ASSERT_EQ(2u, jobs.size());
+    EXPECT_EQ("a.exr", jobs[0].filename_1);
+    EXPECT_EQ("out.png", jobs[0].filename_out);
+    EXPECT_EQ("dir with spaces/a.exr", jobs[1].filename_1);
+    EXPECT_EQ("out.exr", jobs[1].filename_out);
+
+    std::stringstream bad("a.exr b.exr\n");
+    EXPECT_THROW(Manifest::parse(bad, "manifest"), std::runtime_error);
+}
+
+
+TEST(Batch, BoundedQueue)
+{
+    BoundedQueue<int> queue(2);
+
+    std::thread producer([&]() {
+        for (int i = 0; i < 100; i++) {
+            queue.push(i);
+        }
+
+        queue.close();
+    });
+
+    int value, expected = 0;
+
+    while (queue.pop(value)) {
+        EXPECT_EQ(expected++, value);
+    }
+
+    producer.join();
+    EXPECT_EQ(100, expected);
+}
+
+
+#ifndef _WIN32
+TEST(Server, Protocol)
+{
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+    SocketStream client(fds[0]);
+    SocketStream server(fds[1]);
+
+    DiffRequest request;
+    request.filename_1   = "/renders/frame 1.exr";
+    request.filename_2   = "/golden/frame 1.exr";
+    request.max_deltaE   = 2.5f;
+    request.exposure     = -1.f / 3.f;
+    request.stats        = true;
+    request.gate         = true;
+    request.max_count    = 12;
+
+    request.write(client);
+
+    DiffRequest received;
+    ASSERT_TRUE(received.read(server));
+    EXPECT_EQ(request.filename_1, received.filename_1);
+    EXPECT_EQ(request.filename_2, received.filename_2);
+    EXPECT_TRUE(received.filename_out.empty());
+    EXPECT_EQ(request.max_deltaE, received.max_deltaE);
+    EXPECT_EQ(request.exposure, received.exposure);
+    EXPECT_TRUE(received.stats);
+    EXPECT_TRUE(received.gate);
+    EXPECT_FALSE(received.displayScale);
+    EXPECT_EQ(12u, received.max_count);
+
+    DiffResponse response;
+    response.status = 2;
+    response.out    = "{\n}\n";
+    response.err    = "[gate] Failed\n";
+    response.write(server);
+
+    DiffResponse answer;
+    answer.read(client);
+    EXPECT_EQ(2, answer.status);
+    EXPECT_EQ(response.out, answer.out);
+    EXPECT_EQ(response.err, answer.err);
+
+    // A client leaving in the middle of a request
+    client.write("file1 /renders/frame 1.exr\nfile2 /golden");
+    ASSERT_EQ(0, shutdown(fds[0], SHUT_WR));
+
+    EXPECT_THROW(received.read(server), std::runtime_error);
+}
+
+
+TEST(Server, Timeout)
+{
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+    SocketStream client(fds[0]);
+    SocketStream server(fds[1]);
+
+    // A client stalled in the middle of its request
+    client.write("file1 /renders/frame 1.exr\n");
+    server.setTimeout(50);
+
+    DiffRequest request;
+
+    try {
+        request.read(server);
+        FAIL() << "The stalled client is not dropped";
+    } catch (std::runtime_error &e) {
+        EXPECT_STREQ("Connection timed out", e.what());
+    }
+}
+#endif
+
+
+TEST(Cache, ContentHash)
+{
+    // XXH64 reference values
+    ContentHash empty;
+    EXPECT_EQ(0xEF46DB3751D8E999ULL, empty.digest());
+
+    const char *text = "Nobody inspects the spammish repetition";
+
+    ContentHash whole;
+    whole.update(text, strlen(text));
+    EXPECT_EQ(0xFBCEA83C8A378BF1ULL, whole.digest());
+
+    // Same value whatever the pieces the data is given in
+    ContentHash pieces;
+
+    for (size_t i = 0; i < strlen(text); i += 5) {
+        pieces.update(text + i, std::min(size_t(5), strlen(text) - i));
+    }
+
+    EXPECT_EQ(whole.digest(), pieces.digest());
+}
+
+
+TEST(Cache, LabEntry)
+{
+    const std::string directory = ::testing::TempDir() + "lab_cache_test";
+    const size_t      width = 21, height = 5, band_rows = 2;
+
+    LabDiskCache cache(directory);
+    EXPECT_EQ(nullptr, cache.find(42, width, height));
+
+    LabImage band(width, band_rows);
+
+    {
+        std::unique_ptr<LabCacheWriter> writer(cache.create(42, width, height));
+
+        for (size_t y_begin = 0; y_begin < height; y_begin += band_rows) {
+            const size_t y_end = std::min(height, y_begin + band_rows);
+
+            for (size_t y = y_begin; y < y_end; y++) {
+                for (int c = 0; c < 3; c++) {
+                    for (size_t x = 0; x < width; x++) {
+                        band.row(c, y - y_begin)[x] = float(c * 1000 + y * 100 + x);
+                    }
+                }
+            }
+
+            writer->writeRows(y_begin, y_end, band);
+        }
+
+        // Nothing visible before the entry is complete
+        EXPECT_EQ(nullptr, cache.find(42, width, height));
+        EXPECT_TRUE(writer->commit());
+    }
+
+    std::unique_ptr<LabImage> Lab(cache.find(42, width, height));
+    ASSERT_NE(nullptr, Lab.get());
+    EXPECT_EQ(float(2 * 1000 + 4 * 100 + 20), Lab->row(2, 4)[20]);
+    EXPECT_EQ(float(1 * 1000 + 3 * 100 + 7), Lab->row(1, 3)[7]);
+    EXPECT_EQ(0.f, Lab->row(0, 0)[width]);
+
+    // Wrong key or size
+    EXPECT_EQ(nullptr, cache.find(43, width, height));
+    EXPECT_EQ(nullptr, cache.find(42, width, height + 1));
+
+    std::remove(cache.entryFilename(42).c_str());
+}
+
+
+TEST(ImageFormat, HalfToFloat)
+{
+    // Little endian: 1, -2, 65504, smallest normal, smallest denormal, inf
+    const unsigned char half[] = {
+        0x00, 0x3C, 0x00, 0xC0, 0xFF, 0x7B, 0x00, 0x04, 0x01, 0x00, 0x00, 0x7C};
+    float values[6];
+
+    half_to_float_row(half, values, 6);
+
+    EXPECT_EQ(1.f, values[0]);
+    EXPECT_EQ(-2.f, values[1]);
+    EXPECT_EQ(65504.f, values[2]);
+    EXPECT_EQ(std::ldexp(1.f, -14), values[3]);
+    EXPECT_EQ(std::ldexp(1.f, -24), values[4]);
+    EXPECT_TRUE(std::isinf(values[5]));
+    EXPECT_TRUE(std::isnan(half_to_float(0x7E00)));
+
+    // Unaligned floats
+    const unsigned char raw[] = {0xFF, 0x00, 0x00, 0x80, 0x3F};
+    float value;
+
+    float_row(raw + 1, &value, 1);
+    EXPECT_EQ(1.f, value);
+}
+
+
+TEST(Diff, RGB_half_to_Lab_batch)
+{
+    // Every finite half value, as R, G and B in different orders
+    std::vector<uint16_t> RGB_half[3];
+
+    for (uint32_t h = 0; h < 0x10000; h++) {
+        if (((h >> 10) & 0x1F) == 0x1F) {
+            continue;
+        }
+
+        RGB_half[0].push_back(uint16_t(h));
+        RGB_half[1].push_back(uint16_t(h ^ 0x8000));
+        RGB_half[2].push_back(uint16_t((h * 40503u) & 0x7BFF));
+    }
+
+    const size_t n = RGB_half[0].size() - 3;
+
+    std::vector<float> RGB[3];
+
+    for (int c = 0; c < 3; c++) {
+        for (size_t i = 0; i < n; i++) {
+            RGB[c].push_back(half_to_float(RGB_half[c][i]));
+        }
+    }
+
+    float rgb_to_xyz[9];
+    lin_rgb_to_xyz_matrix(0.5f, rgb_to_xyz);
+
+    // Same bits as the conversion of the widened values
+    for (int level = 0; level <= int(simd_level_supported()); level++) {
+        std::vector<float> Lab_float[3], Lab_half[3];
+
+        for (int c = 0; c < 3; c++) {
+            Lab_float[c].resize(n);
+            Lab_half[c].resize(n);
+        }
+
+        lin_rgb_to_Lab_batch(
+            SimdLevel(level),
+            rgb_to_xyz,
+            RGB[0].data(),
+            RGB[1].data(),
+            RGB[2].data(),
+            Lab_float[0].data(),
+            Lab_float[1].data(),
+            Lab_float[2].data(),
+            n);
+
+        lin_rgb_to_Lab_batch(
+            SimdLevel(level),
+            rgb_to_xyz,
+            RGB_half[0].data(),
+            RGB_half[1].data(),
+            RGB_half[2].data(),
+            Lab_half[0].data(),
+            Lab_half[1].data(),
+            Lab_half[2].data(),
+            n);
+
+        for (int c = 0; c < 3; c++) {
+            EXPECT_EQ(0, memcmp(Lab_float[c].data(), Lab_half[c].data(), n * sizeof(float)))
+                << "level " << level << ", channel " << c;
+        }
+    }
+}
+
+
+// Value of the channel `name` at (x, y) in the test files, in [-0.05, 4]
+static float test_value(const std::string &name, int x, int y)
+{
+    int seed = 0;
+
+    for (size_t i = 0; i < name.size(); i++) {
+        seed += int((unsigned char)name[i]);
+    }
+
+    return -0.05f
+           + 0.0007f * float(((x + 3) * (seed % 17 + 5) + (y + 1) * (y + seed % 13 + 7)) % 5800);
+}
+
+
+// Image and header given to tinyexr to write a test file: each channel holds
+// test_value(), stored as `pixel_type`. Scanline when `tile_width` is 0.
+class TestEXR
+{
+  public:
+    TestEXR(
+        const std::vector<std::string> &channels,
+        int                             width,
+        int                             height,
+        int                             pixel_type,
+        int                             compression,
+        int                             tile_width  = 0,
+        int                             tile_height = 0,
+        int                             min_x       = 0,
+        int                             min_y       = 0)
+      : _channels(channels.size())
+      , _pixel_types(channels.size(), TINYEXR_PIXELTYPE_FLOAT)
+      , _requested_pixel_types(channels.size(), pixel_type)
+      , _planes(channels.size())
+    {
+        InitEXRHeader(&header);
+        InitEXRImage(&image);
+
+        for (size_t c = 0; c < channels.size(); c++) {
+            memset(&_channels[c], 0, sizeof(EXRChannelInfo));
+            strncpy(_channels[c].name, channels[c].c_str(), 255);
+
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    _planes[c].push_back(test_value(channels[c], x + min_x, y + min_y));
+                }
+            }
+        }
+
+        header.num_channels          = int(channels.size());
+        header.channels              = _channels.data();
+        header.pixel_types           = _pixel_types.data();
+        header.requested_pixel_types = _requested_pixel_types.data();
+        header.compression_type      = compression;
+        header.data_window.min_x     = min_x;
+        header.data_window.min_y     = min_y;
+        header.data_window.max_x     = min_x + width - 1;
+        header.data_window.max_y     = min_y + height - 1;
+        header.display_window        = header.data_window;
+        header.pixel_aspect_ratio    = 1.f;
+        header.screen_window_width   = 1.f;
+
+        image.num_channels = int(channels.size());
+        image.width        = width;
+        image.height       = height;
+
+        if (tile_width == 0) {
+            for (size_t c = 0; c < channels.size(); c++) {
+                _images.push_back(reinterpret_cast<unsigned char *>(_planes[c].data()));
+            }
+
+            image.images = _images.data();
+
+            return;
+        }
+
+        header.tiled              = 1;
+        header.tile_size_x        = tile_width;
+        header.tile_size_y        = tile_height;
+        header.tile_level_mode    = TINYEXR_TILE_ONE_LEVEL;
+        header.tile_rounding_mode = TINYEXR_TILE_ROUND_DOWN;
+
+        // Tiles in row order, each with its channels tile_width pixels wide
+        const int n_x = (width + tile_width - 1) / tile_width;
+        const int n_y = (height + tile_height - 1) / tile_height;
+
+        _tiles.resize(n_x * n_y);
+        _tile_planes.resize(n_x * n_y * channels.size());
+        _tile_images.resize(n_x * n_y * channels.size());
+
+        for (int t = 0; t < n_x * n_y; t++) {
+            EXRTile &tile = _tiles[t];
+            memset(&tile, 0, sizeof(EXRTile));
+
+            tile.offset_x = t % n_x;
+            tile.offset_y = t / n_x;
+            tile.width    = std::min(tile_width, width - tile.offset_x * tile_width);
+            tile.height   = std::min(tile_height, height - tile.offset_y * tile_height);
+            tile.images   = &_tile_images[t * channels.size()];
+
+            for (size_t c = 0; c < channels.size(); c++) {
+                std::vector<float> &plane = _tile_planes[t * channels.size() + c];
+                plane.resize(tile_width * tile_height);
+
+                for (int j = 0; j < tile.height; j++) {
+                    for (int i = 0; i < tile.width; i++) {
+                        const int x = tile.offset_x * tile_width + i;
+                        const int y = tile.offset_y * tile_height + j;
+
+                        plane[j * tile_width + i] = _planes[c][y * width + x];
+                    }
+                }
+
+                tile.images[c] = reinterpret_cast<unsigned char *>(plane.data());
+            }
+        }
+
+        image.tiles     = _tiles.data();
+        image.num_tiles = n_x * n_y;
+    }
+
+
+    // Adds a chromaticities attribute
+    void setChromaticities(const float chromaticities[8])
+    {
+        memset(&_chromaticities, 0, sizeof(EXRAttribute));
+        strcpy(_chromaticities.name, "chromaticities");
+        strcpy(_chromaticities.type, "chromaticities");
+
+        _chromaticities_value.resize(32);
+        memcpy(_chromaticities_value.data(), chromaticities, 32);
+
+        _chromaticities.value      = _chromaticities_value.data();
+        _chromaticities.size       = 32;
+        header.custom_attributes     = &_chromaticities;
+        header.num_custom_attributes = 1;
+    }
+
+
+    void write(const std::string &filename) const
+    {
+        unsigned char *memory = nullptr;
+        const char *   err    = nullptr;
+
+        const size_t size = SaveEXRImageToMemory(&image, &header, &memory, &err);
+        ASSERT_NE(size_t(0), size) << (err ? err : "");
+
+        write(filename, memory, size);
+        free(memory);
+    }
+
+
+    static void write(const std::string &filename, const unsigned char *data, size_t size)
+    {
+        FILE *file = fopen(filename.c_str(), "wb");
+        ASSERT_NE(nullptr, file);
+        EXPECT_EQ(size, fwrite(data, 1, size, file));
+        fclose(file);
+    }
+
+
+    // Stores the channel `c` as `pixel_type`
+    void setPixelType(size_t c, int pixel_type) { _requested_pixel_types[c] = pixel_type; }
+
+
+    // Changes the value of the channel `c` at (x, y)
+    void setValue(size_t c, int x, int y, float v)
+    {
+        _planes[c][y * image.width + x] = v;
+
+        if (header.tiled) {
+            const int n_x = (image.width + header.tile_size_x - 1) / header.tile_size_x;
+            const int t   = (y / header.tile_size_y) * n_x + x / header.tile_size_x;
+
+            _tile_planes[t * _planes.size() + c]
+                        [(y % header.tile_size_y) * header.tile_size_x + x % header.tile_size_x]
+                = v;
+        }
+    }
+
+
+    EXRHeader header;
+    EXRImage  image;
+
+  private:
+    TestEXR(const TestEXR &) = delete;
+    TestEXR &operator=(const TestEXR &) = delete;
+
+    std::vector<EXRChannelInfo>       _channels;
+    std::vector<int>                  _pixel_types;
+    std::vector<int>                  _requested_pixel_types;
+    std::vector<std::vector<float>>   _planes;
+    std::vector<unsigned char *>      _images;
+    std::vector<EXRTile>              _tiles;
+    std::vector<std::vector<float>>   _tile_planes;
+    std::vector<unsigned char *>      _tile_images;
+    EXRAttribute                      _chromaticities;
+    std::vector<unsigned char>        _chromaticities_value;
+};
+
+
+// Lab values of a file loaded as a whole by tinyexr and converted one pixel
+// at a time
+static std::vector<float> reference_Lab(const std::string &filename, int &width, int &height)
+{
+    float *     rgba = nullptr;
+    const char *err  = nullptr;
+
+    std::vector<float> Lab;
+
+    const int ret = LoadEXR(&rgba, &width, &height, filename.c_str(), &err);
+    EXPECT_EQ(TINYEXR_SUCCESS, ret) << (err ? err : "");
+
+    if (ret != TINYEXR_SUCCESS) {
+        FreeEXRErrorMessage(err);
+        return Lab;
+    }
+
+    Lab.resize(3 * size_t(width) * size_t(height));
+
+    for (size_t i = 0; i < size_t(width) * size_t(height); i++) {
+        lin_rgb_to_Lab(&rgba[4 * i], &Lab[3 * i]);
+    }
+
+    free(rgba);
+
+    return Lab;
+}
+
+
+// Decodes a test file with EXRBandReader, in bands that neither start nor end
+// on chunk boundaries, and compares with the whole image read by tinyexr
+static void check_band_reader(int compression, int tile_width, int tile_height, int pixel_type)
+{
+    SCOPED_TRACE(
+        "compression " + std::to_string(compression) + ", tiles "
+        + std::to_string(tile_width) + "x" + std::to_string(tile_height)
+        + ", pixel type " + std::to_string(pixel_type));
+
+    const std::string filename = ::testing::TempDir() + "band_reader_test.exr";
+    const std::vector<std::string> channels = {"B", "G", "R"};
+
+    {
+        TestEXR exr(channels, 45, 53, pixel_type, compression, tile_width, tile_height);
+        exr.write(filename);
+    }
+
+    int width, height;
+    const std::vector<float> Lab_ref = reference_Lab(filename, width, height);
+    ASSERT_FALSE(Lab_ref.empty());
+
+    EXRBandReader reader(filename.c_str());
+    ASSERT_EQ(size_t(width), reader.width());
+    ASSERT_EQ(size_t(height), reader.height());
+
+    // Chunks are 1, 12, 16 or 32 rows high: every band but the first crosses
+    // a chunk boundary. The second pass reads columns that do not start nor
+    // end on tile boundaries.
+    const size_t bands[2][6] = {{0, 1, 8, 21, 40, 53}, {0, 13, 30, 33, 50, 53}};
+    const size_t columns[2][2] = {{0, size_t(width)}, {3, size_t(width) - 2}};
+
+    for (int pass = 0; pass < 2; pass++) {
+        const size_t x_begin = columns[pass][0], x_end = columns[pass][1];
+
+        PlanarImage Lab(x_end - x_begin, height);
+
+        for (int b = 0; b < 5; b++) {
+            reader.readRows(bands[pass][b], bands[pass][b + 1], Lab, bands[pass][b], x_begin, x_end);
+        }
+
+        // Empty ranges leave the image as it is
+        reader.readRows(21, 21, Lab, 0, x_begin, x_end);
+        reader.readRows(0, size_t(height), Lab, 0, x_begin, x_begin);
+
+        for (size_t y = 0; y < size_t(height); y++) {
+            for (size_t x = x_begin; x < x_end; x++) {
+                for (int c = 0; c < 3; c++) {
+                    const float ref = Lab_ref[3 * (y * width + x) + c];
+
+                    ASSERT_NEAR(ref, Lab.row(c, y)[x - x_begin], 1E-3 * std::max(1.f, std::abs(ref)))
+                        << "pass " << pass << ", pixel (" << x << ", " << y << "), channel " << c;
+                }
+            }
+        }
+    }
+
+    std::remove(filename.c_str());
+}
+
+
+TEST(ImageFormat, BandReader)
+{
+    const int compressions[] = {
+        TINYEXR_COMPRESSIONTYPE_NONE,
+        TINYEXR_COMPRESSIONTYPE_ZIPS,
+        TINYEXR_COMPRESSIONTYPE_ZIP};
+
+    for (int compression: compressions) {
+        for (int pixel_type: {TINYEXR_PIXELTYPE_HALF, TINYEXR_PIXELTYPE_FLOAT}) {
+            check_band_reader(compression, 0, 0, pixel_type);
+            check_band_reader(compression, 16, 12, pixel_type);
+        }
+    }
+}
+
+
+TEST(ImageFormat, BandReader_PIZ)
+{
+    for (int pixel_type: {TINYEXR_PIXELTYPE_HALF, TINYEXR_PIXELTYPE_FLOAT}) {
+        check_band_reader(TINYEXR_COMPRESSIONTYPE_PIZ, 0, 0, pixel_type);
+        check_band_reader(TINYEXR_COMPRESSIONTYPE_PIZ, 16, 12, pixel_type);
+    }
+}
+
+
+TEST(Diff, ROI)
+{
+    const EXRBox2i roi = parse_roi("10,-5,20,30");
+    EXPECT_EQ(10, roi.min_x);
+    EXPECT_EQ(-5, roi.min_y);
+    EXPECT_EQ(29, roi.max_x);
+    EXPECT_EQ(24, roi.max_y);
+
+    const char *malformed[] = {
+        "",
+        "10,20,30",
+        "1,2,3,4,5",
+        "1;2;3;4",
+        "1,2,0,4",
+        "1,2,3,-4",
+        "a,b,c,d",
+        "1,2,3,4x",
+        "2147483647,0,2,1"};
+
+    for (const char *value: malformed) {
+        EXPECT_THROW(parse_roi(value), std::runtime_error) << value;
+    }
+}
+
+
+TEST(Diff, OffsetDataWindows)
+{
+    const std::string filename_1 = ::testing::TempDir() + "window_test_1.exr";
+    const std::string filename_2 = ::testing::TempDir() + "window_test_2.exr";
+    const std::string filename_3 = ::testing::TempDir() + "window_test_3.exr";
+    const std::vector<std::string> channels = {"B", "G", "R"};
+
+    // The pixels hold the same values in all files at the same position:
+    // they only match when the files are aligned
+    TestEXR(channels, 40, 30, TINYEXR_PIXELTYPE_HALF, TINYEXR_COMPRESSIONTYPE_ZIP)
+        .write(filename_1);
+    TestEXR(channels, 35, 33, TINYEXR_PIXELTYPE_HALF, TINYEXR_COMPRESSIONTYPE_NONE, 8, 8, -7, 9)
+        .write(filename_2);
+    TestEXR(channels, 10, 10, TINYEXR_PIXELTYPE_HALF, TINYEXR_COMPRESSIONTYPE_NONE, 0, 0, 40, 0)
+        .write(filename_3);
+
+    EXRBandReader reader_1(filename_1.c_str());
+    EXRBandReader reader_2(filename_2.c_str());
+    EXRBandReader reader_3(filename_3.c_str());
+
+    const EXRBox2i everything = {INT_MIN / 2, INT_MIN / 2, INT_MAX / 2, INT_MAX / 2};
+
+    EXRBox2i region;
+    EXPECT_FALSE(check_headers(reader_1, reader_3, everything, region));
+    EXPECT_FALSE(check_headers(reader_1, reader_2, parse_roi("-7,9,7,4"), region));
+
+    const EXRBox2i rois[] = {everything, parse_roi("5,12,10,4")};
+    const EXRBox2i expected[] = {{0, 9, 27, 29}, {5, 12, 14, 15}};
+
+    for (int r = 0; r < 2; r++) {
+        ASSERT_TRUE(check_headers(reader_1, reader_2, rois[r], region));
+        EXPECT_EQ(0, memcmp(&expected[r], &region, sizeof(EXRBox2i)));
+
+        const size_t width  = size_t(region.max_x - region.min_x + 1);
+        const size_t height = size_t(region.max_y - region.min_y + 1);
+
+        PlanarImage Lab_1(width, height), Lab_2(width, height);
+        reader_1.readRegion(region, 0, height, Lab_1);
+        reader_2.readRegion(region, 0, 3, Lab_2);
+        reader_2.readRegion(region, 3, height, Lab_2, 3);
+
+        for (size_t y = 0; y < height; y++) {
+            for (size_t x = 0; x < width; x++) {
+                for (int c = 0; c < 3; c++) {
+                    ASSERT_NEAR(Lab_1.row(c, y)[x], Lab_2.row(c, y)[x], 1E-3)
+                        << "pixel (" << x << ", " << y << "), channel " << c;
+                }
+            }
+        }
+    }
+
+    std::remove(filename_1.c_str());
+    std::remove(filename_2.c_str());
+    std::remove(filename_3.c_str());
+}
+
+
+// Values of a NPY file of `height` rows of `width` floats, empty if the file
+// does not hold such an array
+static std::vector<float> read_npy(const std::string &filename, size_t width, size_t height)
+{
+    std::vector<unsigned char> file;
+
+    {
+        std::ifstream in(filename.c_str(), std::ios::binary);
+        file.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    const size_t header_size = file.size() < 10 ? 0 : size_t(file[8]) | (size_t(file[9]) << 8);
+    std::vector<float> values(width * height);
+
+    std::stringstream shape;
+    shape << "'shape': (" << height << ", " << width << ")";
+
+    if (   file.size() != 10 + header_size + values.size() * sizeof(float)
+        || std::string(file.begin() + 10, file.begin() + 10 + header_size).find(shape.str())
+               == std::string::npos) {
+        return std::vector<float>();
+    }
+
+    memcpy(values.data(), &file[10 + header_size], values.size() * sizeof(float));
+
+    return values;
+}
+
+
+// Files of the same pixels stored in offset data windows: only the pixels of
+// both, aligned, are compared
+static void write_offset_windows(const std::string &filename_1, const std::string &filename_2)
+{
+    const std::vector<std::string> channels = {"B", "G", "R"};
+
+    TestEXR(channels, 40, 30, TINYEXR_PIXELTYPE_HALF, TINYEXR_COMPRESSIONTYPE_ZIP)
+        .write(filename_1);
+    TestEXR(channels, 35, 33, TINYEXR_PIXELTYPE_HALF, TINYEXR_COMPRESSIONTYPE_ZIP, 0, 0, -7, 9)
+        .write(filename_2);
+}
+
+
+TEST(Batch, Run)
+{
+    const std::string dir = ::testing::TempDir();
+    const std::vector<std::string> channels = {"B", "G", "R"};
+
+    // A small pair of identical files, a larger pair differing at one pixel
+    TestEXR(channels, 10, 8, TINYEXR_PIXELTYPE_HALF, TINYEXR_COMPRESSIONTYPE_ZIP)
+        .write(dir + "batch_small.exr");
+
+    {
+        TestEXR exr(channels, 30, 20, TINYEXR_PIXELTYPE_HALF, TINYEXR_COMPRESSIONTYPE_ZIP);
+        exr.write(dir + "batch_large_1.exr");
+        exr.setValue(1, 7, 12, 3.f);
+        exr.write(dir + "batch_large_2.exr");
+    }
+
+    const char *files[3][3] = {
+        {"batch_small.exr", "batch_small.exr", "batch_small.npy"},
+        {"batch_missing.exr", "batch_small.exr", "batch_missing.npy"},
+        {"batch_large_1.exr", "batch_large_2.exr", "batch_large.npy"}};
+
+    std::vector<BatchJob> jobs(3);
+
+    for (size_t j = 0; j < jobs.size(); j++) {
+        jobs[j].filename_1   = dir + files[j][0];
+        jobs[j].filename_2   = dir + files[j][1];
+        jobs[j].filename_out = dir + files[j][2];
+    }
+
+    OutputSettings settings = {nullptr, 10.f, false, 6, PNGFilter::Adaptive, false};
+    BatchRunner    runner(0.f, settings);
+
+    // The failed job does not stop the others
+    EXPECT_EQ(size_t(1), runner.run(jobs));
+
+    // Largest first, unreadable files last
+    ASSERT_EQ(size_t(3), jobs.size());
+    EXPECT_EQ(dir + "batch_large.npy", jobs[0].filename_out);
+    EXPECT_EQ(dir + "batch_small.npy", jobs[1].filename_out);
+    EXPECT_EQ(dir + "batch_missing.npy", jobs[2].filename_out);
+
+    const std::vector<float> small = read_npy(dir + "batch_small.npy", 10, 8);
+    ASSERT_EQ(size_t(10 * 8), small.size());
+    EXPECT_EQ(size_t(10 * 8), size_t(std::count(small.begin(), small.end(), 0.f)));
+
+    const std::vector<float> large = read_npy(dir + "batch_large.npy", 30, 20);
+    ASSERT_EQ(size_t(30 * 20), large.size());
+    EXPECT_EQ(size_t(30 * 20 - 1), size_t(std::count(large.begin(), large.end(), 0.f)));
+    EXPECT_GT(large[12 * 30 + 7], 0.f);
+
+    std::ifstream missing((dir + "batch_missing.npy").c_str());
+    EXPECT_FALSE(missing.good());
+
+    const char *written[] = {
+        "batch_small.exr", "batch_large_1.exr", "batch_large_2.exr",
+        "batch_small.npy", "batch_large.npy"};
+
+    for (const char *filename: written) {
+        std::remove((dir + filename).c_str());
+    }
+}
+
+
+TEST(Batch, OffsetDataWindows)
+{
+    const std::string filename_1   = ::testing::TempDir() + "batch_window_test_1.exr";
+    const std::string filename_2   = ::testing::TempDir() + "batch_window_test_2.exr";
+    const std::string filename_out = ::testing::TempDir() + "batch_window_test.npy";
+
+    write_offset_windows(filename_1, filename_2);
+
+    OutputSettings settings = {nullptr, 10.f, false, 6, PNGFilter::Adaptive, false};
+    BatchRunner    runner(0.f, settings);
+
+    std::vector<BatchJob> jobs(1);
+    jobs[0].filename_1   = filename_1;
+    jobs[0].filename_2   = filename_2;
+    jobs[0].filename_out = filename_out;
+
+    EXPECT_EQ(size_t(0), runner.run(jobs));
+
+    // The common pixels: [0, 27] x [9, 29]
+    const std::vector<float> deltaE = read_npy(filename_out, 28, 21);
+    ASSERT_EQ(size_t(28 * 21), deltaE.size());
+    EXPECT_EQ(size_t(28 * 21), size_t(std::count(deltaE.begin(), deltaE.end(), 0.f)));
+
+    std::remove(filename_1.c_str());
+    std::remove(filename_2.c_str());
+    std::remove(filename_out.c_str());
+}
+
+
+#ifndef _WIN32
+TEST(Server, OffsetDataWindows)
+{
+    const std::string filename_1   = ::testing::TempDir() + "server_window_test_1.exr";
+    const std::string filename_2   = ::testing::TempDir() + "server_window_test_2.exr";
+    const std::string filename_out = ::testing::TempDir() + "server_window_test.npy";
+
+    write_offset_windows(filename_1, filename_2);
+
+    DiffServer  server("", 1 << 20, 256);
+    DiffRequest request;
+    request.filename_1   = filename_1;
+    request.filename_2   = filename_2;
+    request.filename_out = filename_out;
+
+    const DiffResponse response = server.handle(request);
+
+    EXPECT_EQ(EXIT_SUCCESS, response.status);
+    EXPECT_NE(std::string::npos, response.err.find("[warning] The data windows of the images differ"));
+
+    const std::vector<float> deltaE = read_npy(filename_out, 28, 21);
+    ASSERT_EQ(size_t(28 * 21), deltaE.size());
+    EXPECT_EQ(size_t(28 * 21), size_t(std::count(deltaE.begin(), deltaE.end(), 0.f)));
+
+    std::remove(filename_1.c_str());
+    std::remove(filename_2.c_str());
+    std::remove(filename_out.c_str());
+}
+
+
+TEST(Server, LabCache)
+{
+    const std::string filename_a = ::testing::TempDir() + "lab_cache_a.exr";
+    const std::string filename_b = ::testing::TempDir() + "lab_cache_b.exr";
+    const std::string filename_c = ::testing::TempDir() + "lab_cache_c.exr";
+    const std::vector<std::string> channels = {"B", "G", "R"};
+
+    TestEXR(channels, 16, 16, TINYEXR_PIXELTYPE_HALF, TINYEXR_COMPRESSIONTYPE_ZIP).write(filename_a);
+    TestEXR(channels, 16, 16, TINYEXR_PIXELTYPE_HALF, TINYEXR_COMPRESSIONTYPE_NONE).write(filename_b);
+    TestEXR(channels, 16, 16, TINYEXR_PIXELTYPE_FLOAT, TINYEXR_COMPRESSIONTYPE_ZIP).write(filename_c);
+
+    const size_t image_bytes = 3 * LabImage(16, 16).stride() * 16 * sizeof(float);
+
+    // Room for two images
+    LabCache cache(2 * image_bytes + image_bytes / 2);
+
+    std::shared_ptr<const EXRLabImageFormat> a = cache.get(filename_a, 0.f);
+    EXPECT_EQ(a, cache.get(filename_a, 0.f));
+    EXPECT_NE(a, cache.get(filename_a, 1.f));
+    EXPECT_EQ(1u, cache.hits());
+    EXPECT_EQ(2u, cache.misses());
+    EXPECT_EQ(size_t(2), cache.size());
+    EXPECT_EQ(2 * image_bytes, cache.bytes());
+
+    // The least recently used image is dropped: the one with an exposure
+    cache.get(filename_a, 0.f);
+    cache.get(filename_b, 0.f);
+    EXPECT_EQ(size_t(2), cache.size());
+    EXPECT_EQ(2 * image_bytes, cache.bytes());
+
+    EXPECT_EQ(a, cache.get(filename_a, 0.f));
+    EXPECT_EQ(3u, cache.hits());
+    cache.get(filename_a, 1.f);
+    EXPECT_EQ(4u, cache.misses());
+
+    // A file rewritten in place is loaded again, the images already given
+    // staying valid
+    TestEXR(channels, 8, 16, TINYEXR_PIXELTYPE_HALF, TINYEXR_COMPRESSIONTYPE_ZIP).write(filename_a);
+
+    std::shared_ptr<const EXRLabImageFormat> rewritten = cache.get(filename_a, 0.f);
+    EXPECT_EQ(size_t(8), rewritten->width());
+    EXPECT_EQ(size_t(16), a->width());
+    EXPECT_EQ(5u, cache.misses());
+
+    // Images larger than the cache are not kept
+    LabCache small(image_bytes / 2);
+    small.get(filename_c, 0.f);
+    small.get(filename_c, 0.f);
+    EXPECT_EQ(size_t(0), small.size());
+    EXPECT_EQ(size_t(0), small.bytes());
+    EXPECT_EQ(0u, small.hits());
+
+    std::remove(filename_a.c_str());
+    std::remove(filename_b.c_str());
+    std::remove(filename_c.c_str());
+}
+
+
+TEST(Server, Handle)
+{
+    const std::string filename_1 = ::testing::TempDir() + "server_test_1.exr";
+    const std::string filename_2 = ::testing::TempDir() + "server_test_2.exr";
+    const std::string filename_3 = ::testing::TempDir() + "server_test_3.exr";
+
+    {
+        TestEXR exr({"B", "G", "R"}, 20, 10, TINYEXR_PIXELTYPE_HALF, TINYEXR_COMPRESSIONTYPE_ZIP);
+        exr.write(filename_1);
+
+        for (int x = 0; x < 3; x++) {
+            exr.setValue(0, x, 4, 3.f);
+        }
+
+        exr.write(filename_2);
+    }
+
+    DiffServer server("", 1 << 20, 256);
+
+    DiffRequest request;
+    request.filename_1 = filename_1;
+    request.filename_2 = filename_2;
+    request.stats      = true;
+    request.gate       = true;
+    request.max_count  = 2;
+
+    // Three pixels above the threshold
+    DiffResponse response = server.handle(request);
+    EXPECT_EQ(EXIT_GATE_FAILED, response.status);
+    EXPECT_NE(std::string::npos, response.out.find("\"pixels\": 200,"));
+    EXPECT_NE(std::string::npos, response.err.find("[gate] Failed"));
+    EXPECT_EQ(0u, server.cache().hits());
+    EXPECT_EQ(2u, server.cache().misses());
+
+    // The images are not decoded again
+    request.max_count = 3;
+    response          = server.handle(request);
+    EXPECT_EQ(EXIT_SUCCESS, response.status);
+    EXPECT_NE(std::string::npos, response.err.find("[gate] Passed: 3 pixels"));
+    EXPECT_EQ(2u, server.cache().hits());
+    EXPECT_EQ(2u, server.cache().misses());
+
+    // Errors are reported to the client and do not stop the server
+    request.filename_2 = filename_3;
+    response           = server.handle(request);
+    EXPECT_EQ(EXIT_FAILURE, response.status);
+    EXPECT_NE(std::string::npos, response.err.find("[error] Cannot open file"));
+
+    request.filename_2 = filename_2;
+    request.max_deltaE = 0.f;
+    response           = server.handle(request);
+    EXPECT_EQ(EXIT_FAILURE, response.status);
+    EXPECT_NE(std::string::npos, response.err.find("[error] The maximum Delta E must be positive"));
+
+    std::remove(filename_1.c_str());
+    std::remove(filename_2.c_str());
+}
+#endif
+
+
+// Keeps the whole map given to the output
+class MapOutput: public DiffOutput
+{
+  public:
+    MapOutput(size_t width, size_t height)
+      : DiffOutput(width, height)
+      , values(width * height, -1.f)
+    {}
+
+    virtual void writeRow(size_t y, const float *deltaE, const unsigned char *)
+    {
+        std::copy(deltaE, deltaE + _width, &values[y * _width]);
+    }
+
+    std::vector<float> values;
+};
+
+
+// Delta E 2000 map of two files over their common pixels, compared in bands
+// of 7 rows
+static std::vector<float> diff_map(EXRBandReader &reader_1, EXRBandReader &reader_2, bool skip_identical)
+{
+    const MetricParameters parameters = {100.f, 67.f, 7};
+    const MetricEngine     engine(MetricEngine::parse("de2000"), parameters);
+
+    EXRBox2i region;
+    EXPECT_TRUE(intersect(reader_1.dataWindow(), reader_2.dataWindow(), region));
+
+    const size_t width  = size_t(region.max_x - region.min_x + 1);
+    const size_t height = size_t(region.max_y - region.min_y + 1);
+
+    MapOutput                 output(width, height);
+    std::vector<DiffOutput *> outputs(1, &output);
+
+    diff_files(
+        reader_1,
+        reader_2,
+        nullptr,
+        region,
+        nullptr,
+        nullptr,
+        outputs,
+        engine,
+        split_rows(height, 7),
+        skip_identical);
+
+    return output.values;
+}
+
+
+TEST(Diff, SkipIdenticalChunks)
+{
+    const std::string filename_1 = ::testing::TempDir() + "skip_test_1.exr";
+    const std::string filename_2 = ::testing::TempDir() + "skip_test_2.exr";
+    const std::string filename_3 = ::testing::TempDir() + "skip_test_3.exr";
+    const std::string filename_4 = ::testing::TempDir() + "skip_test_4.exr";
+    const std::vector<std::string> channels = {"B", "G", "R"};
+    const int width = 30, height = 50;
+
+    {
+        TestEXR exr(channels, width, height, TINYEXR_PIXELTYPE_HALF, TINYEXR_COMPRESSIONTYPE_ZIP);
+        exr.write(filename_1);
+
+        // Same pixels, stored differently or in another color space
+        exr.header.compression_type = TINYEXR_COMPRESSIONTYPE_ZIPS;
+        exr.write(filename_3);
+
+        const float rec2020[8] = {0.708f, 0.292f, 0.170f, 0.797f, 0.131f, 0.046f, 0.3127f, 0.3290f};
+        exr.header.compression_type = TINYEXR_COMPRESSIONTYPE_ZIP;
+        exr.setChromaticities(rec2020);
+        exr.write(filename_4);
+    }
+
+    {
+        // The row 20 differs: only the chunk of the rows [16, 32) changes
+        TestEXR exr(channels, width, height, TINYEXR_PIXELTYPE_HALF, TINYEXR_COMPRESSIONTYPE_ZIP);
+
+        for (int x = 0; x < width; x++) {
+            exr.setValue(2, x, 20, 3.f);
+        }
+
+        exr.write(filename_2);
+    }
+
+    EXRBandReader reader_1(filename_1.c_str());
+    EXRBandReader reader_2(filename_2.c_str());
+
+    ASSERT_TRUE(reader_1.sameLayout(reader_2));
+    ASSERT_EQ(size_t(16), reader_1.chunkRows());
+
+    for (size_t c = 0; c < 4; c++) {
+        EXPECT_EQ(c != 1, reader_1.sameChunks(reader_2, c)) << "chunk " << c;
+    }
+
+    const std::vector<float> deltaE = diff_map(reader_1, reader_2, true);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            if (y == 20) {
+                EXPECT_GT(deltaE[y * width + x], 0.f) << "pixel (" << x << ", " << y << ")";
+            } else {
+                EXPECT_EQ(0.f, deltaE[y * width + x]) << "pixel (" << x << ", " << y << ")";
+            }
+        }
+    }
+
+    // Chunks are not skipped when the same bytes may give other colors:
+    // another compression, exposure or RGB to XYZ matrix
+    EXRBandReader reader_3(filename_3.c_str());
+    EXRBandReader reader_4(filename_4.c_str());
+    EXRBandReader reader_5(filename_1.c_str(), 1.f);
+
+    EXPECT_FALSE(reader_1.sameLayout(reader_3));
+    EXPECT_FALSE(reader_1.sameLayout(reader_4));
+    EXPECT_FALSE(reader_1.sameLayout(reader_5));
+
+    EXRBandReader *others[2] = {&reader_4, &reader_5};
+
+    for (int i = 0; i < 2; i++) {
+        EXPECT_TRUE(reader_1.sameChunks(*others[i], 0));
+
+        const std::vector<float> skipped  = diff_map(reader_1, *others[i], true);
+        const std::vector<float> compared = diff_map(reader_1, *others[i], false);
+
+        EXPECT_EQ(compared, skipped);
+    }
+
+    // A different exposure changes every pixel
+    const std::vector<float> exposed = diff_map(reader_1, reader_5, true);
+    EXPECT_EQ(0, std::count(exposed.begin(), exposed.end(), 0.f));
+
+    std::remove(filename_1.c_str());
+    std::remove(filename_2.c_str());
+    std::remove(filename_3.c_str());
+    std::remove(filename_4.c_str());
+}
+
+
+TEST(Diff, CachedSpatialMetric)
+{
+    const std::string filename_1 = ::testing::TempDir() + "cached_test_1.exr";
+    const std::string filename_2 = ::testing::TempDir() + "cached_test_2.exr";
+    const std::vector<std::string> channels = {"B", "G", "R"};
+    const size_t width = 30, height = 20;
+
+    {
+        TestEXR exr(channels, int(width), int(height), TINYEXR_PIXELTYPE_HALF, TINYEXR_COMPRESSIONTYPE_ZIP);
+        exr.write(filename_1);
+
+        for (int x = 5; x < 12; x++) {
+            exr.setValue(2, x, 9, 3.f);
+        }
+
+        exr.write(filename_2);
+    }
+
+    // The cache holds the whole Lab image of the second file
+    EXRBandReader reader_1(filename_1.c_str());
+    EXRBandReader reader_2(filename_2.c_str());
+    LabImage      cached_2(width, height);
+
+    reader_2.readRows(0, height, cached_2);
+
+    const MetricParameters parameters = {100.f, 67.f, 7};
+    const MetricEngine     engine(MetricEngine::parse("ssim"), parameters);
+    const EXRBox2i         region = reader_1.dataWindow();
+
+    ASSERT_TRUE(engine.spatial());
+
+    std::vector<float> maps[2];
+
+    for (int c = 0; c < 2; c++) {
+        MapOutput                 output(width, height);
+        std::vector<DiffOutput *> outputs(1, &output);
+
+        diff_files(
+            reader_1,
+            reader_2,
+            nullptr,
+            region,
+            c ? &cached_2 : nullptr,
+            nullptr,
+            outputs,
+            engine,
+            split_rows(height, height),
+            false);
+
+        maps[c] = output.values;
+    }
+
+    EXPECT_EQ(maps[0], maps[1]);
+    EXPECT_GT(*std::max_element(maps[1].begin(), maps[1].end()), 0.f);
+
+    std::remove(filename_1.c_str());
+    std::remove(filename_2.c_str());
+}
+
+
+// Counts the bands given to the outputs, never needing their rows
+class BandCounter: public DiffOutput
+{
+  public:
+    BandCounter(size_t width, size_t height)
+      : DiffOutput(width, height)
+      , bands(0)
+    {}
+
+    virtual void beginBand(size_t, size_t) { bands++; }
+    virtual void writeRow(size_t, const float *, const unsigned char *) {}
+    virtual bool done() const { return true; }
+
+    size_t bands;
+};
+
+
+TEST(Gate, EarlyExit)
+{
+    const std::string filename = ::testing::TempDir() + "gate_test.exr";
+    const size_t width = 30, height = 50;
+
+    {
+        TestEXR exr({"B", "G", "R"}, int(width), int(height), TINYEXR_PIXELTYPE_HALF, TINYEXR_COMPRESSIONTYPE_ZIP);
+        exr.write(filename);
+    }
+
+    // Another exposure changes every pixel: the gate fails in the first band
+    EXRBandReader reader_1(filename.c_str());
+    EXRBandReader reader_2(filename.c_str(), 1.f);
+
+    const MetricParameters parameters = {100.f, 67.f, 7};
+    const MetricEngine     engine(MetricEngine::parse("de2000,de76"), parameters);
+
+    // Only the first metric has a consumer, like with --fail-above alone
+    MultiOutput  output_1(width, height);
+    MultiOutput  output_2(width, height);
+    GateOutput * gate    = new GateOutput(width, height, 0.5f, 10);
+    BandCounter *counter = new BandCounter(width, height);
+
+    output_1.add(gate);
+    output_1.add(counter);
+
+    const std::vector<DiffOutput *> outputs = {&output_1, &output_2};
+
+    diff_files(
+        reader_1,
+        reader_2,
+        nullptr,
+        reader_1.dataWindow(),
+        nullptr,
+        nullptr,
+        outputs,
+        engine,
+        split_rows(height, 10),
+        false);
+
+    EXPECT_FALSE(gate->passed());
+    EXPECT_EQ(size_t(1), counter->bands);
+
+    std::remove(filename.c_str());
+}
+
+
+// Writes the images and headers of `parts` as a multipart file
+static void write_multipart(const std::string &filename, TestEXR *const *parts, size_t n_parts)
+{
+    std::vector<EXRImage>          images;
+    std::vector<const EXRHeader *> headers;
+
+    for (size_t p = 0; p < n_parts; p++) {
+        images.push_back(parts[p]->image);
+        headers.push_back(&parts[p]->header);
+    }
+
+    unsigned char *memory = nullptr;
+    const char *   err    = nullptr;
+
+    const size_t size = SaveEXRMultipartImageToMemory(
+        images.data(), headers.data(), (unsigned int)n_parts, &memory, &err);
+    ASSERT_NE(size_t(0), size) << (err ? err : "");
+
+    TestEXR::write(filename, memory, size);
+    free(memory);
+}
+
+
+// Decodes the columns [x_begin, x_end) of the selected layer of two files,
+// which must give the same Lab values
+static void expect_same_Lab(
+    EXRBandReader &reader_1, EXRBandReader &reader_2, size_t x_begin = 0, size_t x_end = size_t(-1))
+{
+    ASSERT_EQ(reader_1.width(), reader_2.width());
+    ASSERT_EQ(reader_1.height(), reader_2.height());
+
+    const size_t width  = std::min(x_end, reader_1.width()) - x_begin;
+    const size_t height = reader_1.height();
+
+    PlanarImage Lab_1(width, height);
+    PlanarImage Lab_2(width, height);
+
+    reader_1.readRows(0, height, Lab_1, 0, x_begin, x_end);
+    reader_2.readRows(0, 5, Lab_2, 0, x_begin, x_end);
+    reader_2.readRows(5, height, Lab_2, 5, x_begin, x_end);
+
+    for (size_t y = 0; y < height; y++) {
+        for (int c = 0; c < 3; c++) {
+            ASSERT_EQ(0, memcmp(Lab_1.row(c, y), Lab_2.row(c, y), width * sizeof(float)))
+                << "row " << y << ", channel " << c;
+        }
+    }
+}
+
+
+TEST(Diff, Multipart)
+{
+    const std::string multipart = ::testing::TempDir() + "multipart_test.exr";
+    const std::string beauty    = ::testing::TempDir() + "multipart_test_beauty.exr";
+    const std::string aovs      = ::testing::TempDir() + "multipart_test_aovs.exr";
+    const std::string combined  = ::testing::TempDir() + "multipart_test_combined.exr";
+
+    // A compressed scanline part and an uncompressed tiled one, the latter
+    // read in place after the part number of each chunk
+    TestEXR beauty_part(
+        {"B", "G", "R"}, 20, 18, TINYEXR_PIXELTYPE_HALF, TINYEXR_COMPRESSIONTYPE_ZIP);
+    TestEXR aovs_part(
+        {"depth.Z", "diffuse.B", "diffuse.G", "diffuse.R"},
+        20,
+        18,
+        TINYEXR_PIXELTYPE_FLOAT,
+        TINYEXR_COMPRESSIONTYPE_NONE,
+        8,
+        8);
+
+    beauty_part.write(beauty);
+    aovs_part.write(aovs);
+
+    TestEXR(
+        {"B", "G", "R", "diffuse.B", "diffuse.G", "diffuse.R"},
+        20,
+        18,
+        TINYEXR_PIXELTYPE_HALF,
+        TINYEXR_COMPRESSIONTYPE_ZIPS)
+        .write(combined);
+
+    EXRSetNameAttr(&beauty_part.header, "beauty");
+    EXRSetNameAttr(&aovs_part.header, "aovs");
+
+    TestEXR *parts[2] = {&beauty_part, &aovs_part};
+    write_multipart(multipart, parts, 2);
+
+    // Each part reads like a single part file
+    {
+        EXRBandReader reader_1(multipart.c_str(), 0.f, 0);
+        EXRBandReader reader_2(beauty.c_str());
+
+        EXPECT_EQ(2, reader_1.numParts());
+        EXPECT_EQ("beauty", reader_1.partName());
+        EXPECT_EQ(1, reader_2.numParts());
+        EXPECT_EQ("", reader_2.partName());
+
+        expect_same_Lab(reader_1, reader_2);
+    }
+
+    for (const char *layer: {"diffuse", "depth"}) {
+        EXRBandReader reader_1(multipart.c_str(), 0.f, 1);
+        EXRBandReader reader_2(aovs.c_str());
+
+        EXPECT_EQ("aovs", reader_1.partName());
+        EXPECT_EQ(std::vector<std::string>({"depth", "diffuse"}), reader_1.layerNames());
+
+        reader_1.selectLayers(std::vector<std::string>(1, layer));
+        reader_2.selectLayers(std::vector<std::string>(1, layer));
+
+        expect_same_Lab(reader_1, reader_2);
+    }
+
+    EXPECT_THROW(EXRBandReader(multipart.c_str(), 0.f, 2), std::runtime_error);
+    EXPECT_THROW(EXRBandReader(beauty.c_str(), 0.f, 1), std::runtime_error);
+
+    // Layers of a multipart file are named after the part
+    const auto parts_1 = open_parts(multipart, 0.f);
+    const auto parts_2 = open_parts(multipart, 0.f);
+    const auto parts_3 = open_parts(beauty, 0.f);
+    const auto parts_4 = open_parts(combined, 0.f);
+
+    const auto layers = list_layers(parts_1);
+    ASSERT_EQ(size_t(3), layers.size());
+    EXPECT_EQ("beauty", layers[0].first);
+    EXPECT_EQ(0, layers[0].second.first);
+    EXPECT_EQ("", layers[0].second.second);
+    EXPECT_EQ("aovs.depth", layers[1].first);
+    EXPECT_EQ(1, layers[1].second.first);
+    EXPECT_EQ("depth", layers[1].second.second);
+    EXPECT_EQ("aovs.diffuse", layers[2].first);
+
+    const auto combined_layers = list_layers(parts_4);
+    ASSERT_EQ(size_t(2), combined_layers.size());
+    EXPECT_EQ("default", combined_layers[0].first);
+    EXPECT_EQ("diffuse", combined_layers[1].first);
+    EXPECT_EQ("diffuse", combined_layers[1].second.second);
+
+    // All the layers found in both files
+    const std::vector<LayerPair> all
+        = match_layers(parts_1, parts_2, multipart, multipart, "all");
+    ASSERT_EQ(size_t(3), all.size());
+
+    for (size_t i = 0; i < all.size(); i++) {
+        EXPECT_EQ(layers[i].first, all[i].id);
+        EXPECT_EQ(layers[i].second.first, all[i].part_1);
+        EXPECT_EQ(layers[i].second.first, all[i].part_2);
+        EXPECT_EQ(layers[i].second.second, all[i].layer_1);
+        EXPECT_EQ(layers[i].second.second, all[i].layer_2);
+    }
+
+    // Layers missing in either file are left out, but one must remain
+    const std::vector<LayerPair> common
+        = match_layers(parts_3, parts_4, beauty, combined, "all");
+    ASSERT_EQ(size_t(1), common.size());
+    EXPECT_EQ("default", common[0].id);
+    EXPECT_EQ(size_t(1), match_layers(parts_4, parts_3, combined, beauty, "all").size());
+
+    EXPECT_THROW(match_layers(parts_1, parts_3, multipart, beauty, "all"), std::runtime_error);
+
+    // A list, in its order
+    const std::vector<LayerPair> listed
+        = match_layers(parts_1, parts_2, multipart, multipart, "aovs.diffuse,beauty");
+    ASSERT_EQ(size_t(2), listed.size());
+    EXPECT_EQ("aovs.diffuse", listed[0].id);
+    EXPECT_EQ("diffuse", listed[0].layer_1);
+    EXPECT_EQ(1, listed[0].part_2);
+    EXPECT_EQ("beauty", listed[1].id);
+    EXPECT_EQ(0, listed[1].part_1);
+
+    // Missing layers
+    try {
+        match_layers(parts_1, parts_2, multipart, multipart, "beauty,specular");
+        FAIL() << "A missing layer must be rejected";
+    } catch (const std::runtime_error &e) {
+        EXPECT_EQ("Missing layer specular: " + multipart, std::string(e.what()));
+    }
+
+    EXPECT_THROW(match_layers(parts_1, parts_2, multipart, multipart, ""), std::runtime_error);
+    EXPECT_EQ(size_t(1), match_layers(parts_3, parts_3, beauty, beauty, "").size());
+
+    std::remove(multipart.c_str());
+    std::remove(beauty.c_str());
+    std::remove(aovs.c_str());
+    std::remove(combined.c_str());
+}
+
+
+TEST(ImageFormat, ChannelSelection)
+{
+    const std::string filename_1 = ::testing::TempDir() + "channels_test_aovs.exr";
+    const std::string filename_2 = ::testing::TempDir() + "channels_test_rgb.exr";
+
+    // Extra channels sorted before and after R, G and B
+    const std::vector<std::string> aovs
+        = {"A", "albedo.B", "albedo.G", "albedo.R", "B", "G", "R", "Z", "normal.X"};
+    const std::vector<std::string> rgb = {"B", "G", "R"};
+
+    const int half = TINYEXR_PIXELTYPE_HALF, single = TINYEXR_PIXELTYPE_FLOAT;
+
+    // Pixel types of B, G and R, then of the extra channels: the unselected
+    // channels are either of the type of the colors or of the other one
+    const int types[4][4] = {
+        {half, half, half, single},
+        {single, single, single, half},
+        {half, half, half, half},
+        {half, single, half, half}};
+
+    for (int compression: {TINYEXR_COMPRESSIONTYPE_NONE, TINYEXR_COMPRESSIONTYPE_ZIP}) {
+        for (int tile_size: {0, 8}) {
+            for (int t = 0; t < 4; t++) {
+                SCOPED_TRACE(
+                    "compression " + std::to_string(compression) + ", tiles "
+                    + std::to_string(tile_size) + ", types " + std::to_string(t));
+
+                TestEXR exr_1(aovs, 21, 19, types[t][3], compression, tile_size, tile_size);
+                TestEXR exr_2(rgb, 21, 19, types[t][3], compression, tile_size, tile_size);
+
+                for (size_t c = 0; c < 3; c++) {
+                    exr_1.setPixelType(4 + c, types[t][c]);
+                    exr_2.setPixelType(c, types[t][c]);
+                }
+
+                exr_1.write(filename_1);
+                exr_2.write(filename_2);
+
+                EXRBandReader reader_1(filename_1.c_str());
+                EXRBandReader reader_2(filename_2.c_str());
+
+                EXPECT_EQ(
+                    std::vector<std::string>({"", "albedo", "normal"}),
+                    reader_1.layerNames());
+
+                expect_same_Lab(reader_1, reader_2);
+                expect_same_Lab(reader_1, reader_2, 3, 17);
+            }
+        }
+    }
+
+    std::remove(filename_1.c_str());
+    std::remove(filename_2.c_str());
+}
+
+
+TEST(Diff, LayerFilename)
+{
+    EXPECT_EQ("out/diff.beauty.png", layer_filename("out/diff.png", "beauty"));
+    EXPECT_EQ("diff.aovs.depth.exr", layer_filename("diff.exr", "aovs.depth"));
+    EXPECT_EQ("diff.beauty", layer_filename("diff", "beauty"));
+    EXPECT_EQ("renders.v2/diff.beauty", layer_filename("renders.v2/diff", "beauty"));
+    EXPECT_EQ("renders.v2\\diff.beauty", layer_filename("renders.v2\\diff", "beauty"));
+}
+
+
+// Test RGBA pixel: gradients, which deflate as matches, mixed with noise,
+// which deflates as literals
+static unsigned char test_rgba(size_t x, size_t y, int c)
+{
+    const uint32_t noise = uint32_t(x * 2654435761U) ^ uint32_t((y + 1) * 2246822519U);
+
+    return (x % 5 == 0) ? (unsigned char)(noise >> (8 * c))
+                        : (unsigned char)(x * 3 + y * 7 + size_t(c) * 50);
+}
+
+
+// Reads back a PNG file written by PNGStreamWriter: checks its chunks, then
+// inflates its IDAT stream with zlib and reverts the filters of its rows
+static std::vector<unsigned char> read_png(const std::string &filename, size_t &width, size_t &height)
+{
+    std::vector<unsigned char> file;
+
+    {
+        std::ifstream in(filename.c_str(), std::ios::binary);
+        file.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    auto getUInt32 = [&](size_t i) {
+        return (uint32_t(file[i]) << 24) | (uint32_t(file[i + 1]) << 16)
+               | (uint32_t(file[i + 2]) << 8) | uint32_t(file[i + 3]);
+    };
+
+    const unsigned char signature[8] = {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+    EXPECT_TRUE(file.size() > 8 && memcmp(file.data(), signature, 8) == 0);
+
+    std::vector<unsigned char> idat;
+    bool                       end = false;
+
+    for (size_t pos = 8; !end && pos + 12 <= file.size();) {
+        const size_t      size = getUInt32(pos);
+        const std::string type(reinterpret_cast<const char *>(&file[pos + 4]), 4);
+
+        if (pos + 12 + size > file.size()) {
+            ADD_FAILURE() << "Truncated chunk " << type;
+            break;
+        }
+
+        EXPECT_EQ(getUInt32(pos + 8 + size), uint32_t(::crc32(0, &file[pos + 4], uInt(size + 4))))
+            << "CRC of chunk " << type;
+
+        if (type == "IHDR") {
+            width  = getUInt32(pos + 8);
+            height = getUInt32(pos + 12);
+        } else if (type == "IDAT") {
+            idat.insert(idat.end(), &file[pos + 8], &file[pos + 8] + size);
+        }
+
+        end = type == "IEND";
+        pos += 12 + size;
+    }
+
+    EXPECT_TRUE(end);
+
+    // uncompress() also checks the Adler-32 of the stream
+    const size_t               row_size = 4 * width;
+    std::vector<unsigned char> filtered(height * (row_size + 1));
+    uLongf                     filtered_size = uLongf(filtered.size());
+
+    EXPECT_EQ(Z_OK, uncompress(filtered.data(), &filtered_size, idat.data(), uLong(idat.size())));
+    EXPECT_EQ(filtered.size(), size_t(filtered_size));
+
+    std::vector<unsigned char> rgba(height * row_size);
+
+    for (size_t y = 0; y < height; y++) {
+        const unsigned char *in   = &filtered[y * (row_size + 1)];
+        unsigned char *      row  = &rgba[y * row_size];
+        const unsigned char *prev = y > 0 ? &rgba[(y - 1) * row_size] : nullptr;
+
+        for (size_t i = 0; i < row_size; i++) {
+            const int a = i >= 4 ? row[i - 4] : 0;
+            const int b = prev ? prev[i] : 0;
+            const int c = (prev && i >= 4) ? prev[i - 4] : 0;
+
+            int predictor = 0;
+
+            switch (in[0]) {
+                case 0: predictor = 0; break;
+                case 1: predictor = a; break;
+                case 2: predictor = b; break;
+                case 3: predictor = (a + b) / 2; break;
+                case 4: {
+                    const int p  = a + b - c;
+                    const int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+                    predictor    = (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+                    break;
+                }
+                default: ADD_FAILURE() << "Invalid filter " << int(in[0]) << " on row " << y;
+            }
+
+            row[i] = (unsigned char)(in[1 + i] + predictor);
+        }
+    }
+
+    return rgba;
+}
+
+
+// Writes an image with PNGStreamWriter in bands of `band_rows` rows, then
+// checks it reads back to the same pixels
+static void check_png_round_trip(size_t width, size_t height, size_t band_rows, int level, PNGFilter filter)
+{
+    SCOPED_TRACE(
+        std::to_string(width) + "x" + std::to_string(height) + ", bands of "
+        + std::to_string(band_rows) + " rows, level " + std::to_string(level)
+        + ", filter " + std::to_string(int(filter)));
+
+    const std::string filename = ::testing::TempDir() + "png_stream_test.png";
+
+    std::vector<unsigned char> rgba(4 * width * height);
+
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            for (int c = 0; c < 4; c++) {
+                rgba[4 * (y * width + x) + c] = test_rgba(x, y, c);
+            }
+        }
+    }
+
+    {
+        PNGStreamWriter writer(filename, width, height, level, filter);
+
+        for (size_t y = 0; y < height; y += band_rows) {
+            writer.writeRows(&rgba[4 * y * width], std::min(band_rows, height - y));
+        }
+
+        writer.close();
+    }
+
+    size_t                           read_width = 0, read_height = 0;
+    const std::vector<unsigned char> read = read_png(filename, read_width, read_height);
+
+    EXPECT_EQ(width, read_width);
+    EXPECT_EQ(height, read_height);
+    EXPECT_TRUE(rgba == read);
+
+    std::remove(filename.c_str());
+}
+
+
+TEST(ImageFormat, PNGRoundTrip)
+{
+    const PNGFilter filters[] = {
+        PNGFilter::None,
+        PNGFilter::Sub,
+        PNGFilter::Up,
+        PNGFilter::Average,
+        PNGFilter::Paeth,
+        PNGFilter::Adaptive};
+
+    // Rows of 32 KiB: groups of 7 rows are compressed in parallel, a band
+    // holds several groups, or ends in the middle of one
+    const size_t width = 8192, height = 9;
+
+    for (int level: {0, 1, 9}) {
+        for (PNGFilter filter: filters) {
+            check_png_round_trip(width, height, 4, level, filter);
+
+            // A single row, and fewer rows than threads
+            check_png_round_trip(37, 1, 1, level, filter);
+            check_png_round_trip(5, 2, 2, level, filter);
+        }
+
+        for (size_t band_rows: {size_t(1), size_t(8), height}) {
+            check_png_round_trip(width, height, band_rows, level, PNGFilter::Adaptive);
+        }
+    }
+}
+
+
+TEST(Metric, DeltaE76_94)
+{
+    const float Lab_1[3] = {50.f, 2.6772f, -79.7751f};
+    const float Lab_2[3] = {50.f, 0.f, -82.7485f};
+
+    EXPECT_NEAR(4.0011f, deltaE76(Lab_1, Lab_2), 1E-4);
+
+    // Chroma and hue differences are weighted down by the reference chroma
+    EXPECT_LT(deltaE94(Lab_1, Lab_2), deltaE76(Lab_1, Lab_2));
+
+    // Lightness differences are not
+    const float Lab_3[3] = {60.f, 2.6772f, -79.7751f};
+    EXPECT_NEAR(10.f, deltaE94(Lab_3, Lab_1), 1E-4);
+}
+
+
+TEST(Metric, ICtCp)
+{
+    // D65 white of 100 cd/m2
+    const float XYZ[3] = {0.95047f, 1.f, 1.08883f};
+    float       ICtCp[3];
+
+    xyz_to_ICtCp(XYZ, 100.f, ICtCp);
+
+    EXPECT_NEAR(pq_encode(0.01f), ICtCp[0], 1E-3);
+    EXPECT_NEAR(0.508f, ICtCp[0], 1E-3);
+    EXPECT_NEAR(0.f, ICtCp[1], 1E-3);
+    EXPECT_NEAR(0.f, ICtCp[2], 1E-3);
+
+    EXPECT_EQ(0.f, deltaITP(ICtCp, ICtCp));
+}
+
+
+TEST(Metric, Engine)
+{
+    const MetricParameters parameters = {100.f, 67.f, 7};
+
+    EXPECT_THROW(MetricEngine(MetricEngine::parse("de2000,foo"), parameters), std::runtime_error);
+    EXPECT_FALSE(MetricEngine(MetricEngine::parse("de2000,de76,de94"), parameters).needsXYZ());
+
+    MetricEngine engine(MetricEngine::parse("de2000,itp,abs,psnr"), parameters);
+    ASSERT_TRUE(engine.needsXYZ());
+    ASSERT_EQ(4u, engine.size());
+
+    const size_t       n = 16;
+    std::vector<float> XYZ_1[3], XYZ_2[3];
+
+    for (int c = 0; c < 3; c++) {
+        for (size_t i = 0; i < n; i++) {
+            XYZ_1[c].push_back(0.05f * float(i + c));
+            XYZ_2[c].push_back(0.05f * float(i + c) * (i % 2 ? 1.1f : 1.f));
+        }
+    }
+
+    const float *const px_1[3] = {XYZ_1[0].data(), XYZ_1[1].data(), XYZ_1[2].data()};
+    const float *const px_2[3] = {XYZ_2[0].data(), XYZ_2[1].data(), XYZ_2[2].data()};
+
+    std::vector<float> values(4 * n);
+    float *const       out[4] = {&values[0], &values[n], &values[2 * n], &values[3 * n]};
+
+    MetricEngine::Scratch scratch(engine, n);
+    engine.computeRow(scratch, px_1, px_2, n, out);
+
+    for (size_t i = 0; i < n; i++) {
+        const float p_1[3] = {XYZ_1[0][i], XYZ_1[1][i], XYZ_1[2][i]};
+        const float p_2[3] = {XYZ_2[0][i], XYZ_2[1][i], XYZ_2[2][i]};
+
+        float Lab_1[3], Lab_2[3];
+        xyz_to_Lab(p_1, Lab_1);
+        xyz_to_Lab(p_2, Lab_2);
+
+        EXPECT_NEAR(deltaE2000(Lab_1, Lab_2), out[0][i], 1E-3) << i;
+
+        // Identical pixels
+        if (i % 2 == 0) {
+            EXPECT_EQ(0.f, out[1][i]) << i;
+            EXPECT_EQ(0.f, out[2][i]) << i;
+            EXPECT_EQ(0.f, out[3][i]) << i;
+        } else {
+            EXPECT_GT(out[1][i], 0.f) << i;
+            EXPECT_GT(out[2][i], 0.f) << i;
+            EXPECT_GT(out[3][i], 0.f) << i;
+        }
+    }
+}
+
+
+TEST(Metric, FLIP)
+{
+    const size_t width = 48, height = 40;
+
+    PlanarImage reference(width, height), test(width, height);
+
+    // HDR gradient, with a bright square added to the test image
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            for (int c = 0; c < 3; c++) {
+                reference.row(c, y)[x] = 0.01f * float(x + 1) * float(c + 1);
+                test.row(c, y)[x]      = reference.row(c, y)[x];
+            }
+
+            if (x >= 20 && x < 28 && y >= 16 && y < 24) {
+                test.row(1, y)[x] = 8.f;
+            }
+        }
+    }
+
+    const FLIP         flip(67.f);
+    std::vector<float> error(reference.stride() * height);
+
+    flip.compute(reference, reference, error.data(), reference.stride());
+
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            EXPECT_NEAR(0.f, error[y * reference.stride() + x], 1E-6) << x << ", " << y;
+        }
+    }
+
+    test.row(0, 0)[0] = NAN;
+    flip.compute(test, reference, error.data(), reference.stride());
+
+    EXPECT_TRUE(std::isnan(error[0]));
+    EXPECT_GT(error[20 * reference.stride() + 24], 0.5f);
+    EXPECT_LT(error[20 * reference.stride() + 40], error[20 * reference.stride() + 24]);
+
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = (y == 0); x < width; x++) {
+            const float v = error[y * reference.stride() + x];
+
+            EXPECT_TRUE(v >= 0.f && v <= 1.f) << x << ", " << y;
+        }
+    }
+}
+
+
+TEST(Metric, SSIM)
+{
+    const size_t width = 37, height = 29, stride = 40, window = 5;
+
+    std::vector<float> a(stride * height), b(stride * height);
+
+    for (size_t i = 0; i < a.size(); i++) {
+        a[i] = float((i * 7919) % 101);
+        b[i] = a[i] + float((i * 104729) % 13) - 6.f;
+    }
+
+    const SSIM         ssim(window, 100.f);
+    std::vector<float> out(stride * height);
+
+    ssim.compute(a.data(), a.data(), width, height, stride, out.data(), stride);
+
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            EXPECT_NEAR(0.f, out[y * stride + x], 1E-5);
+        }
+    }
+
+    // Running sums give the windowed statistics computed directly, the
+    // windows being truncated at the borders
+    ssim.compute(a.data(), b.data(), width, height, stride, out.data(), stride);
+
+    const int r = int(window / 2);
+
+    for (int y = 0; y < int(height); y++) {
+        for (int x = 0; x < int(width); x++) {
+            double sa = 0., sb = 0., saa = 0., sbb = 0., sab = 0., n = 0.;
+
+            for (int v = std::max(0, y - r); v <= std::min(int(height) - 1, y + r); v++) {
+                for (int u = std::max(0, x - r); u <= std::min(int(width) - 1, x + r); u++) {
+                    const double va = a[v * stride + u], vb = b[v * stride + u];
+
+                    sa += va;
+                    sb += vb;
+                    saa += va * va;
+                    sbb += vb * vb;
+                    sab += va * vb;
+                    n += 1.;
+                }
+            }
+
+            const double mu_a = sa / n, mu_b = sb / n;
+            const double var_a = saa / n - mu_a * mu_a, var_b = sbb / n - mu_b * mu_b;
+            const double cov = sab / n - mu_a * mu_b;
+            const double C1 = 1., C2 = 9.;
+
+            const double expected
+                = ((2. * mu_a * mu_b + C1) * (2. * cov + C2))
+                  / ((mu_a * mu_a + mu_b * mu_b + C1) * (var_a + var_b + C2));
+
+            EXPECT_NEAR(1. - expected, out[y * stride + x], 1E-4) << x << ", " << y;
+        }
+    }
+
+    // Multi-scale: 0 for identical images, more than the finest scale alone
+    // misses otherwise
+    ssim.computeMultiScale(a.data(), a.data(), width, height, stride, out.data(), stride);
+    EXPECT_NEAR(0.f, out[10 * stride + 10], 1E-5);
+
+    ssim.computeMultiScale(a.data(), b.data(), width, height, stride, out.data(), stride);
+
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            EXPECT_TRUE(out[y * stride + x] >= 0.f && out[y * stride + x] <= 1.f);
+        }
+    }
+}
+
+
+TEST(Stats, PSNR)
+{
+    std::stringstream out;
+    StatsOutput       stats(4, 1, 10.f, out);
+    stats.reportPSNR(1.f);
+
+    const float mse[4] = {0.01f, 0.01f, 0.01f, 0.01f};
+
+    stats.beginBand(0, 1);
+    stats.writeRow(0, mse, nullptr);
+    stats.endBand();
+    stats.close();
+
+    EXPECT_NE(std::string::npos, out.str().find("\"psnr\": 20,"));
+}
+
+
+TEST(Stats, Sampled)
+{
+    const size_t width = 64, height = 320, unit_rows = 16;
+
+    // Values correlated along the rows, plus noise
+    std::vector<float> deltaE(width * height);
+
+    for (size_t i = 0; i < deltaE.size(); i++) {
+        const size_t y = i / width;
+
+        deltaE[i] = 1.f + std::sin(float(y) / 13.f) + 0.005f * float((i * 7919) % 101);
+    }
+
+    double exact_mean = 0.;
+
+    for (size_t i = 0; i < deltaE.size(); i++) {
+        exact_mean += deltaE[i];
+    }
+
+    exact_mean /= double(deltaE.size());
+
+    // Interval of `key` in the sampling field
+    auto interval = [](const std::string &json, const std::string &key, double bounds[2]) {
+        const size_t sampling = json.find("\"sampling\"");
+        const size_t pos      = json.find("\"" + key + "\": [", sampling);
+
+        ASSERT_NE(std::string::npos, sampling);
+        ASSERT_NE(std::string::npos, pos);
+
+        std::stringstream in(json.substr(pos + key.size() + 5));
+        char              comma;
+        in >> bounds[0] >> comma >> bounds[1];
+    };
+
+    // One unit out of two, then all the units
+    for (size_t step = 2; step >= 1; step--) {
+        std::stringstream  out;
+        SampledStatsOutput stats(width, height, 10.f, out);
+
+        for (size_t y_begin = (step - 1) * unit_rows; y_begin < height;
+             y_begin += step * unit_rows) {
+            stats.beginBand(y_begin, y_begin + unit_rows);
+
+            for (size_t y = y_begin; y < y_begin + unit_rows; y++) {
+                stats.writeRow(y, &deltaE[y * width], nullptr);
+            }
+
+            stats.endBand();
+        }
+
+        stats.close();
+
+        double mean[2];
+        interval(out.str(), "mean", mean);
+
+        EXPECT_LE(mean[0], exact_mean + 1E-5);
+        EXPECT_GE(mean[1], exact_mean - 1E-5);
+        EXPECT_NE(std::string::npos, out.str().find("\"rows\": " + std::to_string(height / step) + ","));
+
+        if (step == 1) {
+            // The whole image: no sampling error
+            EXPECT_NEAR(mean[0], mean[1], 1E-6);
+            EXPECT_NEAR(exact_mean, mean[0], 1E-5);
+        } else {
+            EXPECT_LT(mean[0], mean[1]);
+        }
+
+        double median[2];
+        interval(out.str(), "50", median);
+        EXPECT_LE(median[0], median[1]);
+    }
+}
+